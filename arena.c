@@ -0,0 +1,222 @@
+/** @file arena.c
+ *  @brief Memory for the request path without heap churn
+ *
+ *  Arena : Per-connection bump allocator for request text and commands.
+ *          Allocated once per worker, reset after each request.
+ *
+ *  Reply segments : Fixed size segments from a shared pool (slab) for the
+ *          text replies are built of, see reply.c. Released segments go
+ *          back to the pool, the pool keeps at most SEGMENT_POOL_MAX of them.
+ *
+ *  In steady state no request allocates from the heap, RSS stays flat.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Shared pool of free reply segments, protected by pool_lock */
+static struct reply_segment* pool_head = NULL;
+static int pool_free = 0;
+static int pool_total = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file arena.c
+ *  @brief Create the arena
+ *
+ *  @param arena and size (bytes)
+ *  @return 0 on success, -1 on error
+ */
+
+int arena_init(struct arena* arena, size_t size)
+{
+	bzero(arena, sizeof(*arena));
+
+	if((arena->base = malloc(size)) == NULL)
+	{
+		printf("\nAssist : Memory allocation fail at arena_init()\n");
+		return -1;
+	}
+	arena->size = size;
+
+	return 0;
+}
+
+
+/** @file arena.c
+ *  @brief Allocate from the arena
+ *
+ *  Memory is valid till arena_reset(). Allocations are 8 byte aligned.
+ *
+ *  @param arena and size (bytes)
+ *  @return memory on success, NULL when arena is exhausted
+ */
+
+void* arena_alloc(struct arena* arena, size_t size)
+{
+	void* memory = NULL;
+	size_t aligned_used = (arena->used + 7) & ~(size_t)7;
+
+	if((aligned_used > arena->size) || (size > arena->size - aligned_used))
+	{
+		printf("\nAssist : Arena exhausted, %ld bytes requested\n", size);
+		return NULL;
+	}
+
+	memory = &arena->base[aligned_used];
+	arena->used = aligned_used + size;
+	if(arena->used > arena->high_water)
+	{
+		arena->high_water = arena->used;
+	}
+
+	return memory;
+}
+
+
+/** @file arena.c
+ *  @brief Formatted string in the arena
+ *
+ *  Length is checked, so request text of any length is safe to format.
+ *
+ *  @param arena, format and arguments (as printf)
+ *  @return string on success, NULL when arena is exhausted
+ */
+
+char* arena_printf(struct arena* arena, const char* format, ...)
+{
+	va_list args;
+	char* string = NULL;
+	int len = 0;
+
+	va_start(args, format);
+	len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if((len < 0) || ((string = arena_alloc(arena, len + 1)) == NULL))
+	{
+		return NULL;
+	}
+
+	va_start(args, format);
+	vsnprintf(string, len + 1, format, args);
+	va_end(args);
+
+	return string;
+}
+
+
+/** @file arena.c
+ *  @brief Release everything allocated from the arena
+ *
+ *  @param arena
+ *  @return none
+ */
+
+void arena_reset(struct arena* arena)
+{
+	arena->used = 0;
+}
+
+
+/** @file arena.c
+ *  @brief Free the arena memory
+ *
+ *  @param arena
+ *  @return none
+ */
+
+void arena_destroy(struct arena* arena)
+{
+	free(arena->base);
+	bzero(arena, sizeof(*arena));
+}
+
+
+/** @file arena.c
+ *  @brief Take a segment from the pool
+ *
+ *  Pool grows on demand when it is empty.
+ *
+ *  @param none
+ *  @return segment on success, NULL on allocation failure
+ */
+
+struct reply_segment* segment_get(void)
+{
+	struct reply_segment* segment = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	if(pool_head)
+	{
+		segment = pool_head;
+		pool_head = segment->next;
+		pool_free--;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if(segment == NULL)
+	{
+		if((segment = malloc(sizeof(*segment))) == NULL)
+		{
+			printf("\nAssist : Memory allocation fail at segment_get()\n");
+			return NULL;
+		}
+		pthread_mutex_lock(&pool_lock);
+		pool_total++;
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	segment->next = NULL;
+	segment->len = 0;
+
+	return segment;
+}
+
+
+/** @file arena.c
+ *  @brief Give a segment back to the pool
+ *
+ *  Above SEGMENT_POOL_MAX free segments, memory goes back to the heap.
+ *
+ *  @param segment
+ *  @return none
+ */
+
+void segment_put(struct reply_segment* segment)
+{
+	pthread_mutex_lock(&pool_lock);
+	if(pool_free < SEGMENT_POOL_MAX)
+	{
+		segment->next = pool_head;
+		pool_head = segment;
+		pool_free++;
+		segment = NULL;
+	}
+	else
+	{
+		pool_total--;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	free(segment);
+}
+
+
+/** @file arena.c
+ *  @brief Segment pool usage
+ *
+ *  @param free_count and total_count (filled)
+ *  @return none
+ */
+
+void segment_pool_stats(int* free_count, int* total_count)
+{
+	pthread_mutex_lock(&pool_lock);
+	*free_count = pool_free;
+	*total_count = pool_total;
+	pthread_mutex_unlock(&pool_lock);
+}
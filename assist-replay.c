@@ -0,0 +1,391 @@
+/** @file assist-replay.c
+ *  @brief Replay a request trace against an assist server
+ *
+ *  Trace is recorded by assist-server with trace_file set, see trace.c.
+ *  Requests are sent again keeping their recorded spacing, sped up by
+ *  -s (1x, 10x, ...) or as fast as possible (-s 0). -j sender threads
+ *  keep up to that many requests in flight.
+ *
+ *  Each reply is compared with the traced one (length and hash), and
+ *  its latency recorded. Summary gives failures, differing replies and
+ *  latency percentiles. Replies holding times, PIDs or counters (journal,
+ *  health, process lists) differ by nature.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Replay shared by the sender threads. replay_next is protected by replay_lock */
+static struct assist_config* replay_config = NULL;
+static struct assist_board replay_board;
+static struct trace_record** replay_records = NULL;
+static struct replay_result* replay_results = NULL;
+static int replay_count = 0;
+static int replay_next = 0;
+static double replay_speed = 1;
+static struct timespec replay_start;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file assist-replay.c
+ *  @brief Monotonic time in us
+ */
+
+static long long replay_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+/** @file assist-replay.c
+ *  @brief Map the trace file and index its records
+ *
+ *  @param path
+ *  @return 0 on success, -1 on error
+ */
+
+static int replay_load(const char* path)
+{
+	struct trace_header* header = NULL;
+	struct trace_record* record = NULL;
+	struct stat file_stat;
+	char* trace = NULL;
+	size_t offset = 0;
+	int fd = -1;
+	int pass = 0;
+
+	if(((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) || (fstat(fd, &file_stat) == -1))
+	{
+		printf("\nReplay : Open trace %s fail, %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if(((size_t)file_stat.st_size < sizeof(*header)) ||
+		((trace = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+	{
+		printf("\nReplay : %s is not a trace\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	header = (struct trace_header*)trace;
+	if((memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) || (header->record_size != sizeof(struct trace_record)))
+	{
+		printf("\nReplay : %s is not a trace of this version\n", path);
+		return -1;
+	}
+
+	/* First pass counts, second pass indexes */
+	for(pass = 0; pass < 2; pass++)
+	{
+		replay_count = 0;
+		for(offset = sizeof(*header); offset + sizeof(*record) <= (size_t)file_stat.st_size; offset += record->size)
+		{
+			record = (struct trace_record*)&trace[offset];
+			if((record->size < sizeof(*record)) || (offset + record->size > (size_t)file_stat.st_size))
+			{
+				printf("\nReplay : Trace is cut at record %d, rest ignored\n", replay_count);
+				break;
+			}
+			if(pass == 1)
+			{
+				replay_records[replay_count] = record;
+			}
+			replay_count++;
+		}
+
+		if((pass == 0) && ((replay_count == 0) ||
+			((replay_records = calloc(replay_count, sizeof(*replay_records))) == NULL) ||
+			((replay_results = calloc(replay_count, sizeof(*replay_results))) == NULL)))
+		{
+			printf("\nReplay : No requests in %s\n", path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file assist-replay.c
+ *  @brief Send one traced request and check its reply
+ *
+ *  @param index (record)
+ *  @return none
+ */
+
+static void replay_request(int index)
+{
+	struct trace_record* record = replay_records[index];
+	struct replay_result* result = &replay_results[index];
+	struct assist_board board = replay_board;
+	char* text = (char*)(record + 1);
+	char* request = NULL;
+	long long sent_us = 0;
+	int timeout_ms = 0;
+	int len = 0;
+
+	if(record->deadline_ms > 0)
+	{
+		len = asprintf(&request, "%s%d %.*s", DEADLINE_TAG, record->deadline_ms, (int)record->request_len, text);
+		timeout_ms = record->deadline_ms + DEADLINE_GRACE_MS;
+	}
+	else
+	{
+		len = asprintf(&request, "%.*s", (int)record->request_len, text);
+		timeout_ms = DEFAULT_DEADLINE_MS + DEADLINE_GRACE_MS;
+	}
+
+	if(len == -1)
+	{
+		result->failed = 1;
+		return;
+	}
+
+	sent_us = replay_now_us();
+	result->failed = (fanout_request(replay_config, &board, 1, request, timeout_ms) != 1);
+	result->latency_us = replay_now_us() - sent_us;
+
+	if(!result->failed)
+	{
+		result->differs = (board.reply_len != record->reply_len) ||
+			(trace_hash(TRACE_HASH_INIT, board.reply, board.reply_len) != record->reply_hash);
+		result->reply_len = board.reply_len;
+	}
+
+	free(board.reply);
+	free(request);
+}
+
+
+/** @file assist-replay.c
+ *  @brief Sender thread
+ *
+ *  Takes the next record, waits till it is due, sends it.
+ *
+ *  @param arg (unused)
+ *  @return NULL
+ */
+
+static void* replay_thread(void* arg)
+{
+	struct timespec due;
+	long long offset_us = 0;
+	int index = 0;
+
+	(void)arg;
+
+	while(1)
+	{
+		pthread_mutex_lock(&replay_lock);
+		index = replay_next++;
+		pthread_mutex_unlock(&replay_lock);
+
+		if(index >= replay_count)
+		{
+			return NULL;
+		}
+
+		/* Recorded spacing from the first request, scaled by speed */
+		if(replay_speed > 0)
+		{
+			offset_us = (long long)((replay_records[index]->start_us - replay_records[0]->start_us) / replay_speed);
+			due.tv_sec = replay_start.tv_sec + offset_us / 1000000;
+			due.tv_nsec = replay_start.tv_nsec + (offset_us % 1000000) * 1000;
+			if(due.tv_nsec >= 1000000000L)
+			{
+				due.tv_sec++;
+				due.tv_nsec -= 1000000000L;
+			}
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+		}
+
+		replay_request(index);
+	}
+}
+
+
+/** @file assist-replay.c
+ *  @brief Order of latencies for qsort()
+ */
+
+static int replay_compare(const void* a, const void* b)
+{
+	long long difference = *(const long long*)a - *(const long long*)b;
+
+	return (difference > 0) - (difference < 0);
+}
+
+
+/** @file assist-replay.c
+ *  @brief Print the replay summary
+ *
+ *  @param elapsed_us (whole replay) and concurrency
+ *  @return number of failed or differing requests
+ */
+
+static int replay_summary(long long elapsed_us, int concurrency)
+{
+	long long* latency = NULL;
+	long long* service = NULL;
+	struct trace_record* record = NULL;
+	char speed[32] = "max";
+	int replied = 0;
+	int failed = 0;
+	int differs = 0;
+	int i = 0;
+
+	latency = calloc(replay_count, sizeof(*latency));
+	service = calloc(replay_count, sizeof(*service));
+
+	for(i = 0; i < replay_count; i++)
+	{
+		record = replay_records[i];
+		if(replay_results[i].failed)
+		{
+			failed++;
+			continue;
+		}
+
+		if(replay_results[i].differs && (++differs <= REPLAY_MAX_DIFFS_SHOWN))
+		{
+			printf("Replay : #%d \"%.*s\" reply differs, %zu bytes, traced %llu\n", i,
+				(int)((record->request_len < 64) ? record->request_len : 64), (char*)(record + 1),
+				replay_results[i].reply_len, record->reply_len);
+		}
+
+		if(latency && service)
+		{
+			latency[replied] = replay_results[i].latency_us;
+			service[replied] = record->duration_us;
+		}
+		replied++;
+	}
+
+	if(replay_speed > 0)
+	{
+		snprintf(speed, sizeof(speed), "%gx", replay_speed);
+	}
+	printf("\nReplay : %d requests in %lld.%03lld s (%.1f requests/s), speed %s, concurrency %d\n",
+		replay_count, elapsed_us / 1000000, (elapsed_us % 1000000) / 1000,
+		(elapsed_us > 0) ? replay_count * 1000000.0 / elapsed_us : 0, speed, concurrency);
+	printf("Replay : %d replied, %d failed, %d replies differ from trace\n", replied, failed, differs);
+
+	if((replied > 0) && latency && service)
+	{
+		qsort(latency, replied, sizeof(*latency), replay_compare);
+		qsort(service, replied, sizeof(*service), replay_compare);
+		printf("Replay : Latency us      min %lld p50 %lld p90 %lld p99 %lld max %lld\n",
+			latency[0], latency[replied / 2], latency[replied * 90 / 100], latency[replied * 99 / 100], latency[replied - 1]);
+		printf("Replay : Traced service us min %lld p50 %lld p90 %lld p99 %lld max %lld\n",
+			service[0], service[replied / 2], service[replied * 90 / 100], service[replied * 99 / 100], service[replied - 1]);
+	}
+
+	free(latency);
+	free(service);
+
+	return failed + differs;
+}
+
+
+/** @file assist-replay.c
+ *  @brief Starting point for assist-replay
+ *
+ *  @param argc and argv (options and trace file)
+ *  @return 0 when every reply matched the trace, -1 otherwise
+ */
+
+int main(int argc, char* argv[])
+{
+	struct assist_board boards[MAX_BOARDS];
+	pthread_t threads[REPLAY_MAX_THREADS];
+	char* config_path = NULL;
+	char* board_name = NULL;
+	long long elapsed_us = 0;
+	int concurrency = 1;
+	int board_count = 0;
+	int started = 0;
+	int opt = 0;
+	int i = 0;
+
+	while((opt = getopt(argc, argv, "hb:c:j:s:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':
+				board_name = optarg;
+				break;
+			case 'c':
+				config_path = optarg;
+				break;
+			case 'j':
+				concurrency = atoi(optarg);
+				break;
+			case 's':
+				replay_speed = (strcmp(optarg, "max") == 0) ? 0 : atof(optarg);
+				break;
+			case 'h':
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if((optind >= argc) || (concurrency < 1) || (concurrency > REPLAY_MAX_THREADS) || (replay_speed < 0))
+	{
+		printf("\nReplay : Help ./assist-replay [-c config-file] [-b board] [-s speed|max] [-j concurrency] trace-file\n");
+		printf("\nReplay : -s Speed against the trace, 1 (default), 10, ... or max (0) for as fast as possible\n");
+		printf("\nReplay : -j Requests in flight, 1 (default) to %d\n", REPLAY_MAX_THREADS);
+		return -1;
+	}
+
+	if((load_config(config_path) != 0) || (replay_load(argv[optind]) != 0))
+	{
+		return -1;
+	}
+	replay_config = config_get();
+
+	if(((board_count = get_assist_boards(replay_config, boards, MAX_BOARDS)) <= 0) ||
+		(select_assist_boards(boards, board_count, board_name) <= 0))
+	{
+		printf("\nReplay : No assist board selected\n");
+		return -1;
+	}
+	replay_board = boards[0];
+	printf("\nReplay : %d requests from %s to %s (%s)\n", replay_count, argv[optind], replay_board.name, replay_board.ip_addr);
+
+	/* Progress messages of thousands of requests are of no use */
+	client_set_quiet(CLIENT_QUIET);
+
+	clock_gettime(CLOCK_MONOTONIC, &replay_start);
+	elapsed_us = replay_now_us();
+	for(i = 0; i < concurrency; i++)
+	{
+		if(pthread_create(&threads[i], NULL, replay_thread, NULL) != 0)
+		{
+			printf("\nReplay : Create sender %d fail\n", i);
+			break;
+		}
+		started++;
+	}
+	for(i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	elapsed_us = replay_now_us() - elapsed_us;
+	config_put(replay_config);
+
+	if(started == 0)
+	{
+		return -1;
+	}
+
+	return (replay_summary(elapsed_us, concurrency) == 0) ? 0 : -1;
+}
@@ -3,6 +3,7 @@
  *
  *  main() function create a socket (tcp/ip) and go in while loop for accepting connection.
  *  Once new request come from DUT, accept the conenction and start processing the request
+ *  in a worker thread.
  *
  *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
  *  @bug No know bugs.
@@ -12,22 +13,212 @@
 
 
 
+/** @file assist-server.c
+ *  @brief Reload the configuration
+ *
+ *  Called on SIGHUP. Connections in progress are not touched. When the
+ *  port changes, new listening socket replaces the old one.
+ *
+ *  @param sockfd (listening socket, replaced on port change) and port (current port)
+ *  @return none
+ */
+
+static void reload_config(int* sockfd, int* port)
+{
+	struct assist_config* config = NULL;
+	int new_sockfd = -1;
+
+	printf("\nAssist : Reloading configuration\n");
+
+	if(load_config(NULL) != 0)
+	{
+		printf("\nAssist : Reload fail, keeping current configuration\n");
+		return;
+	}
+
+	config = config_get();
+
+	if(config->port != *port)
+	{
+		if((new_sockfd = create_socket(config->port)) == -1)
+		{
+			printf("\nAssist : Listen on port %d fail, staying on port %d\n", config->port, *port);
+		}
+		else
+		{
+			close(*sockfd);
+			*sockfd = new_sockfd;
+			*port = config->port;
+		}
+	}
+
+	worker_pool_resize(config->worker_count, config->express_workers, config->session_max_workers);
+	trace_open(config->trace_file);
+	config_put(config);
+}
+
+
+/** @file assist-server.c
+ *  @brief Hand the server over to a new one, see handoff.c
+ *
+ *  Called on SIGUSR2. Exits once the new server took over, serves on
+ *  when it failed to.
+ *
+ *  @param sockfd, local_fd (listening sockets) and port
+ *  @return none
+ */
+
+static void hot_restart(int sockfd, int local_fd, int port)
+{
+	printf("\nAssist : Hot restart requested\n");
+
+	if(handoff_start(sockfd, local_fd, port) != 0)
+	{
+		return;
+	}
+
+	close(sockfd);
+	if(local_fd != -1)
+	{
+		close(local_fd);
+	}
+	printf("\nAssist : Exiting after hot restart\n");
+	exit(0);
+}
+
+
+/** @file assist-server.c
+ *  @brief Give everything back to the previous server and exit
+ *
+ *  Previous server failed to hand over and asked for it all back. It
+ *  still has the listening sockets, it accepts again once this is done.
+ *
+ *  @param channel, sockfd and local_fd (-1 for none)
+ *  @return none, exits
+ */
+
+static void hot_restart_abort(int channel, int sockfd, int local_fd)
+{
+	close(sockfd);
+	if(local_fd != -1)
+	{
+		close(local_fd);
+	}
+
+	handoff_return(channel);
+	close(channel);
+	printf("\nAssist : Exiting after aborted hot restart\n");
+	exit(0);
+}
+
+
 /** @file assist-server.c
  *  @brief Starting point of execution. Create socket and wait in while loop
  *
  *  main() function create a socket (tcp/ip) and go in while loop for accepting connection.
- *  Once new request come from DUT, accept the conenction and start processing the request
+ *  Once new request come from DUT, accept the conenction and queue it for the workers.
+ *  SIGHUP reloads the configuration, SIGUSR2 restarts the server without
+ *  dropping connections. Started by a hot restart, the listening sockets
+ *  and the rest of the state come from the previous server.
  *
- *  @param none
+ *  @param argc and argv ("-c config-file")
  *  @return 0 on success and -1 on error
  */
 
-int main(void) 
+int main(int argc, char* argv[]) 
 { 
 	int sockfd, connfd, sockaddr_len; 
+	int local_fd = -1;
+	int signal_fd = -1;
+	int channel = -1;
+	int taken = 0;
+	int port = 0;
+	int opt = 0;
+	char* config_path = NULL;
+	sigset_t signal_mask;
+	struct signalfd_siginfo siginfo;
+	struct pollfd fds[4];
 	struct sockaddr_in dut_addr; 
+	struct assist_config* config = NULL;
+
+	handoff_init(argv);
 
-	if((sockfd = create_socket()) == -1)
+	while((opt = getopt(argc, argv, "hc:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'c':
+				config_path = optarg;
+				break;
+			case 'h':
+			default:
+				printf("\nAssist : Help ./assist-server [-c config-file]\n");
+				return -1;
+		}
+	}
+
+	if(load_config(config_path) != 0)
+	{
+		printf("\nAssist : Load configuration fail\n");
+		return -1;
+	}
+
+	/* Started by a hot restart. Commands must not inherit the channel */
+	if(getenv(HANDOFF_ENV) != NULL)
+	{
+		channel = atoi(getenv(HANDOFF_ENV));
+		unsetenv(HANDOFF_ENV);
+	}
+
+	/* DUT may close the connection on its deadline before reply is written.
+	 * Writing to such socket must fail with EPIPE, not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Journal is mapped before the executor is forked, both append to it */
+	config = config_get();
+	journal_open(config->journal_file, config->journal_records, channel != -1);
+	trace_open(config->trace_file);
+	config_put(config);
+
+	/* Executor is forked now, while the server is small and single threaded */
+	executor_start();
+
+	/* SIGHUP and SIGUSR2 are received through signal_fd. Block them before
+	 * workers start, so no worker thread gets them */
+	sigemptyset(&signal_mask);
+	sigaddset(&signal_mask, SIGHUP);
+	sigaddset(&signal_mask, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+	if((signal_fd = signalfd(-1, &signal_mask, SFD_CLOEXEC)) == -1)
+	{
+		printf("\nAssist : signalfd fail, SIGHUP reload and SIGUSR2 restart disabled\n");
+	}
+
+	/* Workers and event thread are up before anything is handed over */
+	config = config_get();
+	port = config->port;
+	worker_pool_start(config->worker_count, config->express_workers, config->session_max_workers);
+	telemetry_start();
+	event_start();
+
+	if(channel != -1)
+	{
+		if(handoff_receive(channel, &sockfd, &local_fd, &port) != 0)
+		{
+			sockfd = -1;
+		}
+	}
+	else if((sockfd = create_socket(port)) != -1)
+	{
+		/* DUT on this host, see ring.c. Path is taken at start only */
+		if((config->local_socket[0] != '\0') && ((local_fd = create_local_socket(config->local_socket)) != -1))
+		{
+			printf("\nAssist : Local DUT connections on %s\n", config->local_socket);
+		}
+	}
+	config_put(config);
+
+	if(sockfd == -1)
 	{
 		printf("\nAssist : Create socket fail\n");
 		return -1;
@@ -39,13 +230,73 @@ int main(void)
 	}
 	#endif
 
+	/* Pings and discovery are answered by their own thread. Without them
+	 * the server still serves, DUT only needs its configuration file */
+	config = config_get();
+	ping_start(config->ping_port, config->discovery_group);
+	config_put(config);
+
 	// loop indefinitely for wait or listen or receive mode
 	while(1)
 	{
+		fds[0].fd = sockfd;
+		fds[0].events = POLLIN;
+		fds[1].fd = signal_fd;
+		fds[1].events = POLLIN;
+		fds[2].fd = local_fd;
+		fds[2].events = POLLIN;
+		fds[3].fd = channel;
+		fds[3].events = POLLIN;
+
+		if(poll(fds, 4, -1) == -1)
+		{
+			continue;
+		}
+
+		// Rest of the state from the previous server after a hot restart
+		if((fds[3].revents & (POLLIN | POLLHUP | POLLERR)) && ((taken = handoff_next(channel)) != 0))
+		{
+			if(taken == 2)
+			{
+				hot_restart_abort(channel, sockfd, local_fd);
+			}
+			close(channel);
+			channel = -1;
+		}
+
+		// Reload configuration on SIGHUP, hand over to a new server on SIGUSR2
+		if(fds[1].revents & POLLIN)
+		{
+			if(read(signal_fd, &siginfo, sizeof(siginfo)) != sizeof(siginfo))
+			{
+				continue;
+			}
+
+			if(siginfo.ssi_signo == SIGHUP)
+			{
+				reload_config(&sockfd, &port);
+			}
+			else if(channel != -1)
+			{
+				printf("\nAssist : Hot restart still taking over, SIGUSR2 ignored\n");
+			}
+			else
+			{
+				hot_restart(sockfd, local_fd, port);
+			}
+			continue;
+		}
+
+		if(((fds[0].revents | fds[2].revents) & POLLIN) == 0)
+		{
+			continue;
+		}
+
 		sockaddr_len = sizeof(dut_addr); 
 		
-		// Accept connection from peer
-		if((connfd = accept(sockfd, (struct sockaddr *)&dut_addr, (socklen_t*)&sockaddr_len)) < 0) 
+		// Accept connection from peer, local DUT first
+		if((connfd = (fds[2].revents & POLLIN) ? accept4(local_fd, NULL, NULL, SOCK_CLOEXEC) :
+			accept4(sockfd, (struct sockaddr *)&dut_addr, (socklen_t*)&sockaddr_len, SOCK_CLOEXEC)) < 0) 
 		{ 
 			printf("\nAssist : Accept fail\n"); 
 			continue; 
@@ -55,17 +306,15 @@ int main(void)
 			printf("\n============New connection==============\n"); 
 		}
 
-		// Start receiving the requests or commands from DUT board
-		if(service_request(connfd) == -1)
+		// Hand over to a worker. Commands started for this DUT do not inherit
+		// the connection, it is accepted with SOCK_CLOEXEC
+		if(worker_pool_submit(connfd) != 0)
 		{
-			printf("\nAssist : Something went wrong at assist board. Please check\n");
-			
-			if(write_socket("\nAssist : Something went wrong at assist board. Please check. AssistDataEnds", connfd) != 0)
-			{
-				continue;
-			}
-		} 
+			printf("\nAssist : All workers busy and queue full\n");
+			write_socket("\nAssist : Assist board busy, try again. AssistDataEnds", connfd);
+			close(connfd);
+		}
 	}
 	close(sockfd);
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,469 @@
+/** @file can-gen.c
+ *  @brief CAN frame generator of the assist board
+ *
+ *  Sends a pattern of frames on a raw CAN socket, without a process per
+ *  frame. A pattern is parsed from the CanGenerate request
+ *
+ *  CanGenerate <interface> [id=<hex>[-<hex>]] [idgen=step|random]
+ *              [data=<hex>|counter|random] [len=<0-8>]
+ *              [count=<frames>] [rate=<frames/s>] [burst=<frames>]
+ *
+ *  IDs above 7FF are sent as extended frames. Frames go in batches of up
+ *  to CAN_GEN_MAX_BATCH with one sendmmsg(). With a rate, a periodic
+ *  timerfd releases burst frames every burst/rate seconds. Missed timer
+ *  ticks are caught up, so the rate holds over the run. Without burst it
+ *  is chosen so the timer ticks about every CAN_GEN_TICK_NS.
+ *
+ *  Full transmit queue (ENOBUFS) is counted as a send error and the same
+ *  frames are retried, other errors stop the run.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/** @file can-gen.c
+ *  @brief Monotonic time in ns
+ */
+
+static long long can_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/** @file can-gen.c
+ *  @brief Parse hex payload "1122AABB"
+ *
+ *  @param text and pattern (data and len filled)
+ *  @return 0 on success, -1 on invalid payload
+ */
+
+static int can_parse_data(const char* text, struct can_pattern* pattern)
+{
+	size_t digits = strlen(text);
+	unsigned int byte = 0;
+	size_t i = 0;
+
+	if((digits % 2 != 0) || (digits / 2 > CAN_MAX_DLEN))
+	{
+		return -1;
+	}
+
+	for(i = 0; i < digits / 2; i++)
+	{
+		if(!isxdigit((unsigned char)text[2 * i]) || !isxdigit((unsigned char)text[2 * i + 1]) ||
+			(sscanf(&text[2 * i], "%2x", &byte) != 1))
+		{
+			return -1;
+		}
+		pattern->data[i] = byte;
+	}
+	pattern->len = digits / 2;
+
+	return 0;
+}
+
+
+/** @file can-gen.c
+ *  @brief Parse a number of the pattern and check its range
+ *
+ *  @param key, value (text), min, max and result
+ *  @return 0 on success, -1 on invalid value
+ */
+
+static int can_parse_number(const char* key, const char* value, long long min, long long max, long long* result)
+{
+	char* end = NULL;
+	long long number = 0;
+
+	errno = 0;
+	number = strtoll(value, &end, 10);
+	if((end == value) || (*end != '\0') || (errno != 0) || (number < min) || (number > max))
+	{
+		printf("\nAssist : CanGenerate invalid %s \"%s\", allowed range is %lld to %lld\n", key, value, min, max);
+		return -1;
+	}
+
+	*result = number;
+	return 0;
+}
+
+
+/** @file can-gen.c
+ *  @brief Parse a CanGenerate pattern
+ *
+ *  Defaults : id=0, idgen=step, data=counter, len=8, count=1, rate=0
+ *  (as fast as possible). count is at most CAN_GEN_MAX_COUNT.
+ *
+ *  @param text (request argument, modified) and pattern (filled)
+ *  @return 0 on success, -1 on invalid pattern
+ */
+
+int can_parse_pattern(char* text, struct can_pattern* pattern)
+{
+	char* save = NULL;
+	char* token = NULL;
+	char* value = NULL;
+	char* end = NULL;
+	long long number = 0;
+	int len = -1;
+
+	bzero(pattern, sizeof(*pattern));
+	pattern->data_mode = CAN_DATA_COUNTER;
+	pattern->count = 1;
+
+	if(((token = strtok_r(text, " ", &save)) == NULL) || (strchr(token, '=') != NULL) || (strlen(token) >= IFNAMSIZ))
+	{
+		printf("\nAssist : CanGenerate needs a CAN interface\n");
+		return -1;
+	}
+	snprintf(pattern->ifname, sizeof(pattern->ifname), "%s", token);
+
+	while((token = strtok_r(NULL, " ", &save)) != NULL)
+	{
+		if((value = strchr(token, '=')) == NULL)
+		{
+			printf("\nAssist : CanGenerate \"%s\" is not key=value\n", token);
+			return -1;
+		}
+		*value++ = '\0';
+
+		if(strcmp(token, "id") == 0)
+		{
+			pattern->id_first = strtoul(value, &end, 16);
+			pattern->id_last = (*end == '-') ? strtoul(end + 1, &end, 16) : pattern->id_first;
+			if((*end != '\0') || (pattern->id_last < pattern->id_first) || (pattern->id_last > CAN_EFF_MASK))
+			{
+				printf("\nAssist : CanGenerate invalid id \"%s\"\n", value);
+				return -1;
+			}
+		}
+		else if(strcmp(token, "idgen") == 0)
+		{
+			pattern->id_mode = (strcmp(value, "random") == 0) ? CAN_ID_RANDOM : CAN_ID_STEP;
+		}
+		else if(strcmp(token, "data") == 0)
+		{
+			if(strcmp(value, "counter") == 0)
+			{
+				pattern->data_mode = CAN_DATA_COUNTER;
+			}
+			else if(strcmp(value, "random") == 0)
+			{
+				pattern->data_mode = CAN_DATA_RANDOM;
+			}
+			else if(can_parse_data(value, pattern) == 0)
+			{
+				pattern->data_mode = CAN_DATA_FIXED;
+			}
+			else
+			{
+				printf("\nAssist : CanGenerate invalid data \"%s\"\n", value);
+				return -1;
+			}
+		}
+		else if(strcmp(token, "len") == 0)
+		{
+			if(can_parse_number(token, value, 0, CAN_MAX_DLEN, &number) != 0)
+			{
+				return -1;
+			}
+			len = (int)number;
+		}
+		else if(strcmp(token, "count") == 0)
+		{
+			if(can_parse_number(token, value, 1, CAN_GEN_MAX_COUNT, &pattern->count) != 0)
+			{
+				return -1;
+			}
+		}
+		else if(strcmp(token, "rate") == 0)
+		{
+			if(can_parse_number(token, value, 0, CAN_GEN_MAX_RATE, &number) != 0)
+			{
+				return -1;
+			}
+			pattern->rate = (int)number;
+		}
+		else if(strcmp(token, "burst") == 0)
+		{
+			if(can_parse_number(token, value, 0, CAN_GEN_MAX_RATE, &number) != 0)
+			{
+				return -1;
+			}
+			pattern->burst = (int)number;
+		}
+		else
+		{
+			printf("\nAssist : CanGenerate unknown key \"%s\"\n", token);
+			return -1;
+		}
+	}
+
+	/* len overrides the payload length, fixed payload is zero padded */
+	if(len != -1)
+	{
+		pattern->len = len;
+	}
+	else if(pattern->data_mode != CAN_DATA_FIXED)
+	{
+		pattern->len = CAN_MAX_DLEN;
+	}
+
+	if((pattern->len < 0) || (pattern->len > CAN_MAX_DLEN) || (pattern->count < 1) ||
+		(pattern->rate < 0) || (pattern->rate > CAN_GEN_MAX_RATE) || (pattern->burst < 0))
+	{
+		printf("\nAssist : CanGenerate len, count, rate or burst out of range\n");
+		return -1;
+	}
+
+	if(pattern->burst == 0)
+	{
+		pattern->burst = (pattern->rate > 0) ? (int)(((long long)pattern->rate * CAN_GEN_TICK_NS + 999999999LL) / 1000000000LL) : CAN_GEN_MAX_BATCH;
+	}
+
+	return 0;
+}
+
+
+/** @file can-gen.c
+ *  @brief Fill frame number index of the pattern
+ *
+ *  @param pattern, index, frame and random (xorshift state)
+ *  @return none
+ */
+
+static void can_fill_frame(struct can_pattern* pattern, long long index, struct can_frame* frame, unsigned long long* random)
+{
+	unsigned long long span = (unsigned long long)(pattern->id_last - pattern->id_first) + 1;
+	unsigned long long value = 0;
+	int i = 0;
+
+	*random ^= *random << 13;
+	*random ^= *random >> 7;
+	*random ^= *random << 17;
+
+	bzero(frame, sizeof(*frame));
+	frame->can_id = pattern->id_first + ((pattern->id_mode == CAN_ID_RANDOM) ? *random % span : (unsigned long long)index % span);
+	if(pattern->id_last > CAN_SFF_MASK)
+	{
+		frame->can_id |= CAN_EFF_FLAG;
+	}
+	frame->can_dlc = pattern->len;
+
+	if(pattern->data_mode == CAN_DATA_FIXED)
+	{
+		memcpy(frame->data, pattern->data, pattern->len);
+		return;
+	}
+
+	/* Counter is little endian, random takes the next state */
+	value = (pattern->data_mode == CAN_DATA_COUNTER) ? (unsigned long long)index : *random;
+	for(i = 0; i < pattern->len; i++)
+	{
+		frame->data[i] = (value >> (8 * i)) & 0xff;
+	}
+}
+
+
+/** @file can-gen.c
+ *  @brief Open a raw CAN socket for sending only
+ *
+ *  @param ifname
+ *  @return socket on success, -1 on error (errno set)
+ */
+
+static int can_open_socket(const char* ifname)
+{
+	struct sockaddr_can addr;
+	int sockfd = -1;
+	int saved_errno = 0;
+
+	if((sockfd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW)) == -1)
+	{
+		return -1;
+	}
+
+	/* Nothing is received, frames of the bus must not queue up here */
+	setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+
+	bzero(&addr, sizeof(addr));
+	addr.can_family = AF_CAN;
+	if(((addr.can_ifindex = if_nametoindex(ifname)) == 0) ||
+		(bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1))
+	{
+		saved_errno = errno;
+		close(sockfd);
+		errno = saved_errno;
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/** @file can-gen.c
+ *  @brief Send frames [result->sent, due) in batches
+ *
+ *  @param sockfd, pattern, frames and msgs (batch buffers), due,
+ *         random (xorshift state) and result (updated)
+ *  @return 0 on success (or full queue, to retry), -1 on error
+ */
+
+static int can_send_due(int sockfd, struct can_pattern* pattern, struct can_frame* frames, struct mmsghdr* msgs,
+	long long due, unsigned long long* random, struct can_result* result)
+{
+	int batch = 0;
+	int sent = 0;
+	int i = 0;
+
+	while(result->sent < due)
+	{
+		batch = (due - result->sent < CAN_GEN_MAX_BATCH) ? (int)(due - result->sent) : CAN_GEN_MAX_BATCH;
+		for(i = 0; i < batch; i++)
+		{
+			can_fill_frame(pattern, result->sent + i, &frames[i], random);
+		}
+
+		if((sent = sendmmsg(sockfd, msgs, batch, 0)) == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			result->send_errors++;
+			result->last_errno = errno;
+
+			/* Transmit queue full, these frames go again on next round */
+			return (errno == ENOBUFS) || (errno == EAGAIN) ? 0 : -1;
+		}
+		result->sent += sent;
+	}
+
+	return 0;
+}
+
+
+/** @file can-gen.c
+ *  @brief Send a pattern of frames
+ *
+ *  Runs in the calling worker till count frames are sent, the deadline
+ *  expires or sending fails.
+ *
+ *  @param pattern, deadline_ms (0 for none) and result (filled)
+ *  @return 0 on success, -1 on error (result->last_errno tells)
+ */
+
+int can_generate(struct can_pattern* pattern, int deadline_ms, struct can_result* result)
+{
+	struct can_frame frames[CAN_GEN_MAX_BATCH];
+	struct mmsghdr msgs[CAN_GEN_MAX_BATCH];
+	struct iovec iov[CAN_GEN_MAX_BATCH];
+	struct itimerspec interval;
+	struct timespec retry;
+	unsigned long long random = 0;
+	unsigned long long ticks = 0;
+	unsigned long long expirations = 0;
+	long long interval_ns = 0;
+	long long start_ns = 0;
+	long long due = 0;
+	int timer_fd = -1;
+	int sockfd = -1;
+	int retVal = 0;
+	int i = 0;
+
+	bzero(result, sizeof(*result));
+
+	if((sockfd = can_open_socket(pattern->ifname)) == -1)
+	{
+		result->last_errno = errno;
+		return -1;
+	}
+
+	bzero(msgs, sizeof(msgs));
+	for(i = 0; i < CAN_GEN_MAX_BATCH; i++)
+	{
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = sizeof(frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* Timer releases burst frames per tick */
+	if(pattern->rate > 0)
+	{
+		interval_ns = (long long)pattern->burst * 1000000000LL / pattern->rate;
+		bzero(&interval, sizeof(interval));
+		interval.it_interval.tv_sec = interval_ns / 1000000000LL;
+		interval.it_interval.tv_nsec = interval_ns % 1000000000LL;
+		interval.it_value = interval.it_interval;
+		if(((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1) ||
+			(timerfd_settime(timer_fd, 0, &interval, NULL) == -1))
+		{
+			result->last_errno = errno;
+			if(timer_fd != -1)
+			{
+				close(timer_fd);
+			}
+			close(sockfd);
+			return -1;
+		}
+	}
+
+	start_ns = can_now_ns();
+	random = (unsigned long long)start_ns | 1;
+	retry.tv_sec = 0;
+	retry.tv_nsec = CAN_GEN_RETRY_NS;
+
+	while(result->sent < pattern->count)
+	{
+		/* First burst goes right away, the next with each tick */
+		due = (pattern->rate > 0) ? (long long)(ticks + 1) * pattern->burst : result->sent + pattern->burst;
+		if(due > pattern->count)
+		{
+			due = pattern->count;
+		}
+
+		if(can_send_due(sockfd, pattern, frames, msgs, due, &random, result) != 0)
+		{
+			retVal = -1;
+			break;
+		}
+
+		if((deadline_ms > 0) && (can_now_ns() - start_ns >= (long long)deadline_ms * 1000000LL))
+		{
+			result->stopped = 1;
+			break;
+		}
+
+		if(result->sent < due)
+		{
+			/* Queue was full, give the bus time */
+			nanosleep(&retry, NULL);
+		}
+		else if((pattern->rate > 0) && (result->sent < pattern->count))
+		{
+			if(read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			{
+				ticks += expirations;
+			}
+		}
+	}
+
+	result->elapsed_ns = can_now_ns() - start_ns;
+
+	if(timer_fd != -1)
+	{
+		close(timer_fd);
+	}
+	close(sockfd);
+
+	return retVal;
+}
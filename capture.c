@@ -0,0 +1,1400 @@
+/** @file capture.c
+ *  @brief Binary CAN capture files of the assist board
+ *
+ *  CanCaptureStart records the frames of a CAN interface to a file, in a
+ *  background thread, till CanCaptureStop. The file is
+ *
+ *  struct capture_header
+ *  struct capture_record  fixed size, in receive order
+ *  struct capture_block   every index_stride records, written at stop
+ *  struct capture_id      one per CAN ID, sorted, written at stop, the first
+ *                         CAPTURE_MAX_IDS only (CAPTURE_IDS_INCOMPLETE)
+ *  struct capture_trailer ends with CAPTURE_INDEX_MAGIC
+ *
+ *  Records carry the kernel receive time (SO_TIMESTAMPNS), so they are in
+ *  time order and a time window is found by binary search on the mapped
+ *  records. Blocks hold a bloom filter of the IDs in them, and the ID
+ *  summary the first and last record of each ID, so an ID is looked up
+ *  without reading the blocks it is not in. A capture still running (or
+ *  cut by a crash) has no index, it is searched by time and scanned.
+ *
+ *  An existing file is unlinked before a capture creates its own, never
+ *  truncated. A fetch still mapping the old one keeps reading it.
+ *
+ *  Frames dropped by the socket are counted with SO_RXQ_OVFL.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Running captures, protected by capture_lock */
+static struct capture* captures[CAPTURE_MAX];
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file capture.c
+ *  @brief Bloom filter bits of a CAN ID
+ *
+ *  @param can_id, first and second (bit numbers filled)
+ *  @return none
+ */
+
+static void capture_bloom_bits(unsigned int can_id, unsigned int* first, unsigned int* second)
+{
+	can_id &= CAN_EFF_MASK;
+	*first = (can_id * 0x9E3779B1U) >> 24;
+	*second = (can_id * 0x85EBCA6BU) >> 24;
+}
+
+
+/** @file capture.c
+ *  @brief Add a received record to the index kept in memory
+ *
+ *  @param capture and record (record number capture->records)
+ *  @return none
+ */
+
+static void capture_index(struct capture* capture, struct capture_record* record)
+{
+	struct capture_block* blocks = NULL;
+	struct capture_block* block = NULL;
+	struct capture_id* id = NULL;
+	unsigned int can_id = record->can_id & CAN_EFF_MASK;
+	unsigned int slot = (can_id * 0x9E3779B1U) % CAPTURE_ID_SLOTS;
+	unsigned int first = 0, second = 0;
+
+	if((capture->records % CAPTURE_INDEX_STRIDE) == 0)
+	{
+		if(capture->block_count == capture->block_alloc)
+		{
+			if((blocks = realloc(capture->blocks, (capture->block_alloc * 2 + 64) * sizeof(*blocks))) == NULL)
+			{
+				capture->records++;
+				return;
+			}
+			capture->blocks = blocks;
+			capture->block_alloc = capture->block_alloc * 2 + 64;
+		}
+		block = &capture->blocks[capture->block_count++];
+		bzero(block, sizeof(*block));
+		block->time_ns = record->time_ns;
+		block->record = capture->records;
+	}
+
+	/* Block missing after a failed allocation is left out of the index */
+	if((capture->block_count > 0) &&
+		(capture->blocks[capture->block_count - 1].record / CAPTURE_INDEX_STRIDE == capture->records / CAPTURE_INDEX_STRIDE))
+	{
+		block = &capture->blocks[capture->block_count - 1];
+		capture_bloom_bits(can_id, &first, &second);
+		block->id_bloom[first / 64] |= 1ULL << (first % 64);
+		block->id_bloom[second / 64] |= 1ULL << (second % 64);
+	}
+
+	/* ID summary, open addressing on can_id. Slots hold index + 1 */
+	while((capture->id_slots[slot] != 0) && (capture->ids[capture->id_slots[slot] - 1].can_id != can_id))
+	{
+		slot = (slot + 1) % CAPTURE_ID_SLOTS;
+	}
+	if((capture->id_slots[slot] == 0) && (capture->id_count < CAPTURE_MAX_IDS))
+	{
+		id = &capture->ids[capture->id_count++];
+		id->can_id = can_id;
+		id->first_record = capture->records;
+		capture->id_slots[slot] = capture->id_count;
+	}
+	else if(capture->id_slots[slot] == 0)
+	{
+		capture->ids_incomplete = 1;
+	}
+	if(capture->id_slots[slot] != 0)
+	{
+		id = &capture->ids[capture->id_slots[slot] - 1];
+		id->frames++;
+		id->last_record = capture->records;
+	}
+
+	capture->records++;
+}
+
+
+/** @file capture.c
+ *  @brief Write all of a buffer to the capture file
+ *
+ *  @param fd, data and len
+ *  @return 0 on success, -1 on error
+ */
+
+static int capture_write(int fd, const void* data, size_t len)
+{
+	ssize_t written = 0;
+
+	while(len > 0)
+	{
+		if((written = write(fd, data, len)) == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		data = (const char*)data + written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+
+/** @file capture.c
+ *  @brief Set up the recvmmsg() batch of a capture thread
+ *
+ *  @param rx
+ *  @return none
+ */
+
+static void capture_rx_init(struct capture_rx* rx)
+{
+	int i = 0;
+
+	bzero(rx, sizeof(*rx));
+	for(i = 0; i < CAPTURE_BATCH; i++)
+	{
+		rx->iov[i].iov_base = &rx->frames[i];
+		rx->iov[i].iov_len = sizeof(rx->frames[i]);
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+		rx->msgs[i].msg_hdr.msg_control = rx->control[i];
+	}
+}
+
+
+/** @file capture.c
+ *  @brief Receive a batch of frames as records
+ *
+ *  Frames are received with their receive time and the socket drop
+ *  counter. Makes no allocation and no logging, realtime thread uses it.
+ *
+ *  @param capture and rx (records filled)
+ *  @return records received, 0 when none
+ */
+
+static int capture_receive(struct capture* capture, struct capture_rx* rx)
+{
+	struct cmsghdr* cmsg = NULL;
+	struct timespec stamp;
+	int count = 0;
+	int i = 0;
+
+	for(i = 0; i < CAPTURE_BATCH; i++)
+	{
+		rx->msgs[i].msg_hdr.msg_controllen = sizeof(rx->control[i]);
+	}
+
+	if((count = recvmmsg(capture->sockfd, rx->msgs, CAPTURE_BATCH, MSG_DONTWAIT, NULL)) <= 0)
+	{
+		return 0;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		clock_gettime(CLOCK_REALTIME, &stamp);
+		for(cmsg = CMSG_FIRSTHDR(&rx->msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&rx->msgs[i].msg_hdr, cmsg))
+		{
+			if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+			{
+				memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+			}
+			else if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL))
+			{
+				memcpy(&capture->drops, CMSG_DATA(cmsg), sizeof(capture->drops));
+			}
+		}
+
+		bzero(&rx->records[i], sizeof(rx->records[i]));
+		rx->records[i].time_ns = (long long)stamp.tv_sec * 1000000000LL + stamp.tv_nsec;
+		rx->records[i].can_id = rx->frames[i].can_id;
+		rx->records[i].len = (rx->frames[i].can_dlc <= CAN_MAX_DLEN) ? rx->frames[i].can_dlc : CAN_MAX_DLEN;
+		memcpy(rx->records[i].data, rx->frames[i].data, rx->records[i].len);
+	}
+
+	return count;
+}
+
+
+/** @file capture.c
+ *  @brief Index records and append them to the capture file
+ *
+ *  @param capture, records and count
+ *  @return none
+ */
+
+static void capture_store(struct capture* capture, struct capture_record* records, int count)
+{
+	int i = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		capture_index(capture, &records[i]);
+	}
+
+	if((capture->write_errno == 0) && (capture_write(capture->fd, records, count * sizeof(records[0])) != 0))
+	{
+		capture->write_errno = errno;
+		printf("\nAssist : Capture %s write fail, %s\n", capture->path, strerror(errno));
+	}
+}
+
+
+/** @file capture.c
+ *  @brief Capture thread
+ *
+ *  Receive frames in batches and append them to the file with one write
+ *  per batch.
+ *
+ *  @param arg (struct capture)
+ *  @return NULL
+ */
+
+static void* capture_thread(void* arg)
+{
+	struct capture* capture = arg;
+	struct capture_rx rx;
+	struct pollfd pfd;
+	int count = 0;
+
+	capture_rx_init(&rx);
+	pfd.fd = capture->sockfd;
+	pfd.events = POLLIN;
+
+	while(__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE))
+	{
+		if((poll(&pfd, 1, CAPTURE_POLL_MS) > 0) && ((count = capture_receive(capture, &rx)) > 0))
+		{
+			capture_store(capture, rx.records, count);
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @file capture.c
+ *  @brief Realtime receive thread
+ *
+ *  Runs SCHED_FIFO on its own CPU from a locked stack. Frames only go
+ *  to the locked buffer, the writer thread indexes and writes them. A
+ *  full buffer loses the frame and counts an overrun. No allocation,
+ *  no logging and no file I/O here.
+ *
+ *  @param arg (struct capture)
+ *  @return NULL
+ */
+
+static void* capture_rt_thread(void* arg)
+{
+	struct capture* capture = arg;
+	struct capture_rx rx;
+	struct pollfd pfd;
+	unsigned long long mask = capture->buffer_frames - 1;
+	unsigned long long head = 0;
+	unsigned long long tail = 0;
+	int count = 0;
+	int i = 0;
+
+	capture_rx_init(&rx);
+	pfd.fd = capture->sockfd;
+	pfd.events = POLLIN;
+
+	while(__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE))
+	{
+		if((poll(&pfd, 1, CAPTURE_POLL_MS) <= 0) || ((count = capture_receive(capture, &rx)) == 0))
+		{
+			continue;
+		}
+
+		tail = __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+		for(i = 0; i < count; i++)
+		{
+			if(head - tail == capture->buffer_frames)
+			{
+				tail = __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+				if(head - tail == capture->buffer_frames)
+				{
+					capture->overruns++;
+					continue;
+				}
+			}
+			capture->buffer[head & mask] = rx.records[i];
+			head++;
+		}
+		__atomic_store_n(&capture->head, head, __ATOMIC_RELEASE);
+
+		if(head - tail > capture->high_water)
+		{
+			capture->high_water = head - tail;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @file capture.c
+ *  @brief Writer thread of a realtime capture
+ *
+ *  Take frames from the buffer every CAPTURE_DRAIN_MS, index them and
+ *  write them to the file straight from the buffer. Once draining is
+ *  cleared (receive thread joined), the buffer is emptied and it ends.
+ *
+ *  @param arg (struct capture)
+ *  @return NULL
+ */
+
+static void* capture_writer_thread(void* arg)
+{
+	struct capture* capture = arg;
+	struct timespec pause;
+	unsigned long long mask = capture->buffer_frames - 1;
+	unsigned long long head = 0;
+	unsigned long long count = 0;
+	int draining = 0;
+
+	pause.tv_sec = 0;
+	pause.tv_nsec = CAPTURE_DRAIN_MS * 1000000L;
+
+	while(1)
+	{
+		/* Draining before head : frames of a joined receive thread are all seen */
+		draining = __atomic_load_n(&capture->draining, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE);
+		if(head == capture->tail)
+		{
+			if(!draining)
+			{
+				break;
+			}
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		/* Up to the end of the buffer, the rest on next turn */
+		count = head - capture->tail;
+		if(count > capture->buffer_frames - (capture->tail & mask))
+		{
+			count = capture->buffer_frames - (capture->tail & mask);
+		}
+		capture_store(capture, &capture->buffer[capture->tail & mask], count);
+		__atomic_store_n(&capture->tail, capture->tail + count, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+
+/** @file capture.c
+ *  @brief Start the threads of a realtime capture
+ *
+ *  Buffer and receive thread stack are pre-faulted and locked. Receive
+ *  thread gets SCHED_FIFO at capture_priority and the capture_cpu
+ *  affinity. Without the privilege for them, capture runs in the same
+ *  threads at normal priority or unlocked, and status tells it.
+ *
+ *  @param capture and config
+ *  @return 0 on success, -1 on error (errno set)
+ */
+
+static int capture_start_rt(struct capture* capture, struct assist_config* config)
+{
+	struct sched_param param;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int rcvbuf = CAPTURE_RT_RCVBUF;
+	int retVal = 0;
+
+	for(capture->buffer_frames = 1024; (int)capture->buffer_frames < config->capture_buffer_frames; capture->buffer_frames *= 2);
+	capture->buffer_len = capture->buffer_frames * sizeof(struct capture_record);
+	if(((capture->buffer = mmap(NULL, capture->buffer_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0)) == MAP_FAILED) ||
+		((capture->stack = mmap(NULL, CAPTURE_RT_STACK, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_STACK, -1, 0)) == MAP_FAILED))
+	{
+		retVal = errno;
+		if(capture->buffer != MAP_FAILED)
+		{
+			munmap(capture->buffer, capture->buffer_len);
+		}
+		capture->buffer = NULL;
+		capture->stack = NULL;
+		errno = retVal;
+		return -1;
+	}
+
+	capture->status = CAPTURE_REALTIME;
+	if((mlock(capture->buffer, capture->buffer_len) == 0) && (mlock(capture->stack, CAPTURE_RT_STACK) == 0))
+	{
+		capture->status |= CAPTURE_LOCKED;
+	}
+	else
+	{
+		printf("\nAssist : Capture %s buffer not locked, %s\n", capture->path, strerror(errno));
+	}
+
+	/* Socket queue covers the receive thread being late, forced beyond rmem_max when allowed */
+	if(setsockopt(capture->sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+	{
+		setsockopt(capture->sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+
+	capture->draining = 1;
+	if(pthread_create(&capture->writer, NULL, capture_writer_thread, capture) != 0)
+	{
+		munmap(capture->buffer, capture->buffer_len);
+		munmap(capture->stack, CAPTURE_RT_STACK);
+		capture->buffer = NULL;
+		capture->stack = NULL;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, capture->stack, CAPTURE_RT_STACK);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	param.sched_priority = config->capture_priority;
+	pthread_attr_setschedparam(&attr, &param);
+	if(config->capture_cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(config->capture_cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	if((retVal = pthread_create(&capture->thread, &attr, capture_rt_thread, capture)) == 0)
+	{
+		capture->status |= CAPTURE_SCHEDULED;
+	}
+	else
+	{
+		/* No CAP_SYS_NICE (EPERM) or no such CPU (EINVAL) : inherited priority, any CPU */
+		printf("\nAssist : Capture %s without SCHED_FIFO %d on CPU %d, %s\n", capture->path,
+			config->capture_priority, config->capture_cpu, strerror(retVal));
+		pthread_attr_destroy(&attr);
+		pthread_attr_init(&attr);
+		pthread_attr_setstack(&attr, capture->stack, CAPTURE_RT_STACK);
+		retVal = pthread_create(&capture->thread, &attr, capture_rt_thread, capture);
+	}
+	pthread_attr_destroy(&attr);
+
+	if(retVal != 0)
+	{
+		__atomic_store_n(&capture->draining, 0, __ATOMIC_RELEASE);
+		pthread_join(capture->writer, NULL);
+		munmap(capture->buffer, capture->buffer_len);
+		munmap(capture->stack, CAPTURE_RT_STACK);
+		capture->buffer = NULL;
+		capture->stack = NULL;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file capture.c
+ *  @brief Open a raw CAN socket receiving every frame with its time
+ *
+ *  @param ifname
+ *  @return socket on success, -1 on error (errno set)
+ */
+
+static int capture_open_socket(const char* ifname)
+{
+	struct sockaddr_can addr;
+	can_err_mask_t err_mask = CAN_ERR_MASK;
+	int enable = 1;
+	int sockfd = -1;
+	int saved_errno = 0;
+
+	if((sockfd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW)) == -1)
+	{
+		return -1;
+	}
+
+	/* Error frames are captured too, they count for bus statistics */
+	setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask));
+	setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+	setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+
+	bzero(&addr, sizeof(addr));
+	addr.can_family = AF_CAN;
+	if(((addr.can_ifindex = if_nametoindex(ifname)) == 0) ||
+		(bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1))
+	{
+		saved_errno = errno;
+		close(sockfd);
+		errno = saved_errno;
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/** @file capture.c
+ *  @brief Start the threads of a capture whose socket and file are open
+ *
+ *  @param config, capture and realtime (see capture_start_rt())
+ *  @return 0 on success, -1 on error (errno set)
+ */
+
+static int capture_launch(struct assist_config* config, struct capture* capture, int realtime)
+{
+	int retVal = 0;
+
+	capture->running = 1;
+	if(realtime)
+	{
+		retVal = capture_start_rt(capture, config);
+	}
+	else if(pthread_create(&capture->thread, NULL, capture_thread, capture) != 0)
+	{
+		errno = EAGAIN;
+		retVal = -1;
+	}
+
+	return retVal;
+}
+
+
+/** @file capture.c
+ *  @brief Stop the threads of a capture
+ *
+ *  Every received frame is in the file on return. Socket and file stay open.
+ *
+ *  @param capture (out of the captures table)
+ *  @return none
+ */
+
+static void capture_halt(struct capture* capture)
+{
+	__atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+	pthread_join(capture->thread, NULL);
+
+	/* Realtime : writer empties the buffer, then ends */
+	if(capture->status & CAPTURE_REALTIME)
+	{
+		__atomic_store_n(&capture->draining, 0, __ATOMIC_RELEASE);
+		pthread_join(capture->writer, NULL);
+		munmap(capture->buffer, capture->buffer_len);
+		munmap(capture->stack, CAPTURE_RT_STACK);
+	}
+}
+
+
+/** @file capture.c
+ *  @brief Start capturing a CAN interface to a file
+ *
+ *  @param config (of the request), ifname, path (file, an existing one is unlinked), realtime (see capture_start_rt()),
+ *         session (owner, empty for the default session) and status (CAPTURE_* flags filled)
+ *  @return 0 on success, -1 on error (errno set)
+ */
+
+int capture_start(struct assist_config* config, const char* ifname, const char* path, int realtime, const char* session, int* status)
+{
+	struct capture_header header;
+	struct capture* capture = NULL;
+	int slot = -1;
+	int i = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	for(i = 0; i < CAPTURE_MAX; i++)
+	{
+		if((captures[i] != NULL) && (strcmp(captures[i]->path, path) == 0))
+		{
+			pthread_mutex_unlock(&capture_lock);
+			errno = EBUSY;
+			return -1;
+		}
+		if((captures[i] == NULL) && (slot == -1))
+		{
+			slot = i;
+		}
+	}
+
+	/* Aligned for the cache lines of head and tail */
+	if((slot == -1) || ((capture = aligned_alloc(64, sizeof(*capture))) == NULL))
+	{
+		pthread_mutex_unlock(&capture_lock);
+		errno = (slot == -1) ? EMFILE : ENOMEM;
+		return -1;
+	}
+	bzero(capture, sizeof(*capture));
+	snprintf(capture->path, sizeof(capture->path), "%s", path);
+	snprintf(capture->ifname, sizeof(capture->ifname), "%s", ifname);
+	snprintf(capture->session, sizeof(capture->session), "%s", session);
+	capture->fd = -1;
+
+	bzero(&header, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	header.record_size = sizeof(struct capture_record);
+	header.index_stride = CAPTURE_INDEX_STRIDE;
+	snprintf(header.ifname, sizeof(header.ifname), "%s", ifname);
+	header.start_ns = clock_sync_now_us() * 1000;
+
+	if(((capture->sockfd = capture_open_socket(ifname)) == -1) ||
+		((unlink(path) != 0) && (errno != ENOENT)) ||
+		((capture->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1) ||
+		(capture_write(capture->fd, &header, sizeof(header)) != 0))
+	{
+		i = errno;
+		if(capture->sockfd != -1)
+		{
+			close(capture->sockfd);
+		}
+		if(capture->fd != -1)
+		{
+			close(capture->fd);
+		}
+		free(capture);
+		pthread_mutex_unlock(&capture_lock);
+		errno = i;
+		return -1;
+	}
+
+	if(capture_launch(config, capture, realtime) != 0)
+	{
+		i = errno;
+		close(capture->sockfd);
+		close(capture->fd);
+		free(capture);
+		pthread_mutex_unlock(&capture_lock);
+		errno = i;
+		return -1;
+	}
+	captures[slot] = capture;
+	*status = capture->status;
+	pthread_mutex_unlock(&capture_lock);
+
+	printf("\nAssist : Capturing %s to %s%s\n", ifname, path, realtime ? " in realtime mode" : "");
+
+	return 0;
+}
+
+
+/** @file capture.c
+ *  @brief Order of ID summary by can_id for qsort()
+ */
+
+static int capture_compare_id(const void* a, const void* b)
+{
+	const struct capture_id* first = a;
+	const struct capture_id* second = b;
+
+	return (first->can_id > second->can_id) - (first->can_id < second->can_id);
+}
+
+
+/** @file capture.c
+ *  @brief Stop a capture and write its index
+ *
+ *  @param path, session (must be the one which started it) and counters (filled)
+ *  @return 0 on success, -1 when not capturing to path (errno ENOENT), capture
+ *          is of another session (errno EPERM) or index write fails
+ */
+
+int capture_stop(const char* path, const char* session, struct capture_counters* counters)
+{
+	struct capture_trailer trailer;
+	struct capture* capture = NULL;
+	off_t offset = 0;
+	int retVal = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	for(i = 0; i < CAPTURE_MAX; i++)
+	{
+		if((captures[i] != NULL) && (strcmp(captures[i]->path, path) == 0))
+		{
+			if(strcmp(captures[i]->session, session) != 0)
+			{
+				pthread_mutex_unlock(&capture_lock);
+				errno = EPERM;
+				return -1;
+			}
+			capture = captures[i];
+			captures[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&capture_lock);
+
+	if(capture == NULL)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	capture_halt(capture);
+	close(capture->sockfd);
+
+	qsort(capture->ids, capture->id_count, sizeof(capture->ids[0]), capture_compare_id);
+
+	bzero(&trailer, sizeof(trailer));
+	offset = lseek(capture->fd, 0, SEEK_END);
+	trailer.index_offset = offset;
+	trailer.records = capture->records;
+	trailer.block_count = capture->block_count;
+	trailer.id_count = capture->id_count;
+	trailer.flags = capture->ids_incomplete ? CAPTURE_IDS_INCOMPLETE : 0;
+	memcpy(trailer.magic, CAPTURE_INDEX_MAGIC, sizeof(trailer.magic));
+
+	/* Index is only valid over a complete file */
+	if((capture->write_errno != 0) ||
+		((size_t)offset != sizeof(struct capture_header) + capture->records * sizeof(struct capture_record)) ||
+		(capture_write(capture->fd, capture->blocks, capture->block_count * sizeof(capture->blocks[0])) != 0) ||
+		(capture_write(capture->fd, capture->ids, capture->id_count * sizeof(capture->ids[0])) != 0) ||
+		(capture_write(capture->fd, &trailer, sizeof(trailer)) != 0))
+	{
+		printf("\nAssist : Capture %s index not written\n", capture->path);
+		retVal = -1;
+	}
+
+	bzero(counters, sizeof(*counters));
+	counters->records = capture->records;
+	counters->drops = capture->drops;
+	counters->overruns = capture->overruns;
+	counters->high_water = capture->high_water;
+	counters->buffer_frames = capture->buffer_frames;
+	counters->status = capture->status;
+	printf("\nAssist : Capture %s stopped, %llu frames, %u dropped, %llu overruns\n", capture->path,
+		capture->records, capture->drops, capture->overruns);
+
+	close(capture->fd);
+	free(capture->blocks);
+	free(capture);
+
+	return retVal;
+}
+
+
+/** @file capture.c
+ *  @brief Take a running capture out for a hot restart
+ *
+ *  Capture threads are stopped once every received frame is in the file.
+ *  Frames coming in meanwhile wait in the socket for the new server,
+ *  which rebuilds the index from the file, see capture_adopt().
+ *
+ *  @param state (filled) and fds (socket and file, to be sent and closed)
+ *  @return 0 on success, -1 when no capture is running
+ */
+
+int capture_detach(struct handoff_capture* state, int* fds)
+{
+	struct capture* capture = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	for(i = 0; (i < CAPTURE_MAX) && (capture == NULL); i++)
+	{
+		capture = captures[i];
+		captures[i] = NULL;
+	}
+	pthread_mutex_unlock(&capture_lock);
+
+	if(capture == NULL)
+	{
+		return -1;
+	}
+
+	capture_halt(capture);
+
+	bzero(state, sizeof(*state));
+	snprintf(state->path, sizeof(state->path), "%s", capture->path);
+	snprintf(state->ifname, sizeof(state->ifname), "%s", capture->ifname);
+	snprintf(state->session, sizeof(state->session), "%s", capture->session);
+	state->realtime = (capture->status & CAPTURE_REALTIME) ? 1 : 0;
+	state->overruns = capture->overruns;
+	state->high_water = capture->high_water;
+	fds[0] = capture->sockfd;
+	fds[1] = capture->fd;
+
+	printf("\nAssist : Capture %s handed over, %llu frames so far\n", capture->path, capture->records);
+
+	free(capture->blocks);
+	free(capture);
+
+	return 0;
+}
+
+
+/** @file capture.c
+ *  @brief Go on with a capture handed over by the previous server
+ *
+ *  Index is rebuilt from the records in the file, a partial record at
+ *  its end is cut.
+ *
+ *  @param state, sockfd and fd (owned from now, closed on error)
+ *  @return 0 on success, -1 on error
+ */
+
+int capture_adopt(const struct handoff_capture* state, int sockfd, int fd)
+{
+	static struct capture_record records[CAPTURE_BATCH * 16];
+	struct assist_config* config = NULL;
+	struct capture* capture = NULL;
+	ssize_t len = 0;
+	off_t offset = sizeof(struct capture_header);
+	int read_fd = -1;
+	int slot = -1;
+	int retVal = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	for(i = 0; (i < CAPTURE_MAX) && (slot == -1); i++)
+	{
+		if(captures[i] == NULL)
+		{
+			slot = i;
+		}
+	}
+
+	if((slot == -1) || ((capture = aligned_alloc(64, sizeof(*capture))) == NULL) ||
+		((read_fd = open(state->path, O_RDONLY | O_CLOEXEC)) == -1))
+	{
+		pthread_mutex_unlock(&capture_lock);
+		printf("\nAssist : Capture %s not taken over\n", state->path);
+		free(capture);
+		close(sockfd);
+		close(fd);
+		return -1;
+	}
+	bzero(capture, sizeof(*capture));
+	snprintf(capture->path, sizeof(capture->path), "%s", state->path);
+	snprintf(capture->ifname, sizeof(capture->ifname), "%s", state->ifname);
+	snprintf(capture->session, sizeof(capture->session), "%s", state->session);
+	capture->overruns = state->overruns;
+	capture->high_water = state->high_water;
+	capture->sockfd = sockfd;
+	capture->fd = fd;
+
+	/* Records are read in whole, a partial one is left to be cut */
+	while((len = pread(read_fd, records, sizeof(records), offset)) >= (ssize_t)sizeof(records[0]))
+	{
+		for(i = 0; i < len / (ssize_t)sizeof(records[0]); i++)
+		{
+			capture_index(capture, &records[i]);
+		}
+		offset += (len / sizeof(records[0])) * sizeof(records[0]);
+	}
+	close(read_fd);
+
+	config = config_get();
+	retVal = ((ftruncate(fd, offset) != 0) || (lseek(fd, offset, SEEK_SET) == -1) || (capture_launch(config, capture, state->realtime) != 0)) ? errno : 0;
+	config_put(config);
+	if(retVal != 0)
+	{
+		pthread_mutex_unlock(&capture_lock);
+		printf("\nAssist : Capture %s not taken over, %s\n", state->path, strerror(retVal));
+		close(sockfd);
+		close(fd);
+		free(capture->blocks);
+		free(capture);
+		return -1;
+	}
+	captures[slot] = capture;
+	pthread_mutex_unlock(&capture_lock);
+
+	printf("\nAssist : Capture %s taken over at %llu frames\n", capture->path, capture->records);
+
+	return 0;
+}
+
+
+/** @file capture.c
+ *  @brief First record at or after a time (or after it, with after set)
+ *
+ *  @param records, count, time_ns and after
+ *  @return record number, count when there is none
+ */
+
+static unsigned long long capture_search(const struct capture_record* records, unsigned long long count, long long time_ns, int after)
+{
+	unsigned long long low = 0;
+	unsigned long long high = count;
+	unsigned long long middle = 0;
+
+	while(low < high)
+	{
+		middle = low + (high - low) / 2;
+		if((records[middle].time_ns < time_ns) || (after && (records[middle].time_ns == time_ns)))
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+
+/** @file capture.c
+ *  @brief Add a record to the reply, as candump -L
+ *
+ *  "(<wall s.us>) <interface> <id>#<data>"
+ *
+ *  @param reply, ifname and record
+ *  @return none
+ */
+
+static void capture_reply_record(struct reply* reply, const char* ifname, const struct capture_record* record)
+{
+	char data[2 * CAN_MAX_DLEN + 1];
+	int i = 0;
+
+	for(i = 0; (i < record->len) && (i < CAN_MAX_DLEN); i++)
+	{
+		snprintf(&data[2 * i], 3, "%02X", record->data[i]);
+	}
+	data[2 * i] = '\0';
+
+	reply_printf(reply, (record->can_id & CAN_EFF_FLAG) ? "(%lld.%06lld) %s %08X#%s\n" : "(%lld.%06lld) %s %03X#%s\n",
+		record->time_ns / 1000000000LL, (record->time_ns % 1000000000LL) / 1000, ifname,
+		record->can_id & ((record->can_id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK),
+		(record->can_id & CAN_RTR_FLAG) ? "R" : data);
+}
+
+
+/** @file capture.c
+ *  @brief Whether a record passes the ID filter. Error frames pass "any ID" only
+ *
+ *  @param filter and record
+ *  @return 1 when it matches, 0 otherwise
+ */
+
+static int capture_match(const struct capture_filter* filter, const struct capture_record* record)
+{
+	return (filter->mask == 0) ||
+		(((record->can_id & CAN_ERR_FLAG) == 0) &&
+		((record->can_id & CAN_EFF_MASK & filter->mask) == (filter->can_id & filter->mask)));
+}
+
+
+/** @file capture.c
+ *  @brief Map a capture file
+ *
+ *  Records of a finished capture are told by its trailer, those of a
+ *  capture still running by the file size.
+ *
+ *  @param path and map (filled)
+ *  @return 0 on success, -1 when path is not a capture
+ */
+
+static int capture_map_file(const char* path, struct capture_map* map)
+{
+	const struct capture_trailer* trailer = NULL;
+	struct stat file_stat;
+	int fd = -1;
+
+	bzero(map, sizeof(*map));
+	if(((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) || (fstat(fd, &file_stat) == -1) ||
+		((size_t)file_stat.st_size < sizeof(*map->header)) ||
+		((map->file = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED))
+	{
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	close(fd);
+	map->size = file_stat.st_size;
+
+	map->header = (const struct capture_header*)map->file;
+	if((memcmp(map->header->magic, CAPTURE_MAGIC, sizeof(map->header->magic)) != 0) ||
+		(map->header->record_size != sizeof(struct capture_record)))
+	{
+		munmap(map->file, map->size);
+		return -1;
+	}
+	map->records = (const struct capture_record*)(map->header + 1);
+	map->count = (map->size - sizeof(*map->header)) / sizeof(struct capture_record);
+
+	/* Finished capture : trailer tells the records and where the index is */
+	if(map->size >= sizeof(*map->header) + sizeof(*trailer))
+	{
+		trailer = (const struct capture_trailer*)(map->file + map->size - sizeof(*trailer));
+		if((memcmp(trailer->magic, CAPTURE_INDEX_MAGIC, sizeof(trailer->magic)) == 0) &&
+			(trailer->index_offset == sizeof(*map->header) + trailer->records * sizeof(struct capture_record)) &&
+			(trailer->index_offset + trailer->block_count * sizeof(*map->blocks) + trailer->id_count * sizeof(*map->ids) + sizeof(*trailer) == map->size))
+		{
+			map->trailer = trailer;
+			map->count = trailer->records;
+			map->blocks = (const struct capture_block*)(map->file + trailer->index_offset);
+			map->ids = (const struct capture_id*)(map->blocks + trailer->block_count);
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file capture.c
+ *  @brief Records of a mapped capture in the time and record range of a filter
+ *
+ *  @param map, filter, first and last (filled, last is the record after the range)
+ *  @return none
+ */
+
+static void capture_window(const struct capture_map* map, const struct capture_filter* filter,
+	unsigned long long* first, unsigned long long* last)
+{
+	*first = (filter->from_ns > 0) ? capture_search(map->records, map->count, filter->from_ns, 0) : 0;
+	*last = (filter->to_ns > 0) ? capture_search(map->records, map->count, filter->to_ns, 1) : map->count;
+	if(filter->first > *first)
+	{
+		*first = filter->first;
+	}
+	if((filter->last > 0) && (filter->last < *last))
+	{
+		*last = filter->last;
+	}
+}
+
+
+/** @file capture.c
+ *  @brief Add the frames of a capture file matching a filter to the reply
+ *
+ *  Time window is found by binary search. With an exact ID and an index,
+ *  the search is narrowed to the records of the ID and blocks without
+ *  the ID are skipped.
+ *
+ *  @param reply, path, filter (mask 0 for any ID, last is the record after
+ *         the range or 0 for no end, max 0 for no limit) and total
+ *         (records in the file, filled)
+ *  @return frames added, -1 when path is not a capture
+ */
+
+long long capture_fetch(struct reply* reply, const char* path, struct capture_filter* filter, unsigned long long* total)
+{
+	struct capture_map map;
+	const struct capture_id* id = NULL;
+	struct capture_id key;
+	unsigned long long first = 0;
+	unsigned long long last = 0;
+	unsigned long long block = 0;
+	unsigned int bit_first = 0, bit_second = 0;
+	long long sent = 0;
+	int exact = (filter->mask & CAN_EFF_MASK) == CAN_EFF_MASK;
+
+	if(capture_map_file(path, &map) != 0)
+	{
+		return -1;
+	}
+	*total = map.count;
+
+	capture_window(&map, filter, &first, &last);
+
+	if(exact && map.trailer)
+	{
+		key.can_id = filter->can_id & CAN_EFF_MASK;
+		id = bsearch(&key, map.ids, map.trailer->id_count, sizeof(*map.ids), capture_compare_id);
+
+		/* Not in a complete summary, not in the file. Else the bloom filters decide */
+		if((id == NULL) && !(map.trailer->flags & CAPTURE_IDS_INCOMPLETE))
+		{
+			last = first;
+		}
+		else if(id != NULL)
+		{
+			first = (id->first_record > first) ? id->first_record : first;
+			last = (id->last_record + 1 < last) ? id->last_record + 1 : last;
+		}
+		capture_bloom_bits(filter->can_id, &bit_first, &bit_second);
+	}
+
+	while((first < last) && ((filter->max == 0) || (sent < filter->max)))
+	{
+		/* Skip blocks whose bloom filter rules the ID out */
+		block = first / map.header->index_stride;
+		if(exact && map.trailer && (block < map.trailer->block_count) && (first % map.header->index_stride == 0) &&
+			(((map.blocks[block].id_bloom[bit_first / 64] >> (bit_first % 64)) & 1) == 0 ||
+			((map.blocks[block].id_bloom[bit_second / 64] >> (bit_second % 64)) & 1) == 0))
+		{
+			first += map.header->index_stride;
+			continue;
+		}
+
+		if(capture_match(filter, &map.records[first]))
+		{
+			capture_reply_record(reply, map.header->ifname, &map.records[first]);
+			sent++;
+		}
+		first++;
+	}
+
+	munmap(map.file, map.size);
+
+	return sent;
+}
+
+
+/** @file capture.c
+ *  @brief Bits of a frame on the bus, without stuff bits
+ *
+ *  SOF, arbitration, control, data, CRC, ACK, EOF and interframe space :
+ *  47 bits plus data for a standard frame, 67 for an extended one.
+ *
+ *  @param record
+ *  @return bits
+ */
+
+static unsigned int capture_frame_bits(const struct capture_record* record)
+{
+	unsigned int bits = (record->can_id & CAN_EFF_FLAG) ? 67 : 47;
+
+	if((record->can_id & CAN_RTR_FLAG) == 0)
+	{
+		bits += 8 * record->len;
+	}
+
+	return bits;
+}
+
+
+/** @file capture.c
+ *  @brief Add a frame to the statistics
+ *
+ *  @param stats and record (in time order)
+ *  @return none
+ */
+
+static void capture_stats_add(struct capture_stats* stats, const struct capture_record* record)
+{
+	struct capture_id_stats* id = NULL;
+	unsigned int can_id = record->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+	unsigned int slot = (can_id * 0x9E3779B1U) % CAPTURE_ID_SLOTS;
+	long long interval_ns = 0;
+	long long change_ns = 0;
+	long long limit_ns = 0;
+	double delta = 0;
+	int bucket = 0;
+	int i = 0;
+
+	if(stats->frames + stats->error_frames == 0)
+	{
+		stats->first_ns = record->time_ns;
+	}
+	stats->last_ns = record->time_ns;
+
+	/* Error frames from the controller : class bits in the ID */
+	if(record->can_id & CAN_ERR_FLAG)
+	{
+		stats->error_frames++;
+		for(i = 0; i < CAPTURE_ERROR_CLASSES; i++)
+		{
+			stats->errors[i] += (record->can_id >> i) & 1;
+		}
+		return;
+	}
+
+	stats->frames++;
+	stats->extended += (record->can_id & CAN_EFF_FLAG) ? 1 : 0;
+	stats->bits += capture_frame_bits(record);
+
+	/* Open addressing on can_id, as the capture ID summary */
+	while((stats->id_slots[slot] != 0) && (stats->ids[stats->id_slots[slot] - 1].can_id != can_id))
+	{
+		slot = (slot + 1) % CAPTURE_ID_SLOTS;
+	}
+	if(stats->id_slots[slot] == 0)
+	{
+		if(stats->id_count == CAPTURE_MAX_IDS)
+		{
+			stats->untracked++;
+			return;
+		}
+		id = &stats->ids[stats->id_count++];
+		id->can_id = can_id;
+		stats->id_slots[slot] = stats->id_count;
+	}
+	id = &stats->ids[stats->id_slots[slot] - 1];
+
+	id->remote += (record->can_id & CAN_RTR_FLAG) ? 1 : 0;
+	if(id->frames++ == 0)
+	{
+		id->last_ns = record->time_ns;
+		return;
+	}
+
+	interval_ns = record->time_ns - id->last_ns;
+	id->last_ns = record->time_ns;
+
+	if((id->frames == 2) || (interval_ns < id->min_ns))
+	{
+		id->min_ns = interval_ns;
+	}
+	if(interval_ns > id->max_ns)
+	{
+		id->max_ns = interval_ns;
+	}
+
+	/* Running mean and variance over frames - 1 intervals */
+	delta = interval_ns - id->mean_ns;
+	id->mean_ns += delta / (id->frames - 1);
+	id->m2 += delta * (interval_ns - id->mean_ns);
+
+	/* Jitter : change from the previous interval, decades from 10 us */
+	if(id->frames > 2)
+	{
+		change_ns = llabs(interval_ns - id->interval_ns);
+		for(bucket = 0, limit_ns = 10000; (bucket < CAPTURE_JITTER_BUCKETS - 1) && (change_ns >= limit_ns); bucket++, limit_ns *= 10);
+		id->jitter[bucket]++;
+	}
+	id->interval_ns = interval_ns;
+}
+
+
+/** @file capture.c
+ *  @brief Order of ID statistics by can_id for qsort()
+ */
+
+static int capture_compare_id_stats(const void* a, const void* b)
+{
+	const struct capture_id_stats* first = a;
+	const struct capture_id_stats* second = b;
+
+	return (first->can_id > second->can_id) - (first->can_id < second->can_id);
+}
+
+
+/** @file capture.c
+ *  @brief Add the statistics to the reply
+ *
+ *  A summary line, error classes when there are error frames, then one
+ *  line per CAN ID.
+ *
+ *  @param reply, stats and bitrate
+ *  @return none
+ */
+
+static void capture_stats_reply(struct reply* reply, struct capture_stats* stats, int bitrate)
+{
+	static const char* error_names[CAPTURE_ERROR_CLASSES] =
+		{"tx_timeout", "lost_arbitration", "controller", "protocol", "transceiver", "no_ack", "bus_off", "bus_error", "restarted"};
+	struct capture_id_stats* id = NULL;
+	double seconds = (stats->last_ns - stats->first_ns) / 1e9;
+	double period_us = 0;
+	double stddev_us = 0;
+	unsigned int i = 0;
+
+	reply_printf(reply, "Assist : %llu frames (%llu extended), %u IDs, %llu error frames in %.3f s\n",
+		stats->frames, stats->extended, stats->id_count, stats->error_frames, seconds);
+	if(seconds > 0)
+	{
+		reply_printf(reply, "Assist : %.1f frames/s, bus load %.2f %% at %d bit/s\n",
+			stats->frames / seconds, 100.0 * stats->bits / (seconds * bitrate), bitrate);
+	}
+	if(stats->untracked > 0)
+	{
+		reply_printf(reply, "Assist : %llu frames of IDs past the first %d not broken down\n", stats->untracked, CAPTURE_MAX_IDS);
+	}
+
+	if(stats->error_frames > 0)
+	{
+		reply_printf(reply, "Assist : errors");
+		for(i = 0; i < CAPTURE_ERROR_CLASSES; i++)
+		{
+			if(stats->errors[i] > 0)
+			{
+				reply_printf(reply, " %s=%llu", error_names[i], stats->errors[i]);
+			}
+		}
+		reply_printf(reply, "\n");
+	}
+
+	if(stats->id_count == 0)
+	{
+		return;
+	}
+
+	qsort(stats->ids, stats->id_count, sizeof(stats->ids[0]), capture_compare_id_stats);
+
+	reply_printf(reply, "id frames remote rate/s period_us min_us max_us stddev_us jitter(<10us <100us <1ms <10ms more)\n");
+	for(i = 0; i < stats->id_count; i++)
+	{
+		id = &stats->ids[i];
+		period_us = (id->frames > 1) ? id->mean_ns / 1000 : 0;
+		stddev_us = (id->frames > 2) ? sqrt(id->m2 / (id->frames - 2)) / 1000 : 0;
+
+		reply_printf(reply, (id->can_id & CAN_EFF_FLAG) ? "%08X" : "%03X", id->can_id & CAN_EFF_MASK);
+		reply_printf(reply, " %llu %llu %.1f %.0f %lld %lld %.1f %llu %llu %llu %llu %llu\n",
+			id->frames, id->remote, (seconds > 0) ? id->frames / seconds : 0, period_us,
+			id->min_ns / 1000, id->max_ns / 1000, stddev_us,
+			id->jitter[0], id->jitter[1], id->jitter[2], id->jitter[3], id->jitter[4]);
+	}
+}
+
+
+/** @file capture.c
+ *  @brief Traffic statistics of a capture file
+ *
+ *  One sequential pass over the mapped records of the filter window
+ *  (ID, time and record range of capture_filter, max is not used). A
+ *  running capture is read up to its last written batch.
+ *
+ *  @param reply, path, filter, bitrate (bus bit rate for the load) and
+ *         total (records in the file, filled)
+ *  @return frames counted (error frames included), -1 when path is not a
+ *          capture or out of memory
+ */
+
+long long capture_statistics(struct reply* reply, const char* path, struct capture_filter* filter, int bitrate, unsigned long long* total)
+{
+	struct capture_map map;
+	struct capture_stats* stats = NULL;
+	unsigned long long first = 0;
+	unsigned long long last = 0;
+	long long counted = 0;
+
+	if(capture_map_file(path, &map) != 0)
+	{
+		return -1;
+	}
+	if((stats = calloc(1, sizeof(*stats))) == NULL)
+	{
+		munmap(map.file, map.size);
+		return -1;
+	}
+	*total = map.count;
+
+	capture_window(&map, filter, &first, &last);
+	if(first < last)
+	{
+		madvise(map.file, map.size, MADV_SEQUENTIAL);
+	}
+
+	for(; first < last; first++)
+	{
+		if(capture_match(filter, &map.records[first]))
+		{
+			capture_stats_add(stats, &map.records[first]);
+			counted++;
+		}
+	}
+
+	capture_stats_reply(reply, stats, bitrate);
+
+	free(stats);
+	munmap(map.file, map.size);
+
+	return counted;
+}
@@ -0,0 +1,1249 @@
+/** @file client.c
+ *  @brief Client side of the assist protocol
+ *
+ *  Connect to assist boards, send requests and gather replies, used by
+ *  dut-client and assist-replay.
+ *
+ *  One request can be sent to several assist boards in parallel, see
+ *  fanout_request(). Clock sync is an exchange of its own, see
+ *  clock_sync_board(). Health pings and discovery are single UDP
+ *  datagrams, see ping_board() and discover_boards().
+ *
+ *  Assist server on this host (127.0.0.1) is reached on its local socket
+ *  when there is one, and bulk replies come through a shared memory ring,
+ *  see ring.c.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Messages printed, CLIENT_VERBOSE for dut-client, quieter for tools
+ * sending many requests and for libassist */
+static int client_quiet = CLIENT_VERBOSE;
+
+
+/** @file client.c
+ *  @brief Set which messages are printed
+ *
+ *  @param quiet (CLIENT_VERBOSE, CLIENT_QUIET for errors only, CLIENT_SILENT for none)
+ *  @return none
+ */
+
+void client_set_quiet(int quiet)
+{
+	client_quiet = quiet;
+}
+
+
+/** @file client.c
+ *  @brief Print an error, unless silent
+ *
+ *  @param format and arguments (as printf)
+ *  @return none
+ */
+
+static void client_error(const char* format, ...)
+{
+	va_list args;
+
+	if(client_quiet >= CLIENT_SILENT)
+	{
+		return;
+	}
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+
+
+/** @file client.c
+ *  @brief Create socket to establish communication with assist server
+ *
+ *  Create non-blocking socket and start connecting to assist server.
+ *  Connection completes later in fanout_request(), so several assist
+ *  boards can be connected in parallel.
+ *
+ *  @param ip_addr (ip address of assist board) and port (assist server port)
+ *  @return sockfd (socket descriptor) on success and -1 on error
+ */
+
+int client_create_socket(char* ip_addr, int port)
+{
+	int sockfd; 
+	struct sockaddr_in assist_addr;
+
+	/* Create socket */
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0); 
+	if (sockfd == -1) 
+	{ 
+		client_error("\nDUT : Create socket fail\n"); 
+		return -1; 
+	} 
+	#ifdef DEBUG
+	else
+	{
+		printf("\nDUT : Create socket pass\n"); 
+	}
+	#endif
+
+	/* Set zero in assist_addr to remove junk chars */
+	bzero(&assist_addr, sizeof(assist_addr)); 
+
+	/* Assign ip address and port to socket */
+	assist_addr.sin_family = AF_INET; 
+	assist_addr.sin_port = htons(port); 
+	if(inet_pton(AF_INET, ip_addr, &assist_addr.sin_addr) != 1)
+	{
+		client_error("\nDUT : Invalid assist board ip address %s\n", ip_addr);
+		close(sockfd);
+		return -1;
+	}
+	
+	/* Start connecting to assist board. Completion is seen as POLLOUT */
+	if ((connect(sockfd, (SA*)&assist_addr, sizeof(assist_addr)) != 0) && (errno != EINPROGRESS))
+	{ 
+		client_error("\nDUT : Connect to assist board %s fail\n", ip_addr); 
+		close(sockfd);
+		return -1; 
+	} 
+
+	return sockfd;
+}
+
+
+/** @file client.c
+ *  @brief Connect to the local socket of an assist server on this host
+ *
+ *  @param path (local socket of assist server)
+ *  @return sockfd (socket descriptor) on success and -1 on error
+ */
+
+int client_create_local(const char* path)
+{
+	int sockfd = -1;
+	struct sockaddr_un local_addr;
+
+	if((strlen(path) >= sizeof(local_addr.sun_path)) ||
+		((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1))
+	{
+		return -1;
+	}
+
+	bzero(&local_addr, sizeof(local_addr));
+	local_addr.sun_family = AF_UNIX;
+	snprintf(local_addr.sun_path, sizeof(local_addr.sun_path), "%s", path);
+
+	/* Local connect completes at once, or fails (EAGAIN when backlog is full) */
+	if(connect(sockfd, (SA*)&local_addr, sizeof(local_addr)) != 0)
+	{
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/** @file client.c
+ *  @brief Send pending request bytes to assist board
+ *
+ *  Socket is non-blocking, so the request may go out in several parts.
+ *  Request is sent with its terminating '\0' as assist server expects.
+ *
+ *  @param board (assist board)
+ *  @return 1 when request is sent completely, 0 when more to send, -1 on error
+ */
+
+int client_write_socket(struct assist_board* board)
+{
+	ssize_t sent_len = 0;
+
+	while(board->sent_len < board->request_len)
+	{
+		sent_len = write(board->sockfd, &board->request[board->sent_len], board->request_len - board->sent_len);
+		if(sent_len == -1)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return 0;
+			}
+			client_error("\nDUT : [%s] Write socket fail. %s\n", board->name, strerror(errno));
+			return -1;
+		}
+		board->sent_len += sent_len;
+	}
+
+	return 1;
+}
+
+
+/** @file client.c
+ *  @brief Append received bytes to the board reply
+ *
+ *  Older assist servers terminate each sent chunk with '\0', those are dropped.
+ *
+ *  @param board (assist board), data and len
+ *  @return 1 when "AssistDataEnds" is received, 0 when more to read, -1 on error
+ */
+
+static int client_append_reply(struct assist_board* board, const char* data, size_t len)
+{
+	size_t i = 0;
+	size_t search_from = 0;
+	char* tmp_reply = NULL;
+
+	/* Grow reply buffer geometrically, one spare byte for '\0' */
+	if(board->reply_len + len + 1 > board->reply_size)
+	{
+		board->reply_size = (board->reply_size * 2 > board->reply_len + len + 1) ?
+			board->reply_size * 2 : board->reply_len + len + 1;
+		if((tmp_reply = realloc(board->reply, board->reply_size)) == NULL)
+		{
+			client_error("\nDUT : [%s] Memory allocation fail at client_read_socket()\n", board->name);
+			return -1;
+		}
+		board->reply = tmp_reply;
+	}
+
+	/* Sentinel may be split over two reads, search a bit before the new data */
+	search_from = (board->reply_len > strlen("AssistDataEnds")) ? board->reply_len - strlen("AssistDataEnds") : 0;
+
+	for(i = 0; i < len; i++)
+	{
+		if(data[i] != '\0')
+		{
+			board->reply[board->reply_len++] = data[i];
+		}
+	}
+	board->reply[board->reply_len] = '\0';
+
+	#ifdef DEBUG
+		printf("\nDUT : [%s] Accumulated reply length is %ld\n", board->name, board->reply_len);
+	#endif
+
+	/* Indication that this is the end of buffer */
+	if(strstr(&board->reply[search_from], "AssistDataEnds") != NULL)
+	{
+		if(client_quiet == CLIENT_VERBOSE)
+		{
+			printf("\nDUT : [%s] Socket read is completed\n", board->name);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/** @file client.c
+ *  @brief Take the reply from the shared memory ring
+ *
+ *  Bytes are taken from the mapping as the server puts them in.
+ *
+ *  @param board (assist board with ring)
+ *  @return 1 when "AssistDataEnds" is received, 0 when more to read (poll
+ *          ring.data_fd), -1 on error
+ */
+
+static int client_read_ring(struct assist_board* board)
+{
+	const char* data = NULL;
+	size_t len = 0;
+	int retVal = 0;
+
+	while(1)
+	{
+		if((len = ring_peek(&board->ring, &data)) > 0)
+		{
+			retVal = client_append_reply(board, data, len);
+			ring_consume(&board->ring, len);
+			if(retVal != 0)
+			{
+				return retVal;
+			}
+			continue;
+		}
+
+		if((retVal = ring_wait_data(&board->ring)) == 1)
+		{
+			return 0;
+		}
+		else if(retVal == -1)
+		{
+			client_error("\nDUT : [%s] Assist board closed ring before end of data\n", board->name);
+			return -1;
+		}
+	}
+}
+
+
+/** @file client.c
+ *  @brief Read from the local socket, taking a ring offer
+ *
+ *  @param board, buffer and size
+ *  @return bytes read as read(), 0 with ring attached when the server offered one
+ */
+
+static ssize_t client_read_local(struct assist_board* board, char* buffer, size_t size)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg = NULL;
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	unsigned long ring_size = 0;
+	size_t fd_count = 0;
+	size_t i = 0;
+	int fds[3];
+	ssize_t len = 0;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size - 1;
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if((len = recvmsg(board->sockfd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+	{
+		return len;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+	{
+		return len;
+	}
+
+	/* "AssistRing <size>\n" with memfd, data_fd and space_fd. Descriptors
+	 * received are ours to close whatever the offer is worth */
+	buffer[len] = '\0';
+	fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	fd_count = (fd_count > 3) ? 3 : fd_count;
+	memcpy(fds, CMSG_DATA(cmsg), fd_count * sizeof(int));
+	if((cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) || (sscanf(buffer, RING_OFFER " %lu", &ring_size) != 1))
+	{
+		for(i = 0; i < fd_count; i++)
+		{
+			close(fds[i]);
+		}
+		client_error("\nDUT : [%s] Invalid ring offer from assist board\n", board->name);
+		errno = EPROTO;
+		return -1;
+	}
+
+	/* ring_attach() closes them on its failure */
+	if(ring_attach(&board->ring, fds, ring_size) != 0)
+	{
+		client_error("\nDUT : [%s] Invalid ring offer from assist board\n", board->name);
+		errno = EPROTO;
+		return -1;
+	}
+
+	#ifdef DEBUG
+		printf("\nDUT : [%s] Reply through a %lu byte ring\n", board->name, ring_size);
+	#endif
+
+	return 0;
+}
+
+
+/** @file client.c
+ *  @brief Receive/read data from socket
+ *
+ *  Read whatever is available and append to the board reply. On the
+ *  local socket the server may offer a ring, the reply is then read
+ *  from the ring.
+ *
+ *  @param board (assist board) and chunk_size (read size)
+ *  @return 1 when "AssistDataEnds" is received, 0 when more to read, -1 on error
+ */
+
+int client_read_socket(struct assist_board* board, int chunk_size)
+{
+	char chunk_buffer[MAX_CHUNK_SIZE];
+	ssize_t chunk_buffer_len = 0;
+	int retVal = 0;
+
+	while(1)
+	{
+		if(board->ring.header != NULL)
+		{
+			return client_read_ring(board);
+		}
+
+		chunk_buffer_len = board->local ? client_read_local(board, chunk_buffer, chunk_size) :
+			read(board->sockfd, chunk_buffer, chunk_size);
+
+		if(chunk_buffer_len == -1)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return 0;
+			}
+			client_error("\nDUT : [%s] Error in read socket. %s\n", board->name, strerror(errno));
+			return -1;
+		}
+		else if((chunk_buffer_len == 0) && (board->ring.header != NULL))
+		{
+			continue;
+		}
+		else if(chunk_buffer_len == 0)
+		{
+			/* Connection closed before "AssistDataEnds" arrived */
+			client_error("\nDUT : [%s] Assist board closed connection before end of data\n", board->name);
+			return -1;
+		}
+
+		if((retVal = client_append_reply(board, chunk_buffer, chunk_buffer_len)) != 0)
+		{
+			return retVal;
+		}
+	}
+}
+
+
+
+/** @file client.c
+ *  @brief Fetch the assist boards from configuration
+ *
+ *  Boards are "ip_address=" and "board=" lines of the config file, see config.c.
+ *  Without any, and only with discover=1, boards answering discovery are
+ *  used, see discover_boards(). Anything on the network may answer, so
+ *  it is never the default.
+ *
+ *  @param config (configuration), boards (array to fill) and max_boards (array size)
+ *  @return number of boards found
+ */
+
+int get_assist_boards(struct assist_config* config, struct assist_board* boards, int max_boards)
+{
+	int count = 0;
+
+	if((config->board_count == 0) && (config->discover))
+	{
+		return discover_boards(config, boards, max_boards, 0);
+	}
+
+	for(count = 0; (count < config->board_count) && (count < max_boards); count++)
+	{
+		boards[count] = config->boards[count];
+		boards[count].sockfd = -1;
+	}
+
+	return count;
+}
+
+
+/** @file client.c
+ *  @brief Pick the assist boards the request is sent to
+ *
+ *  Boards are selected by comma separated names, or "all".
+ *  Without names the first board of the config is used. Boards found by
+ *  discovery answer in any order, there is no first one : without names
+ *  exactly one must have answered.
+ *
+ *  @param boards (boards from config), count (number of boards) and names (selection, may be NULL)
+ *  @return number of selected boards. Selected boards are moved to the front of the array.
+ */
+
+int select_assist_boards(struct assist_board* boards, int count, char* names)
+{
+	struct assist_board tmp_board;
+	char names_buf[MAX_SIZE];
+	char* name = NULL;
+	char* saveptr = NULL;
+	int selected = 0;
+	int i = 0;
+
+	if((names == NULL) && (count > 1) && (boards[0].discovered))
+	{
+		client_error("\nDUT : %d assist boards answered discovery, select one by name\n", count);
+		for(i = 0; i < count; i++)
+		{
+			client_error("DUT : board=%s %s\n", boards[i].name, boards[i].ip_addr);
+		}
+		return -1;
+	}
+
+	if((names == NULL) || (count == 0))
+	{
+		return (count > 0) ? 1 : 0;
+	}
+
+	if(strcmp(names, "all") == 0)
+	{
+		return count;
+	}
+
+	snprintf(names_buf, sizeof(names_buf), "%s", names);
+	for(name = strtok_r(names_buf, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr))
+	{
+		for(i = selected; i < count; i++)
+		{
+			if(strcmp(boards[i].name, name) == 0)
+			{
+				tmp_board = boards[selected];
+				boards[selected] = boards[i];
+				boards[i] = tmp_board;
+				selected++;
+				break;
+			}
+		}
+
+		if(i == count)
+		{
+			client_error("\nDUT : Assist board \"%s\" not found in config\n", name);
+			return -1;
+		}
+	}
+
+	return selected;
+}
+
+
+/** @file client.c
+ *  @brief Stamp the request with its send time
+ *
+ *  Called once connection is up, right before the first byte goes out.
+ *  Wall-clock time is prefixed as "AssistSent=<us> " for the assist board
+ *  journal, and printed, so one-way latency can be computed.
+ *
+ *  @param board and request
+ *  @return 0 on success, -1 on error
+ */
+
+int stamp_request(struct assist_board* board, char* request)
+{
+	struct timespec now;
+	char* stamped = NULL;
+	int len = 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	board->sent_us = (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+	/* Local DUT asks for the ring as well */
+	len = (board->ring_size > 0) ? asprintf(&stamped, "%s%lld %s%d %s", SENT_TAG, board->sent_us, RING_TAG, board->ring_size, request) :
+		asprintf(&stamped, "%s%lld %s", SENT_TAG, board->sent_us, request);
+	if(len == -1)
+	{
+		client_error("\nDUT : Memory allocation fail at stamp_request()\n");
+		return -1;
+	}
+
+	board->request = stamped;
+	board->request_len = len + 1;
+	if(client_quiet == CLIENT_VERBOSE)
+	{
+		printf("\nDUT : [%s] Request sent at %lld.%06lld\n", board->name, board->sent_us / 1000000, board->sent_us % 1000000);
+	}
+
+	return 0;
+}
+
+
+/** @file client.c
+ *  @brief Send one request to several assist boards in parallel
+ *
+ *  All boards are connected, written and read over non-blocking sockets
+ *  (and rings, see client_read_ring()) from one poll() loop, so total time
+ *  is the time of the slowest board.
+ *  Connect must finish within connect_timeout_ms, and whole exchange within timeout_ms.
+ *
+ *  @param config (configuration), boards (selected boards), count (number of boards), request and timeout_ms (0 for none)
+ *  @return number of boards which replied completely
+ */
+
+int fanout_request(struct assist_config* config, struct assist_board* boards, int count, char* request, int timeout_ms)
+{
+	struct pollfd fds[2 * MAX_BOARDS];
+	struct timespec start, now;
+	int so_error = 0;
+	socklen_t so_error_len = sizeof(so_error);
+	int pending = 0;
+	int completed = 0;
+	int elapsed_ms = 0;
+	int wait_ms = 0;
+	int retVal = 0;
+	int i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Start connecting to every board */
+	for(i = 0; i < count; i++)
+	{
+		boards[i].request = request;
+		boards[i].request_len = strlen(request) + 1;
+		boards[i].sent_len = 0;
+
+		/* Assist server on this host : local socket, bulk replies through a ring */
+		boards[i].local = 0;
+		boards[i].ring_size = 0;
+		if((config->local_socket[0] != '\0') && (strcmp(boards[i].ip_addr, "127.0.0.1") == 0) &&
+			((boards[i].sockfd = client_create_local(config->local_socket)) != -1))
+		{
+			boards[i].local = 1;
+			boards[i].ring_size = config->ring_size;
+		}
+		else if((boards[i].sockfd = client_create_socket(boards[i].ip_addr, config->port)) == -1)
+		{
+			boards[i].state = BOARD_FAILED;
+			continue;
+		}
+		boards[i].state = BOARD_CONNECTING;
+		pending++;
+	}
+
+	while(pending > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000L;
+
+		/* Boards still connecting are bounded by connect timeout, others by deadline */
+		wait_ms = -1;
+		for(i = 0; i < count; i++)
+		{
+			fds[i].fd = -1;
+			fds[i].events = 0;
+			fds[i].revents = 0;
+			fds[count + i].fd = -1;
+			fds[count + i].events = 0;
+			fds[count + i].revents = 0;
+
+			if((boards[i].state == BOARD_CONNECTING) && (elapsed_ms >= config->connect_timeout_ms))
+			{
+				client_error("\nDUT : [%s] Connect to assist board timed out after %d ms\n", boards[i].name, config->connect_timeout_ms);
+				boards[i].state = BOARD_FAILED;
+				pending--;
+			}
+			else if((boards[i].state != BOARD_FAILED) && (boards[i].state != BOARD_DONE) &&
+				(timeout_ms > 0) && (elapsed_ms >= timeout_ms))
+			{
+				client_error("\nDUT : [%s] No reply from assist board within %d ms\n", boards[i].name, timeout_ms);
+				boards[i].state = BOARD_FAILED;
+				pending--;
+			}
+
+			switch(boards[i].state)
+			{
+				case BOARD_CONNECTING:
+				case BOARD_SENDING:
+					fds[i].fd = boards[i].sockfd;
+					fds[i].events = POLLOUT;
+					if((wait_ms == -1) || (config->connect_timeout_ms - elapsed_ms < wait_ms))
+					{
+						wait_ms = config->connect_timeout_ms - elapsed_ms;
+					}
+					break;
+				case BOARD_RECEIVING:
+					/* With a ring, the socket only tells the server is gone */
+					fds[i].fd = boards[i].sockfd;
+					fds[i].events = POLLIN;
+					if(boards[i].ring.header != NULL)
+					{
+						fds[count + i].fd = boards[i].ring.data_fd;
+						fds[count + i].events = POLLIN;
+					}
+					break;
+				default:
+					break;
+			}
+		}
+
+		if(pending == 0)
+		{
+			break;
+		}
+
+		if((timeout_ms > 0) && ((wait_ms == -1) || (timeout_ms - elapsed_ms < wait_ms)))
+		{
+			wait_ms = timeout_ms - elapsed_ms;
+		}
+
+		if((poll(fds, 2 * count, wait_ms) == -1) && (errno != EINTR))
+		{
+			client_error("\nDUT : poll fail. %s\n", strerror(errno));
+			break;
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			if((fds[i].revents == 0) && (fds[count + i].revents == 0))
+			{
+				continue;
+			}
+
+			retVal = 0;
+			switch(boards[i].state)
+			{
+				case BOARD_CONNECTING:
+					getsockopt(boards[i].sockfd, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len);
+					if(so_error != 0)
+					{
+						client_error("\nDUT : [%s] Connect to assist board fail. %s\n", boards[i].name, strerror(so_error));
+						retVal = -1;
+						break;
+					}
+					boards[i].state = BOARD_SENDING;
+					if(stamp_request(&boards[i], request) != 0)
+					{
+						retVal = -1;
+						break;
+					}
+					/* Socket is writable, send right away */
+					/* fall through */
+				case BOARD_SENDING:
+					if((retVal = client_write_socket(&boards[i])) == 1)
+					{
+						boards[i].state = BOARD_RECEIVING;
+						retVal = 0;
+					}
+					break;
+				case BOARD_RECEIVING:
+					if((retVal = client_read_socket(&boards[i], config->chunk_size)) == 1)
+					{
+						boards[i].state = BOARD_DONE;
+						completed++;
+						pending--;
+					}
+					/* Socket hung up, ring neither complete nor closed : server is gone */
+					else if((retVal == 0) && (boards[i].ring.header != NULL) && (fds[i].revents & (POLLHUP | POLLERR)))
+					{
+						client_error("\nDUT : [%s] Assist board closed connection before end of data\n", boards[i].name);
+						retVal = -1;
+					}
+					break;
+				default:
+					break;
+			}
+
+			if(retVal == -1)
+			{
+				boards[i].state = BOARD_FAILED;
+				pending--;
+			}
+		}
+	}
+
+	/* Close the sockets */
+	for(i = 0; i < count; i++)
+	{
+		if(boards[i].sockfd != -1)
+		{
+			close(boards[i].sockfd);
+			boards[i].sockfd = -1;
+		}
+		if(boards[i].ring.header != NULL)
+		{
+			ring_detach(&boards[i].ring);
+		}
+		if(boards[i].request != request)
+		{
+			free(boards[i].request);
+			boards[i].request = request;
+		}
+	}
+
+	return completed;
+}
+
+
+/** @file client.c
+ *  @brief Wait till the socket is ready
+ *
+ *  @param sockfd, events (POLLIN or POLLOUT) and timeout_ms
+ *  @return 1 when ready, 0 on timeout, -1 on error
+ */
+
+int client_wait_socket(int sockfd, short events, int timeout_ms)
+{
+	struct pollfd fds;
+	int retVal = 0;
+
+	fds.fd = sockfd;
+	fds.events = events;
+
+	while(((retVal = poll(&fds, 1, timeout_ms)) == -1) && (errno == EINTR));
+
+	return retVal;
+}
+
+
+/** @file client.c
+ *  @brief Read one line of an exchange (clock sync, file sync)
+ *
+ *  @param board, line, size, len (bytes already in line, updated) and timeout_ms
+ *  @return line length without '\n', -1 on error, close or timeout
+ */
+
+int client_read_line(struct assist_board* board, char* line, size_t size, size_t* len, int timeout_ms)
+{
+	char* end = NULL;
+	ssize_t read_len = 0;
+
+	while((end = memchr(line, '\n', *len)) == NULL)
+	{
+		if((*len >= size - 1) || (client_wait_socket(board->sockfd, POLLIN, timeout_ms) != 1))
+		{
+			client_error("\nDUT : [%s] No answer from assist board\n", board->name);
+			return -1;
+		}
+		if((read_len = read(board->sockfd, &line[*len], size - 1 - *len)) <= 0)
+		{
+			if((read_len == -1) && ((errno == EAGAIN) || (errno == EINTR)))
+			{
+				continue;
+			}
+			client_error("\nDUT : [%s] Assist board closed the connection\n", board->name);
+			return -1;
+		}
+		*len += read_len;
+	}
+
+	*end = '\0';
+	return end - line;
+}
+
+
+/** @file client.c
+ *  @brief Clock sync exchange on a connected socket
+ *
+ *  Ping-pong exchange, see clock-sync.c. The sample of least round
+ *  trip gives the offset, it is sent to assist board in the end line.
+ *
+ *  @param config (configuration), board (connected assist board), session (of the
+ *         DUT, "" for the default one), samples (pings), offset_us and rtt_us (filled)
+ *  @return 0 on success, -1 on error
+ */
+
+int clock_sync_exchange(struct assist_config* config, struct assist_board* board, const char* session, int samples, long long* offset_us, long long* rtt_us)
+{
+	char line[CLOCK_SYNC_LINE_SIZE];
+	char ping[CLOCK_SYNC_LINE_SIZE];
+	size_t len = 0;
+	int line_len = 0;
+	int ping_len = 0;
+	int i = 0;
+	long long t1 = 0, t2 = 0, t3 = 0, t4 = 0, echo = 0;
+	long long rtt = 0;
+
+	/* Request is small, it goes out at once on a fresh connection. Assist
+	 * board keeps the results of each DUT and session apart */
+	ping_len = snprintf(ping, sizeof(ping), "%s%s%sAssistClockSync", (session[0] != '\0') ? SESSION_TAG : "", session,
+		(session[0] != '\0') ? " " : "");
+	if((write(board->sockfd, ping, ping_len + 1) <= 0) ||
+		((line_len = client_read_line(board, line, sizeof(line), &len, config->socket_timeout_ms)) == -1) ||
+		(strcmp(line, "AssistClockSyncReady") != 0))
+	{
+		client_error("\nDUT : [%s] Assist board does not support clock sync\n", board->name);
+		return -1;
+	}
+	len -= line_len + 1;
+	memmove(line, &line[line_len + 1], len);
+
+	*rtt_us = -1;
+	for(i = 0; i < samples; i++)
+	{
+		t1 = clock_sync_now_us();
+		ping_len = snprintf(ping, sizeof(ping), "%lld\n", t1);
+		if((write(board->sockfd, ping, ping_len) != ping_len) ||
+			((line_len = client_read_line(board, line, sizeof(line), &len, config->socket_timeout_ms)) == -1))
+		{
+			return -1;
+		}
+		t4 = clock_sync_now_us();
+
+		if((sscanf(line, "%lld %lld %lld", &echo, &t2, &t3) != 3) || (echo != t1))
+		{
+			client_error("\nDUT : [%s] Invalid clock sync answer\n", board->name);
+			return -1;
+		}
+		len -= line_len + 1;
+		memmove(line, &line[line_len + 1], len);
+
+		/* Least round trip has least asymmetry, its offset is kept */
+		rtt = (t4 - t1) - (t3 - t2);
+		if((*rtt_us == -1) || (rtt < *rtt_us))
+		{
+			*rtt_us = rtt;
+			*offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+		}
+	}
+
+	ping_len = snprintf(ping, sizeof(ping), "AssistClockSyncEnd %lld %lld\n", *offset_us, *rtt_us);
+	if(write(board->sockfd, ping, ping_len) != ping_len)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file client.c
+ *  @brief Estimate clock offset of an assist board
+ *
+ *  Assist board keeps the offset and answers with its drift estimate.
+ *
+ *  @param config (configuration), board (assist board), session (of the DUT) and samples (pings)
+ *  @return 0 on success, -1 on error
+ */
+
+int clock_sync_board(struct assist_config* config, struct assist_board* board, const char* session, int samples)
+{
+	int so_error = 0;
+	socklen_t so_error_len = sizeof(so_error);
+	int nodelay = 1;
+	int retVal = -1;
+	long long offset_us = 0;
+	long long rtt_us = 0;
+
+	if((board->sockfd = client_create_socket(board->ip_addr, config->port)) == -1)
+	{
+		return -1;
+	}
+
+	if((client_wait_socket(board->sockfd, POLLOUT, config->connect_timeout_ms) != 1) ||
+		(getsockopt(board->sockfd, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len) != 0) || (so_error != 0))
+	{
+		client_error("\nDUT : [%s] Connect to assist board fail\n", board->name);
+	}
+	else
+	{
+		setsockopt(board->sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		if((retVal = clock_sync_exchange(config, board, session, samples, &offset_us, &rtt_us)) == 0)
+		{
+			/* Rest is a normal reply, ending with "AssistDataEnds" */
+			while(((retVal = client_read_socket(board, config->chunk_size)) == 0) &&
+				(client_wait_socket(board->sockfd, POLLIN, config->socket_timeout_ms) == 1));
+		}
+	}
+
+	if(retVal == 1)
+	{
+		printf("\nDUT : [%s] Clock offset %lld us (assist board - DUT), RTT %lld us, %d samples\n", board->name, offset_us, rtt_us, samples);
+		printf("\n%s\n", board->reply);
+	}
+
+	close(board->sockfd);
+	board->sockfd = -1;
+	free(board->reply);
+	board->reply = NULL;
+	board->reply_len = 0;
+	board->reply_size = 0;
+
+	return (retVal == 1) ? 0 : -1;
+}
+
+
+/** @file client.c
+ *  @brief Check an assist board with UDP pings, see ping.c
+ *
+ *  No connection, no request. Each pong gives the round trip without the
+ *  time spent at assist board, the clock offset and board health.
+ *  A pong of an earlier ping arriving late is counted, not taken.
+ *
+ *  @param config (configuration), board (assist board) and count (pings)
+ *  @return 0 when any ping was answered, -1 otherwise
+ */
+
+int ping_board(struct assist_config* config, struct assist_board* board, int count)
+{
+	struct sockaddr_in board_addr;
+	char request[PING_DATAGRAM_SIZE];
+	char reply[PING_DATAGRAM_SIZE];
+	unsigned int seq = 0;
+	unsigned int echo_seq = 0;
+	long long t1 = 0, t2 = 0, t3 = 0, t4 = 0, echo = 0;
+	long long rtt = 0, rtt_min = -1, rtt_max = 0, rtt_total = 0;
+	long long wait_us = 0;
+	ssize_t len = 0;
+	int sockfd = -1;
+	int request_len = 0;
+	int timeout_ms = 0;
+	int consumed = 0;
+	int answered = 0;
+	int received = 0;
+	int late = 0;
+
+	if(config->ping_port == 0)
+	{
+		client_error("\nDUT : ping_port is 0, pings disabled\n");
+		return -1;
+	}
+
+	bzero(&board_addr, sizeof(board_addr));
+	board_addr.sin_family = AF_INET;
+	board_addr.sin_port = htons(config->ping_port);
+	if(inet_pton(AF_INET, board->ip_addr, &board_addr.sin_addr) != 1)
+	{
+		client_error("\nDUT : [%s] Invalid IP address %s\n", board->name, board->ip_addr);
+		return -1;
+	}
+
+	/* Connected, so only this board's pongs come in and a closed port
+	 * shows as ECONNREFUSED */
+	if(((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1) ||
+		(connect(sockfd, (struct sockaddr*)&board_addr, sizeof(board_addr)) != 0))
+	{
+		client_error("\nDUT : [%s] Create ping socket fail\n", board->name);
+		if(sockfd != -1)
+		{
+			close(sockfd);
+		}
+		return -1;
+	}
+
+	for(seq = 1; seq <= (unsigned int)count; seq++)
+	{
+		t1 = clock_sync_now_us();
+		request_len = snprintf(request, sizeof(request), PING_REQUEST " %u %lld", seq, t1);
+		if(send(sockfd, request, request_len, 0) != request_len)
+		{
+			client_error("\nDUT : [%s] Send ping fail, %s\n", board->name, strerror(errno));
+			break;
+		}
+
+		answered = 0;
+		while((answered == 0) &&
+			((timeout_ms = (int)((t1 + PING_TIMEOUT_MS * 1000LL - clock_sync_now_us() + 999) / 1000)) > 0) &&
+			(client_wait_socket(sockfd, POLLIN, timeout_ms) == 1))
+		{
+			if((len = recv(sockfd, reply, sizeof(reply) - 1, 0)) < 0)
+			{
+				if(errno == ECONNREFUSED)
+				{
+					client_error("\nDUT : [%s] No assist server on UDP port %d\n", board->name, config->ping_port);
+					close(sockfd);
+					return -1;
+				}
+				continue;
+			}
+			t4 = clock_sync_now_us();
+			reply[len] = '\0';
+
+			consumed = 0;
+			if((sscanf(reply, PING_REPLY " %u %lld %lld %lld %n", &echo_seq, &echo, &t2, &t3, &consumed) != 4) ||
+				(echo_seq != seq) || (echo != t1))
+			{
+				late++;
+				continue;
+			}
+			answered = 1;
+			received++;
+
+			/* Same arithmetic as clock sync, see clock_sync_exchange() */
+			rtt = (t4 - t1) - (t3 - t2);
+			rtt_total += rtt;
+			rtt_max = (rtt > rtt_max) ? rtt : rtt_max;
+			rtt_min = ((rtt_min == -1) || (rtt < rtt_min)) ? rtt : rtt_min;
+
+			printf("\nDUT : [%s] seq=%u rtt=%lld us offset=%lld us %s\n", board->name, seq, rtt,
+				((t2 - t1) + (t3 - t4)) / 2, &reply[consumed]);
+		}
+
+		if(answered == 0)
+		{
+			printf("\nDUT : [%s] seq=%u no answer in %d ms\n", board->name, seq, PING_TIMEOUT_MS);
+		}
+
+		/* Next ping goes PING_INTERVAL_MS after this one */
+		if((seq < (unsigned int)count) && ((wait_us = t1 + PING_INTERVAL_MS * 1000LL - clock_sync_now_us()) > 0))
+		{
+			usleep((useconds_t)wait_us);
+		}
+	}
+	close(sockfd);
+
+	printf("\nDUT : [%s] %u pings, %d answered, %d%% loss", board->name, seq - 1, received,
+		(seq > 1) ? (int)(((seq - 1) - received) * 100 / (seq - 1)) : 0);
+	if(received > 0)
+	{
+		printf(", rtt min/avg/max %lld/%lld/%lld us", rtt_min, rtt_total / received, rtt_max);
+	}
+	if(late > 0)
+	{
+		printf(", %d late", late);
+	}
+	printf("\n");
+
+	return (received > 0) ? 0 : -1;
+}
+
+
+/** @file client.c
+ *  @brief Send the discovery query to one address
+ *
+ *  @param sockfd (UDP socket), address and port
+ *  @return 1 when sent, 0 otherwise
+ */
+
+static int client_discover_send(int sockfd, struct in_addr address, int port)
+{
+	struct sockaddr_in addr;
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr = address;
+	addr.sin_port = htons(port);
+
+	return (sendto(sockfd, DISCOVER_REQUEST, strlen(DISCOVER_REQUEST), 0, (struct sockaddr*)&addr, sizeof(addr)) > 0) ? 1 : 0;
+}
+
+
+/** @file client.c
+ *  @brief Find assist boards without a configuration
+ *
+ *  Query goes to assist server on this host, to the broadcast address of
+ *  every network and to discovery_group on every multicast interface.
+ *  Answers are gathered for discovery_timeout_ms. Boards are named as
+ *  they answer (board_name or host name of the assist board).
+ *
+ *  @param config (configuration), boards (array to fill), max_boards (array size)
+ *         and report (print every answer)
+ *  @return number of boards found
+ */
+
+int discover_boards(struct assist_config* config, struct assist_board* boards, int max_boards, int report)
+{
+	struct ifaddrs* interfaces = NULL;
+	struct ifaddrs* ifa = NULL;
+	struct sockaddr_in peer;
+	socklen_t peer_len = 0;
+	struct in_addr address;
+	struct in_addr group;
+	char reply[PING_DATAGRAM_SIZE];
+	char name[BOARD_NAME_SIZE];
+	char ip_addr[INET_ADDRSTRLEN];
+	long long deadline_us = 0;
+	ssize_t len = 0;
+	int sockfd = -1;
+	int enable = 1;
+	int timeout_ms = 0;
+	int port = 0;
+	int count = 0;
+	int own = 0;
+	int i = 0;
+
+	if(config->ping_port == 0)
+	{
+		client_error("\nDUT : ping_port is 0, discovery disabled\n");
+		return 0;
+	}
+
+	if((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+	{
+		client_error("\nDUT : Create discovery socket fail\n");
+		return 0;
+	}
+	setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+
+	/* Assist server on this host answers on loopback, so it is reached on
+	 * its local socket. Its answers to broadcast are dropped below */
+	address.s_addr = htonl(INADDR_LOOPBACK);
+	client_discover_send(sockfd, address, config->ping_port);
+	address.s_addr = htonl(INADDR_BROADCAST);
+	client_discover_send(sockfd, address, config->ping_port);
+
+	if((config->discovery_group[0] == '\0') || (inet_pton(AF_INET, config->discovery_group, &group) != 1))
+	{
+		group.s_addr = htonl(INADDR_ANY);
+	}
+
+	if(getifaddrs(&interfaces) == 0)
+	{
+		for(ifa = interfaces; ifa != NULL; ifa = ifa->ifa_next)
+		{
+			if((ifa->ifa_addr == NULL) || (ifa->ifa_addr->sa_family != AF_INET) ||
+				((ifa->ifa_flags & (IFF_UP | IFF_LOOPBACK)) != IFF_UP))
+			{
+				continue;
+			}
+
+			if((ifa->ifa_flags & IFF_BROADCAST) && (ifa->ifa_broadaddr != NULL))
+			{
+				client_discover_send(sockfd, ((struct sockaddr_in*)ifa->ifa_broadaddr)->sin_addr, config->ping_port);
+			}
+
+			if((ifa->ifa_flags & IFF_MULTICAST) && (group.s_addr != htonl(INADDR_ANY)))
+			{
+				address = ((struct sockaddr_in*)ifa->ifa_addr)->sin_addr;
+				setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &address, sizeof(address));
+				client_discover_send(sockfd, group, config->ping_port);
+			}
+		}
+	}
+
+	deadline_us = clock_sync_now_us() + config->discovery_timeout_ms * 1000LL;
+	while((count < max_boards) &&
+		((timeout_ms = (int)((deadline_us - clock_sync_now_us() + 999) / 1000)) > 0) &&
+		(client_wait_socket(sockfd, POLLIN, timeout_ms) == 1))
+	{
+		peer_len = sizeof(peer);
+		if((len = recvfrom(sockfd, reply, sizeof(reply) - 1, 0, (struct sockaddr*)&peer, &peer_len)) <= 0)
+		{
+			continue;
+		}
+		reply[len] = '\0';
+
+		if(sscanf(reply, DISCOVER_REPLY " name=%31s port=%d", name, &port) != 2)
+		{
+			continue;
+		}
+		inet_ntop(AF_INET, &peer.sin_addr, ip_addr, sizeof(ip_addr));
+
+		/* Server of this host, answering broadcast on its own address */
+		for(own = 0, ifa = interfaces; (ifa != NULL) && (own == 0); ifa = ifa->ifa_next)
+		{
+			own = (ifa->ifa_addr != NULL) && (ifa->ifa_addr->sa_family == AF_INET) &&
+				(!(ifa->ifa_flags & IFF_LOOPBACK)) &&
+				(((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr == peer.sin_addr.s_addr);
+		}
+
+		/* Same board, reached on several addresses */
+		for(i = 0; (i < count) && (strcmp(boards[i].ip_addr, ip_addr) != 0); i++);
+		if((own) || (i < count))
+		{
+			continue;
+		}
+
+		if(report)
+		{
+			printf("\nDUT : Found %s : %s\n", ip_addr, reply);
+		}
+
+		if(port != config->port)
+		{
+			client_error("\nDUT : [%s] Assist board at %s serves port %d, not port %d of the configuration\n", name, ip_addr, port, config->port);
+			continue;
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			if(strcmp(boards[i].name, name) == 0)
+			{
+				client_error("\nDUT : Assist boards at %s and %s are both named %s, set board_name on them\n", boards[i].ip_addr, ip_addr, name);
+			}
+		}
+
+		bzero(&boards[count], sizeof(boards[count]));
+		snprintf(boards[count].name, sizeof(boards[count].name), "%s", name);
+		snprintf(boards[count].ip_addr, sizeof(boards[count].ip_addr), "%s", ip_addr);
+		boards[count].sockfd = -1;
+		boards[count].discovered = 1;
+		count++;
+	}
+
+	if(interfaces != NULL)
+	{
+		freeifaddrs(interfaces);
+	}
+	close(sockfd);
+
+	return count;
+}
@@ -0,0 +1,277 @@
+/** @file clock-sync.c
+ *  @brief Clock offset between DUT and assist board
+ *
+ *  NTP style ping-pong over the request connection. After the request
+ *  "AssistClockSync" assist server answers "AssistClockSyncReady", then
+ *  for every line "<t1>" from DUT it answers "<t1> <t2> <t3>"
+ *
+ *  t1 : DUT time when ping was sent
+ *  t2 : assist board time when ping was received
+ *  t3 : assist board time when pong is sent
+ *  t4 : DUT time when pong was received (DUT only)
+ *
+ *  offset = ((t2 - t1) + (t3 - t4)) / 2, round trip = (t4 - t1) - (t3 - t2)
+ *
+ *  DUT keeps the sample of least round trip and ends with
+ *  "AssistClockSyncEnd <offset> <rtt>". Assist server keeps the last
+ *  CLOCK_SYNC_HISTORY results of each DUT and estimates its drift from
+ *  them. DUTs sharing the board have clocks of their own, so results are
+ *  kept apart by DUT address and session, for CLOCK_SYNC_PEERS DUTs.
+ *
+ *  Times are CLOCK_REALTIME in us, offset is assist board minus DUT.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Sync results per DUT, protected by clock_lock */
+static struct clock_peer clock_peers[CLOCK_SYNC_PEERS];
+static unsigned long long clock_syncs = 0;
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file clock-sync.c
+ *  @brief Wall-clock time in us
+ */
+
+long long clock_sync_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+/** @file clock-sync.c
+ *  @brief Drift of the assist board clock against a DUT, least squares
+ *
+ *  Called with clock_lock held.
+ *
+ *  @param peer (sync results of the DUT)
+ *  @return drift in ppm (us per s), 0 with less than two syncs
+ */
+
+static double clock_sync_drift(struct clock_peer* peer)
+{
+	struct clock_sample* history = peer->history;
+	double mean_time = 0, mean_offset = 0;
+	double covariance = 0, variance = 0;
+	double time = 0;
+	int i = 0;
+
+	if(peer->count < 2)
+	{
+		return 0;
+	}
+
+	/* Relative to the first sample, us since epoch do not fit a double well */
+	for(i = 0; i < peer->count; i++)
+	{
+		mean_time += history[i].board_us - history[0].board_us;
+		mean_offset += history[i].offset_us;
+	}
+	mean_time /= peer->count;
+	mean_offset /= peer->count;
+
+	for(i = 0; i < peer->count; i++)
+	{
+		time = (history[i].board_us - history[0].board_us) - mean_time;
+		covariance += time * (history[i].offset_us - mean_offset);
+		variance += time * time;
+	}
+
+	return (variance > 0) ? covariance / variance * 1000000 : 0;
+}
+
+
+/** @file clock-sync.c
+ *  @brief Name the DUT of a connection
+ *
+ *  "<address> <session>", "local" as address for the local socket.
+ *
+ *  @param conn (DUT connection), key and size
+ *  @return none
+ */
+
+static void clock_sync_key(struct assist_conn* conn, char* key, size_t size)
+{
+	struct sockaddr_storage peer;
+	socklen_t peer_len = sizeof(peer);
+	char address[INET6_ADDRSTRLEN] = "local";
+
+	if(getpeername(conn->sockfd, (struct sockaddr*)&peer, &peer_len) == 0)
+	{
+		if(peer.ss_family == AF_INET)
+		{
+			inet_ntop(AF_INET, &((struct sockaddr_in*)&peer)->sin_addr, address, sizeof(address));
+		}
+		else if(peer.ss_family == AF_INET6)
+		{
+			inet_ntop(AF_INET6, &((struct sockaddr_in6*)&peer)->sin6_addr, address, sizeof(address));
+		}
+	}
+
+	snprintf(key, size, "%s %s", address, conn->session);
+}
+
+
+/** @file clock-sync.c
+ *  @brief Keep the result of a sync
+ *
+ *  A DUT not seen before takes the place of the one synced least recently.
+ *
+ *  @param key (DUT, see clock_sync_key()), offset_us and rtt_us (sample of least round trip)
+ *  @return drift in ppm of this DUT, including this sync
+ */
+
+static double clock_sync_record(const char* key, long long offset_us, long long rtt_us)
+{
+	struct clock_peer* peer = NULL;
+	double drift_ppm = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&clock_lock);
+	for(i = 0; i < CLOCK_SYNC_PEERS; i++)
+	{
+		if(strcmp(clock_peers[i].key, key) == 0)
+		{
+			peer = &clock_peers[i];
+			break;
+		}
+		if((peer == NULL) || (clock_peers[i].used < peer->used))
+		{
+			peer = &clock_peers[i];
+		}
+	}
+	if(strcmp(peer->key, key) != 0)
+	{
+		bzero(peer, sizeof(*peer));
+		snprintf(peer->key, sizeof(peer->key), "%s", key);
+	}
+
+	if(peer->count == CLOCK_SYNC_HISTORY)
+	{
+		memmove(&peer->history[0], &peer->history[1], (CLOCK_SYNC_HISTORY - 1) * sizeof(peer->history[0]));
+		peer->count--;
+	}
+	peer->history[peer->count].board_us = clock_sync_now_us();
+	peer->history[peer->count].offset_us = offset_us;
+	peer->history[peer->count].rtt_us = rtt_us;
+	peer->count++;
+	peer->used = ++clock_syncs;
+	drift_ppm = clock_sync_drift(peer);
+	pthread_mutex_unlock(&clock_lock);
+
+	return drift_ppm;
+}
+
+
+/** @file clock-sync.c
+ *  @brief Read one line of the exchange
+ *
+ *  @param sockfd, line, size and len (bytes already in line, updated)
+ *  @return line length without '\n', -1 on error or close
+ */
+
+static int clock_sync_read_line(int sockfd, char* line, size_t size, size_t* len)
+{
+	char* end = NULL;
+	ssize_t read_len = 0;
+	int line_len = 0;
+
+	while((end = memchr(line, '\n', *len)) == NULL)
+	{
+		if(*len >= size - 1)
+		{
+			return -1;
+		}
+		if((read_len = recv(sockfd, &line[*len], size - 1 - *len, 0)) <= 0)
+		{
+			if((read_len == -1) && (errno == EINTR))
+			{
+				continue;
+			}
+			return -1;
+		}
+		*len += read_len;
+	}
+
+	*end = '\0';
+	line_len = end - line;
+
+	return line_len;
+}
+
+
+/** @file clock-sync.c
+ *  @brief Serve the ping-pong exchange with DUT
+ *
+ *  Each ping is answered right away, with Nagle off. At most
+ *  CLOCK_SYNC_MAX_SAMPLES pings are answered.
+ *
+ *  @param conn (DUT connection) and result (filled by DUT end line)
+ *  @return 0 on success, -1 on error
+ */
+
+int clock_sync_serve(struct assist_conn* conn, struct clock_sample* result)
+{
+	char line[CLOCK_SYNC_LINE_SIZE];
+	char pong[CLOCK_SYNC_LINE_SIZE];
+	char key[CLOCK_SYNC_KEY_SIZE];
+	size_t len = 0;
+	int line_len = 0;
+	int pong_len = 0;
+	int samples = 0;
+	int nodelay = 1;
+	long long t1 = 0, t2 = 0, t3 = 0;
+
+	setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	if(send(conn->sockfd, "AssistClockSyncReady\n", strlen("AssistClockSyncReady\n"), MSG_NOSIGNAL) == -1)
+	{
+		return -1;
+	}
+
+	while(samples <= CLOCK_SYNC_MAX_SAMPLES)
+	{
+		if((line_len = clock_sync_read_line(conn->sockfd, line, sizeof(line), &len)) == -1)
+		{
+			printf("\nAssist : Clock sync ended by DUT without result\n");
+			return -1;
+		}
+		t2 = clock_sync_now_us();
+
+		if(strncmp(line, "AssistClockSyncEnd", strlen("AssistClockSyncEnd")) == 0)
+		{
+			if(sscanf(line, "AssistClockSyncEnd %lld %lld", &result->offset_us, &result->rtt_us) != 2)
+			{
+				return -1;
+			}
+			result->board_us = t2;
+			clock_sync_key(conn, key, sizeof(key));
+			result->drift_ppm = clock_sync_record(key, result->offset_us, result->rtt_us);
+			return 0;
+		}
+
+		t1 = strtoll(line, NULL, 10);
+		pong_len = snprintf(pong, sizeof(pong), "%lld %lld ", t1, t2);
+		t3 = clock_sync_now_us();
+		pong_len += snprintf(&pong[pong_len], sizeof(pong) - pong_len, "%lld\n", t3);
+		if(send(conn->sockfd, pong, pong_len, MSG_NOSIGNAL) == -1)
+		{
+			return -1;
+		}
+
+		/* Drop the line, keep what came after it */
+		len -= line_len + 1;
+		memmove(line, &line[line_len + 1], len);
+		samples++;
+	}
+
+	printf("\nAssist : Clock sync sent more than %d pings\n", CLOCK_SYNC_MAX_SAMPLES);
+	return -1;
+}
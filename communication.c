@@ -17,17 +17,17 @@
  *
  *  Create tcp/ip socket. And make it ready to use.
  *
- *  @param none
+ *  @param port (TCP port to listen on)
  *  @return sockfd on success and -1 on error.
  */
 
-int create_socket(void)
+int create_socket(int port)
 {
 	int sockfd; 
 	struct sockaddr_in assist_addr; 
 
-	/* Create socket  */
-	sockfd = socket(AF_INET, SOCK_STREAM, 0); 
+	/* Create socket. Commands started by assist server must not inherit it */
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0); 
 	if (sockfd == -1) 
 	{ 
 		printf("Assist : Create socket fail\n"); 
@@ -49,12 +49,13 @@ int create_socket(void)
 	/* Assign ip address and port to socket  */
 	assist_addr.sin_family = AF_INET; 
 	assist_addr.sin_addr.s_addr = htonl(INADDR_ANY); 
-	assist_addr.sin_port = htons(PORT); 
+	assist_addr.sin_port = htons(port); 
 
 	/* Bind socket with address and port */
 	if ((bind(sockfd, (SA*)&assist_addr, sizeof(assist_addr))) != 0) 
 	{ 
 		printf("Assist : Bind socket fail\n"); 
+		close(sockfd);
 		return -1; 
 	} 
 	#ifdef DEBUG
@@ -64,10 +65,11 @@ int create_socket(void)
 	}
 	#endif
 
-	/* Listen using socket. Max connections can be 1 */
-	if ((listen(sockfd, 1)) != 0) 
+	/* Listen using socket. Connections wait here while all workers are busy */
+	if ((listen(sockfd, LISTEN_BACKLOG)) != 0) 
 	{ 
 		printf("Assist : Listen socket fail\n"); 
+		close(sockfd);
 		return -1; 
 	} 
 	#ifdef DEBUG
@@ -82,6 +84,49 @@ int create_socket(void)
 
 
 
+/** @file communication.c
+ *  @brief Create the local (Unix) socket for DUT on the same host
+ *
+ *  A stale socket file of an earlier run is replaced.
+ *
+ *  @param path (socket file)
+ *  @return sockfd on success and -1 on error.
+ */
+
+int create_local_socket(const char* path)
+{
+	int sockfd = -1;
+	struct sockaddr_un local_addr;
+
+	if(strlen(path) >= sizeof(local_addr.sun_path))
+	{
+		printf("Assist : Local socket path %s too long\n", path);
+		return -1;
+	}
+
+	if((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+	{
+		printf("Assist : Create local socket fail\n");
+		return -1;
+	}
+
+	bzero(&local_addr, sizeof(local_addr));
+	local_addr.sun_family = AF_UNIX;
+	snprintf(local_addr.sun_path, sizeof(local_addr.sun_path), "%s", path);
+	unlink(path);
+
+	if((bind(sockfd, (SA*)&local_addr, sizeof(local_addr)) != 0) || (listen(sockfd, LISTEN_BACKLOG) != 0))
+	{
+		printf("Assist : Bind local socket %s fail. %s\n", path, strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+
 /** @file communication.c
  *  @brief Read data from socket.
  *
@@ -92,30 +137,25 @@ int create_socket(void)
  */
 
 
-char* read_socket(int sockfd)
+char* read_socket(struct assist_conn* conn)
 {
 	char *request = NULL;
 	int request_len = 0;
+	int request_size = conn->config->request_size;
 
-	/* Allocate dynamic memory. We know requests length dont cross 1024 bytes, so allocate with fix size */
-	request = (char *)malloc(MAX_SIZE);
+	/* Requests length dont cross request_size bytes, so take fix size from connection arena */
+	request = (char *)arena_alloc(&conn->arena, request_size + 1);
 	if(request == NULL)
 	{
 		printf("\nAssist : Memory allocation fail at read_socket()\n");
 		return NULL;
 	}
-	#ifdef DEBUG
-	else
-	{
-		printf("\nAssist : Memory allocation pass\n");
-	}
-	#endif
 
-	/* Recv/read data from socket */
-	if((request_len = read(sockfd, request, MAX_SIZE)) == -1)
+	/* Recv/read data from socket. Zero length means DUT closed the connection,
+	 * -1 with EAGAIN means the receive timeout expired */
+	if((request_len = read(conn->sockfd, request, request_size)) <= 0)
 	{
 		printf("\nAssist : Read fail\n");
-		free(request); request = NULL;
 		return NULL;
 	}
 	#ifdef DEBUG
@@ -125,8 +165,12 @@ char* read_socket(int sockfd)
 	}
 	#endif
 
-	/* At end there is "\n". Remove it */
-	request[request_len - 1]='\0';
+	/* At end there is "\0" (or "\n" from other tools). Remove it */
+	request[request_len]='\0';
+	if((request[request_len - 1] == '\0') || (request[request_len - 1] == '\n'))
+	{
+		request[request_len - 1]='\0';
+	}
 
 	#ifdef DEBUG
 		printf("\nAssist : Request/command from DUT is \n%s\n", request);
@@ -147,98 +191,69 @@ char* read_socket(int sockfd)
  *  In case of failure, error has to be sent.
  *  Other than console logs request, success or error has to be sent.
  *
+ *  Handlers build their reply with reply_printf() instead, see reply.c.
+ *
  *  @param console_logs (console logs or errors or infomration) and sockfd (socket descriptor)
  *  @return retVal. 0 on success, -1 on error
  */
 
 int write_socket(char* console_logs, int sockfd)
 {
+	struct reply reply;
 	int retVal = -1;
-	int total_send_len = 0;
-    int tmp_send_len = 0;	
-    int tmp_total_send_len = 0;
-	char tmpBuf[MAX_SIZE];
 
 	#ifdef DEBUG
-		printf("\nAssist : send data length is %ld\n", strlen(console_logs));
 		printf("\nAssist : send data is \n%s\n", console_logs);
 	#endif
 
+	/* Sent right here, so the text goes out as a view without copy */
+	reply_init(&reply, sockfd);
+	if(reply_append_view(&reply, console_logs, strlen(console_logs)) != 0)
+	{
+		reply_release(&reply);
+		return -1;
+	}
+
 	/* Send console logs or command execution status back to DUT.  */
-    total_send_len = strlen(console_logs);
-
-    /* Check the data length, if data length more than 1K, send data in chunks/fragments */
-    if(total_send_len >= (MAX_SIZE-1))
-    {
-    	strncpy(tmpBuf, &console_logs[0], MAX_SIZE-1);	
-    	tmp_send_len = MAX_SIZE ;
-    }
-    else
-    {
-    	strcpy(tmpBuf, &console_logs[0]);
-    	tmp_send_len = total_send_len + 1;
-    }
-    
-    /* Loop till last byte is sent */
-    while(1)
-    {
-    	#ifdef DEBUG
-    		printf("\nSend temporary buffer is \n%s\n", tmpBuf);
-    	#endif
-
-    	/* send data through socket */
-		tmp_send_len = write(sockfd, tmpBuf, tmp_send_len);
-
-		/* Check the data send error */
-		if(tmp_send_len == -1)
-		{
-			printf("\nAssist : Writing socket fail. Return value is (-1) %d\n", tmp_send_len);
-			retVal = -1;
-			break;
-		}
-		/* Check the data send error */
-		else if (tmp_send_len < 0)
-		{
-			printf("\nAssist : Writing socket fail. Return value is (<0) %d\n", tmp_send_len);
-			retVal = -1;
-			break;
-		}
-		/* Check the data send error */
-		else if(tmp_send_len == 0)
-		{
-			printf("\nAssist : Writing socket returned zero. Try again. Return value is (0) %d\n", tmp_send_len);
-		}
-		
-		/* Know till now how much data is sent */
-		tmp_total_send_len = tmp_total_send_len + tmp_send_len -1;
-
-		#ifdef DEBUG
-			printf("\nAssist : Send length is %d \n", tmp_send_len - 1);
-			printf("\nAssist : Sent total len is %d\n", tmp_total_send_len);
-			printf("\nAssist : Remaining send length is %d \n", total_send_len - tmp_total_send_len);
-		#endif
-
-		/* Deciding factor to know data send is end or complete */
-		if((total_send_len - tmp_total_send_len) <= 0)
-		{
-			printf("\nAssist : Sent complete data\n");
-			retVal = 0;
-			break;
-		}
-
-		/* Still data is there to send */
-		if((total_send_len - tmp_total_send_len) >= (MAX_SIZE-1))
-		{
-			strncpy(tmpBuf, &console_logs[tmp_total_send_len], MAX_SIZE-1);
-			tmp_send_len = MAX_SIZE ;
-		}
-		/* This is last chunk which is less then 1K */
-		else
-		{
-			strncpy(tmpBuf, &console_logs[tmp_total_send_len], MAX_SIZE-1);
-			tmp_send_len = total_send_len - tmp_total_send_len + 1;
-		}
-		//strncpy(tmpBuf, &console_logs[total_send_len], MAX_SIZE-1);
+	if((retVal = reply_send(&reply)) == 0)
+	{
+		printf("\nAssist : Sent complete data\n");
 	}
+
 	return retVal;
-}
\ No newline at end of file
+}
+
+
+
+/** @file communication.c
+ *  @brief Set send and receive timeout on socket
+ *
+ *  A DUT which connects and never sends, or never reads the reply,
+ *  must not block the assist server forever. Blocking read/write on the
+ *  socket return -1 (EAGAIN) once the timeout expires.
+ *
+ *  @param sockfd (socket descriptor) and timeout_ms (timeout in milliseconds, 0 to disable)
+ *  @return 0 on success, -1 on error
+ */
+
+int set_socket_timeout(int sockfd, int timeout_ms)
+{
+	struct timeval tv;
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	if(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0)
+	{
+		printf("\nAssist : Set receive timeout fail\n");
+		return -1;
+	}
+
+	if(setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+	{
+		printf("\nAssist : Set send timeout fail\n");
+		return -1;
+	}
+
+	return 0;
+}
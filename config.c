@@ -0,0 +1,496 @@
+/** @file config.c
+ *  @brief Configuration of assist server and dut client
+ *
+ *  Configuration file is key=value text, parsed once into struct assist_config.
+ *  Both assist-server and dut-client use the same file and the same keys.
+ *
+ *  port=5678                            TCP port of assist server
+ *  request_size=1024                    Max request length from DUT
+ *  chunk_size=1024                      Send/receive chunk size
+ *  console_log_file=/tmp/cmd_console_logs
+ *  worker_count=4                       Requests served in parallel by assist server
+ *  express_workers=1                    Workers kept for control requests (health, kill, check)
+ *  bulk_rate_kbps=0                     Pacing of bulk replies (console logs, journal), 0 for none
+ *  socket_timeout_ms=10000              Send/receive timeout at assist server
+ *  connect_timeout_ms=5000              Connect timeout at DUT
+ *  deadline_ms=60000                    Default request deadline at DUT
+ *  telemetry_interval_ms=1000           Health sample interval at assist server
+ *  reply_high_water=65536               Reply bytes queued before its producer waits for DUT
+ *  reply_low_water=16384                Unsent reply bytes below which the producer goes on
+ *  journal_file=/tmp/assist_journal     Event journal of assist server, read at start
+ *  journal_records=65536                Events kept in the journal, 0 disables it
+ *  trace_file=<path>                    Trace of served requests for assist-replay, off when empty
+ *  local_socket=/tmp/assist.sock        Unix socket for DUT on the assist board itself, off when empty
+ *  ring_size=1048576                    Shared memory ring DUT asks for on the local socket, 0 for none
+ *  capture_realtime=0                   CAN captures in realtime mode unless the request says otherwise
+ *  capture_cpu=-1                       CPU of the realtime capture receive thread, -1 for any
+ *  capture_priority=50                  SCHED_FIFO priority of the realtime capture receive thread
+ *  capture_buffer_frames=65536          Locked frame buffer of a realtime capture
+ *  session_max_processes=0              Processes a named session may run, 0 for no limit
+ *  session_max_log_bytes=0              Console log size of a named session, 0 for no limit
+ *  session_max_workers=0                Workers busy for one named session, 0 for no limit
+ *  session=<name>                       Session of the requests of dut-client, default session when empty
+ *  ping_port=5678                       UDP port of health pings and discovery, same as port when
+ *                                       not set, 0 disables it
+ *  discovery_group=239.255.56.78        Multicast group of discovery, broadcast only when empty
+ *  discovery_timeout_ms=500             Time DUT waits for discovery replies
+ *  discover=0                           Without board lines, DUT uses boards answering discovery
+ *  board_name=<name>                    Name assist server gives in discovery, host name when empty
+ *  ip_address=<ip>                      Unnamed assist board, known as "default"
+ *  board=<name> <ip>                    Named assist board
+ *
+ *  Assist server reloads the file on SIGHUP. Requests in progress keep
+ *  the configuration they started with, see config_get() and config_put().
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Current configuration and the path it was loaded from */
+static struct assist_config* current_config = NULL;
+static char current_config_path[PATH_MAX];
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file config.c
+ *  @brief Set the default configuration values
+ *
+ *  Defaults are the values which were compile time defines before.
+ *
+ *  @param config (configuration to fill)
+ *  @return none
+ */
+
+static void config_defaults(struct assist_config* config)
+{
+	bzero(config, sizeof(*config));
+	config->port = PORT;
+	config->request_size = MAX_SIZE;
+	config->chunk_size = MAX_SIZE;
+	config->worker_count = DEFAULT_WORKER_COUNT;
+	config->express_workers = DEFAULT_EXPRESS_WORKERS;
+	config->socket_timeout_ms = SOCKET_TIMEOUT_MS;
+	config->connect_timeout_ms = CONNECT_TIMEOUT_MS;
+	config->deadline_ms = DEFAULT_DEADLINE_MS;
+	config->telemetry_interval_ms = TELEMETRY_INTERVAL_MS;
+	config->reply_high_water = REPLY_HIGH_WATER;
+	config->reply_low_water = REPLY_LOW_WATER;
+	snprintf(config->console_log_file, sizeof(config->console_log_file), "%s", CONSOLE_LOG_FILE);
+	snprintf(config->journal_file, sizeof(config->journal_file), "%s", JOURNAL_FILE);
+	config->journal_records = JOURNAL_RECORDS;
+	snprintf(config->local_socket, sizeof(config->local_socket), "%s", LOCAL_SOCKET_PATH);
+	config->ring_size = RING_SIZE;
+	config->capture_cpu = -1;
+	config->capture_priority = CAPTURE_PRIORITY;
+	config->capture_buffer_frames = CAPTURE_BUFFER_FRAMES;
+	config->ping_port = -1;
+	snprintf(config->discovery_group, sizeof(config->discovery_group), "%s", DISCOVERY_GROUP);
+	config->discovery_timeout_ms = DISCOVERY_TIMEOUT_MS;
+}
+
+
+/** @file config.c
+ *  @brief Parse an integer value and check its range
+ *
+ *  @param key, value (text), min, max and result
+ *  @return 0 on success, -1 on invalid value
+ */
+
+static int config_parse_int(char* key, char* value, int min, int max, int* result)
+{
+	char* end = NULL;
+	long number = strtol(value, &end, 10);
+
+	if((end == value) || (*end != '\0') || (number < min) || (number > max))
+	{
+		printf("\nConfig : Invalid value \"%s\" for %s. Allowed range is %d to %d\n", value, key, min, max);
+		return -1;
+	}
+
+	*result = (int)number;
+	return 0;
+}
+
+
+/** @file config.c
+ *  @brief Parse one key=value line
+ *
+ *  @param config (configuration to fill) and line (without new line)
+ *  @return 0 on success, -1 on invalid line
+ */
+
+static int config_parse_line(struct assist_config* config, char* line)
+{
+	char* key = line;
+	char* value = NULL;
+	struct assist_board* board = NULL;
+	struct in_addr group;
+
+	if((value = strchr(line, '=')) == NULL)
+	{
+		printf("\nConfig : Missing '=' in line \"%s\"\n", line);
+		return -1;
+	}
+	*value++ = '\0';
+
+	if(strcmp(key, "port") == 0)
+	{
+		return config_parse_int(key, value, 1, 65535, &config->port);
+	}
+	else if(strcmp(key, "request_size") == 0)
+	{
+		return config_parse_int(key, value, 64, MAX_REQUEST_SIZE, &config->request_size);
+	}
+	else if(strcmp(key, "chunk_size") == 0)
+	{
+		return config_parse_int(key, value, 64, MAX_CHUNK_SIZE, &config->chunk_size);
+	}
+	else if(strcmp(key, "worker_count") == 0)
+	{
+		return config_parse_int(key, value, 1, MAX_WORKER_COUNT, &config->worker_count);
+	}
+	else if(strcmp(key, "express_workers") == 0)
+	{
+		return config_parse_int(key, value, 0, MAX_WORKER_COUNT, &config->express_workers);
+	}
+	else if(strcmp(key, "bulk_rate_kbps") == 0)
+	{
+		return config_parse_int(key, value, 0, 10000000, &config->bulk_rate_kbps);
+	}
+	else if(strcmp(key, "socket_timeout_ms") == 0)
+	{
+		return config_parse_int(key, value, 0, 3600000, &config->socket_timeout_ms);
+	}
+	else if(strcmp(key, "connect_timeout_ms") == 0)
+	{
+		return config_parse_int(key, value, 1, 3600000, &config->connect_timeout_ms);
+	}
+	else if(strcmp(key, "deadline_ms") == 0)
+	{
+		return config_parse_int(key, value, 0, 86400000, &config->deadline_ms);
+	}
+	else if(strcmp(key, "telemetry_interval_ms") == 0)
+	{
+		return config_parse_int(key, value, 10, 3600000, &config->telemetry_interval_ms);
+	}
+	else if(strcmp(key, "reply_high_water") == 0)
+	{
+		return config_parse_int(key, value, REPLY_SEGMENT_SIZE, REPLY_MAX_WATER, &config->reply_high_water);
+	}
+	else if(strcmp(key, "reply_low_water") == 0)
+	{
+		return config_parse_int(key, value, 1, REPLY_MAX_WATER, &config->reply_low_water);
+	}
+	else if(strcmp(key, "journal_file") == 0)
+	{
+		snprintf(config->journal_file, sizeof(config->journal_file), "%s", value);
+		return 0;
+	}
+	else if(strcmp(key, "trace_file") == 0)
+	{
+		snprintf(config->trace_file, sizeof(config->trace_file), "%s", value);
+		return 0;
+	}
+	else if(strcmp(key, "local_socket") == 0)
+	{
+		snprintf(config->local_socket, sizeof(config->local_socket), "%s", value);
+		return 0;
+	}
+	else if(strcmp(key, "ring_size") == 0)
+	{
+		return config_parse_int(key, value, 0, RING_MAX_SIZE, &config->ring_size);
+	}
+	else if(strcmp(key, "capture_realtime") == 0)
+	{
+		return config_parse_int(key, value, 0, 1, &config->capture_realtime);
+	}
+	else if(strcmp(key, "capture_cpu") == 0)
+	{
+		return config_parse_int(key, value, -1, CPU_SETSIZE - 1, &config->capture_cpu);
+	}
+	else if(strcmp(key, "capture_priority") == 0)
+	{
+		return config_parse_int(key, value, 1, 99, &config->capture_priority);
+	}
+	else if(strcmp(key, "capture_buffer_frames") == 0)
+	{
+		return config_parse_int(key, value, 1024, 16777216, &config->capture_buffer_frames);
+	}
+	else if(strcmp(key, "session_max_processes") == 0)
+	{
+		return config_parse_int(key, value, 0, 1048576, &config->session_max_processes);
+	}
+	else if(strcmp(key, "session_max_log_bytes") == 0)
+	{
+		return config_parse_int(key, value, 0, INT_MAX, &config->session_max_log_bytes);
+	}
+	else if(strcmp(key, "session_max_workers") == 0)
+	{
+		return config_parse_int(key, value, 0, MAX_WORKER_COUNT, &config->session_max_workers);
+	}
+	else if(strcmp(key, "session") == 0)
+	{
+		snprintf(config->session, sizeof(config->session), "%s", value);
+		return 0;
+	}
+	else if(strcmp(key, "ping_port") == 0)
+	{
+		return config_parse_int(key, value, 0, 65535, &config->ping_port);
+	}
+	else if(strcmp(key, "discovery_group") == 0)
+	{
+		if((value[0] != '\0') && ((inet_pton(AF_INET, value, &group) != 1) || (!IN_MULTICAST(ntohl(group.s_addr)))))
+		{
+			printf("\nConfig : Invalid discovery_group \"%s\", not an IPv4 multicast address\n", value);
+			return -1;
+		}
+		snprintf(config->discovery_group, sizeof(config->discovery_group), "%s", value);
+		return 0;
+	}
+	else if(strcmp(key, "discovery_timeout_ms") == 0)
+	{
+		return config_parse_int(key, value, 10, 60000, &config->discovery_timeout_ms);
+	}
+	else if(strcmp(key, "discover") == 0)
+	{
+		return config_parse_int(key, value, 0, 1, &config->discover);
+	}
+	else if(strcmp(key, "board_name") == 0)
+	{
+		if(strpbrk(value, " \t") != NULL)
+		{
+			printf("\nConfig : Invalid board_name \"%s\", no spaces allowed\n", value);
+			return -1;
+		}
+		snprintf(config->board_name, sizeof(config->board_name), "%s", value);
+		return 0;
+	}
+	else if(strcmp(key, "journal_records") == 0)
+	{
+		return config_parse_int(key, value, 0, 16777216, &config->journal_records);
+	}
+	else if(strcmp(key, "console_log_file") == 0)
+	{
+		snprintf(config->console_log_file, sizeof(config->console_log_file), "%s", value);
+		return 0;
+	}
+	else if((strcmp(key, "ip_address") == 0) || (strcmp(key, "board") == 0))
+	{
+		if(config->board_count >= MAX_BOARDS)
+		{
+			printf("\nConfig : More than %d boards, \"%s\" ignored\n", MAX_BOARDS, value);
+			return 0;
+		}
+
+		board = &config->boards[config->board_count];
+		bzero(board, sizeof(*board));
+		board->sockfd = -1;
+
+		if(strcmp(key, "ip_address") == 0)
+		{
+			strcpy(board->name, "default");
+			if(sscanf(value, "%15s", board->ip_addr) != 1)
+			{
+				printf("\nConfig : Invalid ip_address line\n");
+				return -1;
+			}
+		}
+		else if(sscanf(value, "%31s %15s", board->name, board->ip_addr) != 2)
+		{
+			printf("\nConfig : Invalid board line \"%s\"\n", value);
+			return -1;
+		}
+
+		config->board_count++;
+		return 0;
+	}
+
+	printf("\nConfig : Unknown key \"%s\"\n", key);
+	return -1;
+}
+
+
+/** @file config.c
+ *  @brief Load the configuration file
+ *
+ *  Parse the file into a new configuration and make it current.
+ *  On any error, current configuration is kept as it is.
+ *  Missing file is not an error, defaults are used.
+ *
+ *  @param path (configuration file, NULL for $ASSIST_CONF or ASSIST_CONF_FILE)
+ *  @return 0 on success, -1 on error
+ */
+
+int load_config(const char* path)
+{
+	struct assist_config* config = NULL;
+	struct assist_config* old_config = NULL;
+	FILE *conf_file = NULL;
+	char line[PATH_MAX + 64];
+	char* start = NULL;
+	int line_number = 0;
+	int retVal = 0;
+
+	if(path == NULL)
+	{
+		path = (current_config_path[0] != '\0') ? current_config_path : getenv("ASSIST_CONF");
+	}
+	if(path == NULL)
+	{
+		path = ASSIST_CONF_FILE;
+	}
+
+	if((config = malloc(sizeof(*config))) == NULL)
+	{
+		printf("\nConfig : Memory allocation fail at load_config()\n");
+		return -1;
+	}
+	config_defaults(config);
+
+	if((conf_file = fopen(path, "r")) == NULL)
+	{
+		printf("\nConfig : Cannot open %s, using defaults\n", path);
+	}
+
+	/* Loop over key=value lines */
+	while((conf_file != NULL) && fgets(line, sizeof(line), conf_file))
+	{
+		line_number++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		/* Skip leading blanks, empty lines and comments */
+		for(start = line; (*start == ' ') || (*start == '\t'); start++);
+		if((*start == '\0') || (*start == '#'))
+		{
+			continue;
+		}
+
+		if(config_parse_line(config, start) != 0)
+		{
+			printf("\nConfig : Error at %s line %d\n", path, line_number);
+			retVal = -1;
+		}
+	}
+
+	if(conf_file != NULL)
+	{
+		fclose(conf_file);
+	}
+
+	if(config->reply_low_water > config->reply_high_water)
+	{
+		printf("\nConfig : reply_low_water %d is above reply_high_water %d\n", config->reply_low_water, config->reply_high_water);
+		retVal = -1;
+	}
+
+	/* Pings go to the same port number as requests, unless set */
+	if(config->ping_port == -1)
+	{
+		config->ping_port = config->port;
+	}
+
+	if(retVal != 0)
+	{
+		free(config);
+		return -1;
+	}
+
+	#ifdef DEBUG
+		printf("\nConfig : port %d, request_size %d, chunk_size %d, worker_count %d, boards %d\n",
+			config->port, config->request_size, config->chunk_size, config->worker_count, config->board_count);
+	#endif
+
+	/* Publish the new configuration. Old one is freed by its last user */
+	config->refcount = 1;
+
+	pthread_mutex_lock(&config_lock);
+	if(path != current_config_path)
+	{
+		snprintf(current_config_path, sizeof(current_config_path), "%s", path);
+	}
+	old_config = current_config;
+	current_config = config;
+	pthread_mutex_unlock(&config_lock);
+
+	if(old_config)
+	{
+		config_put(old_config);
+	}
+
+	return 0;
+}
+
+
+/** @file config.c
+ *  @brief Take a reference to the current configuration
+ *
+ *  Reference stays valid across a reload. Release it with config_put().
+ *  Loads the defaults when no configuration is loaded yet.
+ *
+ *  @param none
+ *  @return current configuration
+ */
+
+struct assist_config* config_get(void)
+{
+	struct assist_config* config = NULL;
+
+	pthread_mutex_lock(&config_lock);
+	config = current_config;
+	if(config)
+	{
+		config->refcount++;
+	}
+	pthread_mutex_unlock(&config_lock);
+
+	if(config == NULL)
+	{
+		if(load_config(NULL) != 0)
+		{
+			printf("\nConfig : Falling back to defaults\n");
+			if((config = malloc(sizeof(*config))) == NULL)
+			{
+				printf("\nConfig : Memory allocation fail at config_get()\n");
+				exit(-1);
+			}
+			config_defaults(config);
+			config->refcount = 1;
+			pthread_mutex_lock(&config_lock);
+			if(current_config == NULL)
+			{
+				current_config = config;
+				config = NULL;
+			}
+			pthread_mutex_unlock(&config_lock);
+			free(config);
+		}
+		return config_get();
+	}
+
+	return config;
+}
+
+
+/** @file config.c
+ *  @brief Release a reference taken with config_get()
+ *
+ *  @param config (configuration)
+ *  @return none
+ */
+
+void config_put(struct assist_config* config)
+{
+	int refcount = 0;
+
+	pthread_mutex_lock(&config_lock);
+	refcount = --config->refcount;
+	pthread_mutex_unlock(&config_lock);
+
+	if(refcount == 0)
+	{
+		free(config);
+	}
+}
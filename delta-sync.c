@@ -0,0 +1,1109 @@
+/** @file delta-sync.c
+ *  @brief Delta sync of files and directory trees from DUT to assist board
+ *
+ *  rsync style. After the request "AssistFileSync <path>" assist server
+ *  answers "AssistFileSyncReady", then frames (struct delta_frame and its
+ *  payload) go both ways on the request connection :
+ *
+ *  DUT                                   Assist board
+ *  DELTA_DIR    mode, path               directory created when missing
+ *  DELTA_FILE   size, mtime, mode, path
+ *                                        DELTA_SIGNATURES of the full blocks
+ *                                        of the old file, in batches
+ *  DELTA_COPY   run of old blocks
+ *  DELTA_DATA   bytes not found in them
+ *  DELTA_END    hash of the whole file
+ *                                        DELTA_STATUS (0 or errno)
+ *  ...
+ *  DELTA_DONE                            usual reply, "AssistDataEnds"
+ *
+ *  DUT finds the old blocks in its file with a rolling checksum (weak, a
+ *  byte at a time) confirmed by a 64 bit hash (strong), so only changed
+ *  bytes cross the wire. Assist board writes the new file next to the old
+ *  one, checks its hash and renames it over the old one : a reader sees the
+ *  old file or the new one, never a mix. A file of the same size and mtime
+ *  is not read at all (DELTA_FLAG_SAME). On a hash mismatch DUT sends the
+ *  file again whole.
+ *
+ *  Paths are relative to the request path and may not leave it.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/** @file delta-sync.c
+ *  @brief Hash of a byte stream, FNV-1a 64. Chunks may be of any size
+ *
+ *  @param hash (DELTA_HASH_INIT to start), data and len
+ *  @return hash
+ */
+
+unsigned long long delta_hash(unsigned long long hash, const unsigned char* data, size_t len)
+{
+	size_t i = 0;
+
+	for(i = 0; i < len; i++)
+	{
+		hash = (hash ^ data[i]) * DELTA_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Strong hash of a block, 8 bytes a step
+ *
+ *  Bytes are taken little endian whatever the host, DUT and assist board
+ *  must agree.
+ *
+ *  @param data and len
+ *  @return hash
+ */
+
+static unsigned long long delta_strong(const unsigned char* data, size_t len)
+{
+	unsigned long long hash = DELTA_HASH_INIT ^ len;
+	unsigned long long word = 0;
+	size_t i = 0;
+
+	for(i = 0; i + 8 <= len; i += 8)
+	{
+		word = (unsigned long long)data[i] | ((unsigned long long)data[i + 1] << 8) |
+			((unsigned long long)data[i + 2] << 16) | ((unsigned long long)data[i + 3] << 24) |
+			((unsigned long long)data[i + 4] << 32) | ((unsigned long long)data[i + 5] << 40) |
+			((unsigned long long)data[i + 6] << 48) | ((unsigned long long)data[i + 7] << 56);
+		hash = (hash ^ word) * DELTA_HASH_PRIME;
+		hash ^= hash >> 29;
+	}
+
+	return delta_hash(hash, &data[i], len - i);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Rolling checksum of a block, as rsync
+ *
+ *  a is the sum of the bytes, b the sum of a over the block, both mod 2^16.
+ *  Sliding one byte is a few operations, see delta_match_file().
+ *
+ *  @param data, len, a and b (filled, not reduced)
+ *  @return checksum
+ */
+
+static unsigned int delta_weak(const unsigned char* data, size_t len, unsigned int* a, unsigned int* b)
+{
+	size_t i = 0;
+
+	*a = 0;
+	*b = 0;
+	for(i = 0; i < len; i++)
+	{
+		*a += data[i];
+		*b += (unsigned int)(len - i) * data[i];
+	}
+
+	return (*a & 0xFFFF) | (*b << 16);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Block size for a file, about the square root of its size
+ *
+ *  @param size
+ *  @return block size
+ */
+
+static unsigned int delta_block_size(unsigned long long size)
+{
+	unsigned long long block_size = DELTA_MIN_BLOCK;
+
+	while((block_size * block_size < size) && (block_size < DELTA_MAX_BLOCK))
+	{
+		block_size *= 2;
+	}
+
+	return (unsigned int)block_size;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Read len bytes, waiting at most timeout_ms for each part
+ *
+ *  @param sockfd, data, len and timeout_ms
+ *  @return 0 on success, -1 on error, timeout or closed connection
+ */
+
+static int delta_read(int sockfd, void* data, size_t len, int timeout_ms)
+{
+	struct pollfd fds;
+	ssize_t read_len = 0;
+	size_t done = 0;
+
+	fds.fd = sockfd;
+	fds.events = POLLIN;
+	while(done < len)
+	{
+		if((read_len = read(sockfd, (char*)data + done, len - done)) > 0)
+		{
+			done += read_len;
+			continue;
+		}
+		if((read_len == 0) || ((errno != EAGAIN) && (errno != EINTR)) ||
+			((errno == EAGAIN) && (poll(&fds, 1, timeout_ms) != 1)))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Write len bytes, waiting at most timeout_ms for each part
+ *
+ *  @param sockfd, data, len and timeout_ms
+ *  @return 0 on success, -1 on error or timeout
+ */
+
+static int delta_write(int sockfd, const void* data, size_t len, int timeout_ms)
+{
+	struct pollfd fds;
+	ssize_t write_len = 0;
+	size_t done = 0;
+
+	fds.fd = sockfd;
+	fds.events = POLLOUT;
+	while(done < len)
+	{
+		if((write_len = send(sockfd, (const char*)data + done, len - done, MSG_NOSIGNAL)) > 0)
+		{
+			done += write_len;
+			continue;
+		}
+		if(((write_len == -1) && (errno != EAGAIN) && (errno != EINTR)) ||
+			((errno == EAGAIN) && (poll(&fds, 1, timeout_ms) != 1)))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Send one frame
+ *
+ *  @param sockfd, type, payload, len and timeout_ms
+ *  @return 0 on success, -1 on error
+ */
+
+static int delta_send(int sockfd, unsigned int type, const void* payload, size_t len, int timeout_ms)
+{
+	struct delta_frame frame;
+
+	frame.type = htobe32(type);
+	frame.length = htobe32((unsigned int)len);
+
+	return ((delta_write(sockfd, &frame, sizeof(frame), timeout_ms) == 0) &&
+		(delta_write(sockfd, payload, len, timeout_ms) == 0)) ? 0 : -1;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Receive one frame
+ *
+ *  @param sockfd, type (filled), payload, size (of payload), len (filled)
+ *         and timeout_ms
+ *  @return 0 on success, -1 on error or a frame larger than size
+ */
+
+static int delta_recv(int sockfd, unsigned int* type, void* payload, size_t size, size_t* len, int timeout_ms)
+{
+	struct delta_frame frame;
+
+	if(delta_read(sockfd, &frame, sizeof(frame), timeout_ms) != 0)
+	{
+		return -1;
+	}
+
+	*type = be32toh(frame.type);
+	*len = be32toh(frame.length);
+	if(*len > size)
+	{
+		errno = EPROTO;
+		return -1;
+	}
+
+	return delta_read(sockfd, payload, *len, timeout_ms);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Path on the assist board of a synced path
+ *
+ *  Absolute paths and ".." are refused, a sync stays under its root.
+ *
+ *  @param root (request path), name and len (relative path, not
+ *         terminated, empty for the root itself), path and size
+ *  @return 0 on success, -1 on an invalid path
+ */
+
+static int delta_path(const char* root, const char* name, size_t len, char* path, size_t size)
+{
+	char relative[PATH_MAX];
+	char* part = NULL;
+	char* save = NULL;
+
+	if((len >= sizeof(relative)) || (memchr(name, '\0', len) != NULL) || ((len > 0) && (name[0] == '/')))
+	{
+		return -1;
+	}
+	memcpy(relative, name, len);
+	relative[len] = '\0';
+
+	if(len == 0)
+	{
+		return (snprintf(path, size, "%s", root) < (int)size) ? 0 : -1;
+	}
+
+	if(snprintf(path, size, "%s/%s", root, relative) >= (int)size)
+	{
+		return -1;
+	}
+
+	for(part = strtok_r(relative, "/", &save); part != NULL; part = strtok_r(NULL, "/", &save))
+	{
+		if(strcmp(part, "..") == 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Send the signatures of the full blocks of the old file
+ *
+ *  @param sockfd, old_fd (-1 for no old file), size (of old file),
+ *         block_size, buffer (DELTA_MAX_BLOCK for a block, then
+ *         DELTA_MAX_DATA for a batch) and timeout_ms
+ *  @return 0 on success, -1 on error (connection unusable)
+ */
+
+static int delta_send_signatures(int sockfd, int old_fd, unsigned long long size, unsigned int block_size,
+	unsigned char* buffer, int timeout_ms)
+{
+	struct delta_blocks* batch = (struct delta_blocks*)&buffer[DELTA_MAX_BLOCK];
+	struct delta_signature* signatures = (struct delta_signature*)&batch[1];
+	unsigned long long blocks = (old_fd == -1) ? 0 : size / block_size;
+	unsigned long long i = 0;
+	unsigned int a = 0, b = 0;
+	int count = 0;
+
+	batch->block_size = htobe32(block_size);
+	batch->flags = 0;
+	for(i = 0; i < blocks; i++)
+	{
+		/* Old file changed size under us, the rest is sent as data */
+		if(pread(old_fd, buffer, block_size, i * block_size) != (ssize_t)block_size)
+		{
+			break;
+		}
+		signatures[count].weak = htobe32(delta_weak(buffer, block_size, &a, &b));
+		signatures[count].reserved = 0;
+		signatures[count].strong = htobe64(delta_strong(buffer, block_size));
+		count++;
+
+		if((count == DELTA_SIGNATURE_BATCH) && (i + 1 < blocks))
+		{
+			if(delta_send(sockfd, DELTA_SIGNATURES, batch, sizeof(*batch) + count * sizeof(*signatures), timeout_ms) != 0)
+			{
+				return -1;
+			}
+			count = 0;
+		}
+	}
+
+	batch->flags = htobe32(DELTA_FLAG_LAST);
+
+	return delta_send(sockfd, DELTA_SIGNATURES, batch, sizeof(*batch) + count * sizeof(*signatures), timeout_ms);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Receive one file, assist board side
+ *
+ *  Frame errors end the sync. A file that cannot be written is read to its
+ *  DELTA_END all the same and reported in its status, the sync goes on.
+ *
+ *  @param sockfd, root, payload and len (DELTA_FILE frame), buffer
+ *         (DELTA_MAX_DATA + DELTA_MAX_BLOCK), timeout_ms and result
+ *  @return 0 on success, -1 on error (connection unusable)
+ */
+
+static int delta_serve_file(int sockfd, const char* root, char* payload, size_t len, unsigned char* buffer,
+	int timeout_ms, struct delta_result* result)
+{
+	struct delta_file file;
+	struct delta_copy copy;
+	struct delta_blocks blocks;
+	struct stat old_stat;
+	struct timespec times[2];
+	char path[PATH_MAX];
+	char temp[PATH_MAX + 16];
+	char* base = NULL;
+	unsigned char* data = buffer + DELTA_MAX_BLOCK;
+	unsigned long long hash = DELTA_HASH_INIT;
+	unsigned long long written = 0;
+	unsigned long long end_hash = 0;
+	unsigned long long literal = 0;
+	unsigned int block_size = DELTA_MIN_BLOCK;
+	unsigned int type = 0;
+	unsigned int i = 0;
+	size_t data_len = 0;
+	int old_fd = -1;
+	int temp_fd = -1;
+	int same = 0;
+	int error = 0;
+	int status[2];
+
+	if(len < sizeof(file))
+	{
+		return -1;
+	}
+	memcpy(&file, payload, sizeof(file));
+	file.size = be64toh(file.size);
+	file.mtime_ns = (long long)be64toh((unsigned long long)file.mtime_ns);
+	file.mode = be32toh(file.mode);
+	file.flags = be32toh(file.flags);
+
+	if(delta_path(root, &payload[sizeof(file)], len - sizeof(file), path, sizeof(path)) != 0)
+	{
+		error = EINVAL;
+	}
+	else if(((old_fd = open(path, O_RDONLY | O_CLOEXEC)) != -1) &&
+		((fstat(old_fd, &old_stat) != 0) || !S_ISREG(old_stat.st_mode)))
+	{
+		close(old_fd);
+		old_fd = -1;
+	}
+
+	/* Unchanged by size and mtime, nothing is read or sent */
+	if((old_fd != -1) && !(file.flags & DELTA_FLAG_WHOLE) && ((unsigned long long)old_stat.st_size == file.size) &&
+		((long long)old_stat.st_mtim.tv_sec * 1000000000LL + old_stat.st_mtim.tv_nsec == file.mtime_ns))
+	{
+		same = 1;
+	}
+
+	if(error || same)
+	{
+		blocks.block_size = 0;
+		blocks.flags = htobe32(DELTA_FLAG_SAME | DELTA_FLAG_LAST);
+		if(delta_send(sockfd, DELTA_SIGNATURES, &blocks, sizeof(blocks), timeout_ms) != 0)
+		{
+			error = -1;
+		}
+	}
+	else
+	{
+		block_size = (old_fd == -1) ? DELTA_MIN_BLOCK : delta_block_size(old_stat.st_size);
+		if(delta_send_signatures(sockfd, (file.flags & DELTA_FLAG_WHOLE) ? -1 : old_fd,
+			(old_fd == -1) ? 0 : old_stat.st_size, block_size, buffer, timeout_ms) != 0)
+		{
+			error = -1;
+		}
+
+		/* New file is written next to the old one, rename is atomic */
+		base = strrchr(path, '/');
+		snprintf(temp, sizeof(temp), "%.*s.%s.XXXXXX", (base == NULL) ? 0 : (int)(base + 1 - path), path,
+			(base == NULL) ? path : base + 1);
+		if((error == 0) && ((temp_fd = mkostemp(temp, O_CLOEXEC)) == -1))
+		{
+			error = errno;
+		}
+	}
+
+	while(error != -1)
+	{
+		if(delta_recv(sockfd, &type, data, DELTA_MAX_DATA, &data_len, timeout_ms) != 0)
+		{
+			error = -1;
+		}
+		else if(type == DELTA_END)
+		{
+			break;
+		}
+		else if((type == DELTA_COPY) && (data_len == sizeof(copy)))
+		{
+			memcpy(&copy, data, sizeof(copy));
+			copy.block = be32toh(copy.block);
+			copy.count = be32toh(copy.count);
+			for(i = 0; (i < copy.count) && (error == 0) && (temp_fd != -1); i++)
+			{
+				if(pread(old_fd, buffer, block_size, ((off_t)copy.block + i) * block_size) != (ssize_t)block_size)
+				{
+					error = EIO;
+				}
+				else if(write(temp_fd, buffer, block_size) != (ssize_t)block_size)
+				{
+					error = errno;
+				}
+				hash = delta_hash(hash, buffer, block_size);
+				written += block_size;
+			}
+		}
+		else if(type == DELTA_DATA)
+		{
+			if((error == 0) && (temp_fd != -1) && (write(temp_fd, data, data_len) != (ssize_t)data_len))
+			{
+				error = errno;
+			}
+			hash = delta_hash(hash, data, data_len);
+			written += data_len;
+			literal += data_len;
+		}
+		else
+		{
+			error = -1;
+		}
+	}
+
+	if((error != -1) && (data_len == sizeof(end_hash)))
+	{
+		memcpy(&end_hash, data, sizeof(end_hash));
+		end_hash = be64toh(end_hash);
+	}
+
+	if((error == 0) && same && ((old_stat.st_mode & 07777) != (file.mode & 07777)) && (fchmod(old_fd, file.mode & 07777) != 0))
+	{
+		error = errno;
+	}
+	else if((error == 0) && !same)
+	{
+		/* Rebuilt file is checked before it replaces the old one */
+		times[0].tv_sec = file.mtime_ns / 1000000000LL;
+		times[0].tv_nsec = file.mtime_ns % 1000000000LL;
+		times[1] = times[0];
+		if((written != file.size) || (hash != end_hash))
+		{
+			error = EBADMSG;
+		}
+		else if((fchmod(temp_fd, file.mode & 07777) != 0) || (futimens(temp_fd, times) != 0) ||
+			(fsync(temp_fd) != 0) || (rename(temp, path) != 0))
+		{
+			error = errno;
+		}
+	}
+
+	if(temp_fd != -1)
+	{
+		close(temp_fd);
+		if(error != 0)
+		{
+			unlink(temp);
+		}
+	}
+	if(old_fd != -1)
+	{
+		close(old_fd);
+	}
+
+	if(error == -1)
+	{
+		return -1;
+	}
+
+	result->files++;
+	result->bytes += file.size;
+	result->literal += literal;
+	if(error != 0)
+	{
+		printf("\nAssist : Sync of %s fail. %s\n", path, strerror(error));
+		result->failed++;
+	}
+	else if(!same)
+	{
+		result->changed++;
+	}
+
+	status[0] = htobe32(error);
+	status[1] = 0;
+
+	return delta_send(sockfd, DELTA_STATUS, status, sizeof(status), timeout_ms);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Serve a file sync, assist board side
+ *
+ *  @param sockfd (DUT connection, request read), root (request path),
+ *         timeout_ms (for each frame) and result (filled)
+ *  @return 0 on success, -1 on error
+ */
+
+int delta_serve(int sockfd, const char* root, int timeout_ms, struct delta_result* result)
+{
+	struct stat dir_stat;
+	unsigned char* buffer = NULL;
+	char path[PATH_MAX];
+	unsigned int type = 0;
+	unsigned int mode = 0;
+	size_t len = 0;
+	int retVal = -1;
+
+	bzero(result, sizeof(*result));
+
+	if((root[0] == '\0') || ((buffer = malloc(DELTA_MAX_DATA + DELTA_MAX_BLOCK)) == NULL) ||
+		(delta_write(sockfd, DELTA_READY "\n", strlen(DELTA_READY "\n"), timeout_ms) != 0))
+	{
+		free(buffer);
+		return -1;
+	}
+
+	/* Payloads are read past the data half, the other half holds old blocks */
+	while(delta_recv(sockfd, &type, &buffer[DELTA_MAX_BLOCK], DELTA_MAX_DATA, &len, timeout_ms) == 0)
+	{
+		if(type == DELTA_DONE)
+		{
+			retVal = 0;
+			break;
+		}
+		else if((type == DELTA_DIR) && (len >= sizeof(mode)))
+		{
+			memcpy(&mode, &buffer[DELTA_MAX_BLOCK], sizeof(mode));
+			mode = be32toh(mode);
+			if((delta_path(root, (char*)&buffer[DELTA_MAX_BLOCK + sizeof(mode)], len - sizeof(mode), path, sizeof(path)) != 0) ||
+				((mkdir(path, mode & 07777) != 0) && ((errno != EEXIST) || (stat(path, &dir_stat) != 0) || !S_ISDIR(dir_stat.st_mode))))
+			{
+				printf("\nAssist : Sync of directory %s fail\n", path);
+				result->failed++;
+			}
+			result->dirs++;
+		}
+		else if((type != DELTA_FILE) ||
+			(delta_serve_file(sockfd, root, (char*)&buffer[DELTA_MAX_BLOCK], len, buffer, timeout_ms, result) != 0))
+		{
+			break;
+		}
+	}
+
+	free(buffer);
+
+	return retVal;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Frames of a file being pushed, buffered, DUT side
+ *
+ *  @param out (buffer, len and sockfd), type, payload, len and timeout_ms
+ *  @return 0 on success, -1 on error
+ */
+
+static int delta_out(struct delta_output* out, unsigned int type, const void* payload, size_t len, int timeout_ms)
+{
+	struct delta_frame frame;
+
+	if((out->len + sizeof(frame) + len > sizeof(out->buffer)) && (out->len > 0))
+	{
+		if(delta_write(out->sockfd, out->buffer, out->len, timeout_ms) != 0)
+		{
+			return -1;
+		}
+		out->len = 0;
+	}
+
+	frame.type = htobe32(type);
+	frame.length = htobe32((unsigned int)len);
+	memcpy(&out->buffer[out->len], &frame, sizeof(frame));
+	memcpy(&out->buffer[out->len + sizeof(frame)], payload, len);
+	out->len += sizeof(frame) + len;
+
+	return 0;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Send the pending run of old blocks, then the bytes after it
+ *
+ *  @param out, copy (pending run, emptied), data and len (literal bytes,
+ *         split in DELTA_MAX_DATA frames), result and timeout_ms
+ *  @return 0 on success, -1 on error
+ */
+
+static int delta_flush(struct delta_output* out, struct delta_copy* copy, const unsigned char* data, size_t len,
+	struct delta_result* result, int timeout_ms)
+{
+	struct delta_copy wire;
+	size_t part = 0;
+
+	if(copy->count > 0)
+	{
+		wire.block = htobe32(copy->block);
+		wire.count = htobe32(copy->count);
+		if(delta_out(out, DELTA_COPY, &wire, sizeof(wire), timeout_ms) != 0)
+		{
+			return -1;
+		}
+		copy->count = 0;
+	}
+
+	for(; len > 0; data += part, len -= part)
+	{
+		part = (len > DELTA_MAX_DATA) ? DELTA_MAX_DATA : len;
+		if(delta_out(out, DELTA_DATA, data, part, timeout_ms) != 0)
+		{
+			return -1;
+		}
+		result->literal += part;
+	}
+
+	return 0;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Old block matching the window, DUT side
+ *
+ *  Block following the last match is tried first, so unchanged runs stay
+ *  one DELTA_COPY.
+ *
+ *  @param signatures, count, heads (hash table), next (chain), bits (of
+ *         the table), weak, data, block_size and prefer (block to try first)
+ *  @return block, -1 when none matches
+ */
+
+static long delta_match(struct delta_signature* signatures, unsigned long count, long* heads, long* next, int bits,
+	unsigned int weak, const unsigned char* data, unsigned int block_size, unsigned long prefer)
+{
+	unsigned long long strong = 0;
+	int strong_done = 0;
+	long i = 0;
+
+	if((prefer < count) && (signatures[prefer].weak == weak))
+	{
+		strong = delta_strong(data, block_size);
+		strong_done = 1;
+		if(signatures[prefer].strong == strong)
+		{
+			return (long)prefer;
+		}
+	}
+
+	for(i = heads[((unsigned long long)weak * 0x9E3779B97F4A7C15ULL) >> (64 - bits)]; i != -1; i = next[i])
+	{
+		if(signatures[i].weak != weak)
+		{
+			continue;
+		}
+		if(!strong_done)
+		{
+			strong = delta_strong(data, block_size);
+			strong_done = 1;
+		}
+		if(signatures[i].strong == strong)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Send a file as runs of old blocks and new bytes, DUT side
+ *
+ *  Window slides a byte at a time over the file until it matches an old
+ *  block, then jumps over the block.
+ *
+ *  @param out, data and size (mapped file), signatures, count, block_size,
+ *         result and timeout_ms
+ *  @return 0 on success, -1 on error
+ */
+
+static int delta_match_file(struct delta_output* out, const unsigned char* data, unsigned long long size,
+	struct delta_signature* signatures, unsigned long count, unsigned int block_size,
+	struct delta_result* result, int timeout_ms)
+{
+	struct delta_copy copy;
+	unsigned long long pos = 0;
+	unsigned long long literal = 0;
+	unsigned int a = 0, b = 0;
+	long* heads = NULL;
+	long* next = NULL;
+	long block = 0;
+	int bits = 1;
+	unsigned long i = 0;
+
+	copy.block = 0;
+	copy.count = 0;
+
+	if((count == 0) || (size < block_size))
+	{
+		return delta_flush(out, &copy, data, size, result, timeout_ms);
+	}
+
+	while((bits < 30) && ((1UL << bits) < count * 2))
+	{
+		bits++;
+	}
+	if(((heads = malloc((1UL << bits) * sizeof(*heads))) == NULL) || ((next = malloc(count * sizeof(*next))) == NULL))
+	{
+		free(heads);
+		return -1;
+	}
+	memset(heads, 0xFF, (1UL << bits) * sizeof(*heads));
+
+	/* Last block is first in its chain, lowest block is found first */
+	for(i = count; i > 0; i--)
+	{
+		block = (long)((unsigned long long)signatures[i - 1].weak * 0x9E3779B97F4A7C15ULL >> (64 - bits));
+		next[i - 1] = heads[block];
+		heads[block] = i - 1;
+	}
+
+	delta_weak(data, block_size, &a, &b);
+	while(pos + block_size <= size)
+	{
+		block = delta_match(signatures, count, heads, next, bits, (a & 0xFFFF) | (b << 16), &data[pos], block_size,
+			copy.count ? copy.block + copy.count : count);
+		if(block != -1)
+		{
+			if(((pos > literal) || ((copy.count > 0) && ((unsigned long)block != copy.block + copy.count))) &&
+				(delta_flush(out, &copy, &data[literal], pos - literal, result, timeout_ms) != 0))
+			{
+				break;
+			}
+			if(copy.count == 0)
+			{
+				copy.block = block;
+			}
+			copy.count++;
+			pos += block_size;
+			literal = pos;
+			if(pos + block_size <= size)
+			{
+				delta_weak(&data[pos], block_size, &a, &b);
+			}
+			continue;
+		}
+
+		/* Slide by a byte. Literal bytes go out before they pile up */
+		if(pos + block_size < size)
+		{
+			a += data[pos + block_size] - data[pos];
+			b += a - block_size * data[pos];
+		}
+		pos++;
+		if(pos - literal >= DELTA_MAX_DATA)
+		{
+			if(delta_flush(out, &copy, &data[literal], pos - literal, result, timeout_ms) != 0)
+			{
+				break;
+			}
+			literal = pos;
+		}
+	}
+
+	free(heads);
+	free(next);
+
+	return (pos + block_size <= size) ? -1 : delta_flush(out, &copy, &data[literal], size - literal, result, timeout_ms);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Push one file, DUT side
+ *
+ *  @param out, path (on DUT), name (relative path sent), file_stat,
+ *         flags (DELTA_FLAG_WHOLE to skip matching), result and timeout_ms
+ *  @return status from assist board (0 or errno), -1 on error (connection
+ *          unusable)
+ */
+
+static int delta_push_file(struct delta_output* out, const char* path, const char* name, struct stat* file_stat,
+	unsigned int flags, struct delta_result* result, int timeout_ms)
+{
+	struct delta_signature* signatures = NULL;
+	struct delta_signature* grown = NULL;
+	struct delta_blocks blocks;
+	struct delta_file* file = (struct delta_file*)out->buffer;
+	unsigned char* data = MAP_FAILED;
+	unsigned long long hash = DELTA_HASH_INIT;
+	unsigned long count = 0;
+	unsigned long batch = 0;
+	unsigned long i = 0;
+	unsigned int block_size = 0;
+	unsigned int type = 0;
+	size_t len = 0;
+	int status[2];
+	int fd = -1;
+	int retVal = -1;
+
+	if(((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) ||
+		((file_stat->st_size > 0) && ((data = mmap(NULL, file_stat->st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)))
+	{
+		printf("\nDUT : Skipped %s. %s\n", path, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		result->skipped++;
+		return 0;
+	}
+	close(fd);
+
+	/* Header and name in the output buffer, sent right away */
+	file->size = htobe64(file_stat->st_size);
+	file->mtime_ns = (long long)htobe64((unsigned long long)file_stat->st_mtim.tv_sec * 1000000000ULL + file_stat->st_mtim.tv_nsec);
+	file->mode = htobe32(file_stat->st_mode);
+	file->flags = htobe32(flags);
+	memcpy(&out->buffer[sizeof(*file)], name, strlen(name));
+	if(delta_send(out->sockfd, DELTA_FILE, out->buffer, sizeof(*file) + strlen(name), timeout_ms) != 0)
+	{
+		if(file_stat->st_size > 0)
+		{
+			munmap(data, file_stat->st_size);
+		}
+		return -1;
+	}
+
+	/* Signatures of the old file, its full blocks */
+	bzero(&blocks, sizeof(blocks));
+	do
+	{
+		if((delta_recv(out->sockfd, &type, out->buffer, sizeof(out->buffer), &len, timeout_ms) != 0) ||
+			(type != DELTA_SIGNATURES) || (len < sizeof(blocks)))
+		{
+			break;
+		}
+		memcpy(&blocks, out->buffer, sizeof(blocks));
+		blocks.block_size = be32toh(blocks.block_size);
+		blocks.flags = be32toh(blocks.flags);
+		batch = (len - sizeof(blocks)) / sizeof(*signatures);
+
+		if((batch > 0) && ((grown = realloc(signatures, (count + batch) * sizeof(*signatures))) == NULL))
+		{
+			break;
+		}
+		signatures = (batch > 0) ? grown : signatures;
+		memcpy(&signatures[count], &out->buffer[sizeof(blocks)], batch * sizeof(*signatures));
+		for(i = count; i < count + batch; i++)
+		{
+			signatures[i].weak = be32toh(signatures[i].weak);
+			signatures[i].strong = be64toh(signatures[i].strong);
+		}
+		count += batch;
+		block_size = blocks.block_size;
+	} while(!(blocks.flags & DELTA_FLAG_LAST));
+
+	if((type == DELTA_SIGNATURES) && (blocks.flags & DELTA_FLAG_LAST) &&
+		((blocks.flags & DELTA_FLAG_SAME) || (block_size > 0)))
+	{
+		/* Unchanged file has its END only, without hash */
+		if(!(blocks.flags & DELTA_FLAG_SAME))
+		{
+			hash = (file_stat->st_size > 0) ? delta_hash(hash, data, file_stat->st_size) : hash;
+			retVal = delta_match_file(out, data, file_stat->st_size, signatures, count, block_size, result, timeout_ms);
+		}
+		else
+		{
+			retVal = 0;
+		}
+
+		hash = htobe64(hash);
+		if((retVal == 0) && ((delta_out(out, DELTA_END, &hash, sizeof(hash), timeout_ms) != 0) ||
+			(delta_write(out->sockfd, out->buffer, out->len, timeout_ms) != 0)))
+		{
+			retVal = -1;
+		}
+		out->len = 0;
+	}
+
+	free(signatures);
+	if(file_stat->st_size > 0)
+	{
+		munmap(data, file_stat->st_size);
+	}
+
+	if((retVal != 0) || (delta_recv(out->sockfd, &type, status, sizeof(status), &len, timeout_ms) != 0) ||
+		(type != DELTA_STATUS) || (len != sizeof(status)))
+	{
+		return -1;
+	}
+
+	return (int)be32toh(status[0]);
+}
+
+
+/** @file delta-sync.c
+ *  @brief Push a file, sent again whole when the rebuilt one does not match
+ *
+ *  @param out, path, name, file_stat, result and timeout_ms
+ *  @return 0 on success, -1 on error (connection unusable)
+ */
+
+static int delta_push_one(struct delta_output* out, const char* path, const char* name, struct stat* file_stat,
+	struct delta_result* result, int timeout_ms)
+{
+	struct delta_result attempt;
+	int status = 0;
+
+	bzero(&attempt, sizeof(attempt));
+	if((status = delta_push_file(out, path, name, file_stat, 0, &attempt, timeout_ms)) == EBADMSG)
+	{
+		printf("\nDUT : %s did not match after rebuild, sending it whole\n", path);
+		status = delta_push_file(out, path, name, file_stat, DELTA_FLAG_WHOLE, &attempt, timeout_ms);
+	}
+
+	if(status == -1)
+	{
+		return -1;
+	}
+
+	result->literal += attempt.literal;
+	result->skipped += attempt.skipped;
+	if(attempt.skipped == 0)
+	{
+		result->files++;
+		result->bytes += file_stat->st_size;
+		if(status != 0)
+		{
+			printf("\nDUT : Sync of %s fail at assist board. %s\n", path, strerror(status));
+			result->failed++;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Push a directory tree, DUT side
+ *
+ *  Directories go before their contents. Symbolic links, devices and
+ *  sockets are skipped.
+ *
+ *  @param out, path (on DUT), name (relative path, empty for the root),
+ *         mode (of the directory), result and timeout_ms
+ *  @return 0 on success, -1 on error (connection unusable)
+ */
+
+static int delta_push_dir(struct delta_output* out, const char* path, const char* name, mode_t mode,
+	struct delta_result* result, int timeout_ms)
+{
+	struct dirent* entry = NULL;
+	struct stat entry_stat;
+	char entry_path[PATH_MAX];
+	char entry_name[PATH_MAX];
+	unsigned int wire_mode = htobe32(mode);
+	DIR* dir = NULL;
+	int retVal = 0;
+
+	memcpy(out->buffer, &wire_mode, sizeof(wire_mode));
+	memcpy(&out->buffer[sizeof(wire_mode)], name, strlen(name));
+	if(delta_send(out->sockfd, DELTA_DIR, out->buffer, sizeof(wire_mode) + strlen(name), timeout_ms) != 0)
+	{
+		return -1;
+	}
+	result->dirs++;
+
+	if((dir = opendir(path)) == NULL)
+	{
+		printf("\nDUT : Skipped %s. %s\n", path, strerror(errno));
+		result->skipped++;
+		return 0;
+	}
+
+	while((retVal == 0) && ((entry = readdir(dir)) != NULL))
+	{
+		if((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+		{
+			continue;
+		}
+
+		if((snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name) >= (int)sizeof(entry_path)) ||
+			(snprintf(entry_name, sizeof(entry_name), "%s%s%s", name, (name[0] == '\0') ? "" : "/", entry->d_name) >= (int)sizeof(entry_name)) ||
+			(lstat(entry_path, &entry_stat) != 0))
+		{
+			printf("\nDUT : Skipped %s\n", entry_path);
+			result->skipped++;
+		}
+		else if(S_ISDIR(entry_stat.st_mode))
+		{
+			retVal = delta_push_dir(out, entry_path, entry_name, entry_stat.st_mode, result, timeout_ms);
+		}
+		else if(S_ISREG(entry_stat.st_mode))
+		{
+			retVal = delta_push_one(out, entry_path, entry_name, &entry_stat, result, timeout_ms);
+		}
+		else
+		{
+			printf("\nDUT : Skipped %s, not a regular file\n", entry_path);
+			result->skipped++;
+		}
+	}
+	closedir(dir);
+
+	return retVal;
+}
+
+
+/** @file delta-sync.c
+ *  @brief Push a file or directory tree, DUT side
+ *
+ *  @param sockfd (connection, "AssistFileSyncReady" read), local (file or
+ *         directory on DUT), timeout_ms (for each frame) and result (filled)
+ *  @return 0 on success, -1 on error
+ */
+
+int delta_push(int sockfd, const char* local, int timeout_ms, struct delta_result* result)
+{
+	struct delta_output* out = NULL;
+	struct stat local_stat;
+	int retVal = -1;
+
+	bzero(result, sizeof(*result));
+
+	if(stat(local, &local_stat) != 0)
+	{
+		printf("\nDUT : %s not found. %s\n", local, strerror(errno));
+		return -1;
+	}
+	if((out = malloc(sizeof(*out))) == NULL)
+	{
+		return -1;
+	}
+	out->sockfd = sockfd;
+	out->len = 0;
+
+	if(S_ISDIR(local_stat.st_mode))
+	{
+		retVal = delta_push_dir(out, local, "", local_stat.st_mode, result, timeout_ms);
+	}
+	else if(S_ISREG(local_stat.st_mode))
+	{
+		retVal = delta_push_one(out, local, "", &local_stat, result, timeout_ms);
+	}
+	else
+	{
+		printf("\nDUT : %s is not a file or directory\n", local);
+	}
+
+	if((retVal == 0) && (delta_send(sockfd, DELTA_DONE, out->buffer, 0, timeout_ms) != 0))
+	{
+		retVal = -1;
+	}
+	free(out);
+
+	return retVal;
+}
@@ -12,6 +12,11 @@
  *  Kill a process
  *  Check the process state
  *  Assist board health
+ *  Sync a file or directory tree, changed blocks only
+ *  Ping assist boards and discover them over UDP
+ *
+ *  One request can be sent to several assist boards in parallel. Replies
+ *  are gathered and printed labelled by board name.
  *
  *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
  *  @bug No know bugs.
@@ -23,228 +28,138 @@
 
 
 /** @file dut-client.c
- *  @brief Create socket to establish communication with assist server
+ *  @brief Sync a file or directory tree to an assist board
  *
- *  Create socket to establish communication with assist server
+ *  Only changed blocks are sent, see delta-sync.c.
  *
- *  @param ip_addr (ip address of assist board)
- *  @return sockfs (socket descriptor). 0 on success and -1 on error
+ *  @param config (configuration), board (assist board), request
+ *         ("AssistFileSync <path>" with prefixes) and local (file or
+ *         directory on DUT)
+ *  @return 0 on success, -1 on error
  */
 
-int client_create_socket(char* ip_addr)
+static int delta_sync_board(struct assist_config* config, struct assist_board* board, const char* request, const char* local)
 {
-	int sockfd; 
-	struct sockaddr_in assist_addr;
-
-	/* Create socket */
-	sockfd = socket(AF_INET, SOCK_STREAM, 0); 
-	if (sockfd == -1) 
-	{ 
-		printf("\nDUT : Create socket fail\n"); 
-		return -1; 
-	} 
-	#ifdef DEBUG
-	else
+	struct delta_result result;
+	char line[CLOCK_SYNC_LINE_SIZE];
+	size_t len = 0;
+	int so_error = 0;
+	socklen_t so_error_len = sizeof(so_error);
+	int retVal = -1;
+
+	if((board->sockfd = client_create_socket(board->ip_addr, config->port)) == -1)
 	{
-		printf("\nDUT : Create socket pass\n"); 
+		return -1;
 	}
-	#endif
 
-	/* Set zero in assist_addr to remove junk chars */
-	bzero(&assist_addr, sizeof(assist_addr)); 
-
-	/* Assign ip address and port to socket */
-	assist_addr.sin_family = AF_INET; 
-	/* assist_addr.sin_addr.s_addr = inet_addr(ASSIST_ADDR); */
-	assist_addr.sin_addr.s_addr = inet_addr(ip_addr); 
-	assist_addr.sin_port = htons(PORT); 
-	
-	/* Connect to assist board */
-	if (connect(sockfd, (SA*)&assist_addr, sizeof(assist_addr)) != 0) 
-	{ 
-		printf("\nDUT : Connect to assist board fail\n"); 
-		return -1; 
-	} 
-	#ifdef DEBUG
-	else
+	if((client_wait_socket(board->sockfd, POLLOUT, config->connect_timeout_ms) != 1) ||
+		(getsockopt(board->sockfd, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len) != 0) || (so_error != 0))
 	{
-		printf("\nDUT : Connect to assist board pass\n"); 
+		printf("\nDUT : [%s] Connect to assist board fail\n", board->name);
 	}
-	#endif
-
-	return sockfd;
-}
-
-
-/** @file dut-client.c
- *  @brief Receive/read data/request from socket
- *
- *  Receive/read data/request from socket
- *
- *  @param sockfd (socket descriptor)
- *  @return receive_data. Data on success, NULL on error
- */
-
-char* client_read_socket(int sockfd)
-{
-	char chunk_buffer[MAX_SIZE];
-	int chunk_buffer_len = 0;
-	char* receive_data = NULL; 
-	int error_count = 0;
-
-	/* Make buffer zero so that we can avoid accidental termination */
-	bzero(chunk_buffer, MAX_SIZE);
-
-	/* In case if there is big data to receive we have to use while loop */
-	/* and data termination value check */
-	while(1)
+	/* Request is small, it goes out at once on a fresh connection */
+	else if((write(board->sockfd, request, strlen(request) + 1) <= 0) ||
+		(client_read_line(board, line, sizeof(line), &len, config->socket_timeout_ms) == -1) ||
+		(strcmp(line, DELTA_READY) != 0))
 	{
-		chunk_buffer_len = read(sockfd, chunk_buffer, MAX_SIZE);
-		chunk_buffer[chunk_buffer_len]='\0';
-		
-		#ifdef DEBUG
-			printf("\nDUT : Chunk buffer is : \n%s\n", chunk_buffer);
-			printf("\nDUT : Chunk buffer len is : %d\n", chunk_buffer_len);
-		#endif
-
-        if(chunk_buffer_len == -1)
-        {
-            printf("\nDUT : Error in read socket\n");
-            if(receive_data)
-            {
-            	free(receive_data); receive_data = NULL;
-            }
-            break;
-        }
-		else if(chunk_buffer_len < 0)
-        {
-            printf("\nDUT : Chunk buffer is less than zero\n");
-            if(receive_data)
-            {
-            	free(receive_data); receive_data = NULL;            
-            }
-            break;
-        }
-        else if(chunk_buffer_len == 0)
-        {
-            printf("\nDUT : Chunk buffer is 0 bytes, try again\n");
-            sleep(2);
-            error_count += 1;
-            if(error_count >= 5)
-            {
-            	free(receive_data); receive_data = NULL; 
-            	break;
-            }
-            /* continue; */
-        }
-
-        /* If we are looping second time onwards */
-		if((receive_data) && (strlen(receive_data) > 0))
-		{
-			char *tmp_receive_data = receive_data;
-			receive_data = malloc(chunk_buffer_len + strlen(receive_data) + 1);
-
-			strcpy(receive_data, tmp_receive_data);
-			strcat(receive_data, chunk_buffer);	
-
-			if(tmp_receive_data)
-			{
-				free(tmp_receive_data);
-            	tmp_receive_data = NULL;
-            }
-
-			#ifdef DEBUG
-				printf("\nDUT : Accumalated2 chunk buffer is \n%s\n", receive_data);
-			#endif		
-		}
-		/* First time we are looping */
-		else
-		{
-			receive_data = malloc(chunk_buffer_len);
-			strcpy(receive_data, chunk_buffer);
-			#ifdef DEBUG
-				printf("\nDUT : Accumalated1 chunk buffer is : \n%s\n", receive_data);
-			#endif
-		}
-
-		/* Indication that this is the end of buffer */
-        if(strstr(chunk_buffer, "AssistDataEnds") != NULL)
-        {
-        	printf("\nDUT : Socket read is completed\n");
-        	/* receive_data = malloc(chunk_buffer_len); */
-        	/* strcpy(receive_data, chunk_buffer); */
-        	break;
-        }
-
-		bzero(chunk_buffer, MAX_SIZE);         
+		printf("\nDUT : [%s] Assist board does not support file sync\n", board->name);
 	}
-	
-	#ifdef DEBUG
-		printf("\nDUT : Console logs length is : %ld\n", strlen(receive_data));
-		printf("\nDUT : Console logs : \n%s\n", receive_data);
-	#endif
-	return receive_data ;
-}
-
-
-
-/** @file dut-client.c
- *  @brief Read config file and fetch the assist board IP
- *
- *  Read config file and fetch the assist board IP
- *
- *  @param none
- *  @return assist_ip_address. ip address on success and NULL on error.
- */
-
-char* get_assist_ip()
-{
-
-	FILE *assist_conf;
-	char line[200];
-	char* assist_ip_address = NULL;
-
-	if((assist_conf = fopen(ASSIST_CONF_FILE, "r")) == NULL)
+	else if((retVal = delta_push(board->sockfd, local, config->socket_timeout_ms, &result)) == 0)
 	{
-		printf("\nCannot open the file");
-		return NULL;
-	}	
+		/* Rest is a normal reply, ending with "AssistDataEnds" */
+		while(((retVal = client_read_socket(board, config->chunk_size)) == 0) &&
+			(client_wait_socket(board->sockfd, POLLIN, config->socket_timeout_ms) == 1));
+	}
 
-	/* Loop and find the assist ip address */
-	while (fgets(line, sizeof(line), assist_conf)) 
+	if(retVal == 1)
 	{
-		if(strstr(line, "ip_address=") != NULL) 
-		{			
-			sprintf(line, "%s", &line[strlen("ip_address=")]);
-			assist_ip_address = malloc(strlen(line));
-			strcpy(assist_ip_address, line);
-			/* printf("\nIP address is %s\n", line); */
-			return assist_ip_address;
-		}
+		printf("\nDUT : [%s] %llu files, %llu bytes, %llu sent as data, %llu skipped\n", board->name,
+			result.files, result.bytes, result.literal, result.skipped);
+		printf("\n%s\n", board->reply);
 	}
-	return NULL;
+
+	close(board->sockfd);
+	board->sockfd = -1;
+	free(board->reply);
+	board->reply = NULL;
+	board->reply_len = 0;
+	board->reply_size = 0;
+
+	return ((retVal == 1) && (result.failed == 0)) ? 0 : -1;
 }
 
 
 /** @file dut-client.c
  *  @brief Starting point for dut-client.
  *
- *  Starting point for dut-client. Create socket to establish communication with assist server
+ *  Starting point for dut-client. Send the request to selected assist boards
+ *  and print the replies.
  *
- *  @param ip_addr (ip address of assist board)
- *  @return sockfs (socket descriptor) on success and -1 on failure
+ *  @param argc and argv (options and request)
+ *  @return 0 when every selected board replied and -1 on failure
  */
 
 
 int main(int argc, char* argv[]) 
 { 
-	int sockfd; 
-	char* ip_addr = NULL;
+	struct assist_board boards[MAX_BOARDS];
+	int board_count = 0;
+	int completed = 0;
+	int opt = 0;
+	int i = 0;
+	int deadline_ms = -1;
+	long seconds = 0;
+	char* end = NULL;
+	int samples = 0;
+	int pings = 0;
+	int len = 0;
+	char* board_names = NULL;
+	char* config_path = NULL;
+	char* session = NULL;
+	char* request = NULL;
+	char* remote = NULL;
+	char request_buf[MAX_REQUEST_SIZE];
+	char local[PATH_MAX];
+	struct assist_config* config = NULL;
+
+	/* Options end at the request, so "any-command -x" is passed as it is */
+	while((opt = getopt(argc, argv, "+hb:c:s:t:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':
+				board_names = optarg;
+				break;
+			case 'c':
+				config_path = optarg;
+				break;
+			case 's':
+				session = optarg;
+				break;
+			case 't':
+				seconds = strtol(optarg, &end, 10);
+				if((end == optarg) || (*end != '\0') || (seconds <= 0) || (seconds > INT_MAX / 1000))
+				{
+					printf("\nDUT : Invalid deadline \"%s\". Allowed range is 1 to %d seconds\n", optarg, INT_MAX / 1000);
+					return -1;
+				}
+				deadline_ms = (int)seconds * 1000;
+				break;
+			case 'h':
+			default:
+				optind = argc;
+				break;
+		}
+	}
 
 	/* Help in running the dut-client */
-	if(( argc < 2 ) || (strstr(argv[1], "-h")))
+	if(optind >= argc)
 	{
-		printf("\nDUT : Help ./dut-client \"request\"\n");
+		printf("\nDUT : Help ./dut-client [-c config-file] [-b board[,board...]|all] [-s session] [-t seconds] \"request\"\n");
+		printf("\nDUT : -c Config file. Default is $ASSIST_CONF or %s\n", ASSIST_CONF_FILE);
+		printf("\nDUT : -b Assist boards from config file. Default is the first one\n");
+		printf("\nDUT : -s Session of the request on a shared assist board. Default is session from config file\n");
+		printf("\nDUT : -t Request deadline in seconds. Default is deadline_ms from config file, where 0 disables it\n");
 		printf("\nDUT : Request can be ...\n\n");
 		printf("DUT : ./dut-client \"ConsoleLogsClear\"\n");
 		printf("DUT : ./dut-client \"any-command\"\n");
@@ -253,77 +168,187 @@ int main(int argc, char* argv[])
 		printf("DUT : ./dut-client \"StartProcess\"\n");
 		printf("DUT : ./dut-client \"CheckProcessRunning\"\n");
 		printf("DUT : ./dut-client \"KillRunningProcess\"\n");
+		printf("DUT : ./dut-client \"AssistClockSync [samples]\"\n");
+		printf("DUT : ./dut-client \"AssistSession\"\n");
+		printf("DUT : ./dut-client \"AssistFileSync local-path assist-board-path\"\n");
+		printf("DUT : ./dut-client \"AssistPing [count]\"\n");
+		printf("DUT : ./dut-client \"AssistDiscover\"\n");
 		return -1;
 	}
 	#ifdef DEBUG
 	else
 	{
-		printf("\nDUT : The argument supplied is : \"%s\" \n", argv[1]);
+		printf("\nDUT : The argument supplied is : \"%s\" \n", argv[optind]);
 	}
 	#endif
 
-	/* Read the configuration file and get the assist board IP */	
-	if((ip_addr = get_assist_ip()) == NULL)
+	/* Read the configuration file */
+	if(load_config(config_path) != 0)
 	{
-		printf("\nDUT : Get assist IP address fail\n");
+		printf("\nDUT : Load configuration fail\n");
+		return -1;
 	}
-	else
+	config = config_get();
+
+	if(deadline_ms < 0)
+	{
+		deadline_ms = config->deadline_ms;
+	}
+	if(session == NULL)
 	{
-		printf("\nDUT : Assist IP address is \n%s\n", ip_addr);
+		session = config->session;
 	}
-	
 
-	/* Create socket and connect */
-	if((sockfd = client_create_socket(ip_addr)) == -1)
+	/* Assist board keeps the requests of a session apart from other DUTs',
+	 * and enforces the deadline on the commands it runs */
+	request = argv[optind];
+	if(session[0] != '\0')
 	{
-		printf("\nDUT : Create socket fail\n");
-		return -1;
+		len += snprintf(&request_buf[len], sizeof(request_buf) - len, "%s%s ", SESSION_TAG, session);
 	}
-	#ifdef DEBUG
-	else
+	if(deadline_ms > 0)
 	{
-		printf("\nDUT : Create socket pass\n");
+		len += snprintf(&request_buf[len], sizeof(request_buf) - len, "%s%d ", DEADLINE_TAG, deadline_ms);
+	}
+	if(len > 0)
+	{
+		snprintf(&request_buf[len], sizeof(request_buf) - len, "%s", argv[optind]);
+		request = request_buf;
 	}
-	#endif
 
-	/* Send request to assist board */
-	if(write_socket(argv[1], sockfd) == -1)
+	/* Discovery lists the boards answering, as lines for the config file */
+	if(strcmp(argv[optind], "AssistDiscover") == 0)
 	{
-		printf("\nDUT : Write socket fail\n");
-		return -1;
+		board_count = discover_boards(config, boards, MAX_BOARDS, 1);
+		printf("\nDUT : %d assist boards found\n", board_count);
+		for(i = 0; i < board_count; i++)
+		{
+			printf("board=%s %s\n", boards[i].name, boards[i].ip_addr);
+		}
+		config_put(config);
+
+		return (board_count > 0) ? 0 : -1;
 	}
-	#ifdef DEBUG
-	else
+
+	/* Get the assist boards */	
+	if((board_count = get_assist_boards(config, boards, MAX_BOARDS)) <= 0)
 	{
-		printf("\nDUT : Write socket pass\n");
+		printf("\nDUT : Get assist IP address fail\n");
+		config_put(config);
+		return -1;
 	}
-	#endif
 
-	/* Receive the assist board data */
-	char* received_data = NULL;
-	if((received_data = client_read_socket(sockfd)) == NULL)
+	if((board_count = select_assist_boards(boards, board_count, board_names)) <= 0)
 	{
-		printf("\nDUT : Read socket fail\n");
+		printf("\nDUT : No assist board selected\n");
+		config_put(config);
 		return -1;
 	}
-	#ifdef DEBUG
-	else
+
+	for(i = 0; i < board_count; i++)
 	{
-		printf("\nDUT : Read socket pass\n");
+		printf("\nDUT : Assist board %s IP address is %s\n", boards[i].name, boards[i].ip_addr);
 	}
-	#endif
 
-	/* Close the socket */
-	close(sockfd); 
-	
-	printf("\nDUT : Data received from assist board is \n%s\n", received_data);
-	
-	/* Free allocated memory */
-	if(received_data)
-    {
-        free(received_data);		
-    }	
-
-	//return received_data;
-	return -1;
-}
\ No newline at end of file
+	/* Clock sync is an exchange, not a single request. Boards one by one */
+	if(strncmp(argv[optind], "AssistClockSync", strlen("AssistClockSync")) == 0)
+	{
+		samples = atoi(&argv[optind][strlen("AssistClockSync")]);
+		if((samples <= 0) || (samples > CLOCK_SYNC_MAX_SAMPLES))
+		{
+			samples = CLOCK_SYNC_SAMPLES;
+		}
+
+		for(i = 0; i < board_count; i++)
+		{
+			if(clock_sync_board(config, &boards[i], session, samples) == 0)
+			{
+				completed++;
+			}
+		}
+		config_put(config);
+
+		return (completed == board_count) ? 0 : -1;
+	}
+
+	/* Pings are UDP datagrams, no connection. Boards one by one */
+	if(strncmp(argv[optind], "AssistPing", strlen("AssistPing")) == 0)
+	{
+		pings = atoi(&argv[optind][strlen("AssistPing")]);
+		if((pings <= 0) || (pings > PING_MAX_COUNT))
+		{
+			pings = PING_COUNT;
+		}
+
+		for(i = 0; i < board_count; i++)
+		{
+			if(ping_board(config, &boards[i], pings) == 0)
+			{
+				completed++;
+			}
+		}
+		config_put(config);
+
+		return (completed == board_count) ? 0 : -1;
+	}
+
+	/* File sync is an exchange too. Local path is for DUT, the request names
+	 * the path at assist board only */
+	if(strncmp(argv[optind], "AssistFileSync", strlen("AssistFileSync")) == 0)
+	{
+		snprintf(local, sizeof(local), "%s", &argv[optind][strlen("AssistFileSync") + strspn(&argv[optind][strlen("AssistFileSync")], " ")]);
+		if(((remote = strchr(local, ' ')) == NULL) || (remote == local))
+		{
+			printf("\nDUT : AssistFileSync needs a local path and an assist board path\n");
+			config_put(config);
+			return -1;
+		}
+		*remote++ = '\0';
+		remote += strspn(remote, " ");
+		snprintf(&request_buf[len], sizeof(request_buf) - len, "AssistFileSync %s", remote);
+
+		for(i = 0; i < board_count; i++)
+		{
+			if(delta_sync_board(config, &boards[i], request_buf, local) == 0)
+			{
+				completed++;
+			}
+		}
+		config_put(config);
+
+		return (completed == board_count) ? 0 : -1;
+	}
+
+	/* Send request to every selected board. Reply may take as long as
+	 * the deadline, plus time to send it back */
+	completed = fanout_request(config, boards, board_count, request, (deadline_ms > 0) ? deadline_ms + DEADLINE_GRACE_MS : 0);
+	config_put(config);
+
+	for(i = 0; i < board_count; i++)
+	{
+		if(boards[i].state == BOARD_DONE)
+		{
+			if(board_names == NULL)
+			{
+				printf("\nDUT : Data received from assist board is \n%s\n", boards[i].reply);
+			}
+			else
+			{
+				printf("\nDUT : [%s] Data received from assist board is \n%s\n", boards[i].name, boards[i].reply);
+			}
+		}
+		else
+		{
+			printf("\nDUT : [%s] Read socket fail\n", boards[i].name);
+		}
+
+		/* Free allocated memory */
+		if(boards[i].reply)
+		{
+			free(boards[i].reply);
+			boards[i].reply = NULL;
+		}
+	}
+
+	return (completed == board_count) ? 0 : -1;
+}
@@ -0,0 +1,1188 @@
+/** @file event.c
+ *  @brief Push notifications of server events to subscribed DUT connections
+ *
+ *  DUT waiting for a process to exit, a console log line, a CAN frame or
+ *  a telemetry value used to poll CheckProcessRunning or
+ *  ConsoleLogsRequest in a loop. A Subscribe request registers the
+ *  interest instead, and the server pushes an "AssistEvent" line on the
+ *  open connection when the event happens.
+ *
+ *  Subscribe is served by a worker like any request, the connection is
+ *  then kept by the event thread. It waits in one epoll set on
+ *
+ *  pidfd of the watched processes (exit)
+ *  inotify on the console log files (new lines, in the log of the session)
+ *  raw CAN sockets filtered by the kernel on ID/mask (frames)
+ *  the DUT connections (close) and a timerfd (deadlines)
+ *
+ *  Thresholds are checked by the telemetry sampler on every sample, see
+ *  event_telemetry(). Nothing runs while nothing happens.
+ *
+ *  Pushes never block : a DUT not reading its connection loses the
+ *  subscription. Subscription ends with the usual AssistDataEnds line
+ *  once count events are sent, on its deadline or when no watched
+ *  process is left.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Running subscriptions, protected by event_lock */
+static struct event_subscription* subscriptions[EVENT_MAX_SUBSCRIPTIONS];
+static unsigned int event_next_id = 0;
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static int event_epoll_fd = -1;
+static int event_timer_fd = -1;
+
+/* Console logs followed for EVENT_LOG subscriptions, protected by event_lock */
+static int log_inotify_fd = -1;
+static struct event_log event_logs[EVENT_MAX_LOGS];
+
+/* Subscription types as DUT names them, by EVENT_* */
+static const char* event_type_names[] = { "exit", "log", "can", "threshold" };
+
+/* Telemetry values for threshold subscriptions */
+static const struct event_metric event_metrics[] =
+{
+	{ "cpu_permille", offsetof(struct telemetry_sample, cpu_permille), 0 },
+	{ "load1_centi", offsetof(struct telemetry_sample, load1_centi), 0 },
+	{ "mem_avail_kb", offsetof(struct telemetry_sample, mem_avail_kb), 1 },
+	{ "queue_depth", offsetof(struct telemetry_sample, queue_depth), 0 },
+	{ "workers_busy", offsetof(struct telemetry_sample, workers_busy), 0 },
+	{ "segments_free", offsetof(struct telemetry_sample, segments_free), 0 },
+};
+
+
+/** @file event.c
+ *  @brief Monotonic time in ns
+ */
+
+static long long event_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/** @file event.c
+ *  @brief Add a source fd of a subscription to the epoll set
+ *
+ *  Epoll data is the subscription id and the source, so a stale event of
+ *  a released subscription finds nothing.
+ *
+ *  @param fd, id and source (EVENT_SOURCE_*, pid index added for EVENT_SOURCE_PID)
+ *  @return 0 on success, -1 on error
+ */
+
+static int event_watch(int fd, unsigned int id, unsigned int source)
+{
+	struct epoll_event event;
+
+	bzero(&event, sizeof(event));
+	event.events = (source == EVENT_SOURCE_SOCKET) ? (EPOLLIN | EPOLLRDHUP) : EPOLLIN;
+	event.data.u64 = ((unsigned long long)id << 32) | source;
+
+	return epoll_ctl(event_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+
+/** @file event.c
+ *  @brief Close a source fd of a subscription
+ *
+ *  @param fd (set to -1)
+ *  @return none
+ */
+
+static void event_unwatch(int* fd)
+{
+	if(*fd != -1)
+	{
+		epoll_ctl(event_epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+
+/** @file event.c
+ *  @brief Arm the timer for the nearest subscription deadline
+ *
+ *  @param none (event_lock held)
+ *  @return none
+ */
+
+static void event_arm_timer(void)
+{
+	struct itimerspec timer;
+	long long expiry_ns = 0;
+	int i = 0;
+
+	for(i = 0; i < EVENT_MAX_SUBSCRIPTIONS; i++)
+	{
+		if((subscriptions[i] != NULL) && (subscriptions[i]->expiry_ns > 0) &&
+			((expiry_ns == 0) || (subscriptions[i]->expiry_ns < expiry_ns)))
+		{
+			expiry_ns = subscriptions[i]->expiry_ns;
+		}
+	}
+
+	/* Zero disarms */
+	bzero(&timer, sizeof(timer));
+	timer.it_value.tv_sec = expiry_ns / 1000000000LL;
+	timer.it_value.tv_nsec = expiry_ns % 1000000000LL;
+	timerfd_settime(event_timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+
+static int event_deliver(struct event_subscription* sub, const char* format, ...);
+
+
+/** @file event.c
+ *  @brief Match the new lines of a console log against its log subscriptions
+ *
+ *  Log is read from where the last scan stopped. A cleared (truncated)
+ *  log is read from the start.
+ *
+ *  @param index (in event_logs, event_lock held)
+ *  @return none
+ */
+
+static void event_scan_log(int index)
+{
+	struct event_log* log = &event_logs[index];
+	struct event_subscription* sub = NULL;
+	struct stat status;
+	char buffer[4096];
+	ssize_t len = 0;
+	ssize_t i = 0;
+	int j = 0;
+
+	if((log->subscribers == 0) || (fstat(log->fd, &status) == -1))
+	{
+		return;
+	}
+
+	if(status.st_size < log->offset)
+	{
+		log->offset = 0;
+		log->line_len = 0;
+	}
+
+	while((len = pread(log->fd, buffer, sizeof(buffer), log->offset)) > 0)
+	{
+		log->offset += len;
+
+		for(i = 0; i < len; i++)
+		{
+			/* Overlong lines are matched in pieces */
+			if((buffer[i] != '\n') && (log->line_len < sizeof(log->line) - 1))
+			{
+				log->line[log->line_len++] = buffer[i];
+				continue;
+			}
+			log->line[log->line_len] = '\0';
+
+			for(j = 0; j < EVENT_MAX_SUBSCRIPTIONS; j++)
+			{
+				sub = subscriptions[j];
+				if((sub != NULL) && (sub->type == EVENT_LOG) && (sub->log == index) &&
+					(regexec(&sub->regex, log->line, 0, NULL, 0) == 0))
+				{
+					event_deliver(sub, "AssistEvent %u log %lld %s\n", sub->id, clock_sync_now_us(), log->line);
+				}
+			}
+
+			log->line_len = 0;
+			if(buffer[i] != '\n')
+			{
+				log->line[log->line_len++] = buffer[i];
+			}
+		}
+	}
+}
+
+
+/** @file event.c
+ *  @brief Follow the console log of a session for a new log subscription
+ *
+ *  First subscriber starts at the end of the log. Later ones get the
+ *  lines written so far delivered to the others first, so every
+ *  subscriber sees only the lines written after it subscribed.
+ *
+ *  @param session (empty for the default session, event_lock held)
+ *  @return index in event_logs, -1 on error
+ */
+
+static int event_log_open(const char* session)
+{
+	struct assist_config* config = NULL;
+	struct event_log* log = NULL;
+	char path[PATH_MAX];
+	int index = -1;
+	int i = 0;
+
+	config = config_get();
+	session_log_file(config, session, path, sizeof(path));
+	config_put(config);
+
+	for(i = 0; i < EVENT_MAX_LOGS; i++)
+	{
+		if((event_logs[i].subscribers > 0) && (strcmp(event_logs[i].path, path) == 0))
+		{
+			event_scan_log(i);
+			event_logs[i].subscribers++;
+			return i;
+		}
+		if((event_logs[i].subscribers == 0) && (index == -1))
+		{
+			index = i;
+		}
+	}
+
+	if(index == -1)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	log = &event_logs[index];
+
+	if((log->fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0644)) == -1)
+	{
+		return -1;
+	}
+	if((log->watch = inotify_add_watch(log_inotify_fd, path, IN_MODIFY)) == -1)
+	{
+		close(log->fd);
+		log->fd = -1;
+		return -1;
+	}
+
+	snprintf(log->path, sizeof(log->path), "%s", path);
+	log->offset = lseek(log->fd, 0, SEEK_END);
+	log->line_len = 0;
+	log->subscribers = 1;
+
+	return index;
+}
+
+
+/** @file event.c
+ *  @brief Stop following a console log after its last log subscription
+ *
+ *  @param index (in event_logs, event_lock held)
+ *  @return none
+ */
+
+static void event_log_close(int index)
+{
+	struct event_log* log = &event_logs[index];
+
+	if(--log->subscribers > 0)
+	{
+		return;
+	}
+
+	inotify_rm_watch(log_inotify_fd, log->watch);
+	log->watch = -1;
+	close(log->fd);
+	log->fd = -1;
+}
+
+
+/** @file event.c
+ *  @brief Release a subscription and its sources
+ *
+ *  @param sub (event_lock held)
+ *  @return none
+ */
+
+static void event_release(struct event_subscription* sub)
+{
+	int i = 0;
+
+	for(i = 0; i < EVENT_MAX_SUBSCRIPTIONS; i++)
+	{
+		if(subscriptions[i] == sub)
+		{
+			subscriptions[i] = NULL;
+		}
+	}
+
+	for(i = 0; i < sub->pid_count; i++)
+	{
+		event_unwatch(&sub->pid_fd[i]);
+	}
+	event_unwatch(&sub->can_fd);
+	event_unwatch(&sub->sockfd);
+
+	if(sub->regex_valid)
+	{
+		regfree(&sub->regex);
+		if(sub->type == EVENT_LOG)
+		{
+			event_log_close(sub->log);
+		}
+	}
+
+	free(sub);
+}
+
+
+/** @file event.c
+ *  @brief End a subscription, with the final line DUT waits for
+ *
+ *  @param sub, status (return value in the reply) and reason
+ *  @return none
+ */
+
+static void event_end(struct event_subscription* sub, int status, const char* reason)
+{
+	char line[MAX_SIZE];
+	int len = 0;
+
+	printf("\nAssist : Subscription %u %s after %d events\n", sub->id, reason, sub->sent);
+	len = snprintf(line, sizeof(line), "Assist : Subscription %u %s, %d events. Return value is %d. AssistDataEnds",
+		sub->id, reason, sub->sent, status);
+	send(sub->sockfd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	event_release(sub);
+}
+
+
+/** @file event.c
+ *  @brief Push one notification line
+ *
+ *  Subscription ends once it got count events. DUT which does not take
+ *  the line at once is dropped.
+ *
+ *  @param sub and format
+ *  @return 0 when the subscription goes on, 1 when it is released
+ */
+
+static int event_deliver(struct event_subscription* sub, const char* format, ...)
+{
+	char line[EVENT_LINE_SIZE + 128];
+	va_list args;
+	int len = 0;
+
+	va_start(args, format);
+	len = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if(len >= (int)sizeof(line))
+	{
+		len = sizeof(line) - 1;
+		line[len - 1] = '\n';
+	}
+
+	if(send(sub->sockfd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+	{
+		printf("\nAssist : Subscription %u dropped, DUT does not read its notifications\n", sub->id);
+		event_release(sub);
+		return 1;
+	}
+
+	sub->sent++;
+	journal_append(JOURNAL_EVENT, sub->id, 0, sub->type, line);
+
+	if((sub->count > 0) && (sub->sent >= sub->count))
+	{
+		event_end(sub, 0, "complete");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/** @file event.c
+ *  @brief Watched process exited
+ *
+ *  @param sub and index (of the pid)
+ *  @return none
+ */
+
+static void event_exit(struct event_subscription* sub, int index)
+{
+	event_unwatch(&sub->pid_fd[index]);
+	sub->pid_alive--;
+
+	if(event_deliver(sub, "AssistEvent %u exit %lld %d\n", sub->id, clock_sync_now_us(), sub->pids[index]) != 0)
+	{
+		return;
+	}
+
+	/* Nothing is left to wait for */
+	if(sub->pid_alive == 0)
+	{
+		event_end(sub, 0, "complete, no process left");
+	}
+}
+
+
+/** @file event.c
+ *  @brief Frames of a CAN subscription
+ *
+ *  Kernel filter passes only the subscribed ID/mask. Frames go out as
+ *  candump -L lines with their receive time.
+ *
+ *  @param sub
+ *  @return none
+ */
+
+static void event_can(struct event_subscription* sub)
+{
+	struct can_frame frame;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg = NULL;
+	struct timespec* stamp = NULL;
+	char control[CMSG_SPACE(sizeof(struct timespec))];
+	char data[2 * CAN_MAX_DLEN + 1];
+	long long time_ns = 0;
+	int frames = 0;
+	int i = 0;
+
+	/* Batch bounded, so a busy bus does not hold the other subscriptions */
+	for(frames = 0; frames < EVENT_CAN_BATCH; frames++)
+	{
+		iov.iov_base = &frame;
+		iov.iov_len = sizeof(frame);
+		bzero(&msg, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if(recvmsg(sub->can_fd, &msg, MSG_DONTWAIT) < (ssize_t)sizeof(frame))
+		{
+			return;
+		}
+
+		time_ns = clock_sync_now_us() * 1000;
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+			{
+				stamp = (struct timespec*)CMSG_DATA(cmsg);
+				time_ns = (long long)stamp->tv_sec * 1000000000LL + stamp->tv_nsec;
+			}
+		}
+
+		for(i = 0; (i < frame.can_dlc) && (i < CAN_MAX_DLEN); i++)
+		{
+			snprintf(&data[2 * i], 3, "%02X", frame.data[i]);
+		}
+		data[2 * i] = '\0';
+
+		if(event_deliver(sub, (frame.can_id & CAN_EFF_FLAG) ? "AssistEvent %u can %lld %s %08X#%s\n" : "AssistEvent %u can %lld %s %03X#%s\n",
+			sub->id, time_ns / 1000, sub->ifname,
+			frame.can_id & ((frame.can_id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK),
+			(frame.can_id & CAN_RTR_FLAG) ? "R" : data) != 0)
+		{
+			return;
+		}
+	}
+}
+
+
+/** @file event.c
+ *  @brief Raw CAN socket passing only the frames of an ID/mask
+ *
+ *  @param sub
+ *  @return socket on success, -1 on error (errno set)
+ */
+
+static int event_can_socket(struct event_subscription* sub)
+{
+	struct sockaddr_can addr;
+	struct can_filter filter;
+	int enable = 1;
+	int sockfd = -1;
+	int saved_errno = 0;
+
+	if((sockfd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, CAN_RAW)) == -1)
+	{
+		return -1;
+	}
+
+	filter.can_id = sub->can_id;
+	filter.can_mask = sub->can_mask;
+	setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+	setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+
+	bzero(&addr, sizeof(addr));
+	addr.can_family = AF_CAN;
+	if(((addr.can_ifindex = if_nametoindex(sub->ifname)) == 0) ||
+		(bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1))
+	{
+		saved_errno = errno;
+		close(sockfd);
+		errno = saved_errno;
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/** @file event.c
+ *  @brief pidfd of the processes of an exit subscription
+ *
+ *  Subscription is by PID or by name (same match as CheckProcessRunning).
+ *  A process which is gone already is not watched.
+ *
+ *  @param sub
+ *  @return 0 on success, -1 on error (errno set)
+ */
+
+static int event_open_pids(struct event_subscription* sub)
+{
+	struct proc_entry results[PROC_MAX_RESULTS];
+	char* end = NULL;
+	long pid = 0;
+	int count = 0;
+	int i = 0;
+
+	pid = strtol(sub->text, &end, 10);
+	if((end != sub->text) && (*end == '\0') && (pid > 0))
+	{
+		sub->pids[0] = (pid_t)pid;
+		sub->pid_count = 1;
+	}
+	else
+	{
+		if((count = proc_scan_find(sub->text, PROC_MATCH_NAME, 0, results, PROC_MAX_RESULTS)) == -1)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		for(i = 0; (i < count) && (i < EVENT_MAX_PIDS); i++)
+		{
+			sub->pids[i] = results[i].pid;
+		}
+		sub->pid_count = i;
+	}
+
+	for(i = 0; i < sub->pid_count; i++)
+	{
+		#ifdef SYS_pidfd_open
+			sub->pid_fd[i] = syscall(SYS_pidfd_open, sub->pids[i], 0);
+		#else
+			errno = ENOSYS;
+		#endif
+		if(sub->pid_fd[i] != -1)
+		{
+			event_watch(sub->pid_fd[i], sub->id, EVENT_SOURCE_PID + i);
+			sub->pid_alive++;
+		}
+		else if(errno != ESRCH)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file event.c
+ *  @brief Parse a Subscribe request
+ *
+ *  [count=<n>] exit <pid|name>
+ *  [count=<n>] log <regular expression>
+ *  [count=<n>] can <interface> <id>[/<mask>]
+ *  [count=<n>] threshold <metric> <op> <value>
+ *
+ *  count is 1 by default, 0 for no limit. Threshold metrics are the
+ *  telemetry values of event_metrics, op is >, >=, < or <=.
+ *
+ *  @param request (after "Subscribe") and sub (filled)
+ *  @return 0 on success, -1 on error
+ */
+
+int event_parse(char* request, struct event_subscription* sub)
+{
+	char type[16];
+	char* argument = NULL;
+	char* end = NULL;
+	size_t i = 0;
+	int offset = 0;
+
+	sub->count = 1;
+	sub->sockfd = -1;
+	sub->can_fd = -1;
+	for(i = 0; i < EVENT_MAX_PIDS; i++)
+	{
+		sub->pid_fd[i] = -1;
+	}
+
+	if(strncmp(request, "count=", strlen("count=")) == 0)
+	{
+		sub->count = strtol(&request[strlen("count=")], &end, 10);
+		request = end + strspn(end, " ");
+	}
+	if((sub->count < 0) || (sscanf(request, "%15s%n", type, &offset) != 1))
+	{
+		return -1;
+	}
+
+	argument = &request[offset];
+	argument += strspn(argument, " ");
+	snprintf(sub->text, sizeof(sub->text), "%s", argument);
+	if(sub->text[0] == '\0')
+	{
+		return -1;
+	}
+
+	if(strcmp(type, "exit") == 0)
+	{
+		sub->type = EVENT_EXIT;
+	}
+	else if(strcmp(type, "log") == 0)
+	{
+		sub->type = EVENT_LOG;
+		if(regcomp(&sub->regex, sub->text, REG_EXTENDED | REG_NOSUB) != 0)
+		{
+			return -1;
+		}
+		sub->regex_valid = 1;
+	}
+	else if(strcmp(type, "can") == 0)
+	{
+		sub->type = EVENT_CAN;
+		if(sscanf(sub->text, "%15s %x%n", sub->ifname, &sub->can_id, &offset) != 2)
+		{
+			return -1;
+		}
+
+		/* Only frames of the same format : 11 bit IDs do not match 29 bit ones */
+		sub->can_mask = (sub->can_id > CAN_SFF_MASK) ? CAN_EFF_MASK : CAN_SFF_MASK;
+		if(sub->text[offset] == '/')
+		{
+			sub->can_mask = strtoul(&sub->text[offset + 1], NULL, 16);
+		}
+		if(sub->can_id > CAN_SFF_MASK)
+		{
+			sub->can_id |= CAN_EFF_FLAG;
+		}
+		sub->can_mask |= CAN_EFF_FLAG;
+	}
+	else if(strcmp(type, "threshold") == 0)
+	{
+		sub->type = EVENT_THRESHOLD;
+		sub->metric = -1;
+		for(i = 0; i < sizeof(event_metrics) / sizeof(event_metrics[0]); i++)
+		{
+			if((strncmp(sub->text, event_metrics[i].name, strlen(event_metrics[i].name)) == 0) &&
+				(strchr("<> ", sub->text[strlen(event_metrics[i].name)]) != NULL))
+			{
+				sub->metric = i;
+				argument = &sub->text[strlen(event_metrics[i].name)];
+			}
+		}
+		if(sub->metric == -1)
+		{
+			return -1;
+		}
+
+		argument += strspn(argument, " ");
+		if(strncmp(argument, ">=", 2) == 0)
+		{
+			sub->op = THRESHOLD_AT_LEAST;
+		}
+		else if(strncmp(argument, "<=", 2) == 0)
+		{
+			sub->op = THRESHOLD_AT_MOST;
+		}
+		else if(*argument == '>')
+		{
+			sub->op = THRESHOLD_ABOVE;
+		}
+		else if(*argument == '<')
+		{
+			sub->op = THRESHOLD_BELOW;
+		}
+		else
+		{
+			return -1;
+		}
+
+		argument += strspn(argument, "<>= ");
+		sub->value = strtoll(argument, &end, 10);
+		if(end == argument)
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file event.c
+ *  @brief Put a parsed subscription in the table
+ *
+ *  @param sub (id 0 for a new one, released on error, event_lock held)
+ *  @return subscription id, 0 on error (errno set)
+ */
+
+static unsigned int event_add(struct event_subscription* sub)
+{
+	int slot = -1;
+	int i = 0;
+
+	for(i = 0; (i < EVENT_MAX_SUBSCRIPTIONS) && (slot == -1); i++)
+	{
+		if(subscriptions[i] == NULL)
+		{
+			slot = i;
+		}
+	}
+
+	if((event_epoll_fd == -1) || (slot == -1))
+	{
+		if(sub->regex_valid)
+		{
+			regfree(&sub->regex);
+		}
+		free(sub);
+		errno = (event_epoll_fd == -1) ? ENOSYS : EBUSY;
+		return 0;
+	}
+
+	if(sub->id == 0)
+	{
+		sub->id = ++event_next_id;
+	}
+	subscriptions[slot] = sub;
+
+	return sub->id;
+}
+
+
+/** @file event.c
+ *  @brief Arm the sources of a subscription in the table
+ *
+ *  Log subscription counts on the log of its session once it follows it.
+ *
+ *  @param sub (event_lock held) and sockfd (DUT connection, owned from now)
+ *  @return 0 on success, -1 on error (release the subscription)
+ */
+
+static int event_arm(struct event_subscription* sub, int sockfd)
+{
+	if((sub->type == EVENT_LOG) && ((sub->log = event_log_open(sub->session)) == -1))
+	{
+		regfree(&sub->regex);
+		sub->regex_valid = 0;
+		close(sockfd);
+		return -1;
+	}
+
+	sub->sockfd = sockfd;
+	if((event_watch(sub->sockfd, sub->id, EVENT_SOURCE_SOCKET) == 0) &&
+		(((sub->type == EVENT_EXIT) && (event_open_pids(sub) == 0)) ||
+		((sub->type == EVENT_CAN) && ((sub->can_fd = event_can_socket(sub)) != -1) &&
+			(event_watch(sub->can_fd, sub->id, EVENT_SOURCE_CAN) == 0)) ||
+		(sub->type == EVENT_LOG) || (sub->type == EVENT_THRESHOLD)))
+	{
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/** @file event.c
+ *  @brief Register a subscription of a DUT connection
+ *
+ *  Sources are armed before DUT gets the acknowledge line (sent from
+ *  here), so an event following the acknowledge is not missed. The
+ *  connection is duplicated, the worker closes its own copy as usual.
+ *
+ *  @param sub (parsed, owned by the event thread from now, released on
+ *         error) and conn (DUT connection, deadline ends the subscription)
+ *  @return subscription id on success, -1 on error (errno set)
+ */
+
+int event_subscribe(struct event_subscription* sub, struct assist_conn* conn)
+{
+	unsigned int id = 0;
+	int sockfd = -1;
+	int saved_errno = 0;
+
+	pthread_mutex_lock(&event_lock);
+
+	snprintf(sub->session, sizeof(sub->session), "%s", conn->session);
+	if((id = event_add(sub)) == 0)
+	{
+		pthread_mutex_unlock(&event_lock);
+		return -1;
+	}
+
+	if(((sockfd = fcntl(conn->sockfd, F_DUPFD_CLOEXEC, 0)) != -1) && (event_arm(sub, sockfd) == 0))
+	{
+		sub->deadline_ms = conn->deadline_ms;
+		sub->expiry_ns = (conn->deadline_ms > 0) ? event_now_ns() + conn->deadline_ms * 1000000LL : 0;
+		event_arm_timer();
+
+		reply_printf(&conn->reply, "Assist : Subscription %u to %s\n", sub->id, sub->text);
+		reply_send(&conn->reply);
+
+		/* Process gone already, or never there */
+		if((sub->type == EVENT_EXIT) && (sub->pid_alive == 0))
+		{
+			event_end(sub, 0, "complete, no process left");
+		}
+
+		pthread_mutex_unlock(&event_lock);
+		return (int)id;
+	}
+
+	/* Log is not followed when the connection could not be duplicated */
+	if((sockfd == -1) && (sub->type == EVENT_LOG))
+	{
+		regfree(&sub->regex);
+		sub->regex_valid = 0;
+	}
+	saved_errno = errno;
+	event_release(sub);
+	pthread_mutex_unlock(&event_lock);
+	errno = saved_errno;
+
+	return -1;
+}
+
+
+/** @file event.c
+ *  @brief Take a subscription out for a hot restart
+ *
+ *  Subscription ends here without its final line, the new server goes
+ *  on with it on the same connection, see event_adopt().
+ *
+ *  @param state (filled) and sockfd (DUT connection, to be sent and closed)
+ *  @return 0 on success, -1 when no subscription is left
+ */
+
+int event_detach(struct handoff_event* state, int* sockfd)
+{
+	struct event_subscription* sub = NULL;
+	long long now_ns = event_now_ns();
+	int i = 0;
+
+	pthread_mutex_lock(&event_lock);
+	for(i = 0; (i < EVENT_MAX_SUBSCRIPTIONS) && (sub == NULL); i++)
+	{
+		sub = subscriptions[i];
+	}
+
+	if(sub == NULL)
+	{
+		pthread_mutex_unlock(&event_lock);
+		return -1;
+	}
+
+	bzero(state, sizeof(*state));
+	state->id = sub->id;
+	state->count = sub->count;
+	state->sent = sub->sent;
+	state->deadline_ms = sub->deadline_ms;
+	state->remaining_ms = (sub->expiry_ns == 0) ? 0 : (sub->expiry_ns > now_ns) ? (sub->expiry_ns - now_ns + 999999) / 1000000 : 1;
+	snprintf(state->session, sizeof(state->session), "%s", sub->session);
+	snprintf(state->text, sizeof(state->text), "%s %s", event_type_names[sub->type], sub->text);
+
+	/* Connection goes on in the new server, release must not close it */
+	epoll_ctl(event_epoll_fd, EPOLL_CTL_DEL, sub->sockfd, NULL);
+	*sockfd = sub->sockfd;
+	sub->sockfd = -1;
+	event_release(sub);
+	pthread_mutex_unlock(&event_lock);
+
+	return 0;
+}
+
+
+/** @file event.c
+ *  @brief Go on with a subscription handed over by the previous server
+ *
+ *  Sources are armed again, events in between are not seen. Id, count
+ *  and deadline are kept, so DUT sees no difference.
+ *
+ *  @param state and sockfd (DUT connection, owned from now, closed on error)
+ *  @return 0 on success, -1 on error
+ */
+
+int event_adopt(const struct handoff_event* state, int sockfd)
+{
+	struct event_subscription* sub = NULL;
+	char text[sizeof(state->text)];
+
+	snprintf(text, sizeof(text), "%s", state->text);
+	if(((sub = calloc(1, sizeof(*sub))) == NULL) || (event_parse(text, sub) == -1))
+	{
+		if((sub != NULL) && sub->regex_valid)
+		{
+			regfree(&sub->regex);
+		}
+		free(sub);
+		close(sockfd);
+		return -1;
+	}
+	sub->count = state->count;
+	sub->sent = state->sent;
+	snprintf(sub->session, sizeof(sub->session), "%s", state->session);
+
+	pthread_mutex_lock(&event_lock);
+
+	if(state->id > event_next_id)
+	{
+		event_next_id = state->id;
+	}
+	sub->id = state->id;
+	if(event_add(sub) == 0)
+	{
+		pthread_mutex_unlock(&event_lock);
+		close(sockfd);
+		printf("\nAssist : Subscription %u not taken over\n", state->id);
+		return -1;
+	}
+	if(event_arm(sub, sockfd) != 0)
+	{
+		event_release(sub);
+		pthread_mutex_unlock(&event_lock);
+		printf("\nAssist : Subscription %u not taken over\n", state->id);
+		return -1;
+	}
+
+	sub->deadline_ms = state->deadline_ms;
+	sub->expiry_ns = (state->remaining_ms > 0) ? event_now_ns() + state->remaining_ms * 1000000LL : 0;
+	event_arm_timer();
+
+	if((sub->type == EVENT_EXIT) && (sub->pid_alive == 0))
+	{
+		event_end(sub, 0, "complete, no process left");
+	}
+	pthread_mutex_unlock(&event_lock);
+
+	printf("\nAssist : Subscription %u taken over\n", state->id);
+
+	return 0;
+}
+
+
+/** @file event.c
+ *  @brief Check threshold subscriptions against a telemetry sample
+ *
+ *  Called by the sampler. An event is sent when the condition starts to
+ *  hold, not on every sample it holds.
+ *
+ *  @param sample
+ *  @return none
+ */
+
+void event_telemetry(struct telemetry_sample* sample)
+{
+	struct event_subscription* sub = NULL;
+	const struct event_metric* metric = NULL;
+	long long value = 0;
+	int holds = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&event_lock);
+
+	for(i = 0; i < EVENT_MAX_SUBSCRIPTIONS; i++)
+	{
+		if(((sub = subscriptions[i]) == NULL) || (sub->type != EVENT_THRESHOLD))
+		{
+			continue;
+		}
+
+		metric = &event_metrics[sub->metric];
+		value = metric->is_long ? (long long)*(unsigned long*)((char*)sample + metric->offset) :
+			(long long)*(int*)((char*)sample + metric->offset);
+
+		holds = ((sub->op == THRESHOLD_ABOVE) && (value > sub->value)) ||
+			((sub->op == THRESHOLD_AT_LEAST) && (value >= sub->value)) ||
+			((sub->op == THRESHOLD_BELOW) && (value < sub->value)) ||
+			((sub->op == THRESHOLD_AT_MOST) && (value <= sub->value));
+
+		if(holds && !sub->crossed)
+		{
+			sub->crossed = 1;
+			event_deliver(sub, "AssistEvent %u threshold %lld %s=%lld\n", sub->id, clock_sync_now_us(), metric->name, value);
+		}
+		else if(!holds)
+		{
+			sub->crossed = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&event_lock);
+}
+
+
+/** @file event.c
+ *  @brief Serve one ready source
+ *
+ *  @param source (epoll data)
+ *  @return none
+ */
+
+static void event_dispatch(unsigned long long source)
+{
+	struct event_subscription* sub = NULL;
+	char buffer[4096];
+	unsigned long long expirations = 0;
+	ssize_t len = 0;
+	unsigned int id = source >> 32;
+	unsigned int kind = source & 0xFFFFFFFFU;
+	long long now_ns = 0;
+	int i = 0;
+
+	if(kind == EVENT_SOURCE_TIMER)
+	{
+		while(read(event_timer_fd, &expirations, sizeof(expirations)) > 0);
+
+		now_ns = event_now_ns();
+		for(i = 0; i < EVENT_MAX_SUBSCRIPTIONS; i++)
+		{
+			if(((sub = subscriptions[i]) != NULL) && (sub->expiry_ns > 0) && (now_ns >= sub->expiry_ns))
+			{
+				/* Unlimited subscription ends on its deadline normally */
+				event_end(sub, (sub->count == 0) ? 0 : (DEADLINE_EXIT_STATUS << 8), "timed out");
+			}
+		}
+		event_arm_timer();
+		return;
+	}
+
+	if(kind == EVENT_SOURCE_LOG)
+	{
+		while(read(log_inotify_fd, buffer, sizeof(buffer)) > 0);
+		for(i = 0; i < EVENT_MAX_LOGS; i++)
+		{
+			event_scan_log(i);
+		}
+		return;
+	}
+
+	for(i = 0; (i < EVENT_MAX_SUBSCRIPTIONS) && (sub == NULL); i++)
+	{
+		if((subscriptions[i] != NULL) && (subscriptions[i]->id == id))
+		{
+			sub = subscriptions[i];
+		}
+	}
+	if(sub == NULL)
+	{
+		return;
+	}
+
+	if(kind == EVENT_SOURCE_SOCKET)
+	{
+		/* DUT sends nothing more, readable means closed */
+		len = recv(sub->sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if((len == 0) || ((len == -1) && (errno != EAGAIN)))
+		{
+			printf("\nAssist : Subscription %u closed by DUT after %d events\n", sub->id, sub->sent);
+			event_release(sub);
+			event_arm_timer();
+		}
+	}
+	else if(kind == EVENT_SOURCE_CAN)
+	{
+		event_can(sub);
+	}
+	else if((kind >= EVENT_SOURCE_PID) && (kind < EVENT_SOURCE_PID + EVENT_MAX_PIDS))
+	{
+		event_exit(sub, kind - EVENT_SOURCE_PID);
+	}
+}
+
+
+/** @file event.c
+ *  @brief Event thread
+ *
+ *  @param arg (unused)
+ *  @return NULL
+ */
+
+static void* event_thread(void* arg)
+{
+	struct epoll_event events[EVENT_MAX_EVENTS];
+	int count = 0;
+	int i = 0;
+
+	(void)arg;
+
+	while(1)
+	{
+		if((count = epoll_wait(event_epoll_fd, events, EVENT_MAX_EVENTS, -1)) == -1)
+		{
+			if(errno != EINTR)
+			{
+				printf("\nAssist : Event wait fail, %s\n", strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&event_lock);
+		for(i = 0; i < count; i++)
+		{
+			event_dispatch(events[i].data.u64);
+		}
+		pthread_mutex_unlock(&event_lock);
+	}
+
+	return NULL;
+}
+
+
+/** @file event.c
+ *  @brief Start the event thread
+ *
+ *  @param none
+ *  @return 0 on success, -1 on error
+ */
+
+int event_start(void)
+{
+	struct epoll_event event;
+	pthread_t thread;
+
+	if(((event_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) ||
+		((event_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) ||
+		((log_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1))
+	{
+		printf("\nAssist : Event set up fail, %s\n", strerror(errno));
+		return -1;
+	}
+
+	bzero(&event, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = EVENT_SOURCE_TIMER;
+	epoll_ctl(event_epoll_fd, EPOLL_CTL_ADD, event_timer_fd, &event);
+	event.data.u64 = EVENT_SOURCE_LOG;
+	epoll_ctl(event_epoll_fd, EPOLL_CTL_ADD, log_inotify_fd, &event);
+
+	if(pthread_create(&thread, NULL, event_thread, NULL) != 0)
+	{
+		printf("\nAssist : Create event thread fail\n");
+		close(event_epoll_fd);
+		event_epoll_fd = -1;
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return 0;
+}
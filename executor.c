@@ -0,0 +1,609 @@
+/** @file executor.c
+ *  @brief Command executor process, spawns commands for the workers
+ *
+ *  assist-server forks the executor at start, while it is still small and
+ *  has no threads. Workers send commands to it over a Unix socket instead
+ *  of forking the server and running /bin/sh for every command.
+ *
+ *  The executor starts commands with posix_spawn() (vfork based, no copy
+ *  of the parent). Simple commands are split into arguments and started
+ *  directly, program path is resolved once and cached. Only commands with
+ *  shell syntax, or naming no program in PATH (shell builtins), go
+ *  through /bin/sh. Every command runs in its own process group.
+ *
+ *  Protocol : worker sends struct executor_request followed by the
+ *  command, with one end of a fresh socket pair attached (SCM_RIGHTS).
+ *  Executor answers struct executor_reply on that socket once the command
+ *  finished or its deadline expired, so many workers wait in parallel.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Server side : socket to the executor, -1 when it is not running */
+static int executor_fd = -1;
+
+/* Executor side : running commands and resolved programs */
+static struct executor_job executor_jobs[EXECUTOR_MAX_JOBS];
+static struct executor_path path_cache[EXECUTOR_PATH_CACHE];
+static int path_cache_next = 0;
+static char* path_dirs[EXECUTOR_MAX_ARGS];
+static int path_dir_count = 0;
+
+
+/** @file executor.c
+ *  @brief Monotonic time in ms
+ */
+
+static long long executor_now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000L;
+}
+
+
+/** @file executor.c
+ *  @brief Split PATH of the executor into directories, once
+ *
+ *  @param none
+ *  @return none
+ */
+
+static void executor_load_path(void)
+{
+	char* path = getenv("PATH");
+	char* saveptr = NULL;
+	char* dir = NULL;
+
+	if((path == NULL) || ((path = strdup(path)) == NULL))
+	{
+		path = strdup("/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin");
+	}
+
+	for(dir = strtok_r(path, ":", &saveptr); (dir != NULL) && (path_dir_count < EXECUTOR_MAX_ARGS); dir = strtok_r(NULL, ":", &saveptr))
+	{
+		path_dirs[path_dir_count++] = dir;
+	}
+}
+
+
+/** @file executor.c
+ *  @brief Resolve a program name to its path
+ *
+ *  Names with '/' are used as they are. Others are searched in PATH
+ *  on first use and cached.
+ *
+ *  @param name (argv[0])
+ *  @return path, NULL when not found
+ */
+
+static char* executor_resolve(char* name)
+{
+	struct executor_path* entry = NULL;
+	char path[PATH_MAX];
+	int i = 0;
+
+	if(strchr(name, '/') != NULL)
+	{
+		return name;
+	}
+
+	if(strlen(name) >= sizeof(path_cache[0].name))
+	{
+		return NULL;
+	}
+
+	for(i = 0; i < EXECUTOR_PATH_CACHE; i++)
+	{
+		if((path_cache[i].path[0] != '\0') && (strcmp(path_cache[i].name, name) == 0))
+		{
+			return path_cache[i].path;
+		}
+	}
+
+	for(i = 0; i < path_dir_count; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", path_dirs[i], name);
+		if(access(path, X_OK) == 0)
+		{
+			entry = &path_cache[path_cache_next];
+			path_cache_next = (path_cache_next + 1) % EXECUTOR_PATH_CACHE;
+			snprintf(entry->name, sizeof(entry->name), "%s", name);
+			snprintf(entry->path, sizeof(entry->path), "%s", path);
+			return entry->path;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @file executor.c
+ *  @brief Drop a cached path, program was moved or removed
+ *
+ *  @param name (argv[0])
+ *  @return none
+ */
+
+static void executor_forget(char* name)
+{
+	int i = 0;
+
+	for(i = 0; i < EXECUTOR_PATH_CACHE; i++)
+	{
+		if(strcmp(path_cache[i].name, name) == 0)
+		{
+			path_cache[i].path[0] = '\0';
+		}
+	}
+}
+
+
+/** @file executor.c
+ *  @brief Split a simple command into arguments
+ *
+ *  Commands with quotes, redirections, pipes, variables, globs and the
+ *  like are left to the shell.
+ *
+ *  @param command (split in place) and argv (filled, NULL terminated)
+ *  @return number of arguments, 0 when shell is needed
+ */
+
+static int executor_split(char* command, char** argv)
+{
+	char* saveptr = NULL;
+	char* arg = NULL;
+	int argc = 0;
+
+	if(strpbrk(command, "|&;<>()$`\\\"'*?[]#~=%{}!\n") != NULL)
+	{
+		return 0;
+	}
+
+	for(arg = strtok_r(command, " \t", &saveptr); arg != NULL; arg = strtok_r(NULL, " \t", &saveptr))
+	{
+		if(argc == EXECUTOR_MAX_ARGS)
+		{
+			return 0;
+		}
+		argv[argc++] = arg;
+	}
+	argv[argc] = NULL;
+
+	return argc;
+}
+
+
+/** @file executor.c
+ *  @brief Start a command
+ *
+ *  Command gets its own process group, default signal handling,
+ *  ASSIST_SESSION of its session (see session_environ()) and, with
+ *  log_file, stdout appended to the log and stderr where stdout was
+ *  ("2>&1 >> log_file").
+ *
+ *  @param command, log_file (empty for none) and session (empty for default)
+ *  @return pid on success, -1 on error
+ */
+
+static pid_t executor_spawn(char* command, char* log_file, char* session)
+{
+	static char split_buffer[MAX_REQUEST_SIZE + 1];
+	char* argv[EXECUTOR_MAX_ARGS + 1];
+	char* shell_argv[] = { "sh", "-c", command, NULL };
+	char* path = NULL;
+	char** env = NULL;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	sigset_t signal_mask;
+	pid_t pid = -1;
+	int error = -1;
+
+	if((env = session_environ(session)) == NULL)
+	{
+		printf("\nAssist : Spawn of %s fail, no memory for its environment\n", command);
+		return -1;
+	}
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	posix_spawnattr_setpgroup(&attr, 0);
+	sigemptyset(&signal_mask);
+	posix_spawnattr_setsigmask(&attr, &signal_mask);
+	sigaddset(&signal_mask, SIGPIPE);
+	sigaddset(&signal_mask, SIGHUP);
+	sigaddset(&signal_mask, SIGUSR2);
+	sigaddset(&signal_mask, SIGCHLD);
+	posix_spawnattr_setsigdefault(&attr, &signal_mask);
+
+	posix_spawn_file_actions_init(&actions);
+	if(log_file[0] != '\0')
+	{
+		posix_spawn_file_actions_adddup2(&actions, 1, 2);
+		posix_spawn_file_actions_addopen(&actions, 1, log_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	}
+
+	snprintf(split_buffer, sizeof(split_buffer), "%s", command);
+	if((executor_split(split_buffer, argv) > 0) && ((path = executor_resolve(argv[0])) != NULL))
+	{
+		if(((error = posix_spawn(&pid, path, &actions, &attr, argv, env)) == ENOENT) || (error == EACCES))
+		{
+			executor_forget(argv[0]);
+		}
+	}
+
+	if(error != 0)
+	{
+		error = posix_spawn(&pid, "/bin/sh", &actions, &attr, shell_argv, env);
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	free(env);
+
+	if(error != 0)
+	{
+		printf("\nAssist : Spawn of %s fail, %s\n", command, strerror(error));
+		return -1;
+	}
+
+	#ifdef DEBUG
+		printf("\nAssist : Spawned %d %s %s\n", pid, path ? path : "/bin/sh -c", command);
+	#endif
+	journal_append(JOURNAL_SPAWN, 0, pid, 0, command);
+
+	return pid;
+}
+
+
+/** @file executor.c
+ *  @brief Answer the worker waiting for a command and close its socket
+ *
+ *  @param reply_fd, status and timed_out
+ *  @return none
+ */
+
+static void executor_answer(int reply_fd, int status, int timed_out)
+{
+	struct executor_reply reply;
+
+	reply.status = status;
+	reply.timed_out = timed_out;
+	send(reply_fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+	close(reply_fd);
+}
+
+
+/** @file executor.c
+ *  @brief Take one request from the server and start its command
+ *
+ *  @param control_fd, buffer and size (request and command)
+ *  @return 0 on success, -1 when server is gone
+ */
+
+static int executor_accept(int control_fd, char* buffer, size_t size)
+{
+	struct executor_request* request = (struct executor_request*)buffer;
+	struct executor_job* job = NULL;
+	struct cmsghdr* cmsg = NULL;
+	struct msghdr msg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+	int reply_fd = -1;
+	ssize_t len = 0;
+	int i = 0;
+
+	bzero(&msg, sizeof(msg));
+	iov.iov_base = buffer;
+	iov.iov_len = size - 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if((len = recvmsg(control_fd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+	{
+		return ((len == -1) && (errno == EINTR)) ? 0 : -1;
+	}
+
+	if(((cmsg = CMSG_FIRSTHDR(&msg)) == NULL) || (cmsg->cmsg_type != SCM_RIGHTS))
+	{
+		return 0;
+	}
+	memcpy(&reply_fd, CMSG_DATA(cmsg), sizeof(reply_fd));
+
+	if((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || ((size_t)len <= sizeof(*request)))
+	{
+		executor_answer(reply_fd, -1, 0);
+		return 0;
+	}
+	buffer[len] = '\0';
+
+	for(i = 0; i < EXECUTOR_MAX_JOBS; i++)
+	{
+		if(executor_jobs[i].pid == 0)
+		{
+			job = &executor_jobs[i];
+			break;
+		}
+	}
+
+	request->session[sizeof(request->session) - 1] = '\0';
+	if((job == NULL) || ((job->pid = executor_spawn(request->command, request->log_file, request->session)) == -1))
+	{
+		if(job != NULL)
+		{
+			job->pid = 0;
+		}
+		executor_answer(reply_fd, -1, 0);
+		return 0;
+	}
+
+	job->reply_fd = reply_fd;
+	job->timed_out = 0;
+	job->deadline_at = (request->deadline_ms > 0) ? executor_now_ms() + request->deadline_ms : 0;
+
+	return 0;
+}
+
+
+/** @file executor.c
+ *  @brief Reap finished commands and answer their workers
+ *
+ *  @param none
+ *  @return none
+ */
+
+static void executor_reap(void)
+{
+	pid_t pid = 0;
+	int status = 0;
+	int i = 0;
+
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		for(i = 0; i < EXECUTOR_MAX_JOBS; i++)
+		{
+			if(executor_jobs[i].pid == pid)
+			{
+				journal_append(JOURNAL_EXIT, 0, pid, executor_jobs[i].timed_out ? (DEADLINE_EXIT_STATUS << 8) : status, NULL);
+				executor_answer(executor_jobs[i].reply_fd,
+					executor_jobs[i].timed_out ? (DEADLINE_EXIT_STATUS << 8) : status,
+					executor_jobs[i].timed_out);
+				executor_jobs[i].pid = 0;
+				break;
+			}
+		}
+	}
+}
+
+
+/** @file executor.c
+ *  @brief Kill commands past their deadline
+ *
+ *  @param none
+ *  @return ms till the next deadline, -1 when there is none
+ */
+
+static int executor_expire(void)
+{
+	struct executor_job* job = NULL;
+	long long now = executor_now_ms();
+	long long next = -1;
+	int i = 0;
+
+	for(i = 0; i < EXECUTOR_MAX_JOBS; i++)
+	{
+		job = &executor_jobs[i];
+		if((job->pid == 0) || (job->deadline_at == 0) || job->timed_out)
+		{
+			continue;
+		}
+
+		/* Deadline expired. Kill command and everything it started */
+		if(job->deadline_at <= now)
+		{
+			printf("\nAssist : Deadline expired, killing process group %d\n", job->pid);
+			kill(-job->pid, SIGKILL);
+			job->timed_out = 1;
+		}
+		else if((next == -1) || (job->deadline_at - now < next))
+		{
+			next = job->deadline_at - now;
+		}
+	}
+
+	return (int)next;
+}
+
+
+/** @file executor.c
+ *  @brief Executor main loop
+ *
+ *  Waits on the server socket and on SIGCHLD (signalfd). Exits when
+ *  the server is gone.
+ *
+ *  @param control_fd (socket to the server)
+ *  @return none
+ */
+
+static void executor_loop(int control_fd)
+{
+	static char buffer[sizeof(struct executor_request) + MAX_REQUEST_SIZE + 1];
+	struct signalfd_siginfo siginfo;
+	struct pollfd fds[2];
+	sigset_t signal_mask;
+	int child_fd = -1;
+	int timeout_ms = -1;
+
+	sigemptyset(&signal_mask);
+	sigaddset(&signal_mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+	if((child_fd = signalfd(-1, &signal_mask, SFD_CLOEXEC | SFD_NONBLOCK)) == -1)
+	{
+		printf("\nAssist : Executor signalfd fail\n");
+		return;
+	}
+
+	executor_load_path();
+
+	while(1)
+	{
+		fds[0].fd = control_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = child_fd;
+		fds[1].events = POLLIN;
+
+		if((poll(fds, 2, timeout_ms) == -1) && (errno != EINTR))
+		{
+			printf("\nAssist : Executor poll fail\n");
+			return;
+		}
+
+		if((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && (executor_accept(control_fd, buffer, sizeof(buffer)) != 0))
+		{
+			return;
+		}
+
+		if(fds[1].revents & POLLIN)
+		{
+			while(read(child_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo));
+			executor_reap();
+		}
+
+		timeout_ms = executor_expire();
+	}
+}
+
+
+/** @file executor.c
+ *  @brief Fork the executor process
+ *
+ *  Call before any thread is started. The executor dies with the server.
+ *
+ *  @param none
+ *  @return 0 on success, -1 on error (commands are then forked by workers)
+ */
+
+int executor_start(void)
+{
+	pid_t server_pid = getpid();
+	pid_t pid = -1;
+	int sv[2];
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+	{
+		printf("\nAssist : Executor socket fail\n");
+		return -1;
+	}
+
+	/* Pending output must not be printed twice */
+	fflush(stdout);
+
+	if((pid = fork()) == -1)
+	{
+		printf("\nAssist : Executor fork fail\n");
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if(pid == 0)
+	{
+		close(sv[0]);
+		prctl(PR_SET_NAME, "assist-exec");
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		if(getppid() != server_pid)
+		{
+			_exit(0);
+		}
+		/* Reload and hot restart are for the server only, pidof finds us too */
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGUSR2, SIG_IGN);
+		executor_loop(sv[1]);
+		_exit(0);
+	}
+
+	close(sv[1]);
+	executor_fd = sv[0];
+	printf("\nAssist : Command executor %d started\n", pid);
+
+	return 0;
+}
+
+
+/** @file executor.c
+ *  @brief Run a command in the executor and wait for it
+ *
+ *  @param command, log_file (NULL for none), session (empty for the default
+ *         session), deadline_ms (0 for none), timed_out (set to 1 on expiry)
+ *         and status (system() format, -1 on error)
+ *  @return 0 when executor ran the command, -1 when executor is not available
+ */
+
+int executor_run(char* command, const char* log_file, const char* session, int deadline_ms, int* timed_out, int* status)
+{
+	struct executor_request request;
+	struct executor_reply reply;
+	struct cmsghdr* cmsg = NULL;
+	struct msghdr msg;
+	struct iovec iov[2];
+	char control[CMSG_SPACE(sizeof(int))];
+	ssize_t len = 0;
+	int sv[2];
+
+	if(executor_fd == -1)
+	{
+		return -1;
+	}
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+	{
+		return -1;
+	}
+
+	bzero(&request, sizeof(request));
+	request.deadline_ms = deadline_ms;
+	snprintf(request.log_file, sizeof(request.log_file), "%s", log_file ? log_file : "");
+	snprintf(request.session, sizeof(request.session), "%s", session);
+
+	iov[0].iov_base = &request;
+	iov[0].iov_len = sizeof(request);
+	iov[1].iov_base = command;
+	iov[1].iov_len = strlen(command);
+
+	bzero(&msg, sizeof(msg));
+	bzero(control, sizeof(control));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &sv[1], sizeof(int));
+
+	if(sendmsg(executor_fd, &msg, MSG_NOSIGNAL) == -1)
+	{
+		printf("\nAssist : Executor not available, %s\n", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	close(sv[1]);
+
+	while(((len = recv(sv[0], &reply, sizeof(reply), 0)) == -1) && (errno == EINTR));
+	close(sv[0]);
+
+	/* Command was taken, do not run it again even if answer is lost */
+	*timed_out = (len == sizeof(reply)) ? reply.timed_out : 0;
+	*status = (len == sizeof(reply)) ? reply.status : -1;
+
+	return 0;
+}
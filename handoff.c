@@ -0,0 +1,617 @@
+/** @file handoff.c
+ *  @brief Hot restart of the assist server
+ *
+ *  On SIGUSR2 the running server starts its own executable again (a new
+ *  build installed over it is picked up) and hands its state over on a
+ *  socketpair, descriptors as SCM_RIGHTS. DUTs see no refused or reset
+ *  connection.
+ *
+ *  Old server                           New server
+ *  fork, exec with ASSIST_HANDOFF_FD
+ *                                       READY (workers and event thread up)
+ *  LISTEN       tcp and local sockets   accepts from now on
+ *  CONNECTION   each connection no worker started on, served again
+ *  ...          workers finish the requests in progress, captures and
+ *               subscriptions go on meanwhile
+ *  CAPTURE      each capture, its socket and file
+ *  EVENT        each subscription, its DUT connection
+ *  SESSIONS     session table counters
+ *  END                                  DONE
+ *  exit
+ *
+ *  Background commands need no hand over : they keep running, and the new
+ *  server finds them in /proc with their ASSIST_SESSION tags. When the new
+ *  server does not come up, the old one kills it and serves on.
+ *
+ *  When the hand over fails once the new server has the listening sockets,
+ *  the old one sends ABORT. The new server stops accepting and hands back
+ *  the same way, CONNECTION, CAPTURE and EVENT then END, and exits. Its
+ *  session counters are not handed back. A new server which does not hand
+ *  back in HANDOFF_TIMEOUT_MS is killed : the DUT connections, captures
+ *  and subscriptions it held are lost.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Executable and arguments to start the new server with */
+static char handoff_exe[PATH_MAX];
+static char** handoff_argv = NULL;
+
+
+/** @file handoff.c
+ *  @brief Close the descriptors of a message not taken
+ *
+ *  @param fds (HANDOFF_MAX_FDS, -1 when not sent)
+ *  @return none
+ */
+
+static void handoff_close(int* fds)
+{
+	int i = 0;
+
+	for(i = 0; i < HANDOFF_MAX_FDS; i++)
+	{
+		if(fds[i] != -1)
+		{
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+
+
+/** @file handoff.c
+ *  @brief Send a message on the hot restart channel
+ *
+ *  @param channel, message, fds and fd_count (at most HANDOFF_MAX_FDS)
+ *  @return 0 on success, -1 on error
+ */
+
+static int handoff_send(int channel, struct handoff_message* message, int* fds, int fd_count)
+{
+	char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+	struct cmsghdr* cmsg = NULL;
+	struct msghdr msg;
+	struct iovec iov;
+
+	bzero(&msg, sizeof(msg));
+	iov.iov_base = message;
+	iov.iov_len = sizeof(*message);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if(fd_count > 0)
+	{
+		bzero(control, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+	}
+
+	return (sendmsg(channel, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(*message)) ? 0 : -1;
+}
+
+
+/** @file handoff.c
+ *  @brief Receive a message on the hot restart channel
+ *
+ *  @param channel, message, fds (HANDOFF_MAX_FDS, -1 when not sent),
+ *         timeout_ms (-1 waits)
+ *  @return 0 on success, -1 on error, timeout or closed channel
+ */
+
+static int handoff_recv(int channel, struct handoff_message* message, int* fds, int timeout_ms)
+{
+	char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+	struct cmsghdr* cmsg = NULL;
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t len = 0;
+	int i = 0;
+
+	for(i = 0; i < HANDOFF_MAX_FDS; i++)
+	{
+		fds[i] = -1;
+	}
+
+	pfd.fd = channel;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, timeout_ms) != 1)
+	{
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	bzero(&msg, sizeof(msg));
+	iov.iov_base = message;
+	iov.iov_len = sizeof(*message);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if((len = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+	{
+		errno = (len == 0) ? ECONNRESET : errno;
+		return -1;
+	}
+
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+		{
+			memcpy(fds, CMSG_DATA(cmsg), (cmsg->cmsg_len - CMSG_LEN(0) < HANDOFF_MAX_FDS * sizeof(int)) ?
+				cmsg->cmsg_len - CMSG_LEN(0) : HANDOFF_MAX_FDS * sizeof(int));
+		}
+	}
+
+	if(len != (ssize_t)sizeof(*message))
+	{
+		handoff_close(fds);
+		errno = EPROTO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file handoff.c
+ *  @brief Remember how the server was started
+ *
+ *  Executable is read now : once a new build is installed over it,
+ *  /proc/self/exe names the deleted file.
+ *
+ *  @param argv (of main(), kept)
+ *  @return none
+ */
+
+void handoff_init(char** argv)
+{
+	ssize_t len = 0;
+
+	handoff_argv = argv;
+	if((len = readlink("/proc/self/exe", handoff_exe, sizeof(handoff_exe) - 1)) == -1)
+	{
+		snprintf(handoff_exe, sizeof(handoff_exe), "%s", argv[0]);
+		return;
+	}
+	handoff_exe[len] = '\0';
+}
+
+
+/** @file handoff.c
+ *  @brief Environment of the new server : ours, with the channel
+ *
+ *  @param channel (descriptor the new server finds in HANDOFF_ENV)
+ *  @return environment (free() it), NULL on error
+ */
+
+static char** handoff_environ(int channel)
+{
+	char** env = NULL;
+	char* tag = NULL;
+	size_t count = 0;
+	size_t i = 0, j = 0;
+
+	while(environ[count] != NULL)
+	{
+		count++;
+	}
+
+	if((env = malloc((count + 2) * sizeof(*env) + strlen(HANDOFF_ENV) + 16)) == NULL)
+	{
+		return NULL;
+	}
+	tag = (char*)&env[count + 2];
+
+	sprintf(tag, "%s=%d", HANDOFF_ENV, channel);
+	env[j++] = tag;
+	for(i = 0; i < count; i++)
+	{
+		if((strncmp(environ[i], HANDOFF_ENV, strlen(HANDOFF_ENV)) != 0) || (environ[i][strlen(HANDOFF_ENV)] != '='))
+		{
+			env[j++] = environ[i];
+		}
+	}
+	env[j] = NULL;
+
+	return env;
+}
+
+
+/** @file handoff.c
+ *  @brief Give the listening sockets to the new server, once it is up
+ *
+ *  @param channel, sockfd (tcp listening socket), local_fd (local one, -1
+ *         for none) and port
+ *  @return 0 on success, -1 on error (new server holds nothing)
+ */
+
+static int handoff_listen(int channel, int sockfd, int local_fd, int port)
+{
+	struct handoff_message message;
+	int fds[HANDOFF_MAX_FDS];
+
+	if((handoff_recv(channel, &message, fds, HANDOFF_TIMEOUT_MS) != 0) || (message.type != HANDOFF_READY))
+	{
+		printf("\nAssist : New server did not come up\n");
+		return -1;
+	}
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_LISTEN;
+	message.port = port;
+	fds[0] = sockfd;
+	fds[1] = local_fd;
+
+	return handoff_send(channel, &message, fds, (local_fd == -1) ? 1 : 2);
+}
+
+
+/** @file handoff.c
+ *  @brief Send the rest of the state to the other server
+ *
+ *  Old server sends it to the new one, and the new one back on ABORT.
+ *  Listening sockets are the receiver's already.
+ *
+ *  @param channel and sessions (1 to send the session counters)
+ *  @return 0 when the other server took everything, -1 on error
+ */
+
+static int handoff_give(int channel, int sessions)
+{
+	struct handoff_message message;
+	struct pollfd pfd;
+	int fds[HANDOFF_MAX_FDS];
+	int sent = 0;
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_CONNECTION;
+	while((fds[0] = worker_pool_detach()) != -1)
+	{
+		sent = handoff_send(channel, &message, fds, 1);
+		close(fds[0]);
+		if(sent != 0)
+		{
+			return -1;
+		}
+	}
+
+	/* Captures and subscriptions go on here until the requests are done.
+	 * Receiver sends nothing before END, readable is gone. READY tells it
+	 * we are still here */
+	pfd.fd = channel;
+	pfd.events = POLLIN;
+	while(worker_pool_busy() > 0)
+	{
+		if(poll(&pfd, 1, HANDOFF_DRAIN_MS) == 1)
+		{
+			printf("\nAssist : Other server went away\n");
+			return -1;
+		}
+		bzero(&message, sizeof(message));
+		message.type = HANDOFF_READY;
+		if(handoff_send(channel, &message, fds, 0) != 0)
+		{
+			return -1;
+		}
+	}
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_CAPTURE;
+	while((sent == 0) && (capture_detach(&message.data.capture, fds) == 0))
+	{
+		sent = handoff_send(channel, &message, fds, 2);
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_EVENT;
+	while((sent == 0) && (event_detach(&message.data.event, &fds[0]) == 0))
+	{
+		sent = handoff_send(channel, &message, fds, 1);
+		close(fds[0]);
+	}
+
+	if(sent != 0)
+	{
+		return -1;
+	}
+
+	if(sessions)
+	{
+		bzero(&message, sizeof(message));
+		message.type = HANDOFF_SESSIONS;
+		message.count = session_export(message.data.sessions);
+		if(handoff_send(channel, &message, fds, 0) != 0)
+		{
+			return -1;
+		}
+	}
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_END;
+	if((handoff_send(channel, &message, fds, 0) != 0) ||
+		(handoff_recv(channel, &message, fds, HANDOFF_TIMEOUT_MS) != 0) || (message.type != HANDOFF_DONE))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file handoff.c
+ *  @brief Take one piece of state from the other server
+ *
+ *  @param channel, message and fds (received)
+ *  @return 0 for more to come, 1 on END (DONE sent), 2 on ABORT, -1 on error
+ */
+
+static int handoff_take(int channel, struct handoff_message* message, int* fds)
+{
+	switch(message->type)
+	{
+		case HANDOFF_CONNECTION:
+			if((fds[0] != -1) && (worker_pool_submit(fds[0]) != 0))
+			{
+				write_socket("\nAssist : Assist board busy, try again. AssistDataEnds", fds[0]);
+				close(fds[0]);
+			}
+			break;
+		case HANDOFF_CAPTURE:
+			if((fds[0] == -1) || (fds[1] == -1))
+			{
+				handoff_close(fds);
+				break;
+			}
+			capture_adopt(&message->data.capture, fds[0], fds[1]);
+			break;
+		case HANDOFF_EVENT:
+			if(fds[0] != -1)
+			{
+				event_adopt(&message->data.event, fds[0]);
+			}
+			break;
+		case HANDOFF_SESSIONS:
+			session_import(message->data.sessions, (message->count < SESSION_MAX) ? message->count : SESSION_MAX);
+			break;
+		case HANDOFF_END:
+			bzero(message, sizeof(*message));
+			message->type = HANDOFF_DONE;
+			return (handoff_send(channel, message, fds, 0) == 0) ? 1 : -1;
+		case HANDOFF_ABORT:
+			handoff_close(fds);
+			return 2;
+		default:
+			handoff_close(fds);
+			break;
+	}
+
+	return 0;
+}
+
+
+/** @file handoff.c
+ *  @brief Take back what the new server holds, after a failed hand over
+ *
+ *  @param channel
+ *  @return 0 when the new server handed everything back, -1 on error
+ */
+
+static int handoff_take_back(int channel)
+{
+	struct handoff_message message;
+	int fds[HANDOFF_MAX_FDS];
+	int taken = 0;
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_ABORT;
+	if(handoff_send(channel, &message, fds, 0) != 0)
+	{
+		return -1;
+	}
+
+	while(taken == 0)
+	{
+		if(handoff_recv(channel, &message, fds, HANDOFF_TIMEOUT_MS) != 0)
+		{
+			return -1;
+		}
+
+		/* ABORT does not come this way */
+		if((taken = handoff_take(channel, &message, fds)) == 2)
+		{
+			taken = 0;
+		}
+	}
+
+	return (taken == 1) ? 0 : -1;
+}
+
+
+/** @file handoff.c
+ *  @brief Hand the server over to a new one, in the old server
+ *
+ *  Returns once the new server took everything, or failed to. Requests in
+ *  progress are finished here first.
+ *
+ *  @param sockfd (tcp listening socket), local_fd (local one, -1 for none) and port
+ *  @return 0 when handed over (exit now), -1 on error (serve on)
+ */
+
+int handoff_start(int sockfd, int local_fd, int port)
+{
+	char** env = NULL;
+	int channel[2] = { -1, -1 };
+	pid_t pid = -1;
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) != 0)
+	{
+		printf("\nAssist : Hot restart channel fail. %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* Child only sets up descriptors and execs, everything else is done now */
+	if(((env = handoff_environ(channel[1])) == NULL) || ((pid = fork()) == -1))
+	{
+		printf("\nAssist : Hot restart fork fail\n");
+		free(env);
+		close(channel[0]);
+		close(channel[1]);
+		return -1;
+	}
+
+	if(pid == 0)
+	{
+		fcntl(channel[1], F_SETFD, 0);
+		execve(handoff_exe, handoff_argv, env);
+		_exit(127);
+	}
+
+	free(env);
+	close(channel[1]);
+	printf("\nAssist : Hot restart, new server %s is PID %d\n", handoff_exe, (int)pid);
+
+	if(handoff_listen(channel[0], sockfd, local_fd, port) != 0)
+	{
+		printf("\nAssist : Hot restart fail, serving on\n");
+		close(channel[0]);
+
+		/* New server may be half up, it holds nothing yet */
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	if(handoff_give(channel[0], 1) != 0)
+	{
+		printf("\nAssist : Hot restart fail, taking back from PID %d\n", (int)pid);
+		if(handoff_take_back(channel[0]) != 0)
+		{
+			printf("\nAssist : PID %d did not hand back, killed. Its connections and captures are lost\n", (int)pid);
+			kill(pid, SIGKILL);
+		}
+		close(channel[0]);
+		waitpid(pid, NULL, 0);
+		printf("\nAssist : Serving on\n");
+		return -1;
+	}
+
+	printf("\nAssist : Handed over to PID %d\n", (int)pid);
+	close(channel[0]);
+
+	return 0;
+}
+
+
+/** @file handoff.c
+ *  @brief Take the listening sockets over, in the new server
+ *
+ *  Rest of the state comes while the new server already accepts, see
+ *  handoff_next().
+ *
+ *  @param channel (from HANDOFF_ENV), sockfd, local_fd (-1 for none) and port (filled)
+ *  @return 0 on success, -1 on error
+ */
+
+int handoff_receive(int channel, int* sockfd, int* local_fd, int* port)
+{
+	struct handoff_message message;
+	int fds[HANDOFF_MAX_FDS];
+
+	fcntl(channel, F_SETFD, FD_CLOEXEC);
+
+	bzero(&message, sizeof(message));
+	message.type = HANDOFF_READY;
+	if((handoff_send(channel, &message, fds, 0) != 0) ||
+		(handoff_recv(channel, &message, fds, HANDOFF_TIMEOUT_MS) != 0))
+	{
+		printf("\nAssist : Hot restart receive fail. %s\n", strerror(errno));
+		return -1;
+	}
+
+	if((message.type != HANDOFF_LISTEN) || (fds[0] == -1))
+	{
+		printf("\nAssist : Hot restart receive fail, no listening socket\n");
+		handoff_close(fds);
+		return -1;
+	}
+
+	*sockfd = fds[0];
+	*local_fd = fds[1];
+	*port = message.port;
+	printf("\nAssist : Took over port %d from the previous server\n", *port);
+
+	return 0;
+}
+
+
+/** @file handoff.c
+ *  @brief Take over the next piece of state, in the new server
+ *
+ *  Called when the channel is readable.
+ *
+ *  @param channel
+ *  @return 0 for more to come, 1 when the hand over is done, 2 when the
+ *          previous server aborted it (see handoff_return()), -1 on error
+ *          (close the channel on 1 and -1)
+ */
+
+int handoff_next(int channel)
+{
+	struct handoff_message message;
+	int fds[HANDOFF_MAX_FDS];
+	int taken = 0;
+
+	if(handoff_recv(channel, &message, fds, 0) != 0)
+	{
+		printf("\nAssist : Previous server went away. %s\n", strerror(errno));
+		return -1;
+	}
+
+	if((taken = handoff_take(channel, &message, fds)) == 1)
+	{
+		printf("\nAssist : Hot restart complete\n");
+	}
+	else if(taken == 2)
+	{
+		printf("\nAssist : Hot restart aborted by the previous server\n");
+	}
+
+	return taken;
+}
+
+
+/** @file handoff.c
+ *  @brief Hand everything back to the previous server, in the new server
+ *
+ *  Listening sockets must be closed first, the previous server accepts
+ *  again once it has all. Exit after it.
+ *
+ *  @param channel
+ *  @return 0 when handed back, -1 on error
+ */
+
+int handoff_return(int channel)
+{
+	if(handoff_give(channel, 0) != 0)
+	{
+		printf("\nAssist : Hand back to the previous server fail\n");
+		return -1;
+	}
+
+	printf("\nAssist : Handed back to the previous server\n");
+	return 0;
+}
@@ -10,11 +10,18 @@
 #ifndef _ASSIST_HEADER
 #define _ASSIST_HEADER
 
+/* accept4(), SOCK_CLOEXEC and friends */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 /* libc includes. */
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h> 
 #include <netdb.h> 
 #include <netinet/in.h> 
+#include <netinet/tcp.h>
 #include <stdlib.h> 
 #include <string.h> 
 #include <sys/socket.h> 
@@ -24,36 +31,1150 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <netpacket/packet.h>
+#include <linux/errqueue.h>
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
 
-/* Defines or data */
+/* Public client library API */
+#include "libassist.h"
+
+/* Defines or data. Values are defaults, see config.c for the config file keys */
 #define MAX_SIZE 1024
 #define PORT 5678 
 #define SA struct sockaddr 
 #define ASSIST_CONF_FILE "./assist_address.conf"
 #define CONSOLE_LOG_FILE "/tmp/cmd_console_logs"
+#define DEFAULT_WORKER_COUNT 4
+#define MAX_WORKER_COUNT 64
+#define MAX_REQUEST_SIZE 65536
+#define MAX_CHUNK_SIZE 65536
+#define LISTEN_BACKLOG 16
+#define WORK_QUEUE_SIZE 256
+
+/* Request priority classes, see worker-pool.c. Control requests go on the
+ * express queue, bulk replies are paced */
+#define PRIORITY_CONTROL 0
+#define PRIORITY_NORMAL 1
+#define PRIORITY_BULK 2
+#define DEFAULT_EXPRESS_WORKERS 1
+#define CLASSIFY_PEEK_SIZE 256
+#define CLASSIFY_POLL_MS 100
+#define CLASSIFY_MAX_EVENTS 64
+#define SOCKET_PRIORITY_CONTROL 6
+#define SOCKET_PRIORITY_BULK 1
+
+/* Request path memory, see arena.c and reply.c */
+#define ARENA_SIZE (4 * MAX_REQUEST_SIZE)
+#define REPLY_SEGMENT_SIZE 4096
+#define REPLY_FLUSH_SEGMENTS 16
+#define REPLY_HIGH_WATER (64 * 1024)
+#define REPLY_LOW_WATER (16 * 1024)
+#define REPLY_MAX_WATER (16 * 1024 * 1024)
+#define REPLY_MAX_IOV 64
+#define REPLY_SEND_TIMEOUT_MS 10000
+#define ZEROCOPY_THRESHOLD (64 * 1024)
+#define SEGMENT_POOL_MAX 256
+
+/* Process lookup, see proc-scan.c */
+#define PROC_CACHE_INITIAL 2048      /* Entries, the cache grows past it */
+#define PROC_SCAN_TTL_MS 50
+#define PROC_ENVIRON_SIZE 16384
+#define PROC_MAX_RESULTS 64
+#define PROC_CMDLINE_SIZE 4096
+#define PROC_MATCH_NAME 0
+#define PROC_MATCH_PATTERN 1
+#define PROC_MATCH_FULL 2
+
+/* Request deadline. DUT prefixes the request with "AssistDeadline=<ms> " */
+#define DEADLINE_TAG "AssistDeadline="
+#define DEFAULT_DEADLINE_MS 60000
+#define DEADLINE_GRACE_MS 5000
+#define DEADLINE_EXIT_STATUS 124
+#define CONNECT_TIMEOUT_MS 5000
+#define SOCKET_TIMEOUT_MS 10000
+
+/* Client messages, see client_set_quiet() */
+#define CLIENT_VERBOSE 0
+#define CLIENT_QUIET 1
+#define CLIENT_SILENT 2
+
+/* DUT send time, prefixed by DUT as "AssistSent=<wall-clock us> " */
+#define SENT_TAG "AssistSent="
+
+/* Named session of the request, prefixed by DUT as "AssistSession=<name> ".
+ * Commands of a session carry ASSIST_SESSION=<name>, see session.c */
+#define SESSION_TAG "AssistSession="
+#define SESSION_ENV "ASSIST_SESSION"
+#define SESSION_NAME_SIZE 32
+#define SESSION_MAX 32
+
+/* Shared memory transport for DUT on the assist board itself, see ring.c.
+ * DUT asks for it with "AssistRing=<bytes> " on the local socket */
+#define LOCAL_SOCKET_PATH "/tmp/assist.sock"
+#define RING_TAG "AssistRing="
+#define RING_OFFER "AssistRing"
+#define RING_MAGIC 0x474e495254535341ULL
+#define RING_SIZE (1024 * 1024)
+#define RING_MIN_SIZE 65536
+#define RING_MAX_SIZE (64 * 1024 * 1024)
+#define RING_DATA_OFFSET 4096
+
+/* CAN frame generator, see can-gen.c */
+#define CAN_GEN_MAX_BATCH 64
+#define CAN_GEN_TICK_NS 1000000
+#define CAN_GEN_MAX_RATE 1000000
+#define CAN_GEN_MAX_COUNT 100000000LL
+#define CAN_GEN_RETRY_NS 200000
+#define CAN_DATA_FIXED 0
+#define CAN_DATA_COUNTER 1
+#define CAN_DATA_RANDOM 2
+#define CAN_ID_STEP 0
+#define CAN_ID_RANDOM 1
+
+/* CAN capture files, see capture.c */
+#define CAPTURE_MAGIC "ASCAPT01"
+#define CAPTURE_INDEX_MAGIC "ASCAPIDX"
+#define CAPTURE_MAX 8
+#define CAPTURE_BATCH 64
+#define CAPTURE_INDEX_STRIDE 1024
+#define CAPTURE_BLOOM_WORDS 4
+#define CAPTURE_MAX_IDS 2048
+#define CAPTURE_IDS_INCOMPLETE 1            /* Trailer flag, ID summary misses some IDs */
+#define CAPTURE_ID_SLOTS 4096
+#define CAPTURE_POLL_MS 100
+#define CAPTURE_DRAIN_MS 10
+#define CAPTURE_RT_STACK (256 * 1024)
+#define CAPTURE_RT_RCVBUF (4 * 1024 * 1024)
+#define CAPTURE_BUFFER_FRAMES 65536
+#define CAPTURE_PRIORITY 50
+#define CAPTURE_BITRATE 500000
+#define CAPTURE_JITTER_BUCKETS 5
+#define CAPTURE_ERROR_CLASSES 9
+
+/* Event subscriptions, see event.c */
+#define EVENT_MAX_SUBSCRIPTIONS 64
+#define EVENT_MAX_PIDS 16
+#define EVENT_MAX_LOGS 8
+#define EVENT_MAX_EVENTS 64
+#define EVENT_LINE_SIZE 1024
+#define EVENT_CAN_BATCH 32
+#define EVENT_EXIT 0
+#define EVENT_LOG 1
+#define EVENT_CAN 2
+#define EVENT_THRESHOLD 3
+#define EVENT_SOURCE_SOCKET 0
+#define EVENT_SOURCE_CAN 1
+#define EVENT_SOURCE_PID 2
+#define EVENT_SOURCE_LOG 0xFFFFFFFEU
+#define EVENT_SOURCE_TIMER 0xFFFFFFFFU
+#define THRESHOLD_ABOVE 0
+#define THRESHOLD_AT_LEAST 1
+#define THRESHOLD_BELOW 2
+#define THRESHOLD_AT_MOST 3
+
+/* Event journal, see journal.c */
+#define JOURNAL_FILE "/tmp/assist_journal"
+#define JOURNAL_RECORDS 65536
+#define JOURNAL_MAGIC 0x4c4e524a54535341ULL
+#define JOURNAL_NONE 0
+#define JOURNAL_REQUEST 1
+#define JOURNAL_REPLY 2
+#define JOURNAL_SPAWN 3
+#define JOURNAL_EXIT 4
+#define JOURNAL_FRAME 5
+#define JOURNAL_CLOCK 6
+#define JOURNAL_EVENT 7
+#define JOURNAL_TYPE_COUNT 8
+
+/* Request trace for replay, see trace.c */
+#define TRACE_MAGIC "ASTRACE1"
+#define TRACE_HASH_INIT 2166136261U
+#define REPLAY_MAX_THREADS 64
+#define REPLAY_MAX_DIFFS_SHOWN 10
+
+/* Clock offset between DUT and assist board, see clock-sync.c */
+#define CLOCK_SYNC_SAMPLES 8
+#define CLOCK_SYNC_MAX_SAMPLES 64
+#define CLOCK_SYNC_HISTORY 32
+#define CLOCK_SYNC_PEERS 16
+#define CLOCK_SYNC_KEY_SIZE (INET6_ADDRSTRLEN + SESSION_NAME_SIZE + 2)
+#define CLOCK_SYNC_LINE_SIZE 128
+
+/* Command executor process, see executor.c */
+#define EXECUTOR_MAX_JOBS 256
+#define EXECUTOR_MAX_ARGS 256
+#define EXECUTOR_PATH_CACHE 64
+
+/* Health telemetry, see telemetry.c */
+#define TELEMETRY_INTERVAL_MS 1000
+#define TELEMETRY_HISTORY 120
+#define TELEMETRY_MAX_LINKS 8
+
+/* Delta file sync, see delta-sync.c. Frame integers are big endian */
+#define DELTA_READY "AssistFileSyncReady"
+#define DELTA_MIN_BLOCK 1024
+#define DELTA_MAX_BLOCK (128 * 1024)
+#define DELTA_MAX_DATA 65536
+#define DELTA_SIGNATURE_BATCH 2048
+#define DELTA_OUT_SIZE (2 * DELTA_MAX_DATA)
+#define DELTA_HASH_INIT 14695981039346656037ULL
+#define DELTA_HASH_PRIME 1099511628211ULL
+#define DELTA_FILE 1
+#define DELTA_DIR 2
+#define DELTA_COPY 3
+#define DELTA_DATA 4
+#define DELTA_END 5
+#define DELTA_DONE 6
+#define DELTA_SIGNATURES 7
+#define DELTA_STATUS 8
+#define DELTA_FLAG_WHOLE 1            /* File : no signatures, all of it is sent */
+#define DELTA_FLAG_SAME 2             /* Signatures : size and mtime match, nothing to send */
+#define DELTA_FLAG_LAST 4             /* Signatures : last batch */
+
+/* Hot restart, see handoff.c. New server finds its end of the channel in
+ * ASSIST_HANDOFF_FD */
+#define HANDOFF_ENV "ASSIST_HANDOFF_FD"
+#define HANDOFF_TIMEOUT_MS 10000
+#define HANDOFF_DRAIN_MS 100
+#define HANDOFF_MAX_FDS 2
+#define HANDOFF_READY 1
+#define HANDOFF_LISTEN 2
+#define HANDOFF_CONNECTION 3
+#define HANDOFF_CAPTURE 4
+#define HANDOFF_EVENT 5
+#define HANDOFF_SESSIONS 6
+#define HANDOFF_END 7
+#define HANDOFF_DONE 8
+#define HANDOFF_ABORT 9                /* Old to new server : hand everything back */
+
+/* Health pings and discovery over UDP, see ping.c. Datagrams are text */
+#define PING_REQUEST "AssistPing"
+#define PING_REPLY "AssistPong"
+#define DISCOVER_REQUEST "AssistDiscover"
+#define DISCOVER_REPLY "AssistBoard"
+#define DISCOVERY_GROUP "239.255.56.78"
+#define DISCOVERY_TIMEOUT_MS 500
+#define PING_DATAGRAM_SIZE 512
+#define PING_COUNT 4
+#define PING_MAX_COUNT 1000
+#define PING_INTERVAL_MS 100
+#define PING_TIMEOUT_MS 1000
+#define PING_FEATURES "exec,logs,health,journal,clock-sync,file-sync,can-generate,capture,events,sessions,ring,hot-restart"
+
+
+/* Start of the shared ring mapping. head is written by the server only,
+ * tail by DUT only, on cache lines of their own */
+struct ring_header
+{
+	unsigned long long magic;
+	unsigned long long size;
+	unsigned long long head __attribute__((aligned(64)));   /* Bytes written */
+	unsigned int consumer_waiting;                        /* DUT sleeps on data_fd */
+	unsigned int closed;                                  /* Reply complete */
+	unsigned long long tail __attribute__((aligned(64)));   /* Bytes read */
+	unsigned int producer_waiting;                        /* Server sleeps on space_fd */
+};
+
+/* One side of a ring, header NULL when not in use */
+struct ring
+{
+	struct ring_header* header;
+	char* data;
+	size_t size;
+	size_t map_len;
+	int data_fd;                  /* eventfd, server to DUT : data or close */
+	int space_fd;                 /* eventfd, DUT to server : space freed */
+};
+
+/* Assist boards known to DUT, see get_assist_boards() */
+#define MAX_BOARDS 16
+#define BOARD_NAME_SIZE 32
+
+enum board_state
+{
+	BOARD_CONNECTING,
+	BOARD_SENDING,
+	BOARD_RECEIVING,
+	BOARD_DONE,
+	BOARD_FAILED
+};
+
+struct assist_board
+{
+	char name[BOARD_NAME_SIZE];
+	char ip_addr[INET_ADDRSTRLEN];
+	int sockfd;
+	enum board_state state;
+	char* request;
+	size_t request_len;
+	long long sent_us;
+	size_t sent_len;
+	char* reply;
+	size_t reply_len;
+	size_t reply_size;
+	int local;                    /* Connected on the local socket */
+	int ring_size;                /* Ring asked for, 0 for none */
+	struct ring ring;
+	int discovered;               /* Found by discover_boards(), not in config */
+};
+
+/* Configuration, parsed once from ASSIST_CONF_FILE. See config.c */
+struct assist_config
+{
+	int port;
+	int request_size;
+	int chunk_size;
+	int worker_count;
+	int express_workers;
+	int bulk_rate_kbps;
+	int socket_timeout_ms;
+	int connect_timeout_ms;
+	int deadline_ms;
+	int telemetry_interval_ms;
+	int reply_high_water;
+	int reply_low_water;
+	char console_log_file[PATH_MAX];
+	char journal_file[PATH_MAX];
+	int journal_records;
+	char trace_file[PATH_MAX];
+	char local_socket[PATH_MAX];
+	int ring_size;
+	int capture_realtime;
+	int capture_cpu;
+	int capture_priority;
+	int capture_buffer_frames;
+	int session_max_processes;
+	int session_max_log_bytes;
+	int session_max_workers;
+	char session[SESSION_NAME_SIZE];
+	int ping_port;
+	char discovery_group[INET_ADDRSTRLEN];
+	int discovery_timeout_ms;
+	int discover;
+	char board_name[BOARD_NAME_SIZE];
+	struct assist_board boards[MAX_BOARDS];
+	int board_count;
+	int refcount;
+};
+
+/* Per-connection bump allocator, reset after each request */
+struct arena
+{
+	char* base;
+	size_t size;
+	size_t used;
+	size_t high_water;
+};
+
+/* Reply is a scatter/gather list of pooled segments, memory views and file ranges */
+struct reply_segment
+{
+	struct reply_segment* next;
+	size_t len;
+	char data[REPLY_SEGMENT_SIZE];
+};
+
+struct reply_iov
+{
+	const char* base;
+	size_t len;
+	struct reply_segment* segment;
+	int fd;
+	off_t offset;
+};
+
+struct reply
+{
+	int sockfd;
+	struct reply_iov iov[REPLY_MAX_IOV];
+	int iov_count;
+	int segment_count;
+	size_t total_len;
+	size_t sent_len;
+	size_t queued;
+	size_t high_water;
+	size_t low_water;
+	int error;
+	int zerocopy;
+	unsigned int zerocopy_sent;
+	unsigned int zerocopy_done;
+	int trace;
+	unsigned int hash;
+	struct ring ring;             /* Reply goes to the shared ring, not the socket */
+};
+
+/* Process as seen in /proc */
+struct proc_entry
+{
+	pid_t pid;
+	char state;
+	char comm[16];
+	char argv0[64];
+	char argv1[64];
+	char session[SESSION_NAME_SIZE];  /* ASSIST_SESSION of its environment, empty for none */
+	unsigned long cpu_ms;
+	long rss_kb;
+	unsigned long long starttime;
+	int unsettled;                    /* New at the last refresh, may not have exec'd yet */
+};
+
+/* Journal file is this header followed by the records */
+struct journal_header
+{
+	unsigned long long magic;
+	unsigned int record_size;
+	unsigned int capacity;
+	unsigned long long next;
+	long long wall_offset_ns;
+	char boot_id[40];
+	char reserved[56];
+};
+
+struct journal_record
+{
+	unsigned long long sequence;
+	long long time_ns;
+	unsigned short type;
+	unsigned short reserved;
+	unsigned int id;
+	pid_t pid;
+	int padding;
+	long long value;
+	char text[88];
+};
+
+/* Trace file is this header followed by records, each followed by its request text */
+struct trace_header
+{
+	char magic[8];
+	unsigned int record_size;
+	unsigned int reserved;
+};
+
+struct trace_record
+{
+	unsigned int size;
+	unsigned int request_len;
+	long long start_us;
+	unsigned int duration_us;
+	int deadline_ms;
+	unsigned long long reply_len;
+	unsigned int reply_hash;
+	int status;
+};
+
+/* Replay of one traced request, see assist-replay.c */
+struct replay_result
+{
+	long long latency_us;
+	size_t reply_len;
+	int failed;
+	int differs;
+};
+
+/* Clock sync result, assist board time and offset to DUT in us */
+struct clock_sample
+{
+	long long board_us;
+	long long offset_us;
+	long long rtt_us;
+	double drift_ppm;
+};
+
+/* Sync results of one DUT, known by its address and session */
+struct clock_peer
+{
+	char key[CLOCK_SYNC_KEY_SIZE];
+	struct clock_sample history[CLOCK_SYNC_HISTORY];   /* Oldest first */
+	int count;
+	unsigned long long used;                            /* Least recently synced is replaced */
+};
+
+/* Command sent to the executor, command text follows */
+struct executor_request
+{
+	int deadline_ms;
+	char log_file[PATH_MAX];
+	char session[SESSION_NAME_SIZE];
+	char command[];
+};
+
+struct executor_reply
+{
+	int status;
+	int timed_out;
+};
+
+/* Command started by the executor */
+struct executor_job
+{
+	pid_t pid;
+	int reply_fd;
+	long long deadline_at;
+	int timed_out;
+};
+
+/* Program path resolved from PATH */
+struct executor_path
+{
+	char name[64];
+	char path[PATH_MAX];
+};
+
+/* Counters of a CAN interface or UART at sample time */
+struct telemetry_link
+{
+	char name[16];
+	unsigned long long rx;
+	unsigned long long tx;
+	unsigned long long rx_dropped;
+	unsigned long long tx_dropped;
+	unsigned long long rx_errors;
+	unsigned long long tx_errors;
+};
+
+/* One health sample of the assist board */
+struct telemetry_sample
+{
+	unsigned long long time_ms;
+	int cpu_permille;
+	int load1_centi;
+	unsigned long mem_total_kb;
+	unsigned long mem_avail_kb;
+	int queue_depth;
+	int workers_busy;
+	int segments_free;
+	int segments_total;
+	struct telemetry_link links[TELEMETRY_MAX_LINKS];
+	int link_count;
+};
+
+/* Frames to generate, parsed from a CanGenerate request */
+struct can_pattern
+{
+	char ifname[IFNAMSIZ];
+	canid_t id_first;
+	canid_t id_last;
+	int id_mode;
+	unsigned char data[CAN_MAX_DLEN];
+	int len;
+	int data_mode;
+	long long count;
+	int rate;
+	int burst;
+};
+
+/* Outcome of a generator run */
+struct can_result
+{
+	long long sent;
+	long long elapsed_ns;
+	long long send_errors;
+	int last_errno;
+	int stopped;
+};
+
+/* Capture file : header, records, block index, ID summary, trailer.
+ * A capture still being written has no index and no trailer */
+struct capture_header
+{
+	char magic[8];
+	unsigned int record_size;
+	unsigned int index_stride;
+	char ifname[IFNAMSIZ];
+	long long start_ns;
+};
+
+/* One frame. Time is the kernel receive time, wall-clock ns */
+struct capture_record
+{
+	long long time_ns;
+	unsigned int can_id;
+	unsigned char len;
+	unsigned char flags;
+	unsigned short reserved;
+	unsigned char data[CAN_MAX_DLEN];
+};
+
+/* Every index_stride records : time of the first and a bloom filter of IDs */
+struct capture_block
+{
+	long long time_ns;
+	unsigned long long record;
+	unsigned long long id_bloom[CAPTURE_BLOOM_WORDS];
+};
+
+/* Frames of one CAN ID, sorted by can_id in the file */
+struct capture_id
+{
+	unsigned int can_id;
+	unsigned int reserved;
+	unsigned long long frames;
+	unsigned long long first_record;
+	unsigned long long last_record;
+};
 
+struct capture_trailer
+{
+	unsigned long long index_offset;
+	unsigned long long records;
+	unsigned int block_count;
+	unsigned int id_count;
+	unsigned int flags;                 /* CAPTURE_IDS_* */
+	unsigned int reserved;
+	char magic[8];
+};
+
+/* recvmmsg() batch of a capture thread */
+struct capture_rx
+{
+	struct can_frame frames[CAPTURE_BATCH];
+	struct mmsghdr msgs[CAPTURE_BATCH];
+	struct iovec iov[CAPTURE_BATCH];
+	char control[CAPTURE_BATCH][CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(unsigned int))];
+	struct capture_record records[CAPTURE_BATCH];
+};
+
+/* Capture status flags */
+#define CAPTURE_REALTIME 1    /* Receive thread feeds a buffer, writer thread writes it */
+#define CAPTURE_SCHEDULED 2   /* Receive thread got SCHED_FIFO and CPU affinity */
+#define CAPTURE_LOCKED 4      /* Buffer and receive thread stack are locked in memory */
+
+/* Running capture. In realtime mode the receive thread (thread) puts
+ * frames in buffer at head, the writer thread takes them at tail */
+struct capture
+{
+	char path[PATH_MAX];
+	char ifname[IFNAMSIZ];
+	int fd;
+	int sockfd;
+	int running;
+	int status;
+	char session[SESSION_NAME_SIZE];    /* Session which started it */
+	pthread_t thread;
+	unsigned long long records;
+	unsigned int drops;
+	int write_errno;
+	struct capture_block* blocks;
+	unsigned int block_count;
+	unsigned int block_alloc;
+	struct capture_id ids[CAPTURE_MAX_IDS];
+	unsigned int id_count;
+	int ids_incomplete;                 /* An ID past CAPTURE_MAX_IDS was seen */
+	short id_slots[CAPTURE_ID_SLOTS];
+	pthread_t writer;
+	int draining;
+	struct capture_record* buffer;
+	unsigned long long buffer_frames;   /* Power of two */
+	size_t buffer_len;
+	void* stack;
+	unsigned long long head __attribute__((aligned(64)));
+	unsigned long long overruns;        /* Frames lost to a full buffer */
+	unsigned long long high_water;      /* Most frames waiting in the buffer */
+	unsigned long long tail __attribute__((aligned(64)));
+};
+
+/* Counters of a stopped capture */
+struct capture_counters
+{
+	unsigned long long records;
+	unsigned int drops;                 /* Socket receive queue overflows (SO_RXQ_OVFL) */
+	unsigned long long overruns;
+	unsigned long long high_water;
+	unsigned long long buffer_frames;
+	int status;
+};
+
+/* Capture file mapped for reading */
+struct capture_map
+{
+	char* file;
+	size_t size;
+	const struct capture_header* header;
+	const struct capture_record* records;
+	unsigned long long count;
+	const struct capture_trailer* trailer;   /* NULL for a capture without index */
+	const struct capture_block* blocks;
+	const struct capture_id* ids;
+};
+
+/* Inter-arrival times of one CAN ID. Mean and variance are updated as
+ * frames come (Welford), jitter buckets count the change of the interval
+ * from the previous one : <10us, <100us, <1ms, <10ms and above */
+struct capture_id_stats
+{
+	unsigned int can_id;                     /* With CAN_EFF_FLAG */
+	unsigned long long frames;
+	unsigned long long remote;
+	long long last_ns;
+	long long interval_ns;
+	long long min_ns;
+	long long max_ns;
+	double mean_ns;
+	double m2;
+	unsigned long long jitter[CAPTURE_JITTER_BUCKETS];
+};
+
+/* Aggregates of CaptureStats */
+struct capture_stats
+{
+	unsigned long long frames;
+	unsigned long long extended;
+	unsigned long long error_frames;
+	unsigned long long errors[CAPTURE_ERROR_CLASSES];   /* By CAN_ERR_* class bit */
+	unsigned long long bits;
+	unsigned long long untracked;             /* Frames of IDs past CAPTURE_MAX_IDS */
+	long long first_ns;
+	long long last_ns;
+	struct capture_id_stats ids[CAPTURE_MAX_IDS];
+	unsigned int id_count;
+	short id_slots[CAPTURE_ID_SLOTS];
+};
+
+/* Frames wanted by CaptureFetch and CaptureStats */
+struct capture_filter
+{
+	long long from_ns;
+	long long to_ns;
+	unsigned int can_id;
+	unsigned int mask;
+	unsigned long long first;
+	unsigned long long last;
+	long long max;
+};
+
+/* Subscription of a DUT connection to server events. Notifications are
+ * pushed on the connection till count is reached, deadline or DUT close */
+struct event_subscription
+{
+	unsigned int id;
+	int type;
+	int sockfd;                   /* Own copy of the DUT connection */
+	int count;                    /* Events wanted, 0 for no limit */
+	int sent;
+	int deadline_ms;
+	long long expiry_ns;          /* Monotonic, 0 for none */
+	char text[EVENT_LINE_SIZE];   /* As subscribed */
+	char session[SESSION_NAME_SIZE];
+
+	/* EVENT_EXIT : processes by PID or name */
+	int pid_fd[EVENT_MAX_PIDS];
+	pid_t pids[EVENT_MAX_PIDS];
+	int pid_count;
+	int pid_alive;
+
+	/* EVENT_LOG : console log line pattern, in the log of the session */
+	regex_t regex;
+	int regex_valid;
+	int log;                      /* Followed log, see event_log_open() */
+
+	/* EVENT_CAN : frames of an ID/mask */
+	char ifname[IFNAMSIZ];
+	unsigned int can_id;
+	unsigned int can_mask;
+	int can_fd;
+
+	/* EVENT_THRESHOLD : telemetry metric crossing a value */
+	int metric;
+	int op;
+	long long value;
+	int crossed;
+};
+
+/* Console log followed for log subscriptions, one per session log */
+struct event_log
+{
+	char path[PATH_MAX];
+	int fd;
+	int watch;
+	int subscribers;
+	off_t offset;                 /* Scanned so far */
+	char line[EVENT_LINE_SIZE];
+	size_t line_len;
+};
+
+/* Telemetry value usable in a threshold subscription */
+struct event_metric
+{
+	const char* name;
+	size_t offset;                /* In struct telemetry_sample */
+	int is_long;                  /* unsigned long, else int */
+};
+
+/* Accepted connection waiting for a worker */
+struct work_item
+{
+	int connfd;
+	int priority;
+	int session;                  /* Slot from session_get() */
+};
+
+/* Priority class of a request, by its opcode */
+struct request_class
+{
+	const char* opcode;
+	int priority;
+};
+
+/* Session table entry, see session.c */
+struct session
+{
+	char name[SESSION_NAME_SIZE];     /* Empty for the default session and free slots */
+	int refs;                         /* Requests of the session queued or served */
+	unsigned long long requests;
+	long long last_ms;                /* Monotonic time of the last request */
+};
+
+/* DUT connection being served by a worker */
+struct assist_conn
+{
+	int sockfd;
+	int priority;
+	char session[SESSION_NAME_SIZE];  /* Empty for the default session */
+	size_t high_water;
+	size_t low_water;
+	int deadline_ms;
+	long long sent_us;
+	unsigned int journal_id;
+	struct assist_config* config;     /* Taken once per request, see worker_serve() */
+	struct arena arena;
+	struct reply reply;
+};
+
+
+/* Request of a libassist client, see libassist.c */
+struct assist_call
+{
+	struct assist_board board;
+	unsigned int id;
+	char* request;                /* As submitted */
+	char* text;                   /* With deadline prefix, stamped on connect */
+	long long submit_ns;          /* Monotonic */
+	long long connect_expiry_ns;
+	long long expiry_ns;          /* 0 without deadline */
+	int error;
+	assist_callback callback;
+	void* user;
+	struct assist_call* next;
+};
+
+/* libassist client : one board, calls multiplexed on one epoll fd */
+struct assist_client
+{
+	char ip_addr[INET_ADDRSTRLEN];
+	int port;
+	int connect_timeout_ms;
+	int chunk_size;
+	int epoll_fd;
+	int timer_fd;                 /* Nearest timeout of the calls */
+	unsigned int next_id;
+	int pending;
+	char session[SESSION_NAME_SIZE]; /* Empty for the default session */
+	struct assist_call* calls;
+};
+
+/* Frame of a file sync, payload follows */
+struct delta_frame
+{
+	unsigned int type;
+	unsigned int length;
+};
+
+/* DELTA_FILE payload, relative path follows (empty for a single file) */
+struct delta_file
+{
+	unsigned long long size;
+	long long mtime_ns;
+	unsigned int mode;
+	unsigned int flags;
+};
+
+/* DELTA_SIGNATURES payload, signatures of the full blocks follow */
+struct delta_blocks
+{
+	unsigned int block_size;
+	unsigned int flags;
+};
+
+struct delta_signature
+{
+	unsigned int weak;            /* Rolling checksum */
+	unsigned int reserved;
+	unsigned long long strong;
+};
+
+/* DELTA_COPY payload : count blocks of the old file from block */
+struct delta_copy
+{
+	unsigned int block;
+	unsigned int count;
+};
+
+/* Frames of a file being pushed, sent when the buffer is full */
+struct delta_output
+{
+	int sockfd;
+	size_t len;
+	unsigned char buffer[DELTA_OUT_SIZE];
+};
+
+/* Totals of a file sync, on both sides */
+struct delta_result
+{
+	unsigned long long files;
+	unsigned long long changed;
+	unsigned long long dirs;
+	unsigned long long failed;
+	unsigned long long skipped;
+	unsigned long long bytes;     /* Size of the files */
+	unsigned long long literal;   /* Bytes sent as data, the rest is copied from old files */
+};
+
+/* Running capture handed to the new server, with its socket and file */
+struct handoff_capture
+{
+	char path[PATH_MAX];
+	char ifname[IFNAMSIZ];
+	char session[SESSION_NAME_SIZE];
+	int realtime;
+	unsigned long long overruns;
+	unsigned long long high_water;
+};
+
+/* Subscription handed to the new server, with its DUT connection */
+struct handoff_event
+{
+	unsigned int id;
+	int count;
+	int sent;
+	int deadline_ms;
+	long long remaining_ms;       /* Of the deadline, 0 for none */
+	char session[SESSION_NAME_SIZE];
+	char text[EVENT_LINE_SIZE + 16]; /* "<type> <as subscribed>" */
+};
+
+/* Message on the hot restart channel, descriptors go along as SCM_RIGHTS */
+struct handoff_message
+{
+	int type;
+	int port;                     /* HANDOFF_LISTEN */
+	int count;                    /* HANDOFF_SESSIONS */
+	union
+	{
+		struct handoff_capture capture;
+		struct handoff_event event;
+		struct session sessions[SESSION_MAX];
+	} data;
+};
 
 /* Uncomment below line and compile the code to get more informative logs */
 /* #define DEBUG 1 */
 
 
+/* Configuration */
+int load_config(const char* path);
+struct assist_config* config_get(void);
+void config_put(struct assist_config* config);
+
+/* Request path memory */
+int arena_init(struct arena* arena, size_t size);
+void* arena_alloc(struct arena* arena, size_t size);
+char* arena_printf(struct arena* arena, const char* format, ...);
+void arena_reset(struct arena* arena);
+void arena_destroy(struct arena* arena);
+struct reply_segment* segment_get(void);
+void segment_put(struct reply_segment* segment);
+void segment_pool_stats(int* free_count, int* total_count);
+
+/* Reply to DUT */
+void reply_init(struct reply* reply, int sockfd);
+int reply_use_ring(struct reply* reply, int size);
+void reply_set_watermarks(struct reply* reply, size_t high_water, size_t low_water);
+char* reply_reserve(struct reply* reply, size_t* space);
+void reply_commit(struct reply* reply, size_t len);
+int reply_append(struct reply* reply, const char* data, size_t len);
+int reply_printf(struct reply* reply, const char* format, ...);
+int reply_append_view(struct reply* reply, const char* data, size_t len);
+int reply_append_file(struct reply* reply, int fd, off_t offset, size_t len);
+int reply_flush(struct reply* reply);
+int reply_send(struct reply* reply);
+void reply_release(struct reply* reply);
+
+/* Process lookup */
+int proc_scan_find(const char* name, int mode, pid_t after, struct proc_entry* results, int max_results);
+int proc_scan_session(const char* session);
+int proc_scan_reply(struct reply* reply, struct proc_entry* results, int count);
+
 /* Create daemon with send/recv functions */
-int create_socket(void);
-char* read_socket(int sockfd);
+int create_socket(int port);
+int create_local_socket(const char* path);
+char* read_socket(struct assist_conn* conn);
 int write_socket(char* console_logs, int sockfd);
+int set_socket_timeout(int sockfd, int timeout_ms);
+
+/* Worker threads serving the accepted connections */
+int worker_pool_start(int count, int express_workers, int session_workers);
+int worker_pool_resize(int count, int express_workers, int session_workers);
+int worker_pool_submit(int connfd);
+int worker_pool_depth(void);
+int worker_pool_busy(void);
+int worker_pool_detach(void);
+
+/* CAN frame generator */
+int can_parse_pattern(char* text, struct can_pattern* pattern);
+int can_generate(struct can_pattern* pattern, int deadline_ms, struct can_result* result);
+
+/* CAN capture */
+int capture_start(struct assist_config* config, const char* ifname, const char* path, int realtime, const char* session, int* status);
+int capture_stop(const char* path, const char* session, struct capture_counters* counters);
+long long capture_fetch(struct reply* reply, const char* path, struct capture_filter* filter, unsigned long long* total);
+long long capture_statistics(struct reply* reply, const char* path, struct capture_filter* filter, int bitrate, unsigned long long* total);
+int capture_detach(struct handoff_capture* state, int* fds);
+int capture_adopt(const struct handoff_capture* state, int sockfd, int fd);
+
+/* Shared memory ring */
+int ring_create(struct ring* ring, size_t size);
+int ring_offer(struct ring* ring, int sockfd, int memfd);
+int ring_write(struct ring* ring, const char* data, size_t len, int sockfd);
+int ring_write_file(struct ring* ring, int fd, off_t* offset, size_t len, int sockfd);
+void ring_finish(struct ring* ring);
+int ring_attach(struct ring* ring, int* fds, size_t size);
+size_t ring_peek(struct ring* ring, const char** data);
+void ring_consume(struct ring* ring, size_t len);
+int ring_wait_data(struct ring* ring);
+void ring_detach(struct ring* ring);
+
+/* Event subscriptions */
+int event_start(void);
+int event_parse(char* request, struct event_subscription* sub);
+int event_subscribe(struct event_subscription* sub, struct assist_conn* conn);
+void event_telemetry(struct telemetry_sample* sample);
+int event_detach(struct handoff_event* state, int* sockfd);
+int event_adopt(const struct handoff_event* state, int sockfd);
+
+/* Sessions of DUTs sharing the assist board */
+int session_valid(const char* name);
+int session_get(const char* name);
+void session_put(int slot);
+void session_log_file(struct assist_config* config, const char* name, char* path, size_t size);
+char** session_environ(const char* name);
+int session_admit(struct assist_config* config, const char* name, struct reply* reply);
+int session_report(struct assist_config* config, struct reply* reply, const char* current);
+int session_export(struct session* copy);
+void session_import(const struct session* copy, int count);
+
+/* Delta file sync */
+unsigned long long delta_hash(unsigned long long hash, const unsigned char* data, size_t len);
+int delta_serve(int sockfd, const char* root, int timeout_ms, struct delta_result* result);
+int delta_push(int sockfd, const char* local, int timeout_ms, struct delta_result* result);
+
+/* Hot restart */
+void handoff_init(char** argv);
+int handoff_start(int sockfd, int local_fd, int port);
+int handoff_receive(int channel, int* sockfd, int* local_fd, int* port);
+int handoff_next(int channel);
+int handoff_return(int channel);
+
+/* Health pings and discovery */
+int ping_start(int port, const char* group);
+
+/* Event journal */
+int journal_open(const char* path, int records, int live);
+unsigned int journal_append(int type, unsigned int id, pid_t pid, long long value, const char* text);
+int journal_reply(struct reply* reply, long long from_ms, long long to_ms);
+
+/* Request trace */
+unsigned int trace_hash(unsigned int hash, const void* data, size_t len);
+int trace_open(const char* path);
+int trace_enabled(void);
+int trace_append(struct trace_record* record, const char* request);
+
+/* Clock offset between DUT and assist board */
+long long clock_sync_now_us(void);
+int clock_sync_serve(struct assist_conn* conn, struct clock_sample* result);
+
+/* Command executor process */
+int executor_start(void);
+int executor_run(char* command, const char* log_file, const char* session, int deadline_ms, int* timed_out, int* status);
+
+/* Health telemetry */
+int telemetry_start(void);
+int telemetry_history(struct telemetry_sample* samples, int max_samples);
+int telemetry_reply(struct reply* reply, struct telemetry_sample* sample, int compact);
+
+/* DUT side of the protocol */
+void client_set_quiet(int quiet);
+int client_create_socket(char* ip_addr, int port);
+int client_create_local(const char* path);
+int client_write_socket(struct assist_board* board);
+int client_read_socket(struct assist_board* board, int chunk_size);
+int client_wait_socket(int sockfd, short events, int timeout_ms);
+int client_read_line(struct assist_board* board, char* line, size_t size, size_t* len, int timeout_ms);
+int get_assist_boards(struct assist_config* config, struct assist_board* boards, int max_boards);
+int select_assist_boards(struct assist_board* boards, int count, char* names);
+int stamp_request(struct assist_board* board, char* request);
+int fanout_request(struct assist_config* config, struct assist_board* boards, int count, char* request, int timeout_ms);
+int clock_sync_exchange(struct assist_config* config, struct assist_board* board, const char* session, int samples, long long* offset_us, long long* rtt_us);
+int clock_sync_board(struct assist_config* config, struct assist_board* board, const char* session, int samples);
+int ping_board(struct assist_config* config, struct assist_board* board, int count);
+int discover_boards(struct assist_config* config, struct assist_board* boards, int max_boards, int report);
 
 /* Service devider functions */
-int service_request(int sockfd);
+int service_request(struct assist_conn* conn);
+char* parse_request_deadline(char* request, int* deadline_ms);
+char* parse_request_sent(char* request, long long* sent_us);
+char* parse_request_ring(char* request, int* ring_size);
+char* parse_request_session(char* request, char* session);
+char* request_argument(char* request, char* keyword);
+int request_priority(const char* request);
+void request_session(const char* request, char* session);
 
 // Service functions
-int request_console_logs(int sockfd);
-char* collect_console_logs();
-int clear_console_logs(int sockfd);
-int reboot_assist_board(int sockfd);
-int health_check_assist_board(int sockfd);
-int start_process(char* request, int sockfd);
-int check_process_running(char* request, int sockfd);
-int kill_running_process(char* request, int sockfd);
-int execute_request(char* request, int sockfd);
+int request_console_logs(struct assist_conn* conn);
+long append_console_logs(struct assist_config* config, struct reply* reply, const char* session);
+int clear_console_logs(struct assist_conn* conn);
+int reboot_assist_board(struct assist_conn* conn);
+int health_check_assist_board(struct assist_conn* conn, char* request);
+int request_journal(struct assist_conn* conn, char* request);
+int sync_assist_clock(struct assist_conn* conn);
+int sync_files(struct assist_conn* conn, char* request);
+int generate_can_frames(struct assist_conn* conn, char* request);
+int start_can_capture(struct assist_conn* conn, char* request);
+int stop_can_capture(struct assist_conn* conn, char* request);
+int fetch_capture(struct assist_conn* conn, char* request);
+int report_capture_stats(struct assist_conn* conn, char* request);
+int subscribe_events(struct assist_conn* conn, char* request);
+int start_process(struct assist_conn* conn, char* request);
+int check_process_running(struct assist_conn* conn, char* request);
+int kill_running_process(struct assist_conn* conn, char* request);
+int report_sessions(struct assist_conn* conn);
+int execute_request(struct assist_conn* conn, char* request);
+int run_command(char* command, const char* log_file, const char* session, int deadline_ms, int* timed_out);
 
 #endif
\ No newline at end of file
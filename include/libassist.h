@@ -0,0 +1,83 @@
+/** @file libassist.h
+ *  @brief Client library of the assist protocol
+ *
+ *  Send requests to an assist board from a test harness, without forking
+ *  dut-client and parsing its output. Requests are asynchronous : submit
+ *  any number of them, poll assist_fd() (or call assist_process() with a
+ *  timeout) and each completion is delivered to its callback with a
+ *  struct assist_result.
+ *
+ *  static void done(const struct assist_result* result, void* user)
+ *  {
+ *      printf("%u : %d %.*s\n", result->id, result->return_value, (int)result->reply_len, result->reply);
+ *  }
+ *
+ *  struct assist_client* client = assist_open("192.168.1.20", 0);
+ *  assist_submit(client, "cansend can0 123#00", 5000, done, NULL);
+ *  while(assist_pending(client) > 0)
+ *      assist_process(client, -1);
+ *  assist_close(client);
+ *
+ *  A client is not thread safe, use one per thread. Build with
+ *  -lassist -lpthread (libassist.a or libassist.so).
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#ifndef LIBASSIST_H
+#define LIBASSIST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Outcome of a request. Pointers are valid during the callback only */
+struct assist_result
+{
+	unsigned int id;          /* From assist_submit() */
+	int status;               /* 0 replied, -1 failed (see error) */
+	int error;                /* errno value when failed, e.g. ETIMEDOUT, ECONNREFUSED */
+	const char* request;      /* Request as submitted */
+	const char* reply;        /* Reply text without "AssistDataEnds", NUL terminated */
+	size_t reply_len;
+	int has_return_value;     /* Reply has "Return value is <n>" */
+	int return_value;         /* Exit status of the command, when has_return_value */
+	long long sent_us;        /* Wall-clock time the request was sent */
+	long long latency_us;     /* Submit to completion */
+};
+
+struct assist_client;
+
+typedef void (*assist_callback)(const struct assist_result* result, void* user);
+
+/* ip_addr NULL for the first board of the configuration file, port 0 for configured port.
+ * With discover=1 and no board in the file, fails with ENOTUNIQ when several boards answer */
+struct assist_client* assist_open(const char* ip_addr, int port);
+void assist_close(struct assist_client* client);
+
+/* Session of the following requests on a shared board, NULL or "" for the default session */
+int assist_set_session(struct assist_client* client, const char* session);
+
+/* Returns request id, -1 on error. deadline_ms 0 for none */
+int assist_submit(struct assist_client* client, const char* request, int deadline_ms, assist_callback callback, void* user);
+
+/* Readable when assist_process() has work */
+int assist_fd(struct assist_client* client);
+
+/* Run ready requests and deliver completions. timeout_ms -1 waits, 0 does not */
+int assist_process(struct assist_client* client, int timeout_ms);
+
+int assist_pending(struct assist_client* client);
+
+/* Blocking request. result->reply is malloc'd, release with assist_result_free() */
+int assist_request(struct assist_client* client, const char* request, int deadline_ms, struct assist_result* result);
+void assist_result_free(struct assist_result* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+/** @file journal.c
+ *  @brief Timestamped event journal of the assist server
+ *
+ *  Requests, replies, process spawns and exits, clock syncs (and captured
+ *  frames) are appended to journal_file as fixed size binary records. The
+ *  file is memory mapped, so an append is a few stores, no system call.
+ *
+ *  Records carry CLOCK_MONOTONIC time. The header keeps the offset to
+ *  wall-clock time, so records can be lined up with DUT logs. Oldest
+ *  records are overwritten once journal_records are written.
+ *
+ *  The mapping is shared with the executor process, appends reserve their
+ *  slot with an atomic add on the header and publish it with the record
+ *  sequence number, so no lock is needed between threads or processes.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Mapped journal, NULL when journal is disabled */
+static struct journal_header* journal = NULL;
+static struct journal_record* journal_records = NULL;
+
+static const char* journal_type_names[] = { "NONE", "REQUEST", "REPLY", "SPAWN", "EXIT", "FRAME", "CLOCK", "EVENT" };
+
+
+/** @file journal.c
+ *  @brief Monotonic time in ns
+ */
+
+static long long journal_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/** @file journal.c
+ *  @brief Offset of wall-clock time to monotonic time in ns
+ */
+
+static long long journal_wall_offset_ns(void)
+{
+	struct timespec wall;
+
+	clock_gettime(CLOCK_REALTIME, &wall);
+	return ((long long)wall.tv_sec * 1000000000LL + wall.tv_nsec) - journal_now_ns();
+}
+
+
+/** @file journal.c
+ *  @brief Check a journal header against the layout wanted
+ *
+ *  @param header, records and boot_id
+ *  @return 1 when the journal can be continued, 0 otherwise
+ */
+
+static int journal_matches(const struct journal_header* header, int records, const char* boot_id)
+{
+	return (header->magic == JOURNAL_MAGIC) && (header->record_size == sizeof(struct journal_record)) &&
+		(header->capacity == (unsigned int)records) && (memcmp(header->boot_id, boot_id, sizeof(header->boot_id)) == 0);
+}
+
+
+/** @file journal.c
+ *  @brief Open and map the journal file
+ *
+ *  Journal of the same boot and size is continued, otherwise it starts
+ *  empty (monotonic time restarts on boot).
+ *
+ *  On a hot restart the old server (and its executor) still append to
+ *  the file. A journal of another layout is then renamed to <path>.old
+ *  and a new one is created, the old server is never cut or cleared
+ *  under its mapping.
+ *
+ *  @param path, records (capacity, 0 disables the journal) and live (1 when
+ *         the file may be mapped by the server this one takes over)
+ *  @return 0 on success, -1 on error
+ */
+
+int journal_open(const char* path, int records, int live)
+{
+	struct journal_header* header = NULL;
+	struct journal_header current;
+	struct stat file_stat;
+	char boot_id[sizeof(header->boot_id)];
+	char aside[PATH_MAX];
+	size_t size = sizeof(struct journal_header) + (size_t)records * sizeof(struct journal_record);
+	int fd = -1;
+
+	if(records <= 0)
+	{
+		return 0;
+	}
+
+	bzero(boot_id, sizeof(boot_id));
+	if((fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC)) != -1)
+	{
+		if(read(fd, boot_id, sizeof(boot_id) - 1) < 0)
+		{
+			boot_id[0] = '\0';
+		}
+		close(fd);
+	}
+
+	if((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+	{
+		printf("\nAssist : Open journal %s fail, %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	/* In use by the old server with another layout, leave it to it */
+	bzero(&current, sizeof(current));
+	if((live) && (fstat(fd, &file_stat) == 0) && (file_stat.st_size > 0) &&
+		(((size_t)file_stat.st_size != size) || (pread(fd, &current, sizeof(current), 0) != sizeof(current)) ||
+		(!journal_matches(&current, records, boot_id))))
+	{
+		close(fd);
+		snprintf(aside, sizeof(aside), "%s.old", path);
+		if((rename(path, aside) != 0) || ((fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1))
+		{
+			printf("\nAssist : Move journal %s aside fail, %s\n", path, strerror(errno));
+			return -1;
+		}
+		printf("\nAssist : Journal %s of the old server moved to %s\n", path, aside);
+	}
+
+	if((fstat(fd, &file_stat) == -1) || (((size_t)file_stat.st_size != size) && (ftruncate(fd, size) == -1)))
+	{
+		printf("\nAssist : Size journal %s fail, %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if((header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		printf("\nAssist : Map journal %s fail, %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	if(!journal_matches(header, records, boot_id))
+	{
+		bzero(header, size);
+		header->magic = JOURNAL_MAGIC;
+		header->record_size = sizeof(struct journal_record);
+		header->capacity = records;
+		memcpy(header->boot_id, boot_id, sizeof(boot_id));
+	}
+	header->wall_offset_ns = journal_wall_offset_ns();
+
+	journal_records = (struct journal_record*)(header + 1);
+	journal = header;
+
+	printf("\nAssist : Journal %s, %d records, %llu written\n", path, records, (unsigned long long)header->next);
+
+	return 0;
+}
+
+
+/** @file journal.c
+ *  @brief Append an event
+ *
+ *  Safe from any thread and from the executor process.
+ *
+ *  @param type (JOURNAL_*), id (request), pid, value and text (NULL for none)
+ *  @return record id (0 when journal is disabled)
+ */
+
+unsigned int journal_append(int type, unsigned int id, pid_t pid, long long value, const char* text)
+{
+	struct journal_record* record = NULL;
+	unsigned long long index = 0;
+
+	if(journal == NULL)
+	{
+		return 0;
+	}
+
+	index = __atomic_fetch_add(&journal->next, 1, __ATOMIC_RELAXED);
+	record = &journal_records[index % journal->capacity];
+
+	/* Readers skip the slot while it is written. The fence keeps the
+	 * field writes below from being seen before the 0 */
+	__atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	record->time_ns = journal_now_ns();
+	record->type = type;
+	record->id = id ? id : (unsigned int)(index + 1);
+	record->pid = pid;
+	record->value = value;
+	snprintf(record->text, sizeof(record->text), "%s", text ? text : "");
+	__atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+
+	return record->id;
+}
+
+
+/** @file journal.c
+ *  @brief Add the events of a wall-clock time range to the reply
+ *
+ *  One line per event, oldest first
+ *  "<wall s.us> <monotonic s.us> <TYPE> id=<id> pid=<pid> value=<value> <text>"
+ *
+ *  @param reply, from_ms and to_ms (wall-clock ms since epoch, 0 for open end)
+ *  @return number of events, -1 when journal is disabled
+ */
+
+int journal_reply(struct reply* reply, long long from_ms, long long to_ms)
+{
+	struct journal_record record;
+	unsigned long long next = 0;
+	unsigned long long index = 0;
+	unsigned long long sequence = 0;
+	long long wall_us = 0;
+	int count = 0;
+
+	if(journal == NULL)
+	{
+		return -1;
+	}
+
+	next = __atomic_load_n(&journal->next, __ATOMIC_ACQUIRE);
+	index = (next > journal->capacity) ? next - journal->capacity : 0;
+
+	for(; index < next; index++)
+	{
+		struct journal_record* slot = &journal_records[index % journal->capacity];
+
+		/* Copy, then check it was not rewritten meanwhile */
+		if((sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE)) != index + 1)
+		{
+			continue;
+		}
+		record = *slot;
+		/* Reads of the copy complete before the sequence is checked again */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence)
+		{
+			continue;
+		}
+
+		wall_us = (record.time_ns + journal->wall_offset_ns) / 1000;
+		if(((from_ms > 0) && (wall_us < from_ms * 1000)) || ((to_ms > 0) && (wall_us > to_ms * 1000)))
+		{
+			continue;
+		}
+
+		record.text[sizeof(record.text) - 1] = '\0';
+		reply_printf(reply, "%lld.%06lld %lld.%06lld %s id=%u pid=%d value=%lld %s\n",
+			wall_us / 1000000, wall_us % 1000000,
+			record.time_ns / 1000000000LL, (record.time_ns % 1000000000LL) / 1000,
+			(record.type < JOURNAL_TYPE_COUNT) ? journal_type_names[record.type] : "UNKNOWN",
+			record.id, record.pid, record.value, record.text);
+		count++;
+	}
+
+	return count;
+}
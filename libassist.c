@@ -0,0 +1,567 @@
+/** @file libassist.c
+ *  @brief Asynchronous requests to an assist board, see include/libassist.h
+ *
+ *  Every request is a struct assist_call holding a struct assist_board,
+ *  driven through connect, send and receive by the same non-blocking
+ *  helpers as fanout_request() (client.c). Sockets of all calls and a
+ *  timerfd for their timeouts are in one epoll set, which is the fd
+ *  given to the harness.
+ *
+ *  Connect must finish within the connect timeout, and a request with a
+ *  deadline must complete within deadline plus DEADLINE_GRACE_MS, as
+ *  with dut-client.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/** @file libassist.c
+ *  @brief Monotonic time in ns
+ */
+
+static long long assist_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/** @file libassist.c
+ *  @brief Open a client for one assist board
+ *
+ *  @param ip_addr (NULL for the first board of the configuration) and
+ *         port (0 for the configured port)
+ *  @return client on success, NULL on error
+ */
+
+struct assist_client* assist_open(const char* ip_addr, int port)
+{
+	struct assist_board boards[MAX_BOARDS];
+	struct assist_config* config = NULL;
+	struct assist_client* client = NULL;
+	struct epoll_event event;
+	int count = 0;
+
+	client_set_quiet(CLIENT_SILENT);
+
+	if((client = calloc(1, sizeof(*client))) == NULL)
+	{
+		return NULL;
+	}
+	client->port = port;
+	client->connect_timeout_ms = CONNECT_TIMEOUT_MS;
+	client->chunk_size = MAX_CHUNK_SIZE;
+	client->epoll_fd = -1;
+	client->timer_fd = -1;
+
+	/* Configuration only when something is left to it */
+	if((ip_addr == NULL) || (port == 0))
+	{
+		config = config_get();
+		if(ip_addr == NULL)
+		{
+			if(((count = get_assist_boards(config, boards, MAX_BOARDS)) <= 0) ||
+				(select_assist_boards(boards, count, NULL) <= 0))
+			{
+				config_put(config);
+				free(client);
+				errno = (count > 1) ? ENOTUNIQ : ENOENT;
+				return NULL;
+			}
+			ip_addr = boards[0].ip_addr;
+		}
+		client->port = (port == 0) ? config->port : port;
+		client->connect_timeout_ms = config->connect_timeout_ms;
+		snprintf(client->session, sizeof(client->session), "%s", config->session);
+		config_put(config);
+	}
+	snprintf(client->ip_addr, sizeof(client->ip_addr), "%s", ip_addr);
+
+	bzero(&event, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if(((client->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) ||
+		((client->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) ||
+		(epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, client->timer_fd, &event) == -1))
+	{
+		assist_close(client);
+		return NULL;
+	}
+
+	return client;
+}
+
+
+/** @file libassist.c
+ *  @brief Release a call
+ *
+ *  @param call
+ *  @return none
+ */
+
+static void assist_free_call(struct assist_call* call)
+{
+	if(call->board.sockfd != -1)
+	{
+		close(call->board.sockfd);
+	}
+	free(call->board.request);
+	free(call->board.reply);
+	free(call->text);
+	free(call->request);
+	free(call);
+}
+
+
+/** @file libassist.c
+ *  @brief Close a client
+ *
+ *  Pending requests are dropped without callback.
+ *
+ *  @param client
+ *  @return none
+ */
+
+void assist_close(struct assist_client* client)
+{
+	struct assist_call* call = NULL;
+
+	if(client == NULL)
+	{
+		return;
+	}
+
+	while((call = client->calls) != NULL)
+	{
+		client->calls = call->next;
+		assist_free_call(call);
+	}
+
+	if(client->timer_fd != -1)
+	{
+		close(client->timer_fd);
+	}
+	if(client->epoll_fd != -1)
+	{
+		close(client->epoll_fd);
+	}
+	free(client);
+}
+
+
+/** @file libassist.c
+ *  @brief Arm the timer for the nearest timeout of the calls
+ *
+ *  @param client
+ *  @return none
+ */
+
+static void assist_arm_timer(struct assist_client* client)
+{
+	struct itimerspec timer;
+	struct assist_call* call = NULL;
+	long long expiry_ns = 0;
+	long long call_expiry_ns = 0;
+
+	for(call = client->calls; call != NULL; call = call->next)
+	{
+		call_expiry_ns = (call->board.state == BOARD_RECEIVING) ? call->expiry_ns : call->connect_expiry_ns;
+		if((call_expiry_ns > 0) && ((expiry_ns == 0) || (call_expiry_ns < expiry_ns)))
+		{
+			expiry_ns = call_expiry_ns;
+		}
+	}
+
+	/* Zero disarms */
+	bzero(&timer, sizeof(timer));
+	timer.it_value.tv_sec = expiry_ns / 1000000000LL;
+	timer.it_value.tv_nsec = expiry_ns % 1000000000LL;
+	timerfd_settime(client->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+
+/** @file libassist.c
+ *  @brief Set the session of the requests submitted next
+ *
+ *  Board checks the name, see session.c. Client opened from the
+ *  configuration starts in its session= one.
+ *
+ *  @param client and session (NULL or empty string for the default session)
+ *  @return 0 on success, -1 on error (errno EINVAL)
+ */
+
+int assist_set_session(struct assist_client* client, const char* session)
+{
+	if(session == NULL)
+	{
+		session = "";
+	}
+
+	if((strlen(session) >= sizeof(client->session)) || (strchr(session, ' ') != NULL))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	snprintf(client->session, sizeof(client->session), "%s", session);
+	return 0;
+}
+
+
+/** @file libassist.c
+ *  @brief Submit a request
+ *
+ *  Connect starts right away, the rest happens in assist_process().
+ *
+ *  @param client, request, deadline_ms (0 for none), callback and user (given to callback)
+ *  @return request id on success, -1 on error (errno set)
+ */
+
+int assist_submit(struct assist_client* client, const char* request, int deadline_ms, assist_callback callback, void* user)
+{
+	struct assist_call* call = NULL;
+	struct epoll_event event;
+	char prefix[128] = "";
+	int len = 0;
+
+	if((call = calloc(1, sizeof(*call))) == NULL)
+	{
+		return -1;
+	}
+	call->board.sockfd = -1;
+	call->callback = callback;
+	call->user = user;
+
+	if((call->request = strdup(request)) == NULL)
+	{
+		assist_free_call(call);
+		return -1;
+	}
+
+	/* Send time prefix is added once connected, see stamp_request() */
+	if(client->session[0] != '\0')
+	{
+		snprintf(prefix, sizeof(prefix), "%s%s ", SESSION_TAG, client->session);
+	}
+	if(deadline_ms > 0)
+	{
+		snprintf(&prefix[strlen(prefix)], sizeof(prefix) - strlen(prefix), "%s%d ", DEADLINE_TAG, deadline_ms);
+	}
+	len = asprintf(&call->text, "%s%s", prefix, request);
+	if(len == -1)
+	{
+		call->text = NULL;
+		assist_free_call(call);
+		return -1;
+	}
+
+	snprintf(call->board.name, sizeof(call->board.name), "%s", client->ip_addr);
+	snprintf(call->board.ip_addr, sizeof(call->board.ip_addr), "%s", client->ip_addr);
+	if((call->board.sockfd = client_create_socket(call->board.ip_addr, client->port)) == -1)
+	{
+		assist_free_call(call);
+		return -1;
+	}
+	call->board.state = BOARD_CONNECTING;
+
+	bzero(&event, sizeof(event));
+	event.events = EPOLLOUT;
+	event.data.ptr = call;
+	if(epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, call->board.sockfd, &event) == -1)
+	{
+		assist_free_call(call);
+		return -1;
+	}
+
+	call->submit_ns = assist_now_ns();
+	call->connect_expiry_ns = call->submit_ns + client->connect_timeout_ms * 1000000LL;
+	call->expiry_ns = (deadline_ms > 0) ? call->submit_ns + (deadline_ms + DEADLINE_GRACE_MS) * 1000000LL : 0;
+	call->id = ++client->next_id;
+
+	call->next = client->calls;
+	client->calls = call;
+	client->pending++;
+	assist_arm_timer(client);
+
+	return call->id;
+}
+
+
+/** @file libassist.c
+ *  @brief Epoll fd of the client, readable when there is work
+ *
+ *  @param client
+ *  @return fd
+ */
+
+int assist_fd(struct assist_client* client)
+{
+	return client->epoll_fd;
+}
+
+
+/** @file libassist.c
+ *  @brief Requests not completed yet
+ *
+ *  @param client
+ *  @return count
+ */
+
+int assist_pending(struct assist_client* client)
+{
+	return client->pending;
+}
+
+
+/** @file libassist.c
+ *  @brief Move a call on after its socket got ready
+ *
+ *  @param client and call
+ *  @return 1 when replied, 0 when more to do, -1 on error (call->error set)
+ */
+
+static int assist_advance(struct assist_client* client, struct assist_call* call)
+{
+	struct epoll_event event;
+	socklen_t so_error_len = sizeof(call->error);
+	int retVal = 0;
+
+	switch(call->board.state)
+	{
+		case BOARD_CONNECTING:
+			if((getsockopt(call->board.sockfd, SOL_SOCKET, SO_ERROR, &call->error, &so_error_len) == -1) || (call->error != 0))
+			{
+				return -1;
+			}
+			if(stamp_request(&call->board, call->text) != 0)
+			{
+				call->error = ENOMEM;
+				return -1;
+			}
+			call->board.state = BOARD_SENDING;
+			/* fall through */
+		case BOARD_SENDING:
+			errno = 0;
+			if((retVal = client_write_socket(&call->board)) == -1)
+			{
+				call->error = errno ? errno : EPIPE;
+				return -1;
+			}
+			else if(retVal == 1)
+			{
+				call->board.state = BOARD_RECEIVING;
+				bzero(&event, sizeof(event));
+				event.events = EPOLLIN;
+				event.data.ptr = call;
+				epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, call->board.sockfd, &event);
+			}
+			return 0;
+		case BOARD_RECEIVING:
+			errno = 0;
+			if((retVal = client_read_socket(&call->board, client->chunk_size)) == -1)
+			{
+				call->error = errno ? errno : ECONNRESET;
+			}
+			return retVal;
+		default:
+			return 0;
+	}
+}
+
+
+/** @file libassist.c
+ *  @brief Deliver a completed call to its callback and release it
+ *
+ *  @param client and call (status in call->error, 0 when replied)
+ *  @return none
+ */
+
+static void assist_complete(struct assist_client* client, struct assist_call* call)
+{
+	struct assist_call** link = NULL;
+	struct assist_result result;
+	char* end = NULL;
+	char* value = NULL;
+
+	for(link = &client->calls; *link != NULL; link = &(*link)->next)
+	{
+		if(*link == call)
+		{
+			*link = call->next;
+			break;
+		}
+	}
+	client->pending--;
+
+	bzero(&result, sizeof(result));
+	result.id = call->id;
+	result.status = (call->error == 0) ? 0 : -1;
+	result.error = call->error;
+	result.request = call->request;
+	result.reply = call->board.reply ? call->board.reply : "";
+	result.sent_us = call->board.sent_us;
+	result.latency_us = (assist_now_ns() - call->submit_ns) / 1000;
+
+	/* Harness gets the text only, without sentinel */
+	if((call->error == 0) && ((end = strstr(call->board.reply, "AssistDataEnds")) != NULL))
+	{
+		while((end > call->board.reply) && ((end[-1] == ' ') || (end[-1] == '\n')))
+		{
+			end--;
+		}
+		*end = '\0';
+	}
+	result.reply_len = strlen(result.reply);
+
+	if((value = strstr(result.reply, "Return value is ")) != NULL)
+	{
+		result.has_return_value = (sscanf(value, "Return value is %d", &result.return_value) == 1);
+	}
+
+	if(call->callback)
+	{
+		call->callback(&result, call->user);
+	}
+
+	assist_free_call(call);
+}
+
+
+/** @file libassist.c
+ *  @brief Run ready requests and deliver completions
+ *
+ *  @param client and timeout_ms (-1 waits for an event, 0 does not wait)
+ *  @return completions delivered, -1 on error
+ */
+
+int assist_process(struct assist_client* client, int timeout_ms)
+{
+	struct epoll_event events[CLASSIFY_MAX_EVENTS];
+	struct assist_call* call = NULL;
+	struct assist_call* next = NULL;
+	unsigned long long expirations = 0;
+	long long now_ns = 0;
+	int completed = 0;
+	int count = 0;
+	int i = 0;
+	int j = 0;
+
+	if((client->pending == 0) && (timeout_ms < 0))
+	{
+		return 0;
+	}
+
+	if((count = epoll_wait(client->epoll_fd, events, CLASSIFY_MAX_EVENTS, timeout_ms)) == -1)
+	{
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		if((call = events[i].data.ptr) == NULL)
+		{
+			/* Timer, timeouts are checked below */
+			while(read(client->timer_fd, &expirations, sizeof(expirations)) > 0);
+			continue;
+		}
+
+		if(assist_advance(client, call) != 0)
+		{
+			assist_complete(client, call);
+			completed++;
+
+			/* Later events may point to the released call */
+			for(j = i + 1; j < count; j++)
+			{
+				if(events[j].data.ptr == call)
+				{
+					events[j].data.ptr = NULL;
+				}
+			}
+		}
+	}
+
+	now_ns = assist_now_ns();
+	for(call = client->calls; call != NULL; call = next)
+	{
+		next = call->next;
+		if(((call->board.state != BOARD_RECEIVING) && (now_ns >= call->connect_expiry_ns)) ||
+			((call->expiry_ns > 0) && (now_ns >= call->expiry_ns)))
+		{
+			call->error = ETIMEDOUT;
+			assist_complete(client, call);
+			completed++;
+		}
+	}
+	assist_arm_timer(client);
+
+	return completed;
+}
+
+
+/** @file libassist.c
+ *  @brief Callback of assist_request(), keeps a copy of the result
+ */
+
+static void assist_keep_result(const struct assist_result* result, void* user)
+{
+	struct assist_result* kept = user;
+
+	*kept = *result;
+	kept->request = NULL;
+	kept->reply = strdup(result->reply);
+	kept->reply_len = kept->reply ? result->reply_len : 0;
+}
+
+
+/** @file libassist.c
+ *  @brief Send a request and wait for its completion
+ *
+ *  Completions of other pending requests are delivered meanwhile.
+ *
+ *  @param client, request, deadline_ms and result (filled)
+ *  @return 0 when replied, -1 otherwise
+ */
+
+int assist_request(struct assist_client* client, const char* request, int deadline_ms, struct assist_result* result)
+{
+	bzero(result, sizeof(*result));
+
+	if(assist_submit(client, request, deadline_ms, assist_keep_result, result) == -1)
+	{
+		result->status = -1;
+		result->error = errno;
+		return -1;
+	}
+
+	while(result->id == 0)
+	{
+		if(assist_process(client, -1) == -1)
+		{
+			result->status = -1;
+			result->error = errno;
+			return -1;
+		}
+	}
+
+	return result->status;
+}
+
+
+/** @file libassist.c
+ *  @brief Release the reply of assist_request()
+ *
+ *  @param result
+ *  @return none
+ */
+
+void assist_result_free(struct assist_result* result)
+{
+	free((char*)result->reply);
+	result->reply = NULL;
+}
@@ -0,0 +1,250 @@
+/** @file ping.c
+ *  @brief Health pings and assist board discovery over UDP
+ *
+ *  A connection, a request and a reply over TCP is a lot to only know if
+ *  an assist board is alive. A thread answers single datagrams instead,
+ *  on ping_port
+ *
+ *  "AssistPing <seq> <t1>" is answered with
+ *  "AssistPong <seq> <t1> <t2> <t3> cpu=.. load=.. mem_avail_kb=.. queue=.. busy=.."
+ *  t2 and t3 are receive and send times of assist board in us, so DUT
+ *  takes the time spent here out of the round trip. Health is the latest
+ *  telemetry sample, queue and busy workers are live.
+ *
+ *  "AssistDiscover", broadcast or sent to discovery_group, is answered with
+ *  "AssistBoard name=.. port=.. ping_port=.. workers=.. features=..", so
+ *  DUT finds boards without any of them in its configuration file.
+ *
+ *  The socket has SO_REUSEPORT. After a hot restart the new server binds
+ *  the port while the old one still serves, no ping goes unanswered.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* UDP socket, ping thread only after start */
+static int ping_fd = -1;
+
+
+/** @file ping.c
+ *  @brief Join the discovery group on every multicast interface
+ *
+ *  Joined on INADDR_ANY, only the interface of the default route would
+ *  hear it. Assist boards often sit on several networks.
+ *
+ *  @param sockfd (UDP socket) and group (multicast address)
+ *  @return number of interfaces joined
+ */
+
+static int ping_join_group(int sockfd, const char* group)
+{
+	struct ifaddrs* interfaces = NULL;
+	struct ifaddrs* ifa = NULL;
+	struct ip_mreq mreq;
+	int joined = 0;
+
+	bzero(&mreq, sizeof(mreq));
+	if(inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1)
+	{
+		return 0;
+	}
+
+	if(getifaddrs(&interfaces) == 0)
+	{
+		for(ifa = interfaces; ifa != NULL; ifa = ifa->ifa_next)
+		{
+			if((ifa->ifa_addr == NULL) || (ifa->ifa_addr->sa_family != AF_INET) ||
+				((ifa->ifa_flags & (IFF_UP | IFF_MULTICAST)) != (IFF_UP | IFF_MULTICAST)))
+			{
+				continue;
+			}
+
+			mreq.imr_interface = ((struct sockaddr_in*)ifa->ifa_addr)->sin_addr;
+			if(setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0)
+			{
+				joined++;
+			}
+			#ifdef DEBUG
+			else
+			{
+				printf("\nAssist : Join %s on %s fail, %s\n", group, ifa->ifa_name, strerror(errno));
+			}
+			#endif
+		}
+		freeifaddrs(interfaces);
+	}
+
+	/* No interface listed, let the kernel pick one */
+	if(joined == 0)
+	{
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+		if(setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0)
+		{
+			joined++;
+		}
+	}
+
+	return joined;
+}
+
+
+/** @file ping.c
+ *  @brief Build the reply of one datagram
+ *
+ *  @param request (NUL terminated), received_us (t2), reply and size
+ *  @return reply length, 0 when the datagram is not answered
+ */
+
+static int ping_reply(const char* request, long long received_us, char* reply, size_t size)
+{
+	struct assist_config* config = NULL;
+	struct telemetry_sample sample;
+	char name[BOARD_NAME_SIZE];
+	unsigned int seq = 0;
+	long long sent_us = 0;
+	int len = 0;
+
+	if(sscanf(request, PING_REQUEST " %u %lld", &seq, &sent_us) == 2)
+	{
+		bzero(&sample, sizeof(sample));
+		telemetry_history(&sample, 1);
+
+		len = snprintf(reply, size, PING_REPLY " %u %lld %lld %lld cpu=%d.%d load=%d.%02d mem_avail_kb=%lu queue=%d busy=%d",
+			seq, sent_us, received_us, clock_sync_now_us(),
+			sample.cpu_permille / 10, sample.cpu_permille % 10,
+			sample.load1_centi / 100, sample.load1_centi % 100, sample.mem_avail_kb,
+			worker_pool_depth(), worker_pool_busy());
+	}
+	else if(strncmp(request, DISCOVER_REQUEST, strlen(DISCOVER_REQUEST)) == 0)
+	{
+		config = config_get();
+		if(config->board_name[0] != '\0')
+		{
+			snprintf(name, sizeof(name), "%s", config->board_name);
+		}
+		else if(gethostname(name, sizeof(name)) != 0)
+		{
+			snprintf(name, sizeof(name), "assist");
+		}
+		name[sizeof(name) - 1] = '\0';
+
+		len = snprintf(reply, size, DISCOVER_REPLY " name=%s port=%d ping_port=%d workers=%d features=%s",
+			name, config->port, config->ping_port, config->worker_count, PING_FEATURES);
+		config_put(config);
+	}
+
+	return ((len > 0) && ((size_t)len < size)) ? len : 0;
+}
+
+
+/** @file ping.c
+ *  @brief Answer pings and discovery queries
+ *
+ *  One datagram in, at most one out. Anything else is dropped without
+ *  a word, it may not even be meant for assist server.
+ *
+ *  @param arg (unused)
+ *  @return none, runs for the life of the server
+ */
+
+static void* ping_thread(void* arg)
+{
+	char request[PING_DATAGRAM_SIZE];
+	char reply[PING_DATAGRAM_SIZE];
+	struct sockaddr_in peer;
+	socklen_t peer_len = 0;
+	long long received_us = 0;
+	ssize_t len = 0;
+	int reply_len = 0;
+
+	(void)arg;
+
+	while(1)
+	{
+		peer_len = sizeof(peer);
+		if((len = recvfrom(ping_fd, request, sizeof(request) - 1, 0, (struct sockaddr*)&peer, &peer_len)) <= 0)
+		{
+			continue;
+		}
+		received_us = clock_sync_now_us();
+		request[len] = '\0';
+
+		/* Port 0 can not be answered */
+		if(peer.sin_port == 0)
+		{
+			continue;
+		}
+
+		if((reply_len = ping_reply(request, received_us, reply, sizeof(reply))) > 0)
+		{
+			sendto(ping_fd, reply, reply_len, 0, (struct sockaddr*)&peer, peer_len);
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @file ping.c
+ *  @brief Open the UDP socket and start the ping thread
+ *
+ *  Port is taken at start only, like local_socket.
+ *
+ *  @param port (UDP port, 0 disables pings) and group (discovery multicast
+ *         group, "" for broadcast only)
+ *  @return 0 on success, -1 on error
+ */
+
+int ping_start(int port, const char* group)
+{
+	struct sockaddr_in ping_addr;
+	pthread_t thread;
+	int enable = 1;
+
+	if(port == 0)
+	{
+		return 0;
+	}
+
+	if((ping_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+	{
+		printf("\nAssist : Create ping socket fail\n");
+		return -1;
+	}
+
+	setsockopt(ping_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	setsockopt(ping_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+	bzero(&ping_addr, sizeof(ping_addr));
+	ping_addr.sin_family = AF_INET;
+	ping_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	ping_addr.sin_port = htons(port);
+
+	if(bind(ping_fd, (SA*)&ping_addr, sizeof(ping_addr)) != 0)
+	{
+		printf("\nAssist : Bind ping socket on UDP port %d fail, %s\n", port, strerror(errno));
+		close(ping_fd);
+		ping_fd = -1;
+		return -1;
+	}
+
+	if((group[0] != '\0') && (ping_join_group(ping_fd, group) == 0))
+	{
+		printf("\nAssist : Join discovery group %s fail, broadcast discovery only\n", group);
+	}
+
+	if(pthread_create(&thread, NULL, ping_thread, NULL) != 0)
+	{
+		printf("\nAssist : Create ping thread fail\n");
+		close(ping_fd);
+		ping_fd = -1;
+		return -1;
+	}
+	pthread_detach(thread);
+
+	printf("\nAssist : Health pings and discovery on UDP port %d\n", port);
+	return 0;
+}
@@ -0,0 +1,566 @@
+/** @file proc-scan.c
+ *  @brief Find processes by name from /proc, without pidof/pkill
+ *
+ *  The PID set of the system is cached. Within PROC_SCAN_TTL_MS the
+ *  cache is used as it is. After that /proc is listed again, and only
+ *  new PIDs have their name and command line read, known PIDs are kept
+ *  as they are. A matched PID is checked against its start time, a
+ *  reused one is read again then.
+ *  Stats (state, CPU time, RSS) are read fresh for matched PIDs only.
+ *
+ *  Match modes follow the tools they replace
+ *
+ *  PROC_MATCH_NAME    : pidof -x. Exact name of the program (comm or
+ *                       argv[0]) or of the script run by it (argv[1]).
+ *  PROC_MATCH_PATTERN : pkill. Extended regular expression on comm.
+ *  PROC_MATCH_FULL    : pkill -f. Same on the whole command line, read
+ *                       fresh as it is not cached.
+ *
+ *  Entries carry the session of the process (see session.c), so that
+ *  KillRunningProcess of a session leaves the others alone.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Cached PID set, sorted by pid, protected by proc_lock. Refresh fills
+ * proc_spare and swaps the two */
+static struct proc_entry* proc_cache = NULL;
+static struct proc_entry* proc_spare = NULL;
+static int proc_count = 0;
+static int proc_cache_alloc = 0;
+static int proc_spare_alloc = 0;
+static struct timespec proc_refreshed;
+static pthread_mutex_t proc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file proc-scan.c
+ *  @brief Read a small /proc file
+ *
+ *  @param pid, name (file in /proc/<pid>), buffer and size
+ *  @return bytes read, -1 on error (process gone)
+ */
+
+static int proc_read_file(pid_t pid, const char* name, char* buffer, size_t size)
+{
+	char path[64];
+	int fd = -1;
+	int len = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		return -1;
+	}
+
+	len = read(fd, buffer, size - 1);
+	close(fd);
+
+	if(len < 0)
+	{
+		return -1;
+	}
+	buffer[len] = '\0';
+
+	return len;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Parse /proc/<pid>/stat into the entry
+ *
+ *  comm is in brackets and may itself hold blanks or brackets, so the
+ *  fields are counted from the last ')'.
+ *
+ *  @param entry (pid set, rest is filled)
+ *  @return 0 on success, -1 when process is gone
+ */
+
+static int proc_read_stat(struct proc_entry* entry)
+{
+	char buffer[512];
+	char* comm_start = NULL;
+	char* comm_end = NULL;
+	unsigned long utime = 0, stime = 0;
+	unsigned long long starttime = 0;
+	long rss = 0;
+
+	if(proc_read_file(entry->pid, "stat", buffer, sizeof(buffer)) <= 0)
+	{
+		return -1;
+	}
+
+	if(((comm_start = strchr(buffer, '(')) == NULL) || ((comm_end = strrchr(buffer, ')')) == NULL))
+	{
+		return -1;
+	}
+
+	*comm_end = '\0';
+	snprintf(entry->comm, sizeof(entry->comm), "%s", comm_start + 1);
+
+	/* Fields 3 .. 24 : state ppid pgrp session tty tpgid flags minflt cminflt
+	 * majflt cmajflt utime stime cutime cstime priority nice threads
+	 * itrealvalue starttime vsize rss */
+	if(sscanf(comm_end + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %llu %*u %ld",
+		&entry->state, &utime, &stime, &starttime, &rss) != 5)
+	{
+		return -1;
+	}
+
+	entry->cpu_ms = (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+	entry->rss_kb = rss * (sysconf(_SC_PAGESIZE) / 1024);
+	entry->starttime = starttime;
+
+	return 0;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Read the session of a PID from its environment
+ *
+ *  ASSIST_SESSION is set by the executor for commands of a named session
+ *  and inherited by their children. Environment is the one the process
+ *  was started with. Called with proc_lock held.
+ *
+ *  @param entry (pid set, session is filled)
+ *  @return none
+ */
+
+static void proc_read_session(struct proc_entry* entry)
+{
+	static char environment[PROC_ENVIRON_SIZE];
+	char* variable = NULL;
+	int len = 0;
+
+	/* Zombie has no environment left, it keeps the session it had */
+	if((len = proc_read_file(entry->pid, "environ", environment, sizeof(environment))) <= 0)
+	{
+		return;
+	}
+	entry->session[0] = '\0';
+
+	for(variable = environment; variable < &environment[len]; variable += strlen(variable) + 1)
+	{
+		if((strncmp(variable, SESSION_ENV "=", strlen(SESSION_ENV "=")) == 0) &&
+			session_valid(&variable[strlen(SESSION_ENV "=")]))
+		{
+			snprintf(entry->session, sizeof(entry->session), "%s", &variable[strlen(SESSION_ENV "=")]);
+			return;
+		}
+	}
+}
+
+
+/** @file proc-scan.c
+ *  @brief Read name and command line of a new PID
+ *
+ *  @param entry (pid set, rest is filled, session kept when environment is gone)
+ *  @return 0 on success, -1 when process is gone
+ */
+
+static int proc_read_identity(struct proc_entry* entry)
+{
+	char cmdline[256];
+	char* arg = NULL;
+	char* base = NULL;
+	int len = 0;
+
+	if(proc_read_stat(entry) != 0)
+	{
+		return -1;
+	}
+
+	entry->argv0[0] = '\0';
+	entry->argv1[0] = '\0';
+	proc_read_session(entry);
+
+	/* Kernel threads have empty command line */
+	if((len = proc_read_file(entry->pid, "cmdline", cmdline, sizeof(cmdline))) <= 0)
+	{
+		return 0;
+	}
+
+	/* argv[0] */
+	arg = cmdline;
+	base = strrchr(arg, '/');
+	snprintf(entry->argv0, sizeof(entry->argv0), "%.63s", base ? base + 1 : arg);
+
+	/* argv[1], the script when argv[0] is an interpreter */
+	arg += strlen(arg) + 1;
+	if(arg < &cmdline[len])
+	{
+		base = strrchr(arg, '/');
+		snprintf(entry->argv1, sizeof(entry->argv1), "%.63s", base ? base + 1 : arg);
+	}
+
+	return 0;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Find a PID in the cache
+ *
+ *  @param pid
+ *  @return entry, NULL when not cached
+ */
+
+static struct proc_entry* proc_cache_find(pid_t pid)
+{
+	int low = 0;
+	int high = proc_count - 1;
+	int middle = 0;
+
+	while(low <= high)
+	{
+		middle = (low + high) / 2;
+		if(proc_cache[middle].pid == pid)
+		{
+			return &proc_cache[middle];
+		}
+		else if(proc_cache[middle].pid < pid)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Order of entries by pid for qsort()
+ */
+
+static int proc_compare(const void* a, const void* b)
+{
+	return ((const struct proc_entry*)a)->pid - ((const struct proc_entry*)b)->pid;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Refresh the cached PID set
+ *
+ *  List /proc. Known PIDs are copied from the old cache as they are, new
+ *  PIDs are read. PIDs no longer listed drop out. A PID listed between
+ *  its fork and exec has the identity of its parent, so PIDs new at the
+ *  last refresh are read once more. The cache grows with the system, no
+ *  PID is left out. Called with proc_lock held.
+ *
+ *  @param none
+ *  @return 0 on success, -1 on error (cache kept as it was)
+ */
+
+static int proc_cache_refresh(void)
+{
+	struct proc_entry* old_entry = NULL;
+	struct proc_entry* entry = NULL;
+	struct proc_entry* grown = NULL;
+	struct dirent* dir_entry = NULL;
+	DIR* proc_dir = NULL;
+	int new_count = 0;
+	int sorted = 1;
+	int alloc = 0;
+	pid_t pid = 0;
+
+	if((proc_dir = opendir("/proc")) == NULL)
+	{
+		printf("\nAssist : Cannot open /proc\n");
+		return -1;
+	}
+
+	while((dir_entry = readdir(proc_dir)) != NULL)
+	{
+		if((dir_entry->d_name[0] < '1') || (dir_entry->d_name[0] > '9'))
+		{
+			continue;
+		}
+		pid = atoi(dir_entry->d_name);
+
+		if(new_count == proc_spare_alloc)
+		{
+			alloc = (proc_spare_alloc == 0) ? PROC_CACHE_INITIAL : proc_spare_alloc * 2;
+			if((grown = realloc(proc_spare, alloc * sizeof(*proc_spare))) == NULL)
+			{
+				printf("\nAssist : No memory to cache %d PIDs, lookup fail\n", alloc);
+				closedir(proc_dir);
+				return -1;
+			}
+			proc_spare = grown;
+			proc_spare_alloc = alloc;
+		}
+		entry = &proc_spare[new_count];
+
+		if(((old_entry = proc_cache_find(pid)) != NULL) && !old_entry->unsettled)
+		{
+			*entry = *old_entry;
+		}
+		else
+		{
+			if(old_entry != NULL)
+			{
+				*entry = *old_entry;
+			}
+			else
+			{
+				bzero(entry, sizeof(*entry));
+				entry->pid = pid;
+			}
+			entry->unsettled = (old_entry == NULL);
+			if(proc_read_identity(entry) != 0)
+			{
+				continue;
+			}
+		}
+
+		if((new_count > 0) && (proc_spare[new_count - 1].pid > pid))
+		{
+			sorted = 0;
+		}
+		new_count++;
+	}
+	closedir(proc_dir);
+
+	/* /proc lists in pid order, sort only if it did not */
+	if(!sorted)
+	{
+		qsort(proc_spare, new_count, sizeof(proc_spare[0]), proc_compare);
+	}
+
+	grown = proc_cache;
+	alloc = proc_cache_alloc;
+	proc_cache = proc_spare;
+	proc_cache_alloc = proc_spare_alloc;
+	proc_spare = grown;
+	proc_spare_alloc = alloc;
+	proc_count = new_count;
+	clock_gettime(CLOCK_MONOTONIC, &proc_refreshed);
+
+	return 0;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Refresh the cache once it is older than PROC_SCAN_TTL_MS
+ *
+ *  @param none (proc_lock held)
+ *  @return 0 on success, -1 when the refresh failed
+ */
+
+static int proc_cache_update(void)
+{
+	struct timespec now;
+	long age_ms = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age_ms = (now.tv_sec - proc_refreshed.tv_sec) * 1000 + (now.tv_nsec - proc_refreshed.tv_nsec) / 1000000L;
+	if(((proc_refreshed.tv_sec == 0) && (proc_refreshed.tv_nsec == 0)) || (age_ms >= PROC_SCAN_TTL_MS))
+	{
+		return proc_cache_refresh();
+	}
+
+	return 0;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Check an entry against the name
+ *
+ *  @param entry, name, mode and regex (compiled name for PROC_MATCH_PATTERN
+ *         and PROC_MATCH_FULL)
+ *  @return 1 on match, 0 otherwise
+ */
+
+static int proc_match(struct proc_entry* entry, const char* name, int mode, regex_t* regex)
+{
+	static char cmdline[PROC_CMDLINE_SIZE];
+	int len = 0;
+	int i = 0;
+
+	if(mode == PROC_MATCH_PATTERN)
+	{
+		return regexec(regex, entry->comm, 0, NULL, 0) == 0;
+	}
+
+	/* Arguments joined by blanks, as pkill -f. Kernel threads have none,
+	 * their name is matched */
+	if(mode == PROC_MATCH_FULL)
+	{
+		if((len = proc_read_file(entry->pid, "cmdline", cmdline, sizeof(cmdline))) <= 0)
+		{
+			return regexec(regex, entry->comm, 0, NULL, 0) == 0;
+		}
+		while((len > 0) && (cmdline[len - 1] == '\0'))
+		{
+			len--;
+		}
+		for(i = 0; i < len; i++)
+		{
+			cmdline[i] = (cmdline[i] == '\0') ? ' ' : cmdline[i];
+		}
+		cmdline[len] = '\0';
+		return regexec(regex, cmdline, 0, NULL, 0) == 0;
+	}
+
+	/* comm is cut at 15 chars, long names are matched on argv */
+	return (strcmp(entry->comm, name) == 0) ||
+		(strcmp(entry->argv0, name) == 0) ||
+		(strcmp(entry->argv1, name) == 0);
+}
+
+
+/** @file proc-scan.c
+ *  @brief Find processes by name
+ *
+ *  Matched entries carry fresh state, CPU time, RSS and session. A cached PID
+ *  reused by another process is detected by its start time and re-read.
+ *  assist-server itself is never matched by a pattern. Matches are in
+ *  PID order, more than max_results are fetched by calling again with
+ *  the last PID as after.
+ *
+ *  @param name, mode (PROC_MATCH_NAME, PROC_MATCH_PATTERN or PROC_MATCH_FULL),
+ *         after (PIDs up to it are skipped, 0 for all), results and max_results
+ *  @return number of matched processes, -1 on error (errno EINVAL for an
+ *          invalid pattern, EAGAIN when /proc could not be listed)
+ */
+
+int proc_scan_find(const char* name, int mode, pid_t after, struct proc_entry* results, int max_results)
+{
+	struct proc_entry* entry = NULL;
+	unsigned long long starttime = 0;
+	regex_t regex;
+	int count = 0;
+	int i = 0;
+
+	if((name == NULL) || (name[0] == '\0'))
+	{
+		return 0;
+	}
+
+	if((mode != PROC_MATCH_NAME) && (regcomp(&regex, name, REG_EXTENDED | REG_NOSUB) != 0))
+	{
+		printf("\nAssist : Invalid process pattern %s\n", name);
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&proc_lock);
+
+	/* A partial PID set would report running processes as not running */
+	if(proc_cache_update() != 0)
+	{
+		pthread_mutex_unlock(&proc_lock);
+		if(mode != PROC_MATCH_NAME)
+		{
+			regfree(&regex);
+		}
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for(i = 0; (i < proc_count) && (count < max_results); i++)
+	{
+		entry = &proc_cache[i];
+		/* Like pkill, never signal ourselves */
+		if((entry->pid <= after) || ((mode != PROC_MATCH_NAME) && (entry->pid == getpid())) ||
+			!proc_match(entry, name, mode, &regex))
+		{
+			continue;
+		}
+
+		/* Fresh stats. Gone or reused PIDs are handled here */
+		starttime = entry->starttime;
+		if(proc_read_stat(entry) != 0)
+		{
+			continue;
+		}
+		if(entry->starttime != starttime)
+		{
+			/* Reused PID, nothing of the old process applies */
+			entry->session[0] = '\0';
+			if((proc_read_identity(entry) != 0) || !proc_match(entry, name, mode, &regex))
+			{
+				continue;
+			}
+		}
+		proc_read_session(entry);
+
+		results[count++] = *entry;
+	}
+
+	pthread_mutex_unlock(&proc_lock);
+
+	if(mode != PROC_MATCH_NAME)
+	{
+		regfree(&regex);
+	}
+
+	return count;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Add a process table to the reply
+ *
+ *  @param reply, results and count
+ *  @return 0 on success, -1 on error
+ */
+
+int proc_scan_reply(struct reply* reply, struct proc_entry* results, int count)
+{
+	int i = 0;
+
+	reply_printf(reply, "\nPID STATE CPU_MS RSS_KB NAME\n");
+	for(i = 0; i < count; i++)
+	{
+		reply_printf(reply, "%d %c %lu %ld %s\n", results[i].pid, results[i].state,
+			results[i].cpu_ms, results[i].rss_kb, results[i].argv0[0] ? results[i].argv0 : results[i].comm);
+	}
+
+	return reply->error ? -1 : 0;
+}
+
+
+/** @file proc-scan.c
+ *  @brief Count the processes of a session
+ *
+ *  Cache is refreshed whatever its age, a quota must see the command
+ *  just started. Environment is read again, a PID cached between its
+ *  fork and exec has the environment of its parent.
+ *
+ *  @param session (name)
+ *  @return processes carrying ASSIST_SESSION=<session>, -1 on error
+ */
+
+int proc_scan_session(const char* session)
+{
+	int count = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&proc_lock);
+
+	if(proc_cache_refresh() != 0)
+	{
+		pthread_mutex_unlock(&proc_lock);
+		return -1;
+	}
+
+	for(i = 0; i < proc_count; i++)
+	{
+		proc_read_session(&proc_cache[i]);
+		if((strcmp(proc_cache[i].session, session) == 0) && (kill(proc_cache[i].pid, 0) == 0))
+		{
+			count++;
+		}
+	}
+
+	pthread_mutex_unlock(&proc_lock);
+
+	return count;
+}
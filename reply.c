@@ -0,0 +1,840 @@
+/** @file reply.c
+ *  @brief Reply to DUT as a scatter/gather list
+ *
+ *  A reply is a list of entries, each is one of
+ *
+ *  Segment : Text formatted or copied into a pooled segment (reply_printf)
+ *  View    : Memory not owned by the reply, sent without copy. Static
+ *            strings, or payload valid till the reply is flushed (reply_append_view)
+ *  File    : Range of an open file, sent with sendfile() (reply_append_file)
+ *
+ *  Entries are flushed with one writev() per run of memory entries. Views
+ *  of ZEROCOPY_THRESHOLD bytes or more go with MSG_ZEROCOPY where the
+ *  kernel supports it. Partial writes resume where they stopped, EAGAIN
+ *  waits for the socket to become writable.
+ *
+ *  Flow control : once high_water bytes are queued, the producer adding to
+ *  the reply (file reader, command output, capture) is paused in the
+ *  flush. The socket has TCP_NOTSENT_LOWAT low_water, so the kernel takes
+ *  more, and the producer resumes, only when the DUT has read the backlog
+ *  down to low_water. Memory per connection stays about high_water plus
+ *  low_water however slow the DUT reads.
+ *
+ *  DUT on the same host may get the reply through a shared memory ring
+ *  instead (see ring.c and reply_use_ring()). Entries are then copied or
+ *  read into the ring, and the ring size bounds the queued bytes.
+ *
+ *  Reply ends with "AssistDataEnds". Nothing else is appended on the wire.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/** @file reply.c
+ *  @brief Start an empty reply
+ *
+ *  @param reply and sockfd (socket the reply goes to)
+ *  @return none
+ */
+
+void reply_init(struct reply* reply, int sockfd)
+{
+	bzero(reply, sizeof(*reply));
+	reply->sockfd = sockfd;
+	reply->hash = TRACE_HASH_INIT;
+	reply->high_water = REPLY_HIGH_WATER;
+	reply->low_water = REPLY_LOW_WATER;
+	reply->ring.data_fd = -1;
+	reply->ring.space_fd = -1;
+}
+
+
+/** @file reply.c
+ *  @brief Send the reply through a shared memory ring
+ *
+ *  Only for a DUT on the local socket. The ring is offered to DUT right
+ *  away, so call it before anything is sent.
+ *
+ *  @param reply and size (ring size asked by DUT)
+ *  @return 0 when the ring is used, -1 when the reply goes to the socket
+ */
+
+int reply_use_ring(struct reply* reply, int size)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	int memfd = -1;
+
+	if((getsockname(reply->sockfd, (struct sockaddr*)&addr, &addr_len) == -1) || (addr.ss_family != AF_UNIX))
+	{
+		return -1;
+	}
+
+	if((memfd = ring_create(&reply->ring, size)) == -1)
+	{
+		return -1;
+	}
+
+	if(ring_offer(&reply->ring, reply->sockfd, memfd) != 0)
+	{
+		printf("\nAssist : Ring offer fail, %s\n", strerror(errno));
+		ring_detach(&reply->ring);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Set the flow control watermarks of the reply
+ *
+ *  @param reply, high_water (queued bytes pausing the producer) and
+ *         low_water (unsent bytes in the socket resuming it)
+ *  @return none
+ */
+
+void reply_set_watermarks(struct reply* reply, size_t high_water, size_t low_water)
+{
+	int lowat = (int)low_water;
+
+	reply->high_water = high_water;
+	reply->low_water = low_water;
+
+	/* Not a TCP socket, only high_water applies */
+	if(setsockopt(reply->sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) != 0)
+	{
+		#ifdef DEBUG
+			printf("\nAssist : TCP_NOTSENT_LOWAT not set, %s\n", strerror(errno));
+		#endif
+	}
+}
+
+
+/** @file reply.c
+ *  @brief Take a free entry at the end of the reply
+ *
+ *  Flushes the reply first when the entry table or the segment budget is
+ *  full, or high_water bytes are queued.
+ *
+ *  @param reply
+ *  @return entry on success, NULL on error
+ */
+
+static struct reply_iov* reply_new_entry(struct reply* reply)
+{
+	struct reply_iov* entry = NULL;
+
+	if(reply->error)
+	{
+		return NULL;
+	}
+
+	/* Keep memory bounded, send what is already built */
+	if((reply->iov_count == REPLY_MAX_IOV) || (reply->segment_count >= REPLY_FLUSH_SEGMENTS) ||
+		(reply->queued >= reply->high_water))
+	{
+		if(reply_flush(reply) != 0)
+		{
+			return NULL;
+		}
+	}
+
+	entry = &reply->iov[reply->iov_count++];
+	bzero(entry, sizeof(*entry));
+	entry->fd = -1;
+
+	return entry;
+}
+
+
+/** @file reply.c
+ *  @brief Space at the end of the reply
+ *
+ *  Returns the free space of the segment being filled, adding a new
+ *  segment when it is full. Fill it and call reply_commit().
+ *
+ *  @param reply and space (filled with free bytes)
+ *  @return pointer to free space, NULL on error
+ */
+
+char* reply_reserve(struct reply* reply, size_t* space)
+{
+	struct reply_iov* entry = NULL;
+
+	if(reply->error)
+	{
+		return NULL;
+	}
+
+	/* Last entry is a segment with room left */
+	if(reply->iov_count > 0)
+	{
+		entry = &reply->iov[reply->iov_count - 1];
+		if((entry->segment != NULL) && (entry->segment->len < REPLY_SEGMENT_SIZE))
+		{
+			*space = REPLY_SEGMENT_SIZE - entry->segment->len;
+			return &entry->segment->data[entry->segment->len];
+		}
+	}
+
+	if((entry = reply_new_entry(reply)) == NULL)
+	{
+		return NULL;
+	}
+
+	if((entry->segment = segment_get()) == NULL)
+	{
+		reply->iov_count--;
+		reply->error = 1;
+		return NULL;
+	}
+	entry->base = entry->segment->data;
+	reply->segment_count++;
+
+	*space = REPLY_SEGMENT_SIZE;
+	return entry->segment->data;
+}
+
+
+/** @file reply.c
+ *  @brief Account bytes written into space from reply_reserve()
+ *
+ *  @param reply and len (bytes written)
+ *  @return none
+ */
+
+void reply_commit(struct reply* reply, size_t len)
+{
+	struct reply_iov* entry = &reply->iov[reply->iov_count - 1];
+
+	entry->segment->len += len;
+	entry->len += len;
+	reply->total_len += len;
+	reply->queued += len;
+}
+
+
+/** @file reply.c
+ *  @brief Copy data into the reply
+ *
+ *  For small or short lived data. Bigger payloads which stay valid
+ *  till the reply is flushed should go with reply_append_view().
+ *
+ *  @param reply, data and len (bytes)
+ *  @return 0 on success, -1 on error
+ */
+
+int reply_append(struct reply* reply, const char* data, size_t len)
+{
+	char* space = NULL;
+	size_t space_len = 0;
+
+	while(len > 0)
+	{
+		if((space = reply_reserve(reply, &space_len)) == NULL)
+		{
+			return -1;
+		}
+
+		if(space_len > len)
+		{
+			space_len = len;
+		}
+		memcpy(space, data, space_len);
+		reply_commit(reply, space_len);
+
+		data += space_len;
+		len -= space_len;
+	}
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Append formatted text to the reply
+ *
+ *  Status lines are formatted on stack and appended, so they may span
+ *  two segments. Text longer than a segment is truncated.
+ *
+ *  @param reply, format and arguments (as printf)
+ *  @return 0 on success, -1 on error
+ */
+
+int reply_printf(struct reply* reply, const char* format, ...)
+{
+	va_list args;
+	char text[REPLY_SEGMENT_SIZE];
+	int len = 0;
+
+	va_start(args, format);
+	len = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	if(len < 0)
+	{
+		return -1;
+	}
+	else if((size_t)len >= sizeof(text))
+	{
+		printf("\nAssist : Reply text truncated to %ld bytes\n", sizeof(text) - 1);
+		len = sizeof(text) - 1;
+	}
+
+	return reply_append(reply, text, len);
+}
+
+
+/** @file reply.c
+ *  @brief Append memory to the reply without copy
+ *
+ *  Memory must stay valid and unchanged till reply_flush() or
+ *  reply_send() returns. String literals always are.
+ *
+ *  @param reply, data and len (bytes)
+ *  @return 0 on success, -1 on error
+ */
+
+int reply_append_view(struct reply* reply, const char* data, size_t len)
+{
+	struct reply_iov* entry = NULL;
+
+	if(len == 0)
+	{
+		return 0;
+	}
+
+	if((entry = reply_new_entry(reply)) == NULL)
+	{
+		return -1;
+	}
+
+	entry->base = data;
+	entry->len = len;
+	reply->total_len += len;
+	reply->queued += len;
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Append a range of a file to the reply
+ *
+ *  File is sent with sendfile(), it never passes through user memory.
+ *  Reply owns fd from now on and closes it once sent.
+ *
+ *  @param reply, fd (open file), offset and len (bytes)
+ *  @return 0 on success, -1 on error (fd is closed)
+ */
+
+int reply_append_file(struct reply* reply, int fd, off_t offset, size_t len)
+{
+	struct reply_iov* entry = NULL;
+
+	if((entry = reply_new_entry(reply)) == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+
+	entry->fd = fd;
+	entry->offset = offset;
+	entry->len = len;
+	reply->total_len += len;
+	reply->queued += len;
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Wait till the socket can take more data
+ *
+ *  With TCP_NOTSENT_LOWAT set, that is when less than low_water bytes
+ *  are left unsent.
+ *
+ *  @param reply
+ *  @return 0 when writable, -1 on timeout or error
+ */
+
+static int reply_wait_writable(struct reply* reply)
+{
+	struct pollfd pfd;
+
+	pfd.fd = reply->sockfd;
+	pfd.events = POLLOUT;
+
+	if(poll(&pfd, 1, REPLY_SEND_TIMEOUT_MS) != 1)
+	{
+		printf("\nAssist : Socket not writable within %d ms\n", REPLY_SEND_TIMEOUT_MS);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Wait till kernel is done with zero copy buffers
+ *
+ *  MSG_ZEROCOPY pages belong to the kernel till the completion shows
+ *  up on the socket error queue. Views must not be released before.
+ *
+ *  @param reply
+ *  @return 0 on success, -1 on timeout or error
+ */
+
+static int reply_zerocopy_wait(struct reply* reply)
+{
+	#if defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+	struct msghdr msg;
+	struct cmsghdr* cmsg = NULL;
+	struct sock_extended_err* serr = NULL;
+	struct pollfd pfd;
+	char control[128];
+
+	while(reply->zerocopy_done < reply->zerocopy_sent)
+	{
+		bzero(&msg, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if(recvmsg(reply->sockfd, &msg, MSG_ERRQUEUE) == -1)
+		{
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			{
+				printf("\nAssist : Zero copy completion fail. %s\n", strerror(errno));
+				return -1;
+			}
+
+			/* Completion is signalled as POLLERR */
+			pfd.fd = reply->sockfd;
+			pfd.events = 0;
+			if(poll(&pfd, 1, REPLY_SEND_TIMEOUT_MS) != 1)
+			{
+				printf("\nAssist : Zero copy completion timed out\n");
+				return -1;
+			}
+			continue;
+		}
+
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if((serr->ee_errno == 0) && (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY))
+			{
+				/* Completions [ee_info, ee_data] are done */
+				reply->zerocopy_done += serr->ee_data - serr->ee_info + 1;
+			}
+		}
+	}
+	#else
+	(void)reply;
+	#endif
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Send one big view with MSG_ZEROCOPY
+ *
+ *  Socket is switched to SO_ZEROCOPY on first use. When the kernel
+ *  does not support it, the view is left to writev().
+ *
+ *  @param reply and entry (view, advanced as it is sent)
+ *  @return 1 when sent, 0 when zero copy is not available, -1 on error
+ */
+
+static int reply_send_zerocopy(struct reply* reply, struct reply_iov* entry)
+{
+	#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+	int enable = 1;
+	ssize_t sent_len = 0;
+
+	if(reply->zerocopy == 0)
+	{
+		reply->zerocopy = (setsockopt(reply->sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0) ? 1 : -1;
+	}
+
+	if(reply->zerocopy != 1)
+	{
+		return 0;
+	}
+
+	while(entry->len > 0)
+	{
+		sent_len = send(reply->sockfd, entry->base, entry->len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+		if(sent_len == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			/* ENOBUFS : out of optmem for notifications, let the others complete */
+			else if(errno == ENOBUFS)
+			{
+				if(reply_zerocopy_wait(reply) != 0)
+				{
+					return -1;
+				}
+				continue;
+			}
+			else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				if(reply_wait_writable(reply) != 0)
+				{
+					return -1;
+				}
+				continue;
+			}
+			printf("\nAssist : Zero copy send fail. %s\n", strerror(errno));
+			return -1;
+		}
+
+		reply->zerocopy_sent++;
+		reply->sent_len += sent_len;
+		entry->base += sent_len;
+		entry->len -= sent_len;
+	}
+
+	return 1;
+	#else
+	(void)reply;
+	(void)entry;
+	return 0;
+	#endif
+}
+
+
+/** @file reply.c
+ *  @brief Send one file entry with sendfile()
+ *
+ *  @param reply and entry (file range, advanced as it is sent)
+ *  @return 0 on success, -1 on error
+ */
+
+static int reply_send_file(struct reply* reply, struct reply_iov* entry)
+{
+	ssize_t sent_len = 0;
+
+	while(entry->len > 0)
+	{
+		sent_len = sendfile(reply->sockfd, entry->fd, &entry->offset, entry->len);
+		if(sent_len == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				if(reply_wait_writable(reply) != 0)
+				{
+					return -1;
+				}
+				continue;
+			}
+			printf("\nAssist : sendfile fail. %s\n", strerror(errno));
+			return -1;
+		}
+		/* File got shorter since it was added (e.g. logs cleared) */
+		else if(sent_len == 0)
+		{
+			printf("\nAssist : File ended %ld bytes early\n", entry->len);
+			entry->len = 0;
+			break;
+		}
+
+		reply->sent_len += sent_len;
+		entry->len -= sent_len;
+	}
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Send a run of memory entries with writev()
+ *
+ *  After a partial write the entries are advanced and writev() goes on
+ *  from the first unsent byte.
+ *
+ *  @param reply, first and count (entries iov[first] .. iov[first + count - 1])
+ *  @return 0 on success, -1 on error
+ */
+
+static int reply_send_memory(struct reply* reply, int first, int count)
+{
+	struct iovec iov[REPLY_MAX_IOV];
+	ssize_t sent_len = 0;
+	int i = 0;
+
+	while(count > 0)
+	{
+		for(i = 0; i < count; i++)
+		{
+			iov[i].iov_base = (void*)reply->iov[first + i].base;
+			iov[i].iov_len = reply->iov[first + i].len;
+		}
+
+		sent_len = writev(reply->sockfd, iov, count);
+		if(sent_len == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				if(reply_wait_writable(reply) != 0)
+				{
+					return -1;
+				}
+				continue;
+			}
+			printf("\nAssist : Writing socket fail. %s\n", strerror(errno));
+			return -1;
+		}
+		reply->sent_len += sent_len;
+
+		/* Skip what went out, fully sent entries first */
+		while((count > 0) && ((size_t)sent_len >= reply->iov[first].len))
+		{
+			sent_len -= reply->iov[first].len;
+			reply->iov[first].len = 0;
+			first++;
+			count--;
+		}
+		if(count > 0)
+		{
+			reply->iov[first].base += sent_len;
+			reply->iov[first].len -= sent_len;
+		}
+	}
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Hash the entries about to be sent, for the request trace
+ *
+ *  File ranges are read with pread(), their sendfile() offset is kept.
+ *
+ *  @param reply
+ *  @return none
+ */
+
+static void reply_trace_hash(struct reply* reply)
+{
+	struct reply_iov* entry = NULL;
+	char buffer[REPLY_SEGMENT_SIZE];
+	ssize_t read_len = 0;
+	size_t done = 0;
+	int i = 0;
+
+	for(i = 0; i < reply->iov_count; i++)
+	{
+		entry = &reply->iov[i];
+		if(entry->fd == -1)
+		{
+			reply->hash = trace_hash(reply->hash, entry->base, entry->len);
+			continue;
+		}
+
+		for(done = 0; done < entry->len; done += read_len)
+		{
+			read_len = pread(entry->fd, buffer, (entry->len - done < sizeof(buffer)) ? entry->len - done : sizeof(buffer), entry->offset + done);
+			if(read_len <= 0)
+			{
+				break;
+			}
+			reply->hash = trace_hash(reply->hash, buffer, read_len);
+		}
+	}
+}
+
+
+/** @file reply.c
+ *  @brief Put the entries into the ring
+ *
+ *  @param reply
+ *  @return 0 on success, -1 on error
+ */
+
+static int reply_flush_ring(struct reply* reply)
+{
+	struct reply_iov* entry = NULL;
+	int written = 0;
+	int i = 0;
+
+	for(i = 0; i < reply->iov_count; i++)
+	{
+		entry = &reply->iov[i];
+		if(entry->fd == -1)
+		{
+			if(ring_write(&reply->ring, entry->base, entry->len, reply->sockfd) != 0)
+			{
+				return -1;
+			}
+			reply->sent_len += entry->len;
+		}
+		else
+		{
+			if((written = ring_write_file(&reply->ring, entry->fd, &entry->offset, entry->len, reply->sockfd)) == -1)
+			{
+				return -1;
+			}
+			else if((size_t)written < entry->len)
+			{
+				printf("\nAssist : File ended %ld bytes early\n", entry->len - written);
+			}
+			reply->sent_len += written;
+		}
+		entry->len = 0;
+	}
+
+	return 0;
+}
+
+
+/** @file reply.c
+ *  @brief Send the entries built so far
+ *
+ *  Segments go back to the pool, files are closed. Views can be
+ *  released by the caller once this returns.
+ *
+ *  @param reply
+ *  @return 0 on success, -1 on error
+ */
+
+int reply_flush(struct reply* reply)
+{
+	struct reply_iov* entry = NULL;
+	int first = 0;
+	int i = 0;
+	int retVal = 0;
+
+	if(reply->trace)
+	{
+		reply_trace_hash(reply);
+	}
+
+	if((reply->ring.header != NULL) && (reply->error == 0) && (reply_flush_ring(reply) != 0))
+	{
+		reply->error = 1;
+	}
+
+	for(i = 0; (reply->ring.header == NULL) && (reply->error == 0) && (i <= reply->iov_count); i++)
+	{
+		entry = (i < reply->iov_count) ? &reply->iov[i] : NULL;
+
+		/* Memory entries gather till a file or a big view, or the end */
+		if((entry != NULL) && (entry->fd == -1) &&
+			((entry->segment != NULL) || (entry->len < ZEROCOPY_THRESHOLD) || (reply->zerocopy == -1)))
+		{
+			continue;
+		}
+
+		if((i > first) && (reply_send_memory(reply, first, i - first) != 0))
+		{
+			reply->error = 1;
+			break;
+		}
+		first = i + 1;
+
+		if(entry == NULL)
+		{
+			break;
+		}
+		else if(entry->fd != -1)
+		{
+			retVal = reply_send_file(reply, entry);
+		}
+		else if((retVal = reply_send_zerocopy(reply, entry)) == 0)
+		{
+			/* No zero copy here, send as plain memory */
+			retVal = reply_send_memory(reply, i, 1);
+		}
+
+		if(retVal == -1)
+		{
+			reply->error = 1;
+		}
+	}
+
+	/* Kernel may still be reading the views */
+	if((reply->zerocopy_done < reply->zerocopy_sent) && (reply_zerocopy_wait(reply) != 0))
+	{
+		reply->error = 1;
+	}
+
+	reply_release(reply);
+
+	return reply->error ? -1 : 0;
+}
+
+
+/** @file reply.c
+ *  @brief Send the remaining reply
+ *
+ *  A ring is closed, DUT reads it to the end.
+ *
+ *  @param reply
+ *  @return 0 on success, -1 on error
+ */
+
+int reply_send(struct reply* reply)
+{
+	int retVal = 0;
+
+	#ifdef DEBUG
+		printf("\nAssist : send data length is %ld\n", reply->total_len);
+	#endif
+
+	retVal = reply_flush(reply);
+	if(reply->ring.header != NULL)
+	{
+		ring_finish(&reply->ring);
+	}
+
+	return retVal;
+}
+
+
+/** @file reply.c
+ *  @brief Drop the unsent entries
+ *
+ *  Segments go back to the pool, files are closed. Reply can be built
+ *  further, counters and error state are kept.
+ *
+ *  @param reply
+ *  @return none
+ */
+
+void reply_release(struct reply* reply)
+{
+	int i = 0;
+
+	for(i = 0; i < reply->iov_count; i++)
+	{
+		if(reply->iov[i].segment)
+		{
+			segment_put(reply->iov[i].segment);
+		}
+		if(reply->iov[i].fd != -1)
+		{
+			close(reply->iov[i].fd);
+		}
+	}
+
+	reply->iov_count = 0;
+	reply->segment_count = 0;
+	reply->queued = 0;
+}
@@ -0,0 +1,496 @@
+/** @file ring.c
+ *  @brief Shared memory ring for replies to a DUT on the same host
+ *
+ *  DUT harness and assist-server often run on one machine (loopback and
+ *  vcan CI). Bulk replies then need not go through the TCP stack : DUT
+ *  connects to the local Unix socket and asks for a ring with
+ *  "AssistRing=<bytes> ". For bulk requests the server creates a memfd
+ *  ring and two eventfds, and hands them over with SCM_RIGHTS as
+ *
+ *  "AssistRing <size>\n" + (memfd, data_fd, space_fd)
+ *
+ *  The reply then goes into the ring : memory entries are copied in,
+ *  file ranges are read straight into it. DUT takes the bytes from its
+ *  own mapping. Nothing else is sent on the socket.
+ *
+ *  Single producer, single consumer. Positions are free running byte
+ *  counts, size is a power of two. A side going to sleep sets its
+ *  waiting flag and checks the ring again, the other side signals the
+ *  eventfd only when the flag is set, so a busy transfer costs no
+ *  system calls besides the data copy.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/** @file ring.c
+ *  @brief Wake the other side if it sleeps
+ *
+ *  @param waiting (its flag) and fd (its eventfd)
+ *  @return none
+ */
+
+static void ring_wake(unsigned int* waiting, int fd)
+{
+	unsigned long long one = 1;
+
+	/* Pairs with the fence of the side setting its flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(waiting, __ATOMIC_RELAXED))
+	{
+		if(write(fd, &one, sizeof(one)) != sizeof(one))
+		{
+			#ifdef DEBUG
+				printf("\nAssist : Ring wake up fail, %s\n", strerror(errno));
+			#endif
+		}
+	}
+}
+
+
+/** @file ring.c
+ *  @brief Create a ring
+ *
+ *  @param ring (filled) and size (rounded up to a power of two within
+ *         RING_MIN_SIZE and RING_MAX_SIZE)
+ *  @return memfd on success (ring_offer() hands it over), -1 on error
+ */
+
+int ring_create(struct ring* ring, size_t size)
+{
+	size_t ring_size = RING_MIN_SIZE;
+	int memfd = -1;
+
+	while((ring_size < size) && (ring_size < RING_MAX_SIZE))
+	{
+		ring_size *= 2;
+	}
+
+	bzero(ring, sizeof(*ring));
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+	ring->size = ring_size;
+	ring->map_len = RING_DATA_OFFSET + ring_size;
+
+	if(((memfd = memfd_create("assist-ring", MFD_CLOEXEC)) == -1) ||
+		(ftruncate(memfd, ring->map_len) == -1) ||
+		((ring->header = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) ||
+		((ring->data_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) ||
+		((ring->space_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1))
+	{
+		printf("\nAssist : Create ring fail, %s\n", strerror(errno));
+		if(ring->header == MAP_FAILED)
+		{
+			ring->header = NULL;
+		}
+		if(memfd != -1)
+		{
+			close(memfd);
+		}
+		ring_detach(ring);
+		return -1;
+	}
+
+	ring->header->magic = RING_MAGIC;
+	ring->header->size = ring_size;
+	ring->data = (char*)ring->header + RING_DATA_OFFSET;
+
+	return memfd;
+}
+
+
+/** @file ring.c
+ *  @brief Hand the ring over to DUT
+ *
+ *  @param ring, sockfd (local DUT connection) and memfd (from
+ *         ring_create(), closed here)
+ *  @return 0 on success, -1 on error
+ */
+
+int ring_offer(struct ring* ring, int sockfd, int memfd)
+{
+	char offer[64];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg = NULL;
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	int fds[3];
+	int retVal = 0;
+
+	iov.iov_base = offer;
+	iov.iov_len = snprintf(offer, sizeof(offer), "%s %zu\n", RING_OFFER, ring->size);
+
+	bzero(&msg, sizeof(msg));
+	bzero(control, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	fds[0] = memfd;
+	fds[1] = ring->data_fd;
+	fds[2] = ring->space_fd;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	retVal = (sendmsg(sockfd, &msg, MSG_NOSIGNAL) == (ssize_t)iov.iov_len) ? 0 : -1;
+	close(memfd);
+
+	return retVal;
+}
+
+
+/** @file ring.c
+ *  @brief Wait till DUT frees space in the ring
+ *
+ *  @param ring and sockfd (DUT connection, closed when DUT went away)
+ *  @return 0 when there is space, -1 on timeout or DUT close
+ */
+
+static int ring_wait_space(struct ring* ring, int sockfd)
+{
+	struct ring_header* header = ring->header;
+	struct pollfd fds[2];
+	unsigned long long count = 0;
+	int ready = 0;
+	int retVal = 0;
+
+	__atomic_store_n(&header->producer_waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	while(header->head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) == ring->size)
+	{
+		fds[0].fd = ring->space_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = sockfd;
+		fds[1].events = POLLIN | POLLRDHUP;
+
+		if((ready = poll(fds, 2, REPLY_SEND_TIMEOUT_MS)) == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			retVal = -1;
+			break;
+		}
+		else if(ready == 0)
+		{
+			printf("\nAssist : Ring not read within %d ms\n", REPLY_SEND_TIMEOUT_MS);
+			retVal = -1;
+			break;
+		}
+		else if(fds[1].revents)
+		{
+			printf("\nAssist : DUT closed the connection of its ring\n");
+			retVal = -1;
+			break;
+		}
+		while(read(ring->space_fd, &count, sizeof(count)) > 0);
+	}
+
+	__atomic_store_n(&header->producer_waiting, 0, __ATOMIC_RELAXED);
+
+	return retVal;
+}
+
+
+/** @file ring.c
+ *  @brief Free space at the head of the ring, contiguous up to the wrap
+ *
+ *  @param ring, sockfd and space (filled)
+ *  @return pointer to the space, NULL on error
+ */
+
+static char* ring_reserve(struct ring* ring, int sockfd, size_t* space)
+{
+	struct ring_header* header = ring->header;
+	size_t used = 0;
+	size_t offset = 0;
+
+	if(((used = header->head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE)) == ring->size) &&
+		(ring_wait_space(ring, sockfd) != 0))
+	{
+		return NULL;
+	}
+
+	used = header->head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+	offset = header->head & (ring->size - 1);
+	*space = ring->size - used;
+	if(*space > ring->size - offset)
+	{
+		*space = ring->size - offset;
+	}
+
+	return &ring->data[offset];
+}
+
+
+/** @file ring.c
+ *  @brief Publish bytes written at the head
+ *
+ *  @param ring and len
+ *  @return none
+ */
+
+static void ring_commit(struct ring* ring, size_t len)
+{
+	__atomic_store_n(&ring->header->head, ring->header->head + len, __ATOMIC_RELEASE);
+	ring_wake(&ring->header->consumer_waiting, ring->data_fd);
+}
+
+
+/** @file ring.c
+ *  @brief Copy memory into the ring
+ *
+ *  Waits for DUT when the ring is full, the ring size bounds the reply
+ *  memory like high_water does for the socket.
+ *
+ *  @param ring, data, len and sockfd (DUT connection)
+ *  @return 0 on success, -1 on error
+ */
+
+int ring_write(struct ring* ring, const char* data, size_t len, int sockfd)
+{
+	char* space = NULL;
+	size_t space_len = 0;
+
+	while(len > 0)
+	{
+		if((space = ring_reserve(ring, sockfd, &space_len)) == NULL)
+		{
+			return -1;
+		}
+		if(space_len > len)
+		{
+			space_len = len;
+		}
+
+		memcpy(space, data, space_len);
+		ring_commit(ring, space_len);
+		data += space_len;
+		len -= space_len;
+	}
+
+	return 0;
+}
+
+
+/** @file ring.c
+ *  @brief Read a file range straight into the ring
+ *
+ *  @param ring, fd, offset (advanced), len and sockfd (DUT connection)
+ *  @return bytes written, shorter when the file ended early, -1 on error
+ */
+
+int ring_write_file(struct ring* ring, int fd, off_t* offset, size_t len, int sockfd)
+{
+	char* space = NULL;
+	size_t space_len = 0;
+	size_t done = 0;
+	ssize_t read_len = 0;
+
+	while(done < len)
+	{
+		if((space = ring_reserve(ring, sockfd, &space_len)) == NULL)
+		{
+			return -1;
+		}
+		if(space_len > len - done)
+		{
+			space_len = len - done;
+		}
+
+		if((read_len = pread(fd, space, space_len, *offset)) == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			printf("\nAssist : Reading file into ring fail. %s\n", strerror(errno));
+			return -1;
+		}
+		/* File got shorter since it was added (e.g. logs cleared) */
+		else if(read_len == 0)
+		{
+			break;
+		}
+
+		ring_commit(ring, read_len);
+		*offset += read_len;
+		done += read_len;
+	}
+
+	return (int)done;
+}
+
+
+/** @file ring.c
+ *  @brief Mark the reply complete and release the server side
+ *
+ *  DUT keeps its mapping till it has read the rest.
+ *
+ *  @param ring
+ *  @return none
+ */
+
+void ring_finish(struct ring* ring)
+{
+	unsigned long long one = 1;
+
+	if(ring->header != NULL)
+	{
+		__atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+		if(write(ring->data_fd, &one, sizeof(one)) != sizeof(one))
+		{
+			printf("\nAssist : Ring close signal fail, %s\n", strerror(errno));
+		}
+	}
+
+	ring_detach(ring);
+}
+
+
+/** @file ring.c
+ *  @brief Map a ring handed over by the server
+ *
+ *  @param ring (filled), fds (memfd, data_fd, space_fd, owned by the ring
+ *         from now, memfd is closed once mapped) and size (from the offer)
+ *  @return 0 on success, -1 on error
+ */
+
+int ring_attach(struct ring* ring, int* fds, size_t size)
+{
+	bzero(ring, sizeof(*ring));
+	ring->data_fd = fds[1];
+	ring->space_fd = fds[2];
+	ring->size = size;
+	ring->map_len = RING_DATA_OFFSET + size;
+
+	if((size < RING_MIN_SIZE) || (size > RING_MAX_SIZE) || ((size & (size - 1)) != 0) ||
+		((ring->header = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0)) == MAP_FAILED) ||
+		(ring->header->magic != RING_MAGIC) || (ring->header->size != size))
+	{
+		if(ring->header == MAP_FAILED)
+		{
+			ring->header = NULL;
+		}
+		close(fds[0]);
+		ring_detach(ring);
+		return -1;
+	}
+
+	close(fds[0]);
+	ring->data = (char*)ring->header + RING_DATA_OFFSET;
+
+	return 0;
+}
+
+
+/** @file ring.c
+ *  @brief Bytes available at the tail, contiguous up to the wrap
+ *
+ *  @param ring and data (filled)
+ *  @return available bytes, 0 when empty
+ */
+
+size_t ring_peek(struct ring* ring, const char** data)
+{
+	struct ring_header* header = ring->header;
+	size_t available = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) - header->tail;
+	size_t offset = header->tail & (ring->size - 1);
+
+	/* Awake again, server needs no more signals */
+	if(__atomic_load_n(&header->consumer_waiting, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	*data = &ring->data[offset];
+
+	return (available > ring->size - offset) ? ring->size - offset : available;
+}
+
+
+/** @file ring.c
+ *  @brief Release bytes taken from the tail
+ *
+ *  @param ring and len
+ *  @return none
+ */
+
+void ring_consume(struct ring* ring, size_t len)
+{
+	__atomic_store_n(&ring->header->tail, ring->header->tail + len, __ATOMIC_RELEASE);
+	ring_wake(&ring->header->producer_waiting, ring->space_fd);
+}
+
+
+/** @file ring.c
+ *  @brief Prepare to sleep on data_fd
+ *
+ *  Drains data_fd and sets the waiting flag. Poll data_fd only when this
+ *  returns 1, the ring may have been filled in between.
+ *
+ *  @param ring
+ *  @return 1 when empty (poll data_fd), 0 when data arrived, -1 when
+ *          empty and closed
+ */
+
+int ring_wait_data(struct ring* ring)
+{
+	struct ring_header* header = ring->header;
+	unsigned long long count = 0;
+	unsigned int closed = 0;
+
+	while(read(ring->data_fd, &count, sizeof(count)) > 0);
+
+	__atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/* Closed first : the last head is visible once closed is */
+	closed = __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != header->tail)
+	{
+		__atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	return closed ? -1 : 1;
+}
+
+
+/** @file ring.c
+ *  @brief Unmap a ring and close its eventfds
+ *
+ *  Only for a ring set up by ring_create() or ring_attach(), a zeroed
+ *  struct ring has fd 0 in it.
+ *
+ *  @param ring
+ *  @return none
+ */
+
+void ring_detach(struct ring* ring)
+{
+	if(ring->header != NULL)
+	{
+		munmap(ring->header, ring->map_len);
+		ring->header = NULL;
+	}
+	if(ring->data_fd != -1)
+	{
+		close(ring->data_fd);
+		ring->data_fd = -1;
+	}
+	if(ring->space_fd != -1)
+	{
+		close(ring->space_fd);
+		ring->space_fd = -1;
+	}
+}
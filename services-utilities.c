@@ -25,62 +25,32 @@
 /** @file services-utilities.c
  *  @brief Read the console log file
  *
- *  Console logs are pushed to /tmp/cmd_console_logs during command execution. 
- *  Collect the console logs. 
+ *  Console logs are pushed to console_log_file (default /tmp/cmd_console_logs) during command execution. 
+ *  Add the console logs to the reply. 
  *
- *  @param sockfd (socket descriptor)
+ *  @param conn (DUT connection)
  *  @return retVal (success 0, failure -1).
  */
 
-int request_console_logs(int sockfd)
+int request_console_logs(struct assist_conn* conn)
 {
-	char* console_logs = NULL;
-	int retVal = -1;
+	long console_logs_len = 0;
 
-	/* Read the log file and colect the content */
-	if((console_logs = collect_console_logs()) == NULL)
+	/* Add the log file to the reply, it is sent straight from the file */
+	if((console_logs_len = append_console_logs(conn->config, &conn->reply, conn->session)) == -1)
 	{
-		printf("\nAssist : collect_console_logs() fail\n");
-		if(console_logs)
-		{
-			free(console_logs); 
-			console_logs = NULL;
-		}
-        return retVal = -1;
+		printf("\nAssist : append_console_logs() fail\n");
+        return -1;
 	}
 
 	/* If the console logs length is zero byte or less, it is error */
-	else if(strlen(console_logs) < 1)
-	{
-		printf("\nAssist : collect_console_logs() null\n");
-		if(console_logs)
-		{
-			free(console_logs); 
-			console_logs = NULL;
-		}
-        return retVal = -1;
-	}
-
-	/* Send/write  console logs to socket */
-	if((write_socket(console_logs, sockfd)) == -1)
+	else if(console_logs_len < 1)
 	{
-		printf("\nAssist : Write console logs failed\n");
-		if(console_logs)
-		{
-			free(console_logs); 
-			console_logs = NULL;
-		}
-        return retVal = -1;
-	}		
-
-	/* Free console_log memory */
-	if(console_logs)
-	{
-		free(console_logs); 
-		console_logs = NULL;	
+		printf("\nAssist : append_console_logs() null\n");
+        return -1;
 	}
 
-	return retVal = 0;
+	return reply_append_view(&conn->reply, "\nAssistDataEnds", strlen("\nAssistDataEnds"));
 }
 
 
@@ -88,95 +58,76 @@ int request_console_logs(int sockfd)
 /** @file services-utilities.c
  *  @brief Read the console log file
  *
- *  Console logs are pushed to /tmp/cmd_console_logs during command execution. 
- *  Read the file and collect the console logs. 
+ *  Console logs are pushed to console_log_file (default /tmp/cmd_console_logs) during command execution. 
+ *  Commands of a named session use their own file, see session_log_file().
+ *  Log file is added to the reply as a file range and sent with sendfile(),
+ *  so it is never copied into assist server memory.
  *
- *  @param none
- *  @return console_logs. Data on success, NULL on error
+ *  @param config (of the request), reply (reply to append to) and session (empty for the default session)
+ *  @return console log length on success, -1 on error
  */
 
-char* collect_console_logs(void)
+long append_console_logs(struct assist_config* config, struct reply* reply, const char* session)
 {
-	char *console_logs = NULL; 
-	FILE *fd_cmd_output;
-	unsigned console_logs_len = 0; 
+	int fd_cmd_output = -1;
+	long console_logs_len = 0; 
+	struct stat log_stat;
+	char console_log_file[PATH_MAX];
+
+	session_log_file(config, session, console_log_file, sizeof(console_log_file));
 
 	/* Collect the console logs */
-	/* Open console log file /tmp/cmd_output */
-	if((fd_cmd_output = fopen(CONSOLE_LOG_FILE, "r")) == NULL)
+	if((fd_cmd_output = open(console_log_file, O_RDONLY | O_CLOEXEC)) == -1)
 	{
 		printf("\nCannot open the file");
-		/* Here console logs is NULL */
-		return NULL;
-	}
-	/* Move to end of file */
-    if(fseek(fd_cmd_output, 0 , SEEK_END) != 0)
-    {
-		printf("\nfile seek fail\n");
-    }
-
-    /* Find the size of console logs */
-    if((console_logs_len = ftell(fd_cmd_output)) == 0)
-    {
-    	printf("\nfile size is zero\n");	
-    	fclose(fopen(CONSOLE_LOG_FILE, "w"));
-    	console_logs = NULL;
-		return console_logs;	    	
-    }
-
-    /* Move to begining of file */
-    if(fseek(fd_cmd_output, 0 , SEEK_SET) != 0)
-    {
-		printf("\nfile seek fail\n");
-    }
-
-    if(console_logs_len > 0)
-    {
-    	printf("\nconsole log len is %d\n", console_logs_len);
-    	console_logs = malloc(console_logs_len + strlen("\n") + strlen("AssistDataEnds "));
-    }
-
-    if(console_logs == NULL)
-    {
-		printf("\nMemory allocation fail at collect_console_logs()\n");
-		fclose(fopen(CONSOLE_LOG_FILE, "w"));
-		console_logs = NULL;
-		return console_logs;	    	
-    }
-	
-	if((fread(console_logs, sizeof(char), console_logs_len, fd_cmd_output)) != console_logs_len)
-	{
-		printf("\nfile read fail\n");
-	}
-	console_logs[console_logs_len]='\0';
-	strcat(console_logs, "\n");
-	strcat(console_logs, "AssistDataEnds");
-	
+		return -1;
+	}
+
+	/* Find the size of console logs */
+	if(fstat(fd_cmd_output, &log_stat) != 0)
+	{
+		printf("\nfile stat fail\n");
+		close(fd_cmd_output);
+		return -1;
+	}
+
+	if((console_logs_len = log_stat.st_size) == 0)
+	{
+		printf("\nfile size is zero\n");
+		close(fd_cmd_output);
+		return 0;
+	}
 	#ifdef DEBUG
-		printf("\nfile read data is \n%s\n", console_logs);
+		printf("\nconsole log len is %ld\n", console_logs_len);
 	#endif
-	
-	sleep(1);
-	fclose(fd_cmd_output);
 
-	return console_logs;
+	/* Reply owns and closes the file from here */
+	if(reply_append_file(reply, fd_cmd_output, 0, console_logs_len) != 0)
+	{
+		return -1;
+	}
+
+	return console_logs_len;
 }
 
 
 /** @file services-utilities.c
  *  @brief Clear the console logs
  *
- *  Clear the console logs
+ *  Clear the console logs of the session
  *
- *  @param sockfd (Socket descriptor)
+ *  @param conn (DUT connection)
  *  @return 0 on success and -1 on error
  */
 
-int clear_console_logs(int sockfd)
+int clear_console_logs(struct assist_conn* conn)
 {
 	FILE *fd_cmd_output;
+	char console_log_file[PATH_MAX];
+
+	session_log_file(conn->config, conn->session, console_log_file, sizeof(console_log_file));
 
-	if((fd_cmd_output = fopen(CONSOLE_LOG_FILE, "w")) == NULL)
+	if((fd_cmd_output = fopen(console_log_file, "w")) == NULL)
 	{
 		printf("\nAssist : Cannot open the file");
 		return -1;
@@ -184,7 +135,7 @@ int clear_console_logs(int sockfd)
 
 	fclose(fd_cmd_output);
 
-	write_socket("Assist : clear_console_logs() pass. AssistDataEnds", sockfd);
+	reply_append_view(&conn->reply, "Assist : clear_console_logs() pass. AssistDataEnds", strlen("Assist : clear_console_logs() pass. AssistDataEnds"));
 
 	return 0;
 }
@@ -195,30 +146,26 @@ int clear_console_logs(int sockfd)
  *
  *  Reboot the assist board
  *
- *  @param sockfd (Socket descriptor)
+ *  @param conn (DUT connection)
  *  @return retVal (0 on success and -1 on error).
  */
 
-int reboot_assist_board(int sockfd)
+int reboot_assist_board(struct assist_conn* conn)
 {
-	char tmpBuf[256];
 	int retVal = -1;
 
-	sprintf(tmpBuf, "reboot -h now");
-	retVal = system(tmpBuf);
+	retVal = system("reboot -h now");
 
 	if(0 == retVal)
 	{
 		printf("\nAssist : Board rebooting\n");
-		sprintf(tmpBuf, "Assist : Board rebooting. Return value is %d. AssistDataEnds", retVal);
-		write_socket(tmpBuf, sockfd);
+		reply_printf(&conn->reply, "Assist : Board rebooting. Return value is %d. AssistDataEnds", retVal);
 		retVal = 0;
 	}
 	else
 	{
 		printf("\nAssist : Board reboot fail\n");
-		sprintf(tmpBuf, "Assist : Board reboot fail. Return value is %d. AssistDataEnds", retVal);
-		write_socket(tmpBuf, sockfd);
+		reply_printf(&conn->reply, "Assist : Board reboot fail. Return value is %d. AssistDataEnds", retVal);
 		retVal = -1;
 	}
 	return retVal;
@@ -226,51 +173,569 @@ int reboot_assist_board(int sockfd)
 
 
 /** @file services-utilities.c
- *  @brief assist-server is able to respond
+ *  @brief assist-server is able to respond, with board telemetry
  *
- *  assist-server is able to respond
+ *  Latest telemetry sample, or with "history <n>" the last n samples
+ *  one per line, oldest first. Samples are taken by telemetry.c, the
+ *  request only copies them.
  *
- *  @param sockfd (socket descriptor)
- *  @return 0 on success. Nothing on error
+ *  @param conn (DUT connection) and request (empty or "history <n>")
+ *  @return 0 on success, -1 on error
  */
 
-int health_check_assist_board(int sockfd)
+int health_check_assist_board(struct assist_conn* conn, char* request)
 {
+	struct telemetry_sample* samples = NULL;
+	int max_samples = 1;
+	int count = 0;
+	int i = 0;
+
+	if(strncmp(request, "history", strlen("history")) == 0)
+	{
+		max_samples = atoi(request_argument(request, "history"));
+		if((max_samples <= 0) || (max_samples > TELEMETRY_HISTORY))
+		{
+			max_samples = TELEMETRY_HISTORY;
+		}
+	}
+
+	if((samples = arena_alloc(&conn->arena, max_samples * sizeof(*samples))) == NULL)
+	{
+		return -1;
+	}
+	count = telemetry_history(samples, max_samples);
+
 	printf("\nAssist : Health check is OK\n");
-	write_socket("Assist : Health check is OK. AssistDataEnds", sockfd);
+	reply_printf(&conn->reply, "Assist : Health check is OK.\n");
+	for(i = 0; i < count; i++)
+	{
+		telemetry_reply(&conn->reply, &samples[i], max_samples > 1);
+	}
+	reply_printf(&conn->reply, "AssistDataEnds");
+
+	return conn->reply.error ? -1 : 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Send events of the assist server journal
+ *
+ *  Request can be empty (every event kept), "last <seconds>" or
+ *  "<from> <to>" in wall-clock ms since epoch (date +%s%3N).
+ *
+ *  @param conn (DUT connection) and request (time range)
+ *  @return 0 on success, -1 on error
+ */
+
+int request_journal(struct assist_conn* conn, char* request)
+{
+	struct timespec now;
+	long long from_ms = 0;
+	long long to_ms = 0;
+	int count = 0;
+
+	if(strncmp(request, "last", strlen("last")) == 0)
+	{
+		clock_gettime(CLOCK_REALTIME, &now);
+		from_ms = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000L - atoll(request_argument(request, "last")) * 1000;
+	}
+	else if(request[0] != '\0')
+	{
+		sscanf(request, "%lld %lld", &from_ms, &to_ms);
+	}
+
+	if((count = journal_reply(&conn->reply, from_ms, to_ms)) == -1)
+	{
+		reply_printf(&conn->reply, "Assist : Journal is disabled. AssistDataEnds");
+		return -1;
+	}
+
+	printf("\nAssist : Sent %d journal events\n", count);
+	reply_printf(&conn->reply, "Assist : %d journal events. AssistDataEnds", count);
+
+	return conn->reply.error ? -1 : 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Estimate clock offset to DUT
+ *
+ *  Ping-pong exchange with DUT, see clock-sync.c. Result is kept for
+ *  latency reports and journalled.
+ *
+ *  @param conn (DUT connection)
+ *  @return 0 on success, -1 on error
+ */
+
+int sync_assist_clock(struct assist_conn* conn)
+{
+	struct clock_sample result;
+	char text[64];
+
+	if(clock_sync_serve(conn, &result) != 0)
+	{
+		reply_printf(&conn->reply, "Assist : Clock sync fail. AssistDataEnds");
+		return -1;
+	}
+
+	snprintf(text, sizeof(text), "rtt=%lld drift_ppm=%.3f", result.rtt_us, result.drift_ppm);
+	journal_append(JOURNAL_CLOCK, conn->journal_id, 0, result.offset_us, text);
+
+	printf("\nAssist : Clock offset to DUT %lld us, RTT %lld us, drift %.3f ppm\n", result.offset_us, result.rtt_us, result.drift_ppm);
+	reply_printf(&conn->reply, "Assist : Clock offset %lld us, RTT %lld us, drift %.3f ppm. AssistDataEnds",
+		result.offset_us, result.rtt_us, result.drift_ppm);
+
 	return 0;
 }
 
 
+/** @file services-utilities.c
+ *  @brief Sync a file or directory tree from DUT
+ *
+ *  Exchange with DUT, see delta-sync.c. Reply gives files synced, changed
+ *  and bytes DUT had to send.
+ *
+ *  @param conn (DUT connection) and request (path on the assist board)
+ *  @return 0 on success, -1 on error
+ */
+
+int sync_files(struct assist_conn* conn, char* request)
+{
+	struct delta_result result;
+	int timeout_ms = conn->config->socket_timeout_ms;
+
+	if(request[0] == '\0')
+	{
+		reply_printf(&conn->reply, "Assist : AssistFileSync needs a path. AssistDataEnds");
+		return -1;
+	}
+
+	if(delta_serve(conn->sockfd, request, timeout_ms, &result) != 0)
+	{
+		printf("\nAssist : File sync to %s ended by DUT, %llu files done\n", request, result.files);
+		reply_printf(&conn->reply, "Assist : File sync to %s fail after %llu files. AssistDataEnds", request, result.files);
+		return -1;
+	}
+
+	printf("\nAssist : Synced %s, %llu files (%llu changed), %llu bytes, %llu received as data\n",
+		request, result.files, result.changed, result.bytes, result.literal);
+	reply_printf(&conn->reply, "Assist : Synced %s, %llu files (%llu changed, %llu failed), %llu directories, %llu bytes, %llu received as data. AssistDataEnds",
+		request, result.files, result.changed, result.failed, result.dirs, result.bytes, result.literal);
+
+	return (result.failed == 0) ? 0 : -1;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Send a pattern of CAN frames
+ *
+ *  Frames are sent by can-gen.c on a raw CAN socket, paced to the
+ *  requested rate. Reply gives frames sent, achieved rate and send errors.
+ *  Generator stops at the request deadline. A request without one gets
+ *  deadline_ms of the configuration, a slow rate must not hold the
+ *  worker for ever.
+ *
+ *  @param conn (DUT connection) and request (interface and pattern)
+ *  @return 0 on success, -1 on error
+ */
+
+int generate_can_frames(struct assist_conn* conn, char* request)
+{
+	struct can_pattern pattern;
+	struct can_result result;
+	char* text = NULL;
+	char rate[32] = "max";
+	double seconds = 0;
+	int deadline_ms = conn->deadline_ms;
+	int retVal = 0;
+
+	/* Parsing cuts the text, request stays whole for the trace */
+	if(((text = arena_alloc(&conn->arena, strlen(request) + 1)) == NULL) ||
+		(can_parse_pattern(strcpy(text, request), &pattern) != 0))
+	{
+		reply_printf(&conn->reply, "Assist : Invalid CanGenerate pattern. Usage : CanGenerate <interface> [id=<hex>[-<hex>]] "
+			"[idgen=step|random] [data=<hex>|counter|random] [len=<0-8>] [count=<frames>] [rate=<frames/s>] [burst=<frames>]. AssistDataEnds");
+		return -1;
+	}
+
+	if(deadline_ms <= 0)
+	{
+		deadline_ms = (conn->config->deadline_ms > 0) ? conn->config->deadline_ms : DEFAULT_DEADLINE_MS;
+	}
+
+	retVal = can_generate(&pattern, deadline_ms, &result);
+	if((retVal != 0) && (result.sent == 0))
+	{
+		printf("\nAssist : CanGenerate on %s fail, %s\n", pattern.ifname, strerror(result.last_errno));
+		reply_printf(&conn->reply, "Assist : CanGenerate on %s fail, %s. AssistDataEnds", pattern.ifname, strerror(result.last_errno));
+		return -1;
+	}
+
+	seconds = result.elapsed_ns / 1000000000.0;
+	if(pattern.rate > 0)
+	{
+		snprintf(rate, sizeof(rate), "%d", pattern.rate);
+	}
+	journal_append(JOURNAL_FRAME, conn->journal_id, 0, result.sent, pattern.ifname);
+
+	printf("\nAssist : CanGenerate sent %lld frames on %s in %.3f s\n", result.sent, pattern.ifname, seconds);
+	reply_printf(&conn->reply, "Assist : CanGenerate sent %lld of %lld frames on %s in %.6f s, %.1f frames/s (target %s), "
+		"%lld send errors%s%s%s. AssistDataEnds",
+		result.sent, pattern.count, pattern.ifname, seconds, (seconds > 0) ? result.sent / seconds : 0, rate,
+		result.send_errors, result.send_errors ? ", last " : "", result.send_errors ? strerror(result.last_errno) : "",
+		result.stopped ? ", stopped at deadline" : "");
+
+	return ((retVal == 0) && (result.stopped == 0)) ? 0 : -1;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Start capturing a CAN interface to a binary capture file
+ *
+ *  "realtime" or "normal" after the file overrides capture_realtime of
+ *  the configuration.
+ *
+ *  @param conn (DUT connection) and request ("<interface> <file> [realtime|normal]")
+ *  @return 0 on success, -1 on error
+ */
+
+int start_can_capture(struct assist_conn* conn, char* request)
+{
+	char ifname[IFNAMSIZ];
+	char path[PATH_MAX];
+	char mode[16] = "";
+	int realtime = conn->config->capture_realtime;
+	int status = 0;
+
+	if((sscanf(request, "%15s %4095s %15s", ifname, path, mode) < 2) ||
+		((mode[0] != '\0') && (strcmp(mode, "realtime") != 0) && (strcmp(mode, "normal") != 0)))
+	{
+		reply_printf(&conn->reply, "Assist : Usage : CanCaptureStart <interface> <file> [realtime|normal]. AssistDataEnds");
+		return -1;
+	}
+	if(mode[0] != '\0')
+	{
+		realtime = (strcmp(mode, "realtime") == 0);
+	}
+
+	if(capture_start(conn->config, ifname, path, realtime, conn->session, &status) != 0)
+	{
+		printf("\nAssist : Capture of %s fail, %s\n", ifname, strerror(errno));
+		reply_printf(&conn->reply, "Assist : Capture of %s to %s fail, %s. AssistDataEnds", ifname, path, strerror(errno));
+		return -1;
+	}
+
+	reply_printf(&conn->reply, "Assist : Capturing %s to %s", ifname, path);
+	if(status & CAPTURE_REALTIME)
+	{
+		reply_printf(&conn->reply, " in realtime mode%s%s", (status & CAPTURE_SCHEDULED) ? "" : ", not SCHED_FIFO",
+			(status & CAPTURE_LOCKED) ? "" : ", not locked in memory");
+	}
+	reply_printf(&conn->reply, ". AssistDataEnds");
+
+	return 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Stop a capture and index its file
+ *
+ *  Reply has the socket drops, and for a realtime capture the buffer
+ *  overruns and its peak use, so a lossless capture can be shown.
+ *  Only the session that started the capture stops it.
+ *
+ *  @param conn (DUT connection) and request (capture file)
+ *  @return 0 on success, -1 on error
+ */
+
+int stop_can_capture(struct assist_conn* conn, char* request)
+{
+	struct capture_counters counters;
+
+	if(capture_stop(request, conn->session, &counters) != 0)
+	{
+		if(errno == EPERM)
+		{
+			reply_printf(&conn->reply, "Assist : Capture to %s belongs to another session. AssistDataEnds", request);
+			return -1;
+		}
+		reply_printf(&conn->reply, "Assist : No complete capture to %s. AssistDataEnds", request);
+		return -1;
+	}
+
+	reply_printf(&conn->reply, "Assist : Capture %s stopped, %llu frames, %u dropped", request, counters.records, counters.drops);
+	if(counters.status & CAPTURE_REALTIME)
+	{
+		reply_printf(&conn->reply, ", %llu overruns, buffer peak %llu of %llu frames", counters.overruns,
+			counters.high_water, counters.buffer_frames);
+	}
+	reply_printf(&conn->reply, ". AssistDataEnds");
+
+	return 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Parse a capture filter option
+ *
+ *  last=<seconds>, from=<ms> and to=<ms> (wall-clock ms since epoch),
+ *  id=<hex>[/<mask>] and records=<first>-<last>
+ *
+ *  @param option and filter (updated)
+ *  @return 0 when the option is a filter option, -1 otherwise
+ */
+
+static int parse_capture_filter(char* option, struct capture_filter* filter)
+{
+	char* mask = NULL;
+
+	if(strncmp(option, "last=", strlen("last=")) == 0)
+	{
+		filter->from_ns = (clock_sync_now_us() - atoll(&option[strlen("last=")]) * 1000000LL) * 1000;
+	}
+	else if(strncmp(option, "from=", strlen("from=")) == 0)
+	{
+		filter->from_ns = atoll(&option[strlen("from=")]) * 1000000LL;
+	}
+	else if(strncmp(option, "to=", strlen("to=")) == 0)
+	{
+		filter->to_ns = atoll(&option[strlen("to=")]) * 1000000LL;
+	}
+	else if(strncmp(option, "id=", strlen("id=")) == 0)
+	{
+		filter->can_id = strtoul(&option[strlen("id=")], &mask, 16);
+		filter->mask = (*mask == '/') ? strtoul(mask + 1, NULL, 16) : CAN_EFF_MASK;
+	}
+	else if(strncmp(option, "records=", strlen("records=")) == 0)
+	{
+		filter->first = strtoull(&option[strlen("records=")], &mask, 10);
+		filter->last = (*mask == '-') ? strtoull(mask + 1, NULL, 10) + 1 : filter->first + 1;
+	}
+	else
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Send frames of a capture file
+ *
+ *  Request is "<file>", filter options (see parse_capture_filter()) and
+ *  max=<frames>. Frames are sent as candump -L lines.
+ *
+ *  @param conn (DUT connection) and request (file and filter)
+ *  @return 0 on success, -1 on error
+ */
+
+int fetch_capture(struct assist_conn* conn, char* request)
+{
+	struct capture_filter filter;
+	struct timespec start, end;
+	unsigned long long total = 0;
+	char path[PATH_MAX];
+	char* option = NULL;
+	char* save = NULL;
+	long long sent = 0;
+	int offset = 0;
+
+	bzero(&filter, sizeof(filter));
+	if(sscanf(request, "%4095s%n", path, &offset) != 1)
+	{
+		reply_printf(&conn->reply, "Assist : Usage : CaptureFetch <file> [last=<s>] [from=<ms>] [to=<ms>] "
+			"[id=<hex>[/<mask>]] [records=<first>-<last>] [max=<frames>]. AssistDataEnds");
+		return -1;
+	}
+
+	for(option = strtok_r(&request[offset], " ", &save); option != NULL; option = strtok_r(NULL, " ", &save))
+	{
+		if((parse_capture_filter(option, &filter) != 0) && (strncmp(option, "max=", strlen("max=")) == 0))
+		{
+			filter.max = atoll(&option[strlen("max=")]);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if((sent = capture_fetch(&conn->reply, path, &filter, &total)) == -1)
+	{
+		reply_printf(&conn->reply, "Assist : %s is not a capture file. AssistDataEnds", path);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("\nAssist : Fetched %lld of %llu frames from %s\n", sent, total, path);
+	reply_printf(&conn->reply, "Assist : %lld of %llu frames in %ld us. AssistDataEnds", sent, total,
+		(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
+
+	return conn->reply.error ? -1 : 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Send traffic statistics of a capture file
+ *
+ *  Request is "<file>", filter options (see parse_capture_filter()) and
+ *  bitrate=<bit/s> for the bus load (default CAPTURE_BITRATE). Reply is
+ *  the summary, not the frames.
+ *
+ *  @param conn (DUT connection) and request (file and filter)
+ *  @return 0 on success, -1 on error
+ */
+
+int report_capture_stats(struct assist_conn* conn, char* request)
+{
+	struct capture_filter filter;
+	struct timespec start, end;
+	unsigned long long total = 0;
+	char path[PATH_MAX];
+	char* option = NULL;
+	char* save = NULL;
+	long long counted = 0;
+	int bitrate = CAPTURE_BITRATE;
+	int offset = 0;
+
+	bzero(&filter, sizeof(filter));
+	if(sscanf(request, "%4095s%n", path, &offset) != 1)
+	{
+		reply_printf(&conn->reply, "Assist : Usage : CaptureStats <file> [last=<s>] [from=<ms>] [to=<ms>] "
+			"[id=<hex>[/<mask>]] [records=<first>-<last>] [bitrate=<bit/s>]. AssistDataEnds");
+		return -1;
+	}
+
+	for(option = strtok_r(&request[offset], " ", &save); option != NULL; option = strtok_r(NULL, " ", &save))
+	{
+		if((parse_capture_filter(option, &filter) != 0) && (strncmp(option, "bitrate=", strlen("bitrate=")) == 0))
+		{
+			bitrate = atoi(&option[strlen("bitrate=")]);
+		}
+	}
+
+	if(bitrate <= 0)
+	{
+		reply_printf(&conn->reply, "Assist : Invalid bitrate. AssistDataEnds");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if((counted = capture_statistics(&conn->reply, path, &filter, bitrate, &total)) == -1)
+	{
+		reply_printf(&conn->reply, "Assist : %s is not a capture file. AssistDataEnds", path);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("\nAssist : Statistics of %lld of %llu frames from %s\n", counted, total, path);
+	reply_printf(&conn->reply, "Assist : %lld of %llu frames in %ld us. AssistDataEnds", counted, total,
+		(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
+
+	return conn->reply.error ? -1 : 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Subscribe the connection to an event
+ *
+ *  Reply is an acknowledge line, then an "AssistEvent" line per event
+ *  pushed by the event thread (see event.c), and AssistDataEnds once
+ *  the subscription ends. Request deadline ends it as well.
+ *
+ *  @param conn (DUT connection) and request ("[count=<n>] <event> <arguments>")
+ *  @return 0 on success, -1 on error
+ */
+
+int subscribe_events(struct assist_conn* conn, char* request)
+{
+	struct event_subscription* sub = NULL;
+	int id = 0;
+
+	if((sub = calloc(1, sizeof(*sub))) == NULL)
+	{
+		reply_printf(&conn->reply, "Assist : Subscribe %s fail, out of memory. AssistDataEnds", request);
+		return -1;
+	}
+
+	if(event_parse(request, sub) == -1)
+	{
+		if(sub->regex_valid)
+		{
+			regfree(&sub->regex);
+		}
+		free(sub);
+		reply_printf(&conn->reply, "Assist : Usage : Subscribe [count=<n>] exit <pid|name> | log <regex> | "
+			"can <interface> <id>[/<mask>] | threshold <metric> <op> <value>. AssistDataEnds");
+		return -1;
+	}
+
+	/* Acknowledge is sent by event_subscribe(), the reply is empty on return */
+	if((id = event_subscribe(sub, conn)) == -1)
+	{
+		printf("\nAssist : Subscribe %s fail, %s\n", request, strerror(errno));
+		reply_printf(&conn->reply, "Assist : Subscribe %s fail, %s. AssistDataEnds", request, strerror(errno));
+		return -1;
+	}
+
+	printf("\nAssist : Subscription %d to %s\n", id, request);
+	return 0;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Report the sessions of the assist board
+ *
+ *  @param conn (DUT connection)
+ *  @return 0 on success, -1 on error
+ */
+
+int report_sessions(struct assist_conn* conn)
+{
+	int retVal = session_report(conn->config, &conn->reply, conn->session);
+
+	reply_printf(&conn->reply, "AssistDataEnds");
+
+	return retVal;
+}
+
+
 /** @file services-utilities.c
  *  @brief Start a process/program
  *
- *  Start a process/program
+ *  Start a process/program. Process is killed if it outlives the request deadline.
+ *  Refused when the session is at its quota.
  *
- *  @param request (commands) and sockfd (socket descriptor)
+ *  @param conn (DUT connection) and request (program and its arguments)
  *  @return retVal (0 on success, -1 on failure).
  */
 
-int start_process(char* request, int sockfd)
+int start_process(struct assist_conn* conn, char* request)
 {
-	char tmpBuf[256];
 	int retVal = -1;
+	int timed_out = 0;
 
-	sprintf(tmpBuf, "%s", &request[13]);
-	retVal = system(tmpBuf);
+	if(session_admit(conn->config, conn->session, &conn->reply) != 0)
+	{
+		return -1;
+	}
 
-	if(0 == retVal)
+	retVal = run_command(request, NULL, conn->session, conn->deadline_ms, &timed_out);
+
+	if(timed_out)
+	{
+		printf("\nAssist : Process %s timed out after %d ms\n", request, conn->deadline_ms);
+		reply_printf(&conn->reply, "Assist : Process %s timed out after %d ms. Return value is %d. AssistDataEnds", request, conn->deadline_ms, retVal);
+		retVal = -1;
+	}
+	else if(0 == retVal)
 	{
-		printf("\nAssist : Process %s started successfully\n", &request[13]);
-		sprintf(tmpBuf, "Assist : Process %s started successfully. Return value is %d. AssistDataEnds", &request[13], retVal);
-		write_socket(tmpBuf, sockfd);
+		printf("\nAssist : Process %s started successfully\n", request);
+		reply_printf(&conn->reply, "Assist : Process %s started successfully. Return value is %d. AssistDataEnds", request, retVal);
 		retVal = 0;
 	}
 	else
 	{
-		printf("\nAssist : Process %s started successfully\n", &request[13]);
-		sprintf(tmpBuf, "Assist : Process %s failed to start. Return value is %d. AssistDataEnds", &request[13], retVal);
-		write_socket(tmpBuf, sockfd);
+		printf("\nAssist : Process %s started successfully\n", request);
+		reply_printf(&conn->reply, "Assist : Process %s failed to start. Return value is %d. AssistDataEnds", request, retVal);
 		retVal = -1;
 	}
 	return retVal;	
@@ -280,71 +745,235 @@ int start_process(char* request, int sockfd)
 /** @file services-utilities.c
  *  @brief Check process/program is running
  *
- *  Check the process is runing, send the status
+ *  Check the process is runing, send the status. Same match as "pidof -x",
+ *  done from /proc without starting any process. Reply lists PID, state,
+ *  CPU time and RSS of every match.
  *
- *  @param request (commands) and sockfd (socket descriptor)
+ *  @param conn (DUT connection) and request (process name)
  *  @return retVal (0 on success, -1 on failure).
  */
 
-int check_process_running(char* request, int sockfd)
+int check_process_running(struct assist_conn* conn, char* request)
 {
-	char tmpBuf[256];
+	struct proc_entry results[PROC_MAX_RESULTS];
+	int count = 0;
 	int retVal = -1;
 
-	/* strcpy(process, &request[20]); */
-	/* printf("\nProcess name is %s\n", process); */
-	sprintf(tmpBuf, "pidof -x %s", &request[20]);
-	printf("\nCommand is %s\n", tmpBuf);
-	/* if(0 == system(command)) */
-	if(0 == system(tmpBuf))
+	count = proc_scan_find(request, PROC_MATCH_NAME, 0, results, PROC_MAX_RESULTS);
+	if(count == -1)
+	{
+		printf("\nAssist : Process lookup fail\n");
+		reply_printf(&conn->reply, "Assist : Process lookup of \"%s\" fail. AssistDataEnds", request);
+		retVal = -1;
+	}
+	else if(count > 0)
 	{
 		printf("\nAssist : Process exist\n");
-		sprintf(tmpBuf, "Assist : Process \"%s\" exist. AssistDataEnds", &request[20]);
-		write_socket(tmpBuf, sockfd);
+		reply_printf(&conn->reply, "Assist : Process \"%s\" exist. Process count is %d", request, count);
+		proc_scan_reply(&conn->reply, results, count);
+		reply_printf(&conn->reply, "AssistDataEnds");
 		retVal = 0;
 	}
 	else
 	{
 		printf("\nProcess do not exist\n");
-		sprintf(tmpBuf, "Assist : Process \"%s\" do not exist. AssistDataEnds", &request[20]);
-		write_socket(tmpBuf, sockfd);
+		reply_printf(&conn->reply, "Assist : Process \"%s\" do not exist. AssistDataEnds", request);
 		retVal = -1;
 	}
 	return retVal;
 }
 
 
+/* Signal names pkill takes, as -KILL, -SIGKILL or --signal KILL */
+static const struct
+{
+	const char* name;
+	int number;
+} kill_signals[] =
+{
+	{"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ILL", SIGILL},
+	{"TRAP", SIGTRAP}, {"ABRT", SIGABRT}, {"BUS", SIGBUS}, {"FPE", SIGFPE},
+	{"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"SEGV", SIGSEGV}, {"USR2", SIGUSR2},
+	{"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CHLD", SIGCHLD},
+	{"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+	{"TTOU", SIGTTOU}, {"URG", SIGURG}, {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ},
+	{"VTALRM", SIGVTALRM}, {"PROF", SIGPROF}, {"WINCH", SIGWINCH}, {"IO", SIGIO},
+	{"PWR", SIGPWR}, {"SYS", SIGSYS},
+};
+
+
+/** @file services-utilities.c
+ *  @brief Signal of a pkill option, by number or name
+ *
+ *  @param text ("9", "KILL" or "SIGKILL", case ignored)
+ *  @return signal number, -1 when unknown
+ */
+
+static int kill_parse_signal(const char* text)
+{
+	char* end = NULL;
+	long number = 0;
+	size_t i = 0;
+
+	if(isdigit((unsigned char)text[0]))
+	{
+		number = strtol(text, &end, 10);
+		return ((*end == '\0') && (number > 0) && (number < NSIG)) ? (int)number : -1;
+	}
+
+	if(strncasecmp(text, "SIG", 3) == 0)
+	{
+		text += 3;
+	}
+	for(i = 0; i < sizeof(kill_signals) / sizeof(kill_signals[0]); i++)
+	{
+		if(strcasecmp(text, kill_signals[i].name) == 0)
+		{
+			return kill_signals[i].number;
+		}
+	}
+
+	return -1;
+}
+
+
 /** @file services-utilities.c
  *  @brief Kill the program
  *
- *  Check requested program is running. If so kill it by name
+ *  Check requested program is running. If so kill it by name.
+ *  Same match as "pkill" (regular expression on process name) and same
+ *  return value, done from /proc without starting any process.
+ *  pkill options are taken : -<signal> or --signal <signal> (SIGTERM by
+ *  default), -f for the whole command line and -x for an exact match.
+ *  Only processes of the session are signalled. For the default session
+ *  those are the processes of no named session.
  *
- *  @param request (commands) and sockfd (socket descriptor)
+ *  @param conn (DUT connection) and request ("[options] pattern")
  *  @return retVal (0 on success, -1 on failure).
  */
 
-int kill_running_process(char* request, int sockfd)
+int kill_running_process(struct assist_conn* conn, char* request)
 {
-	char tmpBuf[256];
+	struct proc_entry results[PROC_MAX_RESULTS];
+	char* pattern = request;
+	char* option = NULL;
+	int mode = PROC_MATCH_PATTERN;
+	int signal_number = SIGTERM;
+	int exact = 0;
+	int count = 0;
+	int killed = 0;
 	int retVal = -1;
+	int i = 0;
+	pid_t after = 0;
+
+	/* Options first, as pkill takes them */
+	while((pattern != NULL) && (pattern[0] == '-'))
+	{
+		option = pattern;
+		if((pattern = strchr(pattern, ' ')) != NULL)
+		{
+			*pattern++ = '\0';
+			pattern += strspn(pattern, " ");
+		}
+
+		if(strcmp(option, "--") == 0)
+		{
+			break;
+		}
+		else if(strcmp(option, "--signal") == 0)
+		{
+			option = pattern;
+			if((pattern != NULL) && ((pattern = strchr(pattern, ' ')) != NULL))
+			{
+				*pattern++ = '\0';
+				pattern += strspn(pattern, " ");
+			}
+			if((option == NULL) || ((signal_number = kill_parse_signal(option)) == -1))
+			{
+				pattern = NULL;
+			}
+		}
+		else if(strncmp(option, "--signal=", strlen("--signal=")) == 0)
+		{
+			if((signal_number = kill_parse_signal(&option[strlen("--signal=")])) == -1)
+			{
+				pattern = NULL;
+			}
+		}
+		else if((option[1] != '\0') && (strspn(&option[1], "fx") == strlen(&option[1])))
+		{
+			mode = strchr(option, 'f') ? PROC_MATCH_FULL : mode;
+			exact = exact || (strchr(option, 'x') != NULL);
+		}
+		else if((signal_number = kill_parse_signal(&option[1])) == -1)
+		{
+			pattern = NULL;
+		}
+	}
+
+	if((pattern != NULL) && (pattern[0] != '\0') && exact)
+	{
+		pattern = arena_printf(&conn->arena, "^(%s)$", pattern);
+	}
+
+	/* pkill exit status 2 : syntax error */
+	if((pattern == NULL) || (pattern[0] == '\0'))
+	{
+		retVal = 2 << 8;
+		printf("\nAssist : Invalid KillRunningProcess request\n");
+		reply_printf(&conn->reply, "Assist : Usage : KillRunningProcess [-signal|--signal signal] [-f] [-x] pattern. Return value is %d. AssistDataEnds", retVal);
+		return -1;
+	}
+
+	/* All matches, PROC_MAX_RESULTS at a time */
+	do
+	{
+		if(((count = proc_scan_find(pattern, mode, after, results, PROC_MAX_RESULTS)) == -1) && (errno == EINVAL))
+		{
+			retVal = 2 << 8;
+			reply_printf(&conn->reply, "Assist : Invalid pattern \"%s\". Return value is %d. AssistDataEnds", pattern, retVal);
+			return -1;
+		}
+		/* pkill exit status 3 : fatal error */
+		if(count == -1)
+		{
+			retVal = 3 << 8;
+			reply_printf(&conn->reply, "Assist : Process lookup fail. Return value is %d. AssistDataEnds", retVal);
+			return -1;
+		}
 
-	sprintf(tmpBuf, "pkill %s", &request[19]);
-	printf("\nCommand is %s\n", tmpBuf);
-	/* if(0 == system(command))*/
-	retVal = system(tmpBuf);
+		for(i = 0; i < count; i++)
+		{
+			if(strcmp(results[i].session, conn->session) != 0)
+			{
+				continue;
+			}
+			if(kill(results[i].pid, signal_number) == 0)
+			{
+				printf("\nAssist : Sent signal %d to %d (%s)\n", signal_number, results[i].pid, results[i].comm);
+				killed++;
+			}
+		}
+
+		if(count > 0)
+		{
+			after = results[count - 1].pid;
+		}
+	} while(count == PROC_MAX_RESULTS);
+
+	/* pkill exit status : 0 when something was signalled, 1 otherwise */
+	retVal = (killed > 0) ? 0 : (1 << 8);
 	printf("\nsystem return value is %d\n", retVal);
 	if(0 == retVal)
 	{
 		printf("\nAssist : Process killed\n");
-		sprintf(tmpBuf, "Assist : Process \"%s\" killed. Return value is %d. AssistDataEnds", &request[19], retVal);
-		write_socket(tmpBuf, sockfd);
+		reply_printf(&conn->reply, "Assist : Process \"%s\" killed. Return value is %d. AssistDataEnds", pattern, retVal);
 		retVal = 0;
 	}
 	else
 	{
 		printf("\nProcess do not exist or not killed\n");
-		sprintf(tmpBuf, "Assist : Process \"%s\" do not exist or not killed. Return value is %d. AssistDataEnds", &request[19], retVal);
-		write_socket(tmpBuf, sockfd);
+		reply_printf(&conn->reply, "Assist : Process \"%s\" do not exist or not killed. Return value is %d. AssistDataEnds", pattern, retVal);
 		retVal = -1;
 	}
 	return retVal;
@@ -357,14 +986,24 @@ int kill_running_process(char* request, int sockfd)
  *  Dut Incoming commands can be run in foreground nd background. 
  *  Foregound commands return actual return values
  *  Background commands return always success
+ *  Foreground commands outliving the deadline are killed with their process group
+ *  Output goes to the log of the session. Refused when the session is at its quota.
  *
- *  @param request (commands) and sockfd (socket descriptor)
+ *  @param conn (DUT connection) and request (commands)
  *  @return retVal system retun value
  */
 
-int execute_request(char* request, int sockfd)
+int execute_request(struct assist_conn* conn, char* request)
 {	
-	char tmpBuf[1024];	
+	int timed_out = 0;
+	int retVal = -1;
+	char console_log_file[PATH_MAX];
+
+	if(session_admit(conn->config, conn->session, &conn->reply) != 0)
+	{
+		return -1;
+	}
+	session_log_file(conn->config, conn->session, console_log_file, sizeof(console_log_file));
 
 	/* Append additional parameters to collect the console logs */
 	/* sprintf(tmpBuf, "timeout 10s %s 2>&1 | tee %s", request, CONSOLE_LOG_FILE); */
@@ -372,30 +1011,192 @@ int execute_request(char* request, int sockfd)
 	/* sprintf(tmpBuf, "%s 2>&1 > %s &", request, CONSOLE_LOG_FILE); */
 	/* Following ">" truncate the logs. Change it. We are giving this option to client */
 
-	if(strchr(request, '&') != NULL)
-	{	
-		request[strlen(request) - 1] = '\0';
-		sprintf(tmpBuf, "%s 2>&1 >> %s &", request, CONSOLE_LOG_FILE);
+	/* Execute the request in assist board, as "request 2>&1 >> console_log_file".
+	 * Background commands ("request &") are left to the shell */
+	retVal = run_command(request, console_log_file, conn->session, conn->deadline_ms, &timed_out);
+
+	if(timed_out)
+	{
+		printf("\nAssist : Execution of %s timed out after %d ms\n", request, conn->deadline_ms);
+		reply_printf(&conn->reply, "Assist : Execution of \"%s\" timed out after %d ms. Return value is %d. AssistDataEnds\n", request, conn->deadline_ms, retVal);
+	}
+	else if(retVal !=0)
+	{
+		printf("\nAssist : Execution of %s fail. Return value is %d\n", request, retVal);
+		reply_printf(&conn->reply, "Assist : Execution of \"%s\" fail. Return value is %d. AssistDataEnds\n", request, retVal); 
 	}
 	else
 	{
-		sprintf(tmpBuf, "%s 2>&1 >> %s", request, CONSOLE_LOG_FILE);	
+		printf("\nAssist : Execution of %s pass. Return value is %d\n", request, retVal);
+		reply_printf(&conn->reply, "Assist : Execution of \"%s\" pass. Return value is %d. AssistDataEnds\n", request, retVal);
 	}
+	return retVal;
+}
 
-	/* Execute the request_final in assist board */
-	int retVal = system(tmpBuf);
 
-	if(retVal !=0)
+/** @file services-utilities.c
+ *  @brief Wait for a child process with deadline
+ *
+ *  Wait on pidfd (process exit) and timerfd (deadline) together. On kernels
+ *  without pidfd_open, fall back to polling the child every 10 ms.
+ *  When the deadline expires the whole process group is killed.
+ *
+ *  @param pid (child process), deadline_ms (deadline in ms) and timed_out (set to 1 on expiry)
+ *  @return status in waitpid() format, -1 on error
+ */
+
+static int wait_child_deadline(pid_t pid, int deadline_ms, int* timed_out)
+{
+	struct itimerspec deadline;
+	struct pollfd fds[2];
+	int status = -1;
+	int timer_fd = -1;
+	int pid_fd = -1;
+
+	bzero(&deadline, sizeof(deadline));
+	deadline.it_value.tv_sec = deadline_ms / 1000;
+	deadline.it_value.tv_nsec = (deadline_ms % 1000) * 1000000L;
+
+	if(((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1) ||
+		(timerfd_settime(timer_fd, 0, &deadline, NULL) == -1))
 	{
-		printf("\nAssist : Execution of %s fail. Return value is %d\n", tmpBuf, retVal);
-		sprintf(tmpBuf, "Assist : Execution of \"%s\" fail. Return value is %d. AssistDataEnds\n", request, retVal); 
-		write_socket(tmpBuf, sockfd);
+		printf("\nAssist : timerfd fail, waiting without deadline\n");
+		if(timer_fd != -1)
+		{
+			close(timer_fd);
+		}
+		while((waitpid(pid, &status, 0) == -1) && (errno == EINTR));
+		return status;
+	}
+
+	#ifdef SYS_pidfd_open
+		pid_fd = syscall(SYS_pidfd_open, pid, 0);
+	#endif
+
+	while(1)
+	{
+		fds[0].fd = timer_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = pid_fd;
+		fds[1].events = POLLIN;
+
+		if((poll(fds, (pid_fd != -1) ? 2 : 1, (pid_fd != -1) ? -1 : 10) == -1) && (errno != EINTR))
+		{
+			printf("\nAssist : poll fail while waiting for child\n");
+			break;
+		}
+
+		/* Child finished */
+		if(waitpid(pid, &status, WNOHANG) == pid)
+		{
+			break;
+		}
+
+		/* Deadline expired. Kill child and everything it started */
+		if(fds[0].revents & POLLIN)
+		{
+			printf("\nAssist : Deadline of %d ms expired, killing process group %d\n", deadline_ms, pid);
+			kill(-pid, SIGKILL);
+			while((waitpid(pid, &status, 0) == -1) && (errno == EINTR));
+			*timed_out = 1;
+			status = DEADLINE_EXIT_STATUS << 8;
+			break;
+		}
+	}
+
+	if(pid_fd != -1)
+	{
+		close(pid_fd);
+	}
+	close(timer_fd);
+
+	return status;
+}
+
+
+/** @file services-utilities.c
+ *  @brief Run a shell command with deadline
+ *
+ *  Same as system(), but command runs in its own process group so that
+ *  it can be killed together with its children once deadline expires.
+ *  Command is started by the executor process (see executor.c). Only
+ *  when it is not available the server forks /bin/sh itself.
+ *
+ *  @param command (shell command), log_file (stdout and stderr appended, NULL for none),
+ *         session (empty for the default session), deadline_ms (0 for none) and
+ *         timed_out (set to 1 on expiry)
+ *  @return status in system() format, -1 on error
+ */
+
+int run_command(char* command, const char* log_file, const char* session, int deadline_ms, int* timed_out)
+{
+	char* shell_argv[] = { "sh", "-c", command, NULL };
+	char** env = NULL;
+	sigset_t empty_mask;
+	pid_t pid;
+	int status = -1;
+	int log_fd = -1;
+
+	*timed_out = 0;
+
+	if(executor_run(command, log_file, session, deadline_ms, timed_out, &status) == 0)
+	{
+		return status;
+	}
+
+	/* Built before fork, the child only execs */
+	if((env = session_environ(session)) == NULL)
+	{
+		printf("\nAssist : No memory for environment of %s\n", command);
+		return -1;
+	}
+
+	if((pid = fork()) == -1)
+	{
+		printf("\nAssist : fork fail for %s\n", command);
+		free(env);
+		return -1;
+	}
+
+	/* Child : new process group, "2>&1 >> log_file", then the shell.
+	 * Signals as the executor leaves them : none blocked (server blocks
+	 * SIGHUP and SIGUSR2 for its signalfd), SIGPIPE not ignored */
+	if(pid == 0)
+	{
+		setpgid(0, 0);
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
+		sigemptyset(&empty_mask);
+		sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+		if(log_file != NULL)
+		{
+			if((log_fd = open(log_file, O_WRONLY | O_APPEND | O_CREAT, 0644)) == -1)
+			{
+				_exit(1);
+			}
+			dup2(1, 2);
+			dup2(log_fd, 1);
+			close(log_fd);
+		}
+		execve("/bin/sh", shell_argv, env);
+		_exit(127);
+	}
+	free(env);
+
+	/* Parent : set the group as well to avoid racing with the child */
+	setpgid(pid, pid);
+	journal_append(JOURNAL_SPAWN, 0, pid, 0, command);
+
+	if(deadline_ms <= 0)
+	{
+		while((waitpid(pid, &status, 0) == -1) && (errno == EINTR));
 	}
 	else
 	{
-		printf("\nAssist : Execution of %s pass. Return value is %d\n", tmpBuf, retVal);
-		sprintf(tmpBuf, "Assist : Execution of \"%s\" pass. Return value is %d. AssistDataEnds\n", request, retVal);
-		write_socket(tmpBuf, sockfd);
+		status = wait_child_deadline(pid, deadline_ms, timed_out);
 	}
-	return retVal;
-}
\ No newline at end of file
+	journal_append(JOURNAL_EXIT, 0, pid, status, command);
+
+	return status;
+}
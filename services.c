@@ -11,6 +11,10 @@
  *  Kill a process
  *  Check the process state
  *  Assist board health
+ *  Generate CAN frames
+ *  Capture CAN frames and fetch them
+ *  Subscribe to events
+ *  Report the sessions
  * 
  *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
  *  @bug No know bugs.
@@ -19,26 +23,50 @@
 #include "./include/assist.h"
 
 
+/* Priority class of each opcode, the rest is PRIORITY_NORMAL. Control
+ * requests must get through while long transfers or commands run */
+static const struct request_class request_classes[] =
+{
+	{ "AssistBoardHealth", PRIORITY_CONTROL },
+	{ "KillRunningProcess", PRIORITY_CONTROL },
+	{ "CheckProcessRunning", PRIORITY_CONTROL },
+	{ "AssistClockSync", PRIORITY_CONTROL },
+	{ "ConsoleLogsRequest", PRIORITY_BULK },
+	{ "AssistJournal", PRIORITY_BULK },
+	{ "CaptureFetch", PRIORITY_BULK },
+};
+
+
 /** @file services.c
  *  @brief DUT request is compared and appropriate function is called
  *
  *  DUT request is compared/analised. Based on request appropriate utility is called.
+ *  Utility builds its reply in conn->reply, it is sent here once utility returns.
  *
- *  @param sockfd (socket descriptor)
+ *  @param conn (DUT connection)
  *  @return retVal (success 0, failure -1).
  */
 
 
-int service_request(int sockfd) 
+int service_request(struct assist_conn* conn) 
 { 		
 	char* request = NULL;
+	char* request_data = NULL;
+	int ring_size = 0;
+	int session_error = 0;
 	int retVal = 0;
+	struct trace_record trace;
+	struct timespec start, end;
+
+	reply_init(&conn->reply, conn->sockfd);
+	reply_set_watermarks(&conn->reply, conn->high_water, conn->low_water);
+	conn->reply.trace = trace_enabled();
 
-	if((request = read_socket(sockfd)) == NULL)
+	if((request = read_socket(conn)) == NULL)
 	{
 		printf("\nAssist : read_socket() fail\n");
-		write_socket("Assist : read_socket() fail. AssistDataEnds", sockfd);
-        retVal = -1;
+		write_socket("Assist : read_socket() fail. AssistDataEnds", conn->sockfd);
+		return -1;
 	}
 	#ifdef DEBUG
 	else
@@ -46,15 +74,66 @@ int service_request(int sockfd)
 		printf("\nAssist : Recv/read pass\n");
 	}
 	#endif
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
+	/* Strip the optional send time, deadline, ring and session prefixes, in
+	 * any order. Handlers see the bare request */
+	request_data = request;
+	conn->sent_us = 0;
+	conn->deadline_ms = 0;
+	conn->session[0] = '\0';
+	while(1)
+	{
+		if(strncmp(request_data, SENT_TAG, strlen(SENT_TAG)) == 0)
+		{
+			request_data = parse_request_sent(request_data, &conn->sent_us);
+		}
+		else if(strncmp(request_data, DEADLINE_TAG, strlen(DEADLINE_TAG)) == 0)
+		{
+			request_data = parse_request_deadline(request_data, &conn->deadline_ms);
+		}
+		else if(strncmp(request_data, RING_TAG, strlen(RING_TAG)) == 0)
+		{
+			request_data = parse_request_ring(request_data, &ring_size);
+		}
+		else if(strncmp(request_data, SESSION_TAG, strlen(SESSION_TAG)) == 0)
+		{
+			request_data = parse_request_session(request_data, conn->session);
+			session_error = (conn->session[0] == '\0');
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	/* Local DUT asked for a shared memory ring. Worth it for bulk replies only */
+	if((ring_size > 0) && (request_priority(request_data) == PRIORITY_BULK) && (reply_use_ring(&conn->reply, ring_size) == 0))
+	{
+		#ifdef DEBUG
+			printf("\nAssist : Reply through a %d byte ring\n", ring_size);
+		#endif
+	}
+	conn->journal_id = journal_append(JOURNAL_REQUEST, 0, 0, conn->sent_us, request_data);
+
+
+	/* Session name is used in file names, a bad one is refused */
+	if(session_error)
+	{
+		printf("\nAssist : Invalid session name in request\n");
+		reply_printf(&conn->reply, "Assist : Invalid session name, use up to %d letters, digits, '_', '-' or '.'. AssistDataEnds",
+			SESSION_NAME_SIZE - 1);
+		retVal = -1;
+	}
 
 	/* Receive console logs */
-	if(strcmp(request, "ConsoleLogsRequest") == 0)
+	else if(strcmp(request_data, "ConsoleLogsRequest") == 0)
 	{
-		if(request_console_logs(sockfd) == -1)
+		if(request_console_logs(conn) == -1)
 		{
 			printf("\nAssist : request_console_logs() fail\n");
-			write_socket("Assist : request_console_logs() fail. AssistDataEnds", sockfd);
+			reply_release(&conn->reply);
+			reply_printf(&conn->reply, "Assist : request_console_logs() fail. AssistDataEnds");
 			retVal = -1;
 		}
 		#ifdef DEBUG
@@ -66,12 +145,12 @@ int service_request(int sockfd)
 	}
 
 	/* Clear console logs */
-	else if(strcmp(request, "ConsoleLogsClear") == 0)
+	else if(strcmp(request_data, "ConsoleLogsClear") == 0)
 	{
-		if(clear_console_logs(sockfd) == -1)
+		if(clear_console_logs(conn) == -1)
 		{
 			printf("\nAssist : clear_console_logs() fail\n");
-			write_socket("Assist : clear_console_logs() fail. AssistDataEnds", sockfd);
+			reply_printf(&conn->reply, "Assist : clear_console_logs() fail. AssistDataEnds");
 			retVal = -1;			
 		}
 		#ifdef DEBUG
@@ -83,46 +162,393 @@ int service_request(int sockfd)
 	}
 
 	/* Rebooting assist board */
-	else if(strcmp(request, "AssistBoardReboot") == 0)
+	else if(strcmp(request_data, "AssistBoardReboot") == 0)
 	{
-		retVal = reboot_assist_board(sockfd);
+		retVal = reboot_assist_board(conn);
 	}
 
 	/* Check the health of assit board */
-	else if(strcmp(request, "AssistBoardHealth") == 0)
+	else if(strncmp(request_data, "AssistBoardHealth", strlen("AssistBoardHealth")) == 0)
 	{
-		retVal = health_check_assist_board(sockfd);
+		retVal = health_check_assist_board(conn, request_argument(request_data, "AssistBoardHealth"));
 	}
 
 	/* Start a process */
-	else if(strstr(request, "StartProcess") != 0)
+	else if(strncmp(request_data, "StartProcess", strlen("StartProcess")) == 0)
 	{
-		retVal = start_process(request, sockfd);
+		retVal = start_process(conn, request_argument(request_data, "StartProcess"));
 	}
 
 	/* Check a process is running */
-	else if(strstr(request, "CheckProcessRunning") != 0)
+	else if(strncmp(request_data, "CheckProcessRunning", strlen("CheckProcessRunning")) == 0)
 	{
-		retVal = check_process_running(request, sockfd);
+		retVal = check_process_running(conn, request_argument(request_data, "CheckProcessRunning"));
 	}
 
 	/* Kill a running process */
-	else if(strstr(request, "KillRunningProcess") != 0)
+	else if(strncmp(request_data, "KillRunningProcess", strlen("KillRunningProcess")) == 0)
 	{
-		retVal = kill_running_process(request, sockfd);
+		retVal = kill_running_process(conn, request_argument(request_data, "KillRunningProcess"));
 	}	
 
+	/* Clock offset ping-pong with DUT */
+	else if(strcmp(request_data, "AssistClockSync") == 0)
+	{
+		retVal = sync_assist_clock(conn);
+	}
+
+	/* File or directory tree from DUT, changed blocks only */
+	else if(strncmp(request_data, "AssistFileSync", strlen("AssistFileSync")) == 0)
+	{
+		retVal = sync_files(conn, request_argument(request_data, "AssistFileSync"));
+	}
+
+	/* Send CAN frames from the assist board */
+	else if(strncmp(request_data, "CanGenerate", strlen("CanGenerate")) == 0)
+	{
+		retVal = generate_can_frames(conn, request_argument(request_data, "CanGenerate"));
+	}
+
+	/* Binary capture of a CAN interface */
+	else if(strncmp(request_data, "CanCaptureStart", strlen("CanCaptureStart")) == 0)
+	{
+		retVal = start_can_capture(conn, request_argument(request_data, "CanCaptureStart"));
+	}
+
+	else if(strncmp(request_data, "CanCaptureStop", strlen("CanCaptureStop")) == 0)
+	{
+		retVal = stop_can_capture(conn, request_argument(request_data, "CanCaptureStop"));
+	}
+
+	/* Frames of a capture file by time, ID or record range */
+	else if(strncmp(request_data, "CaptureFetch", strlen("CaptureFetch")) == 0)
+	{
+		retVal = fetch_capture(conn, request_argument(request_data, "CaptureFetch"));
+	}
+
+	/* Per ID counts, rates, jitter, bus load and errors of a capture file */
+	else if(strncmp(request_data, "CaptureStats", strlen("CaptureStats")) == 0)
+	{
+		retVal = report_capture_stats(conn, request_argument(request_data, "CaptureStats"));
+	}
+
+	/* Push notifications of process exit, log line, CAN frame or threshold */
+	else if(strncmp(request_data, "Subscribe", strlen("Subscribe")) == 0)
+	{
+		retVal = subscribe_events(conn, request_argument(request_data, "Subscribe"));
+	}
+
+	/* Sessions sharing the assist board */
+	else if(strcmp(request_data, "AssistSession") == 0)
+	{
+		retVal = report_sessions(conn);
+	}
+
+	/* Events of the assist server journal */
+	else if(strncmp(request_data, "AssistJournal", strlen("AssistJournal")) == 0)
+	{
+		retVal = request_journal(conn, request_argument(request_data, "AssistJournal"));
+	}
+
 	/* Execute the command */
 	else 
 	{
-		retVal = execute_request(request, sockfd);
+		retVal = execute_request(conn, request_data);
     }
 
-    /* Free the allocated memory */ 
-	if(request)
+	/* Send the reply. Its segments go back to the pool */
+	if(reply_send(&conn->reply) != 0)
 	{
-		free(request); 
-		request = NULL;
+		printf("\nAssist : Send reply fail\n");
+		retVal = -1;
 	}
+	journal_append(JOURNAL_REPLY, conn->journal_id, 0, conn->reply.sent_len, (retVal == 0) ? "pass" : "fail");
+
+	/* Trace keeps the request as the handler saw it, and what it replied */
+	if(conn->reply.trace)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		bzero(&trace, sizeof(trace));
+		trace.start_us = (long long)start.tv_sec * 1000000 + start.tv_nsec / 1000;
+		trace.duration_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+		trace.deadline_ms = conn->deadline_ms;
+		trace.reply_len = conn->reply.sent_len;
+		trace.reply_hash = conn->reply.hash;
+		trace.status = retVal;
+		trace_append(&trace, request_data);
+	}
+
+	/* Request memory is in the connection arena, released by the worker */
 	return retVal;
-}
\ No newline at end of file
+}
+
+
+/** @file services.c
+ *  @brief Parse the request deadline
+ *
+ *  DUT can prefix the request with "AssistDeadline=<ms> ". The deadline is
+ *  enforced at assist board for the commands it runs on behalf of DUT.
+ *  Requests without the prefix (old clients) have no deadline, nor have
+ *  requests with a deadline that is not a number or does not fit an int.
+ *
+ *  @param request (request from DUT) and deadline_ms (deadline in ms, 0 for none)
+ *  @return pointer to the request without deadline prefix
+ */
+
+char* parse_request_deadline(char* request, int* deadline_ms)
+{
+	char* end = NULL;
+	long value = 0;
+
+	*deadline_ms = 0;
+
+	if(strncmp(request, DEADLINE_TAG, strlen(DEADLINE_TAG)) != 0)
+	{
+		return request;
+	}
+
+	errno = 0;
+	value = strtol(&request[strlen(DEADLINE_TAG)], &end, 10);
+	if((end == &request[strlen(DEADLINE_TAG)]) || (errno == ERANGE) || (value < 0) || (value > INT_MAX))
+	{
+		printf("\nAssist : Invalid deadline in request, ignored\n");
+		value = 0;
+	}
+
+	*deadline_ms = (int)value;
+
+	/* Skip the separating blank */
+	while(*end == ' ')
+	{
+		end++;
+	}
+
+	#ifdef DEBUG
+		printf("\nAssist : Request deadline is %d ms\n", *deadline_ms);
+	#endif
+
+	return end;
+}
+
+
+/** @file services.c
+ *  @brief Parse the DUT send time
+ *
+ *  DUT prefixes the request with "AssistSent=<us> ", its wall-clock time
+ *  when the request was sent. Journal keeps it with the request, so
+ *  one-way latency can be computed.
+ *
+ *  @param request (request from DUT) and sent_us (send time, 0 when not given)
+ *  @return pointer to the request without send time prefix
+ */
+
+char* parse_request_sent(char* request, long long* sent_us)
+{
+	char* end = NULL;
+
+	*sent_us = 0;
+
+	if(strncmp(request, SENT_TAG, strlen(SENT_TAG)) != 0)
+	{
+		return request;
+	}
+
+	*sent_us = strtoll(&request[strlen(SENT_TAG)], &end, 10);
+
+	/* Skip the separating blank */
+	while(*end == ' ')
+	{
+		end++;
+	}
+
+	return end;
+}
+
+
+/** @file services.c
+ *  @brief Parse the ring request
+ *
+ *  DUT on the local socket prefixes the request with "AssistRing=<bytes> "
+ *  to get bulk replies through a shared memory ring, see ring.c.
+ *
+ *  @param request (request from DUT) and ring_size (ring size, 0 when not asked)
+ *  @return pointer to the request without ring prefix
+ */
+
+char* parse_request_ring(char* request, int* ring_size)
+{
+	char* end = NULL;
+	long value = 0;
+
+	*ring_size = 0;
+
+	if(strncmp(request, RING_TAG, strlen(RING_TAG)) != 0)
+	{
+		return request;
+	}
+
+	value = strtol(&request[strlen(RING_TAG)], &end, 10);
+	*ring_size = ((value > 0) && (value <= RING_MAX_SIZE)) ? (int)value : 0;
+
+	/* Skip the separating blank */
+	while(*end == ' ')
+	{
+		end++;
+	}
+
+	return end;
+}
+
+
+/** @file services.c
+ *  @brief Parse the request session
+ *
+ *  DUT sharing the assist board with others prefixes the request with
+ *  "AssistSession=<name> ", see session.c. Requests without it are in
+ *  the default session.
+ *
+ *  @param request (request from DUT) and session (SESSION_NAME_SIZE, name
+ *         or empty string when the name is not valid)
+ *  @return pointer to the request without session prefix
+ */
+
+char* parse_request_session(char* request, char* session)
+{
+	char* name = NULL;
+	size_t len = 0;
+
+	session[0] = '\0';
+
+	if(strncmp(request, SESSION_TAG, strlen(SESSION_TAG)) != 0)
+	{
+		return request;
+	}
+
+	name = &request[strlen(SESSION_TAG)];
+	len = strcspn(name, " ");
+	if(len < SESSION_NAME_SIZE)
+	{
+		memcpy(session, name, len);
+		session[len] = '\0';
+		if(!session_valid(session))
+		{
+			session[0] = '\0';
+		}
+	}
+
+	/* Skip the separating blank */
+	name += len;
+	while(*name == ' ')
+	{
+		name++;
+	}
+
+	return name;
+}
+
+
+/** @file services.c
+ *  @brief Session of a peeked request
+ *
+ *  Called on the start of the request peeked from the socket, like
+ *  request_priority(), so worker pool can share workers between sessions.
+ *
+ *  @param request (NUL terminated, may be cut) and session (SESSION_NAME_SIZE,
+ *         empty string for the default session or a bad name)
+ *  @return none
+ */
+
+void request_session(const char* request, char* session)
+{
+	size_t len = 0;
+
+	session[0] = '\0';
+
+	while((strncmp(request, SENT_TAG, strlen(SENT_TAG)) == 0) ||
+		(strncmp(request, DEADLINE_TAG, strlen(DEADLINE_TAG)) == 0) ||
+		(strncmp(request, RING_TAG, strlen(RING_TAG)) == 0) ||
+		(strncmp(request, SESSION_TAG, strlen(SESSION_TAG)) == 0))
+	{
+		if(strncmp(request, SESSION_TAG, strlen(SESSION_TAG)) == 0)
+		{
+			request += strlen(SESSION_TAG);
+			len = strcspn(request, " ");
+			if((len < SESSION_NAME_SIZE) && (request[len] == ' '))
+			{
+				memcpy(session, request, len);
+				session[len] = '\0';
+			}
+		}
+		request += strcspn(request, " ");
+		request += strspn(request, " ");
+	}
+
+	if(!session_valid(session))
+	{
+		session[0] = '\0';
+	}
+}
+
+
+/** @file services.c
+ *  @brief Argument of the request
+ *
+ *  "StartProcess <program>" gives "<program>". Request without
+ *  argument gives empty string.
+ *
+ *  @param request (request from DUT) and keyword (request name)
+ *  @return pointer to the argument inside request
+ */
+
+char* request_argument(char* request, char* keyword)
+{
+	char* argument = strstr(request, keyword);
+
+	if(argument == NULL)
+	{
+		return "";
+	}
+
+	argument += strlen(keyword);
+	while(*argument == ' ')
+	{
+		argument++;
+	}
+
+	return argument;
+}
+
+
+/** @file services.c
+ *  @brief Priority class of a request
+ *
+ *  Called on the start of the request peeked from the socket, before a
+ *  worker takes it. Send time, deadline, ring and session prefixes are skipped.
+ *
+ *  @param request (NUL terminated, may be cut)
+ *  @return PRIORITY_CONTROL, PRIORITY_NORMAL or PRIORITY_BULK
+ */
+
+int request_priority(const char* request)
+{
+	size_t i = 0;
+
+	while((strncmp(request, SENT_TAG, strlen(SENT_TAG)) == 0) ||
+		(strncmp(request, DEADLINE_TAG, strlen(DEADLINE_TAG)) == 0) ||
+		(strncmp(request, RING_TAG, strlen(RING_TAG)) == 0) ||
+		(strncmp(request, SESSION_TAG, strlen(SESSION_TAG)) == 0))
+	{
+		request += strcspn(request, " ");
+		request += strspn(request, " ");
+	}
+
+	for(i = 0; i < sizeof(request_classes) / sizeof(request_classes[0]); i++)
+	{
+		if(strncmp(request, request_classes[i].opcode, strlen(request_classes[i].opcode)) == 0)
+		{
+			return request_classes[i].priority;
+		}
+	}
+
+	return PRIORITY_NORMAL;
+}
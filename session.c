@@ -0,0 +1,373 @@
+/** @file session.c
+ *  @brief Named sessions of DUTs sharing one assist board
+ *
+ *  DUT prefixes its requests with "AssistSession=<name> " (dut-client -s,
+ *  or session= in its configuration). Requests without it are in the
+ *  default session, which behaves as assist server always did.
+ *
+ *  A session has
+ *
+ *  Log store     : its commands write console_log_file.<name>, and
+ *                  ConsoleLogsRequest, ConsoleLogsClear and log events
+ *                  of the session use that file.
+ *  Job table     : commands of a session run with ASSIST_SESSION=<name>
+ *                  in their environment. Their children inherit it, so
+ *                  the processes of a session are found in /proc (see
+ *                  proc-scan.c). KillRunningProcess only signals those.
+ *  Captures      : a capture is stopped by the session that started it.
+ *  Quotas        : session_max_processes and session_max_log_bytes are
+ *                  checked before a command is started.
+ *  Fair share    : workers take the waiting request of the session with
+ *                  fewest busy workers first, and at most
+ *                  session_max_workers per session (see worker-pool.c).
+ *
+ *  The table below keeps per-session counters and the slot worker pool
+ *  counts busy workers by. Everything else is keyed by the name, so an
+ *  idle session can be dropped from the table and come back later.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Known sessions, slot 0 is the default session. Protected by session_lock */
+static struct session sessions[SESSION_MAX];
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file session.c
+ *  @brief Check a session name
+ *
+ *  Name is used in file names and the environment : letters, digits,
+ *  '_', '-' and '.', not starting with '.', shorter than SESSION_NAME_SIZE.
+ *
+ *  @param name
+ *  @return 1 when valid, 0 otherwise
+ */
+
+int session_valid(const char* name)
+{
+	size_t i = 0;
+
+	if((name[0] == '\0') || (name[0] == '.') || (strlen(name) >= SESSION_NAME_SIZE))
+	{
+		return 0;
+	}
+
+	for(i = 0; name[i] != '\0'; i++)
+	{
+		if(!isalnum((unsigned char)name[i]) && (name[i] != '_') && (name[i] != '-') && (name[i] != '.'))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/** @file session.c
+ *  @brief Take the slot of a session for a request
+ *
+ *  Unknown session gets a free slot, or the least recently used slot no
+ *  request holds. Invalid names and a full table fall in the default
+ *  session's slot.
+ *
+ *  @param name (empty for the default session)
+ *  @return slot, release with session_put()
+ */
+
+int session_get(const char* name)
+{
+	struct timespec now;
+	int slot = 0;
+	int i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&session_lock);
+	if(session_valid(name))
+	{
+		for(i = 1, slot = -1; i < SESSION_MAX; i++)
+		{
+			if(strcmp(sessions[i].name, name) == 0)
+			{
+				slot = i;
+				break;
+			}
+			if((sessions[i].refs == 0) && ((slot == -1) || (sessions[i].name[0] == '\0') ||
+				((sessions[slot].name[0] != '\0') && (sessions[i].last_ms < sessions[slot].last_ms))))
+			{
+				slot = i;
+			}
+		}
+
+		if(slot == -1)
+		{
+			slot = 0;
+		}
+		else if(strcmp(sessions[slot].name, name) != 0)
+		{
+			bzero(&sessions[slot], sizeof(sessions[slot]));
+			snprintf(sessions[slot].name, sizeof(sessions[slot].name), "%s", name);
+		}
+	}
+
+	sessions[slot].refs++;
+	sessions[slot].requests++;
+	sessions[slot].last_ms = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000L;
+	pthread_mutex_unlock(&session_lock);
+
+	return slot;
+}
+
+
+/** @file session.c
+ *  @brief Release the slot taken by session_get()
+ *
+ *  @param slot
+ *  @return none
+ */
+
+void session_put(int slot)
+{
+	pthread_mutex_lock(&session_lock);
+	sessions[slot].refs--;
+	pthread_mutex_unlock(&session_lock);
+}
+
+
+/** @file session.c
+ *  @brief Console log file of a session
+ *
+ *  @param config (of the request), name (empty for the default session), path and size
+ *  @return none
+ */
+
+void session_log_file(struct assist_config* config, const char* name, char* path, size_t size)
+{
+	if(name[0] == '\0')
+	{
+		snprintf(path, size, "%s", config->console_log_file);
+	}
+	else
+	{
+		snprintf(path, size, "%s.%s", config->console_log_file, name);
+	}
+}
+
+
+/** @file session.c
+ *  @brief Environment of a command of the session
+ *
+ *  Environment of the calling process, with ASSIST_SESSION=<name> first
+ *  for a named session and without ASSIST_SESSION for the default one.
+ *  Array and strings are one allocation.
+ *
+ *  @param name (empty for the default session)
+ *  @return environment (free() it), NULL on error
+ */
+
+char** session_environ(const char* name)
+{
+	char** env = NULL;
+	char* tag = NULL;
+	size_t count = 0;
+	size_t i = 0, j = 0;
+
+	while(environ[count] != NULL)
+	{
+		count++;
+	}
+
+	if((env = malloc((count + 2) * sizeof(*env) + strlen(SESSION_ENV) + SESSION_NAME_SIZE + 1)) == NULL)
+	{
+		return NULL;
+	}
+	tag = (char*)&env[count + 2];
+
+	if(name[0] != '\0')
+	{
+		sprintf(tag, "%s=%.*s", SESSION_ENV, SESSION_NAME_SIZE - 1, name);
+		env[j++] = tag;
+	}
+	for(i = 0; i < count; i++)
+	{
+		if((strncmp(environ[i], SESSION_ENV, strlen(SESSION_ENV)) != 0) || (environ[i][strlen(SESSION_ENV)] != '='))
+		{
+			env[j++] = environ[i];
+		}
+	}
+	env[j] = NULL;
+
+	return env;
+}
+
+
+/** @file session.c
+ *  @brief Check the quotas of a session before it starts a command
+ *
+ *  @param config (of the request), name (session), reply (reason added when refused)
+ *  @return 0 when the command may start, -1 when a quota is reached
+ */
+
+int session_admit(struct assist_config* config, const char* name, struct reply* reply)
+{
+	struct stat log_stat;
+	char log_file[PATH_MAX];
+	long long max_log_bytes = config->session_max_log_bytes;
+	int max_processes = config->session_max_processes;
+	int processes = 0;
+
+	/* Default session is the whole assist board, no quota */
+	if(name[0] == '\0')
+	{
+		return 0;
+	}
+
+	if((max_processes > 0) && ((processes = proc_scan_session(name)) == -1))
+	{
+		printf("\nAssist : Session %s processes not counted\n", name);
+		reply_printf(reply, "Assist : Session %s processes can not be counted for its quota. AssistDataEnds", name);
+		return -1;
+	}
+	if((max_processes > 0) && (processes >= max_processes))
+	{
+		printf("\nAssist : Session %s has %d processes, quota %d\n", name, processes, max_processes);
+		reply_printf(reply, "Assist : Session %s has %d processes running, quota is %d. AssistDataEnds", name, processes, max_processes);
+		return -1;
+	}
+
+	session_log_file(config, name, log_file, sizeof(log_file));
+	if((max_log_bytes > 0) && (stat(log_file, &log_stat) == 0) && (log_stat.st_size >= max_log_bytes))
+	{
+		printf("\nAssist : Session %s log is %lld bytes, quota %lld\n", name, (long long)log_stat.st_size, max_log_bytes);
+		reply_printf(reply, "Assist : Session %s log is %lld bytes, quota is %lld, ConsoleLogsClear first. AssistDataEnds",
+			name, (long long)log_stat.st_size, max_log_bytes);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** @file session.c
+ *  @brief Add the known sessions to the reply
+ *
+ *  One line per session : requests, requests in progress, processes
+ *  (-1 for the default session) and log size.
+ *
+ *  @param config (of the request), reply and current (session of the request, marked)
+ *  @return 0 on success, -1 on error
+ */
+
+int session_report(struct assist_config* config, struct reply* reply, const char* current)
+{
+	struct session copy[SESSION_MAX];
+	struct stat log_stat;
+	char log_file[PATH_MAX];
+	int i = 0;
+
+	pthread_mutex_lock(&session_lock);
+	memcpy(copy, sessions, sizeof(copy));
+	pthread_mutex_unlock(&session_lock);
+
+	reply_printf(reply, "Assist : Session \"%s\"\nSESSION REQUESTS ACTIVE PROCESSES LOG_BYTES\n", current);
+	for(i = 0; i < SESSION_MAX; i++)
+	{
+		if((i > 0) && (copy[i].name[0] == '\0'))
+		{
+			continue;
+		}
+
+		/* Processes of the default session are all the others, not counted */
+		session_log_file(config, copy[i].name, log_file, sizeof(log_file));
+		reply_printf(reply, "%s%s %llu %d %d %lld\n", (i == 0) ? "(default)" : copy[i].name,
+			(strcmp(copy[i].name, current) == 0) ? "*" : "", copy[i].requests, copy[i].refs,
+			(i == 0) ? -1 : proc_scan_session(copy[i].name), (stat(log_file, &log_stat) == 0) ? (long long)log_stat.st_size : 0LL);
+	}
+
+	return reply->error ? -1 : 0;
+}
+
+
+/** @file session.c
+ *  @brief Copy the session table for a hot restart
+ *
+ *  @param copy (SESSION_MAX entries, filled)
+ *  @return entries in use, default session first
+ */
+
+int session_export(struct session* copy)
+{
+	int count = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&session_lock);
+	for(i = 0; i < SESSION_MAX; i++)
+	{
+		if((i == 0) || (sessions[i].name[0] != '\0'))
+		{
+			copy[count++] = sessions[i];
+		}
+	}
+	pthread_mutex_unlock(&session_lock);
+
+	return count;
+}
+
+
+/** @file session.c
+ *  @brief Take over the session table of the previous server
+ *
+ *  Counters go on, references do not : requests in progress stay with the
+ *  previous server and handed over connections take their slot again.
+ *  Sessions already known here keep their slot.
+ *
+ *  @param copy (from session_export()) and count
+ *  @return none
+ */
+
+void session_import(const struct session* copy, int count)
+{
+	int slot = 0;
+	int i = 0, j = 0;
+
+	pthread_mutex_lock(&session_lock);
+	for(i = 0; i < count; i++)
+	{
+		if((copy[i].name[0] != '\0') && !session_valid(copy[i].name))
+		{
+			continue;
+		}
+
+		for(j = 1, slot = (copy[i].name[0] == '\0') ? 0 : -1; (j < SESSION_MAX) && (slot == -1); j++)
+		{
+			if(strcmp(sessions[j].name, copy[i].name) == 0)
+			{
+				slot = j;
+			}
+		}
+		for(j = 1; (j < SESSION_MAX) && (slot == -1); j++)
+		{
+			if(sessions[j].name[0] == '\0')
+			{
+				slot = j;
+				snprintf(sessions[slot].name, sizeof(sessions[slot].name), "%s", copy[i].name);
+			}
+		}
+		if(slot == -1)
+		{
+			continue;
+		}
+
+		sessions[slot].requests += copy[i].requests;
+		if(copy[i].last_ms > sessions[slot].last_ms)
+		{
+			sessions[slot].last_ms = copy[i].last_ms;
+		}
+	}
+	pthread_mutex_unlock(&session_lock);
+}
@@ -0,0 +1,385 @@
+/** @file telemetry.c
+ *  @brief Assist board telemetry for AssistBoardHealth
+ *
+ *  A background thread samples every telemetry_interval_ms
+ *
+ *  CPU load from /proc/stat, 1 minute load average, free memory from
+ *  /proc/meminfo, worker queue depth, busy workers, reply segments in
+ *  use, and counters of
+ *  CAN interfaces (sysfs statistics) and UARTs (/proc/tty/driver/serial).
+ *
+ *  Samples go into a fixed ring of TELEMETRY_HISTORY entries, so memory
+ *  is fixed and a health request only copies from the ring.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Sample ring, protected by telemetry_lock */
+static struct telemetry_sample telemetry_ring[TELEMETRY_HISTORY];
+static int telemetry_next = 0;
+static int telemetry_count = 0;
+static pthread_mutex_t telemetry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* CPU jiffies of previous sample, sampler thread only */
+static unsigned long long cpu_busy_prev = 0;
+static unsigned long long cpu_total_prev = 0;
+
+
+/** @file telemetry.c
+ *  @brief Read a small text file
+ *
+ *  @param path, buffer and size
+ *  @return bytes read, -1 on error
+ */
+
+static int telemetry_read_file(const char* path, char* buffer, size_t size)
+{
+	int fd = -1;
+	int len = 0;
+
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		return -1;
+	}
+
+	len = read(fd, buffer, size - 1);
+	close(fd);
+
+	if(len < 0)
+	{
+		return -1;
+	}
+	buffer[len] = '\0';
+
+	return len;
+}
+
+
+/** @file telemetry.c
+ *  @brief Read a sysfs counter
+ *
+ *  @param interface and counter (file in statistics directory)
+ *  @return counter value, 0 when not available
+ */
+
+static unsigned long long telemetry_read_counter(const char* interface, const char* counter)
+{
+	char path[128];
+	char buffer[32];
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", interface, counter);
+	if(telemetry_read_file(path, buffer, sizeof(buffer)) <= 0)
+	{
+		return 0;
+	}
+
+	return strtoull(buffer, NULL, 10);
+}
+
+
+/** @file telemetry.c
+ *  @brief Sample CPU load, load average and memory
+ *
+ *  @param sample (filled)
+ *  @return none
+ */
+
+static void telemetry_sample_system(struct telemetry_sample* sample)
+{
+	char buffer[2048];
+	char* line = NULL;
+	unsigned long long user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+	unsigned long long busy = 0, total = 0;
+
+	/* First line of /proc/stat is the sum of all CPUs */
+	if((telemetry_read_file("/proc/stat", buffer, sizeof(buffer)) > 0) &&
+		(sscanf(buffer, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+			&user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) >= 4))
+	{
+		busy = user + nice + system + irq + softirq + steal;
+		total = busy + idle + iowait;
+
+		if((cpu_total_prev != 0) && (total > cpu_total_prev))
+		{
+			sample->cpu_permille = (busy - cpu_busy_prev) * 1000 / (total - cpu_total_prev);
+		}
+		cpu_busy_prev = busy;
+		cpu_total_prev = total;
+	}
+
+	if(telemetry_read_file("/proc/loadavg", buffer, sizeof(buffer)) > 0)
+	{
+		sample->load1_centi = (int)(strtod(buffer, NULL) * 100);
+	}
+
+	if(telemetry_read_file("/proc/meminfo", buffer, sizeof(buffer)) > 0)
+	{
+		if((line = strstr(buffer, "MemTotal:")) != NULL)
+		{
+			sample->mem_total_kb = strtoul(line + strlen("MemTotal:"), NULL, 10);
+		}
+		if((line = strstr(buffer, "MemAvailable:")) != NULL)
+		{
+			sample->mem_avail_kb = strtoul(line + strlen("MemAvailable:"), NULL, 10);
+		}
+	}
+}
+
+
+/** @file telemetry.c
+ *  @brief Sample counters of CAN interfaces
+ *
+ *  Every interface of type CAN (ARPHRD_CAN) in sysfs is sampled,
+ *  including vcan.
+ *
+ *  @param sample (filled)
+ *  @return none
+ */
+
+static void telemetry_sample_can(struct telemetry_sample* sample)
+{
+	struct telemetry_link* link = NULL;
+	struct dirent* dir_entry = NULL;
+	DIR* net_dir = NULL;
+	char path[128];
+	char buffer[16];
+
+	if((net_dir = opendir("/sys/class/net")) == NULL)
+	{
+		return;
+	}
+
+	while(((dir_entry = readdir(net_dir)) != NULL) && (sample->link_count < TELEMETRY_MAX_LINKS))
+	{
+		if(dir_entry->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "/sys/class/net/%.32s/type", dir_entry->d_name);
+		if((telemetry_read_file(path, buffer, sizeof(buffer)) <= 0) || (atoi(buffer) != ARPHRD_CAN))
+		{
+			continue;
+		}
+
+		link = &sample->links[sample->link_count++];
+		snprintf(link->name, sizeof(link->name), "%.15s", dir_entry->d_name);
+		link->rx = telemetry_read_counter(link->name, "rx_packets");
+		link->tx = telemetry_read_counter(link->name, "tx_packets");
+		link->rx_dropped = telemetry_read_counter(link->name, "rx_dropped");
+		link->tx_dropped = telemetry_read_counter(link->name, "tx_dropped");
+		link->rx_errors = telemetry_read_counter(link->name, "rx_errors");
+		link->tx_errors = telemetry_read_counter(link->name, "tx_errors");
+	}
+
+	closedir(net_dir);
+}
+
+
+/** @file telemetry.c
+ *  @brief Sample counters of UARTs
+ *
+ *  /proc/tty/driver/serial lines look like
+ *  "0: uart:16550A port:000003F8 irq:4 tx:120 rx:300 oe:2 RTS|DTR"
+ *  Only UARTs which have moved data are sampled. Needs root.
+ *
+ *  @param sample (filled)
+ *  @return none
+ */
+
+static void telemetry_sample_uart(struct telemetry_sample* sample)
+{
+	struct telemetry_link* link = NULL;
+	char buffer[4096];
+	char* line = NULL;
+	char* saveptr = NULL;
+	char* field = NULL;
+	int line_number = 0;
+
+	if(telemetry_read_file("/proc/tty/driver/serial", buffer, sizeof(buffer)) <= 0)
+	{
+		return;
+	}
+
+	for(line = strtok_r(buffer, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr))
+	{
+		if((sample->link_count >= TELEMETRY_MAX_LINKS) || (strstr(line, " tx:") == NULL))
+		{
+			continue;
+		}
+
+		line_number = atoi(line);
+		link = &sample->links[sample->link_count];
+		bzero(link, sizeof(*link));
+		snprintf(link->name, sizeof(link->name), "ttyS%d", line_number);
+
+		link->tx = ((field = strstr(line, " tx:")) != NULL) ? strtoull(field + 4, NULL, 10) : 0;
+		link->rx = ((field = strstr(line, " rx:")) != NULL) ? strtoull(field + 4, NULL, 10) : 0;
+		/* Overruns are the UART drops, framing/parity errors its errors */
+		link->rx_dropped = ((field = strstr(line, " oe:")) != NULL) ? strtoull(field + 4, NULL, 10) : 0;
+		link->rx_errors = ((field = strstr(line, " fe:")) != NULL) ? strtoull(field + 4, NULL, 10) : 0;
+		link->rx_errors += ((field = strstr(line, " pe:")) != NULL) ? strtoull(field + 4, NULL, 10) : 0;
+
+		if((link->tx != 0) || (link->rx != 0))
+		{
+			sample->link_count++;
+		}
+	}
+}
+
+
+/** @file telemetry.c
+ *  @brief Take one sample into the ring
+ *
+ *  @param none
+ *  @return none
+ */
+
+static void telemetry_sample_now(void)
+{
+	struct telemetry_sample sample;
+	struct timespec now;
+
+	bzero(&sample, sizeof(sample));
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sample.time_ms = (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000L;
+
+	telemetry_sample_system(&sample);
+	telemetry_sample_can(&sample);
+	telemetry_sample_uart(&sample);
+	sample.queue_depth = worker_pool_depth();
+	sample.workers_busy = worker_pool_busy();
+	segment_pool_stats(&sample.segments_free, &sample.segments_total);
+
+	pthread_mutex_lock(&telemetry_lock);
+	telemetry_ring[telemetry_next] = sample;
+	telemetry_next = (telemetry_next + 1) % TELEMETRY_HISTORY;
+	if(telemetry_count < TELEMETRY_HISTORY)
+	{
+		telemetry_count++;
+	}
+	pthread_mutex_unlock(&telemetry_lock);
+
+	/* Threshold subscriptions see every sample */
+	event_telemetry(&sample);
+}
+
+
+/** @file telemetry.c
+ *  @brief Sampler thread
+ *
+ *  Interval is re-read from configuration on every tick, so a reload
+ *  takes effect.
+ *
+ *  @param arg (unused)
+ *  @return NULL
+ */
+
+static void* telemetry_thread(void* arg)
+{
+	struct assist_config* config = NULL;
+	int interval_ms = 0;
+
+	(void)arg;
+
+	while(1)
+	{
+		telemetry_sample_now();
+
+		config = config_get();
+		interval_ms = config->telemetry_interval_ms;
+		config_put(config);
+
+		usleep((useconds_t)interval_ms * 1000);
+	}
+
+	return NULL;
+}
+
+
+/** @file telemetry.c
+ *  @brief Start the sampler thread
+ *
+ *  @param none
+ *  @return 0 on success, -1 on error
+ */
+
+int telemetry_start(void)
+{
+	pthread_t thread;
+
+	/* First sample at once, CPU load shows from the second one */
+	telemetry_sample_now();
+
+	if(pthread_create(&thread, NULL, telemetry_thread, NULL) != 0)
+	{
+		printf("\nAssist : Create telemetry sampler fail\n");
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return 0;
+}
+
+
+/** @file telemetry.c
+ *  @brief Copy the latest samples
+ *
+ *  @param samples (filled, oldest first) and max_samples
+ *  @return number of samples copied
+ */
+
+int telemetry_history(struct telemetry_sample* samples, int max_samples)
+{
+	int count = 0;
+	int index = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&telemetry_lock);
+	count = (max_samples < telemetry_count) ? max_samples : telemetry_count;
+	index = (telemetry_next - count + TELEMETRY_HISTORY) % TELEMETRY_HISTORY;
+	for(i = 0; i < count; i++)
+	{
+		samples[i] = telemetry_ring[(index + i) % TELEMETRY_HISTORY];
+	}
+	pthread_mutex_unlock(&telemetry_lock);
+
+	return count;
+}
+
+
+/** @file telemetry.c
+ *  @brief Add a sample to the reply
+ *
+ *  One line for the board, one line per CAN/UART link. With compact,
+ *  all on one line for history listings.
+ *
+ *  @param reply, sample and compact
+ *  @return 0 on success, -1 on error
+ */
+
+int telemetry_reply(struct reply* reply, struct telemetry_sample* sample, int compact)
+{
+	struct telemetry_link* link = NULL;
+	int i = 0;
+
+	reply_printf(reply, "t_ms=%llu cpu=%d.%d%% load1=%d.%02d mem_avail_kb=%lu mem_total_kb=%lu queue=%d busy=%d segments=%d/%d",
+		sample->time_ms, sample->cpu_permille / 10, sample->cpu_permille % 10,
+		sample->load1_centi / 100, sample->load1_centi % 100,
+		sample->mem_avail_kb, sample->mem_total_kb, sample->queue_depth, sample->workers_busy,
+		sample->segments_total - sample->segments_free, sample->segments_total);
+
+	for(i = 0; i < sample->link_count; i++)
+	{
+		link = &sample->links[i];
+		reply_printf(reply, "%s%s rx=%llu tx=%llu rx_drop=%llu tx_drop=%llu rx_err=%llu tx_err=%llu",
+			compact ? " | " : "\n", link->name, link->rx, link->tx,
+			link->rx_dropped, link->tx_dropped, link->rx_errors, link->tx_errors);
+	}
+
+	return reply_printf(reply, "\n");
+}
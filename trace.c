@@ -0,0 +1,163 @@
+/** @file trace.c
+ *  @brief Request trace of the assist server, for replay
+ *
+ *  With trace_file set, every served request is appended to it as one
+ *  compact binary record : when it arrived, how long it took, its
+ *  deadline and status, length and hash of the reply, then the request
+ *  text. assist-replay drives a trace against an assist server again.
+ *
+ *  File starts with struct trace_header. Each record is written with one
+ *  writev() on an O_APPEND file, so records of workers never interleave.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Open trace file, -1 when tracing is off. Protected by trace_lock */
+static int trace_fd = -1;
+static char trace_path[PATH_MAX];
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** @file trace.c
+ *  @brief FNV-1a hash of reply bytes
+ *
+ *  Start with TRACE_HASH_INIT, feed the reply in any number of parts.
+ *
+ *  @param hash, data and len
+ *  @return hash including data
+ */
+
+unsigned int trace_hash(unsigned int hash, const void* data, size_t len)
+{
+	const unsigned char* bytes = data;
+	size_t i = 0;
+
+	for(i = 0; i < len; i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+
+/** @file trace.c
+ *  @brief Start, change or stop tracing
+ *
+ *  Called at start and on reload. Same path keeps the open file.
+ *
+ *  @param path (empty stops tracing)
+ *  @return 0 on success, -1 on error
+ */
+
+int trace_open(const char* path)
+{
+	struct trace_header header;
+	struct stat file_stat;
+	int fd = -1;
+
+	pthread_mutex_lock(&trace_lock);
+
+	if((trace_fd != -1) && (strcmp(trace_path, path) == 0))
+	{
+		pthread_mutex_unlock(&trace_lock);
+		return 0;
+	}
+
+	if(trace_fd != -1)
+	{
+		close(trace_fd);
+		trace_fd = -1;
+		printf("\nAssist : Trace %s closed\n", trace_path);
+	}
+	snprintf(trace_path, sizeof(trace_path), "%s", path);
+
+	if(path[0] == '\0')
+	{
+		pthread_mutex_unlock(&trace_lock);
+		return 0;
+	}
+
+	if(((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) == -1) || (fstat(fd, &file_stat) == -1))
+	{
+		printf("\nAssist : Open trace %s fail, %s\n", path, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		pthread_mutex_unlock(&trace_lock);
+		return -1;
+	}
+
+	/* New file gets the header, existing trace is continued */
+	if(file_stat.st_size == 0)
+	{
+		bzero(&header, sizeof(header));
+		memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+		header.record_size = sizeof(struct trace_record);
+		if(write(fd, &header, sizeof(header)) != sizeof(header))
+		{
+			printf("\nAssist : Write trace %s fail\n", path);
+			close(fd);
+			pthread_mutex_unlock(&trace_lock);
+			return -1;
+		}
+	}
+
+	trace_fd = fd;
+	printf("\nAssist : Tracing requests to %s\n", path);
+	pthread_mutex_unlock(&trace_lock);
+
+	return 0;
+}
+
+
+/** @file trace.c
+ *  @brief Tracing is on
+ *
+ *  @param none
+ *  @return 1 when on, 0 otherwise
+ */
+
+int trace_enabled(void)
+{
+	return trace_fd != -1;
+}
+
+
+/** @file trace.c
+ *  @brief Append a served request
+ *
+ *  @param record (all but size and request_len) and request
+ *  @return 0 on success, -1 on error
+ */
+
+int trace_append(struct trace_record* record, const char* request)
+{
+	struct iovec iov[2];
+	ssize_t len = 0;
+
+	record->request_len = strlen(request);
+	record->size = sizeof(*record) + record->request_len;
+
+	iov[0].iov_base = record;
+	iov[0].iov_len = sizeof(*record);
+	iov[1].iov_base = (void*)request;
+	iov[1].iov_len = record->request_len;
+
+	pthread_mutex_lock(&trace_lock);
+	len = (trace_fd != -1) ? writev(trace_fd, iov, 2) : 0;
+	pthread_mutex_unlock(&trace_lock);
+
+	if((len != -1) && (len != 0) && ((size_t)len != record->size))
+	{
+		printf("\nAssist : Trace record cut short\n");
+		return -1;
+	}
+
+	return (len == -1) ? -1 : 0;
+}
@@ -0,0 +1,667 @@
+/** @file worker-pool.c
+ *  @brief Worker threads serving DUT connections in parallel
+ *
+ *  main() accepts the connections and submits them. Worker threads take
+ *  connections from the queues and run service_request() on them, so a
+ *  long running command from one DUT does not hold requests of others.
+ *
+ *  Submitted connections wait in an epoll set until their request comes
+ *  in. The classifier thread peeks at it and queues the connection by
+ *  priority class (see request_priority()). Control requests (health,
+ *  kill, process check) go on the express queue. Express workers serve
+ *  only that queue, and the other workers take from it first, so a kill
+ *  is not held behind console log transfers or long commands.
+ *
+ *  DUTs of named sessions share the other workers (see session.c) : a
+ *  worker takes the oldest request of the session with fewest busy
+ *  workers, and a named session never has more than session_max_workers
+ *  busy. So one session flooding the board does not starve the others.
+ *  Control requests are not counted, they are short.
+ *
+ *  Bulk replies are paced to bulk_rate_kbps by the kernel, and control
+ *  replies get a higher socket priority, so bulk transfers do not
+ *  monopolise the link.
+ *
+ *  Number of workers is worker_count and express_workers from
+ *  configuration. It can change on reload : extra workers are started,
+ *  surplus workers exit after finishing their current request.
+ *
+ *  @author Yashwanth Dasar (yashwanth_dasar@mentor.com)
+ *  @bug No know bugs.
+ */
+
+#include "./include/assist.h"
+
+
+/* Queues of classified connections, protected by queue_lock.
+ * Waiting connections in all queues are at most WORK_QUEUE_SIZE */
+static struct work_item work_queue[WORK_QUEUE_SIZE];
+static int queue_head = 0;
+static int queue_count = 0;
+static struct work_item express_queue[WORK_QUEUE_SIZE];
+static int express_head = 0;
+static int express_count = 0;
+static int worker_target = 0;
+static int worker_running = 0;
+static int express_target = 0;
+static int express_running = 0;
+static int worker_busy = 0;
+static int session_busy[SESSION_MAX];
+static int session_workers = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* Connections waiting for their request, protected by queue_lock */
+static struct timespec pending_since[WORK_QUEUE_SIZE];
+static int pending_fd[WORK_QUEUE_SIZE];
+static int pending_count = 0;
+static int classify_fd = -1;
+
+
+/** @file worker-pool.c
+ *  @brief Set socket priority and pacing of the connection by its class
+ *
+ *  @param conn (worker's connection state) and config
+ *  @return none
+ */
+
+static void worker_set_priority(struct assist_conn* conn, struct assist_config* config)
+{
+	int priority = 0;
+	unsigned int rate = 0;
+
+	if(conn->priority == PRIORITY_CONTROL)
+	{
+		priority = SOCKET_PRIORITY_CONTROL;
+		setsockopt(conn->sockfd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+	}
+	else if(conn->priority == PRIORITY_BULK)
+	{
+		priority = SOCKET_PRIORITY_BULK;
+		setsockopt(conn->sockfd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+
+		if(config->bulk_rate_kbps > 0)
+		{
+			rate = (unsigned int)config->bulk_rate_kbps * 125;
+			if(setsockopt(conn->sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) == -1)
+			{
+				printf("\nAssist : Pacing bulk reply fail, %s\n", strerror(errno));
+			}
+		}
+	}
+}
+
+
+/** @file worker-pool.c
+ *  @brief Serve one connection
+ *
+ *  Serve the request and close the connection. The configuration is
+ *  taken once, handlers use conn->config.
+ *
+ *  @param conn (worker's connection state) and item (accepted connection)
+ *  @return none
+ */
+
+static void worker_serve(struct assist_conn* conn, struct work_item* item)
+{
+	/* Whole request sees one configuration, a SIGHUP meanwhile applies
+	 * from the next request on */
+	conn->config = config_get();
+	conn->sockfd = item->connfd;
+	conn->priority = item->priority;
+	conn->deadline_ms = 0;
+	conn->high_water = conn->config->reply_high_water;
+	conn->low_water = conn->config->reply_low_water;
+
+	// Silent or stuck DUT must not hold the worker forever
+	set_socket_timeout(conn->sockfd, conn->config->socket_timeout_ms);
+	worker_set_priority(conn, conn->config);
+
+	// Start receiving the requests or commands from DUT board.
+	// Failed request which already replied must not get a second reply
+	if((service_request(conn) == -1) && (conn->reply.sent_len == 0))
+	{
+		printf("\nAssist : Something went wrong at assist board. Please check\n");
+		write_socket("\nAssist : Something went wrong at assist board. Please check. AssistDataEnds", conn->sockfd);
+	}
+
+	// Everything the request allocated goes at once
+	arena_reset(&conn->arena);
+	close(conn->sockfd);
+	config_put(conn->config);
+	conn->config = NULL;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Pick the next request of the work queue
+ *
+ *  Oldest request of the session with fewest busy workers. Named
+ *  sessions at session_workers are skipped. Called with queue_lock held.
+ *
+ *  @param none
+ *  @return position in the work queue, -1 when none can be served now
+ */
+
+static int worker_pick(void)
+{
+	int pick = -1;
+	int slot = 0;
+	int i = 0;
+
+	for(i = 0; i < queue_count; i++)
+	{
+		slot = work_queue[(queue_head + i) % WORK_QUEUE_SIZE].session;
+		if((slot != 0) && (session_workers > 0) && (session_busy[slot] >= session_workers))
+		{
+			continue;
+		}
+		if((pick == -1) || (session_busy[slot] < session_busy[work_queue[(queue_head + pick) % WORK_QUEUE_SIZE].session]))
+		{
+			pick = i;
+		}
+	}
+
+	return pick;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Take a request out of the work queue
+ *
+ *  Later requests move up one place. Called with queue_lock held.
+ *
+ *  @param pick (position from worker_pick()) and item (filled)
+ *  @return none
+ */
+
+static void worker_take(int pick, struct work_item* item)
+{
+	int i = 0;
+
+	*item = work_queue[(queue_head + pick) % WORK_QUEUE_SIZE];
+	queue_count--;
+
+	/* Head of the queue is the usual case */
+	if(pick == 0)
+	{
+		queue_head = (queue_head + 1) % WORK_QUEUE_SIZE;
+		return;
+	}
+	for(i = pick; i < queue_count; i++)
+	{
+		work_queue[(queue_head + i) % WORK_QUEUE_SIZE] = work_queue[(queue_head + i + 1) % WORK_QUEUE_SIZE];
+	}
+}
+
+
+/** @file worker-pool.c
+ *  @brief Worker loop
+ *
+ *  Wait for connections and serve them, express queue first. Express
+ *  workers serve only the express queue. Work queue is shared between
+ *  sessions, see worker_pick(). Exit when there are more
+ *  workers of the kind running than configured.
+ *
+ *  @param express (1 for express worker)
+ *  @return none
+ */
+
+static void worker_loop(int express)
+{
+	struct work_item item;
+	struct assist_conn conn;
+	int counted = 0;
+	int pick = -1;
+
+	/* Connection memory is allocated once, reused for every request */
+	bzero(&conn, sizeof(conn));
+	if(arena_init(&conn.arena, ARENA_SIZE) != 0)
+	{
+		pthread_mutex_lock(&queue_lock);
+		if(express)
+		{
+			express_running--;
+		}
+		else
+		{
+			worker_running--;
+		}
+		pthread_mutex_unlock(&queue_lock);
+		return;
+	}
+
+	while(1)
+	{
+		pthread_mutex_lock(&queue_lock);
+		if(express)
+		{
+			while((express_count == 0) && (express_running <= express_target))
+			{
+				pthread_cond_wait(&queue_cond, &queue_lock);
+			}
+		}
+		else
+		{
+			while((express_count == 0) && ((pick = worker_pick()) == -1) && (worker_running <= worker_target))
+			{
+				pthread_cond_wait(&queue_cond, &queue_lock);
+			}
+		}
+
+		if((express && (express_running > express_target)) || (!express && (worker_running > worker_target)))
+		{
+			if(express)
+			{
+				express_running--;
+			}
+			else
+			{
+				worker_running--;
+			}
+			pthread_mutex_unlock(&queue_lock);
+			#ifdef DEBUG
+				printf("\nAssist : Surplus worker exits\n");
+			#endif
+			arena_destroy(&conn.arena);
+			return;
+		}
+
+		counted = (express_count == 0);
+		if(express_count > 0)
+		{
+			item = express_queue[express_head];
+			express_head = (express_head + 1) % WORK_QUEUE_SIZE;
+			express_count--;
+		}
+		else
+		{
+			worker_take(pick, &item);
+			session_busy[item.session]++;
+		}
+		worker_busy++;
+		pthread_mutex_unlock(&queue_lock);
+
+		worker_serve(&conn, &item);
+		session_put(item.session);
+
+		pthread_mutex_lock(&queue_lock);
+		worker_busy--;
+		if(counted)
+		{
+			session_busy[item.session]--;
+
+			/* Request of a session held at its limit can go now */
+			if(queue_count > 0)
+			{
+				pthread_cond_broadcast(&queue_cond);
+			}
+		}
+		pthread_mutex_unlock(&queue_lock);
+	}
+}
+
+
+/** @file worker-pool.c
+ *  @brief Worker thread
+ *
+ *  @param arg (unused)
+ *  @return NULL
+ */
+
+static void* worker_thread(void* arg)
+{
+	(void)arg;
+	worker_loop(0);
+	return NULL;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Express worker thread, serves only control requests
+ *
+ *  @param arg (unused)
+ *  @return NULL
+ */
+
+static void* express_thread(void* arg)
+{
+	(void)arg;
+	worker_loop(1);
+	return NULL;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Move a pending connection to the queue of its class
+ *
+ *  Called with queue_lock held.
+ *
+ *  @param index (in pending), priority and session (slot from session_get())
+ *  @return none
+ */
+
+static void worker_queue(int index, int priority, int session)
+{
+	struct work_item* item = NULL;
+	int connfd = pending_fd[index];
+
+	epoll_ctl(classify_fd, EPOLL_CTL_DEL, connfd, NULL);
+
+	pending_count--;
+	pending_fd[index] = pending_fd[pending_count];
+	pending_since[index] = pending_since[pending_count];
+
+	if(priority == PRIORITY_CONTROL)
+	{
+		item = &express_queue[(express_head + express_count) % WORK_QUEUE_SIZE];
+		express_count++;
+	}
+	else
+	{
+		item = &work_queue[(queue_head + queue_count) % WORK_QUEUE_SIZE];
+		queue_count++;
+	}
+	item->connfd = connfd;
+	item->priority = priority;
+	item->session = session;
+
+	/* Express workers wait on the same condition, signal could wake only them */
+	pthread_cond_broadcast(&queue_cond);
+}
+
+
+/** @file worker-pool.c
+ *  @brief Priority class and session of the request waiting on a connection
+ *
+ *  @param connfd (readable connection) and session (slot from session_get())
+ *  @return PRIORITY_* (PRIORITY_NORMAL when request cannot be peeked)
+ */
+
+static int worker_classify(int connfd, int* session)
+{
+	char peek[CLASSIFY_PEEK_SIZE];
+	char name[SESSION_NAME_SIZE];
+	ssize_t len = 0;
+
+	if((len = recv(connfd, peek, sizeof(peek) - 1, MSG_PEEK | MSG_DONTWAIT)) <= 0)
+	{
+		*session = session_get("");
+		return PRIORITY_NORMAL;
+	}
+	peek[len] = '\0';
+
+	request_session(peek, name);
+	*session = session_get(name);
+
+	return request_priority(peek);
+}
+
+
+/** @file worker-pool.c
+ *  @brief Classifier thread
+ *
+ *  Queue the connections whose request came in by their class. Silent
+ *  connections are queued as normal after socket_timeout_ms, their
+ *  worker times out on them as before.
+ *
+ *  @param arg (unused)
+ *  @return NULL
+ */
+
+static void* classify_thread(void* arg)
+{
+	struct epoll_event events[CLASSIFY_MAX_EVENTS];
+	struct assist_config* config = NULL;
+	struct timespec now;
+	long long waited_ms = 0;
+	int priority = 0;
+	int session = 0;
+	int queued = 0;
+	int count = 0;
+	int i = 0, j = 0;
+
+	(void)arg;
+
+	while(1)
+	{
+		if((count = epoll_wait(classify_fd, events, CLASSIFY_MAX_EVENTS, CLASSIFY_POLL_MS)) == -1)
+		{
+			count = 0;
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			priority = worker_classify(events[i].data.fd, &session);
+
+			pthread_mutex_lock(&queue_lock);
+			for(j = 0, queued = 0; (j < pending_count) && !queued; j++)
+			{
+				if(pending_fd[j] == events[i].data.fd)
+				{
+					worker_queue(j, priority, session);
+					queued = 1;
+				}
+			}
+			pthread_mutex_unlock(&queue_lock);
+
+			if(!queued)
+			{
+				session_put(session);
+			}
+		}
+
+		config = config_get();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		pthread_mutex_lock(&queue_lock);
+		for(j = pending_count - 1; (j >= 0) && (config->socket_timeout_ms > 0); j--)
+		{
+			waited_ms = (now.tv_sec - pending_since[j].tv_sec) * 1000 + (now.tv_nsec - pending_since[j].tv_nsec) / 1000000;
+			if(waited_ms >= config->socket_timeout_ms)
+			{
+				worker_queue(j, PRIORITY_NORMAL, session_get(""));
+			}
+		}
+		pthread_mutex_unlock(&queue_lock);
+		config_put(config);
+	}
+
+	return NULL;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Start the classifier and worker threads
+ *
+ *  @param count (number of workers), express_workers (express workers) and
+ *         max_session_workers (busy workers per named session, 0 for no limit)
+ *  @return 0 on success, -1 on error
+ */
+
+int worker_pool_start(int count, int express_workers, int max_session_workers)
+{
+	pthread_t thread;
+
+	if((classify_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+	{
+		printf("\nAssist : epoll_create1 fail, %s\n", strerror(errno));
+		return -1;
+	}
+
+	if(pthread_create(&thread, NULL, classify_thread, NULL) != 0)
+	{
+		printf("\nAssist : Create classifier fail\n");
+		close(classify_fd);
+		classify_fd = -1;
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return worker_pool_resize(count, express_workers, max_session_workers);
+}
+
+
+/** @file worker-pool.c
+ *  @brief Change the number of worker threads
+ *
+ *  Start missing workers. Surplus workers exit once they are idle.
+ *
+ *  @param count (number of workers), express_workers (express workers) and
+ *         max_session_workers (busy workers per named session, 0 for no limit)
+ *  @return 0 on success, -1 on error
+ */
+
+int worker_pool_resize(int count, int express_workers, int max_session_workers)
+{
+	pthread_t thread;
+	int retVal = 0;
+
+	pthread_mutex_lock(&queue_lock);
+	worker_target = count;
+	express_target = express_workers;
+	session_workers = max_session_workers;
+
+	while((worker_running < worker_target) || (express_running < express_target))
+	{
+		if(pthread_create(&thread, NULL, (worker_running < worker_target) ? worker_thread : express_thread, NULL) != 0)
+		{
+			printf("\nAssist : Create worker %d fail\n", worker_running + express_running);
+			retVal = -1;
+			break;
+		}
+		pthread_detach(thread);
+		if(worker_running < worker_target)
+		{
+			worker_running++;
+		}
+		else
+		{
+			express_running++;
+		}
+	}
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+
+	printf("\nAssist : %d workers and %d express workers serving requests\n", count, express_workers);
+
+	return retVal;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Submit an accepted connection for the workers
+ *
+ *  Connection is queued once its request comes in, see classify_thread().
+ *
+ *  @param connfd (accepted connection)
+ *  @return 0 on success, -1 when queue is full
+ */
+
+int worker_pool_submit(int connfd)
+{
+	struct epoll_event event;
+
+	pthread_mutex_lock(&queue_lock);
+	if(pending_count + queue_count + express_count >= WORK_QUEUE_SIZE)
+	{
+		pthread_mutex_unlock(&queue_lock);
+		return -1;
+	}
+
+	pending_fd[pending_count] = connfd;
+	clock_gettime(CLOCK_MONOTONIC, &pending_since[pending_count]);
+	pending_count++;
+
+	bzero(&event, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.fd = connfd;
+	if(epoll_ctl(classify_fd, EPOLL_CTL_ADD, connfd, &event) == -1)
+	{
+		// Not classified, but still served
+		worker_queue(pending_count - 1, PRIORITY_NORMAL, session_get(""));
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	return 0;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Connections waiting for a worker
+ *
+ *  @param none
+ *  @return queue depth (including connections whose request is not in yet)
+ */
+
+int worker_pool_depth(void)
+{
+	int depth = 0;
+
+	pthread_mutex_lock(&queue_lock);
+	depth = pending_count + queue_count + express_count;
+	pthread_mutex_unlock(&queue_lock);
+
+	return depth;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Workers serving a connection
+ *
+ *  @param none
+ *  @return busy workers
+ */
+
+int worker_pool_busy(void)
+{
+	int busy = 0;
+
+	pthread_mutex_lock(&queue_lock);
+	busy = worker_busy;
+	pthread_mutex_unlock(&queue_lock);
+
+	return busy;
+}
+
+
+/** @file worker-pool.c
+ *  @brief Take out a connection no worker has started on, for a hot restart
+ *
+ *  Requests are only peeked before a worker reads them, so the new server
+ *  classifies and serves the connection as if it had accepted it.
+ *
+ *  @param none
+ *  @return connection (to be sent and closed), -1 when none is left
+ */
+
+int worker_pool_detach(void)
+{
+	struct work_item item;
+	int connfd = -1;
+
+	pthread_mutex_lock(&queue_lock);
+	if(pending_count > 0)
+	{
+		pending_count--;
+		connfd = pending_fd[pending_count];
+		epoll_ctl(classify_fd, EPOLL_CTL_DEL, connfd, NULL);
+	}
+	else if((express_count > 0) || (queue_count > 0))
+	{
+		if(express_count > 0)
+		{
+			item = express_queue[express_head];
+			express_head = (express_head + 1) % WORK_QUEUE_SIZE;
+			express_count--;
+		}
+		else
+		{
+			worker_take(0, &item);
+		}
+		session_put(item.session);
+		connfd = item.connfd;
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	return connfd;
+}